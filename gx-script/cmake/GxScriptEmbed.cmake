@@ -0,0 +1,82 @@
+# gx_script_embed(<target> [STRIP] [BASE_DIR <dir>] FILES <files>...)
+#
+# Compile Lua scripts at build time with the luac tool and embed the bytecode into <target>
+# as constant byte arrays. Each script is registered under its path relative to BASE_DIR
+# (default: CMAKE_CURRENT_SOURCE_DIR) without the suffix, e.g. "core/util",
+# and "requireLs" or the Lua plugin loader resolve that name from memory.
+#
+# Files must be inside BASE_DIR, and a name can be embedded only once per target.
+#
+# <target> must link gx-script. Registration runs from static initializers,
+# so when <target> is a static library, make sure its objects are not dropped by the linker.
+
+set(GX_SCRIPT_EMBED_SOURCE_SCRIPT ${CMAKE_CURRENT_LIST_DIR}/GxScriptEmbedSource.cmake)
+
+function(gx_script_embed target)
+    cmake_parse_arguments(ARG "STRIP" "BASE_DIR" "FILES" ${ARGN})
+
+    if (NOT TARGET luac)
+        message(FATAL_ERROR "gx_script_embed: luac target not found, enable ENABLE_BUILD_TOOLS")
+    endif ()
+    if (NOT ARG_FILES)
+        message(FATAL_ERROR "gx_script_embed: no FILES given for ${target}")
+    endif ()
+
+    if (ARG_BASE_DIR)
+        get_filename_component(BASE_DIR ${ARG_BASE_DIR} ABSOLUTE)
+    else ()
+        set(BASE_DIR ${CMAKE_CURRENT_SOURCE_DIR})
+    endif ()
+
+    # Aligned code arrays are referenced in place from the embedded array, without copying them per VM
+    set(LUAC_FLAGS -a)
+    if (ARG_STRIP)
+        list(APPEND LUAC_FLAGS -s)
+    endif ()
+
+    set(OUT_DIR ${CMAKE_CURRENT_BINARY_DIR}/gx_script_embed/${target})
+
+    foreach (FILE ${ARG_FILES})
+        get_filename_component(SRC_FILE ${FILE} ABSOLUTE)
+        file(RELATIVE_PATH REL_PATH ${BASE_DIR} ${SRC_FILE})
+        if (IS_ABSOLUTE ${REL_PATH} OR REL_PATH MATCHES "^\\.\\.(/|$)")
+            message(FATAL_ERROR "gx_script_embed: ${SRC_FILE} is outside of BASE_DIR ${BASE_DIR}")
+        endif ()
+        string(REGEX REPLACE "\\.(lua|lsc)$" "" SCRIPT_NAME ${REL_PATH})
+
+        # MAKE_C_IDENTIFIER maps "a/b" and "a_b" to the same identifier, the hash of the name tells them apart
+        string(MD5 NAME_HASH ${SCRIPT_NAME})
+        string(SUBSTRING ${NAME_HASH} 0 8 NAME_HASH)
+        string(MAKE_C_IDENTIFIER "${SCRIPT_NAME}_${NAME_HASH}" SCRIPT_ID)
+
+        get_property(EMBEDDED_NAMES TARGET ${target} PROPERTY GX_SCRIPT_EMBED_NAMES)
+        get_property(EMBEDDED_IDS TARGET ${target} PROPERTY GX_SCRIPT_EMBED_IDS)
+        if (SCRIPT_NAME IN_LIST EMBEDDED_NAMES)
+            message(FATAL_ERROR "gx_script_embed: ${SCRIPT_NAME} is embedded more than once into ${target} (${SRC_FILE})")
+        endif ()
+        if (SCRIPT_ID IN_LIST EMBEDDED_IDS)
+            message(FATAL_ERROR "gx_script_embed: symbol ${SCRIPT_ID} of ${SCRIPT_NAME} collides in ${target}")
+        endif ()
+        set_property(TARGET ${target} APPEND PROPERTY GX_SCRIPT_EMBED_NAMES ${SCRIPT_NAME})
+        set_property(TARGET ${target} APPEND PROPERTY GX_SCRIPT_EMBED_IDS ${SCRIPT_ID})
+
+        set(BC_FILE ${OUT_DIR}/${SCRIPT_ID}.luac)
+        set(GEN_FILE ${OUT_DIR}/${SCRIPT_ID}.cpp)
+
+        add_custom_command(
+                OUTPUT ${GEN_FILE}
+                COMMAND ${CMAKE_COMMAND} -E make_directory ${OUT_DIR}
+                COMMAND $<TARGET_FILE:luac> ${LUAC_FLAGS} -o ${BC_FILE} ${SRC_FILE}
+                COMMAND ${CMAKE_COMMAND}
+                -DINPUT=${BC_FILE}
+                -DOUTPUT=${GEN_FILE}
+                -DSCRIPT_NAME=${SCRIPT_NAME}
+                -DSCRIPT_ID=${SCRIPT_ID}
+                -P ${GX_SCRIPT_EMBED_SOURCE_SCRIPT}
+                DEPENDS ${SRC_FILE} luac ${GX_SCRIPT_EMBED_SOURCE_SCRIPT}
+                COMMENT "Embedding Lua script ${SCRIPT_NAME}"
+                VERBATIM
+        )
+        target_sources(${target} PRIVATE ${GEN_FILE})
+    endforeach ()
+endfunction()
@@ -0,0 +1,26 @@
+# Script mode helper of gx_script_embed: convert a bytecode file into a C++ source
+# that registers it with the gx-script preload registry.
+# Inputs: INPUT, OUTPUT, SCRIPT_NAME, SCRIPT_ID
+
+file(READ ${INPUT} HEX_DATA HEX)
+string(LENGTH "${HEX_DATA}" HEX_LENGTH)
+if (HEX_LENGTH EQUAL 0)
+    message(FATAL_ERROR "gx_script_embed: empty bytecode ${INPUT}")
+endif ()
+
+# 16 bytes per line
+string(REGEX REPLACE "([0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f])"
+        "\\1\n        " HEX_DATA "${HEX_DATA}")
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${HEX_DATA}")
+
+file(WRITE ${OUTPUT}
+        "// Generated by gx_script_embed from ${INPUT}, do not edit.\n"
+        "\n"
+        "#include <gx/script_preload.h>\n"
+        "\n"
+        "alignas(16) static const unsigned char gx_script_embed_${SCRIPT_ID}[] = {\n"
+        "        ${BYTES}\n"
+        "};\n"
+        "\n"
+        "static const gx::ScriptPreloadRegistrar gx_script_embed_${SCRIPT_ID}_registrar(\n"
+        "        \"${SCRIPT_NAME}\", gx_script_embed_${SCRIPT_ID}, sizeof(gx_script_embed_${SCRIPT_ID}));\n")
@@ -1084,14 +1084,11 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
-LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
-                      const char *chunkname, const char *mode) {
-  ZIO z;
+static int loadchunk (lua_State *L, ZIO *z, const char *chunkname,
+                      const char *mode) {
   int status;
-  lua_lock(L);
   if (!chunkname) chunkname = "?";
-  luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname, mode);
+  status = luaD_protectedparser(L, z, chunkname, mode);
   if (status == LUA_OK) {  /* no errors? */
     LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
     if (f->nupvalues >= 1) {  /* does it have an upvalue? */
@@ -1102,11 +1099,112 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
       luaC_barrier(L, f->upvals[0], gt);
     }
   }
+  return status;
+}
+
+
+LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname, const char *mode) {
+  ZIO z;
+  int status;
+  lua_lock(L);
+  luaZ_init(L, &z, reader, data);
+  status = loadchunk(L, &z, chunkname, mode);
   lua_unlock(L);
   return status;
 }
 
 
+typedef struct SharedChunk {
+  const char *s;
+  size_t size;
+} SharedChunk;
+
+
+static const char *getShared (lua_State *L, void *ud, size_t *size) {
+  SharedChunk *sc = (SharedChunk *)ud;
+  UNUSED(L);
+  if (sc->size == 0) return NULL;
+  *size = sc->size;
+  sc->size = 0;
+  return sc->s;
+}
+
+
+LUA_API int lua_loadshared (lua_State *L, const char *buff, size_t size,
+                            const char *chunkname,
+                            lua_ChunkRef ref, void *ud) {
+  ZIO z;
+  SharedChunk sc;
+  int status;
+  lua_lock(L);
+  sc.s = buff;
+  sc.size = size;
+  luaZ_init(L, &z, getShared, &sc);
+  z.ref = ref;
+  z.refud = ud;
+  status = loadchunk(L, &z, chunkname, "b");
+  lua_unlock(L);
+  return status;
+}
+
+
+LUA_API int lua_dumpaligned (lua_State *L, lua_Writer writer, void *data,
+                             int strip) {
+  int status;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = s2v(L->top.p - 1);
+  if (isLfunction(o))
+    status = luaU_dumpx(L, getproto(o), writer, data, strip, 1);
+  else
+    status = 1;
+  lua_unlock(L);
+  return status;
+}
+
+
+LUA_API int lua_dumpproto (lua_State *L, const void *p, lua_Writer writer,
+                           void *data, int strip) {
+  int status;
+  lua_lock(L);
+  status = luaU_dumpx(L, cast(const Proto *, p), writer, data, strip, 1);
+  lua_unlock(L);
+  return status;
+}
+
+
+LUA_API void lua_cloneclosure (lua_State *L, int idx, int fresh) {
+  const TValue *o;
+  LClosure *f;
+  LClosure *cl;
+  int i;
+  lua_lock(L);
+  o = index2value(L, idx);
+  api_check(L, ttisLclosure(o), "Lua function expected");
+  f = clLvalue(o);
+  cl = luaF_newLclosure(L, f->nupvalues);
+  cl->p = f->p;
+  setclLvalue2s(L, L->top.p, cl);  /* anchor new closure */
+  api_incr_top(L);
+  for (i = 0; i < cl->nupvalues; i++) {
+    UpVal *uv;
+    if (i + 1 == fresh) {
+      uv = gco2upv(luaC_newobj(L, LUA_VUPVAL, sizeof(UpVal)));
+      uv->v.p = &uv->u.value;  /* make it closed */
+      setnilvalue(uv->v.p);
+    }
+    else
+      uv = f->upvals[i];
+    cl->upvals[i] = uv;
+    luaC_objbarrier(L, cl, uv);
+  }
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   int status;
   TValue *o;
@@ -26,6 +26,8 @@ typedef struct {
   void *data;
   int strip;
   int status;
+  int align;  /* align code arrays (for shared chunks) */
+  size_t offset;  /* bytes written so far */
 } DumpState;
 
 
@@ -43,6 +45,7 @@ static void dumpBlock (DumpState *D, const void *b, size_t size) {
     lua_unlock(D->L);
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
+    D->offset += size;
   }
 }
 
@@ -101,8 +104,31 @@ static void dumpString (DumpState *D, const TString *s) {
 }
 
 
+/*
+** Dump the size of the code array so that the array starts aligned
+** (relative to the start of the chunk), padding the size with leading
+** zero groups, which 'loadUnsigned' reads as no-ops.
+*/
+static void dumpAlignedSize (DumpState *D, size_t x, size_t align) {
+  size_t len = 0;
+  size_t pad;
+  size_t y = x;
+  do {  /* count bytes used by 'dumpSize' */
+    len++;
+    y >>= 7;
+  } while (y != 0);
+  pad = (align - (D->offset + len) % align) % align;
+  while (pad-- > 0)
+    dumpByte(D, 0);
+  dumpSize(D, x);
+}
+
+
 static void dumpCode (DumpState *D, const Proto *f) {
-  dumpInt(D, f->sizecode);
+  if (D->align)
+    dumpAlignedSize(D, f->sizecode, sizeof(Instruction));
+  else
+    dumpInt(D, f->sizecode);
   dumpVector(D, f->code, f->sizecode);
 }
 
@@ -216,12 +242,20 @@ static void dumpHeader (DumpState *D) {
 */
 int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
               int strip) {
+  return luaU_dumpx(L, f, w, data, strip, 0);
+}
+
+
+int luaU_dumpx(lua_State *L, const Proto *f, lua_Writer w, void *data,
+               int strip, int align) {
   DumpState D;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
   D.status = 0;
+  D.align = align;
+  D.offset = 0;
   dumpHeader(&D);
   dumpByte(&D, f->sizeupvalues);
   dumpFunction(&D, f, NULL);
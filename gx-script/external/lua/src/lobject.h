@@ -554,6 +554,7 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed (named) parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte shared;  /* arrays referenced from a shared chunk (PF_SHARED*) */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -572,8 +573,15 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
+  lua_ChunkRef chunkref;  /* releases the shared chunk ('shared' != 0) */
+  void *chunkud;
 } Proto;
 
+
+/* bits in 'shared' */
+#define PF_SHAREDCODE	1  /* 'code' points into a shared chunk */
+#define PF_SHAREDLINE	2  /* 'lineinfo' points into a shared chunk */
+
 /* }================================================================== */
 
 
@@ -303,6 +303,42 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
 
+/*
+** shared binary chunks: prototypes loaded by 'lua_loadshared' reference
+** the code and line information of the chunk in place instead of
+** copying them. 'ref' is called with +1/-1 as prototypes start and stop
+** using the buffer (possibly from the GC, it must not call Lua); the
+** buffer must stay valid and unchanged until the count drops to zero.
+** 'lua_dumpaligned' writes chunks whose code arrays are aligned, so that
+** they can be fully shared; they are still valid for plain 'lua_load'.
+*/
+typedef void (*lua_ChunkRef) (void *ud, int delta);
+
+LUA_API int (lua_loadshared) (lua_State *L, const char *buff, size_t size,
+                              const char *chunkname,
+                              lua_ChunkRef ref, void *ud);
+
+LUA_API int (lua_dumpaligned) (lua_State *L, lua_Writer writer, void *data,
+                               int strip);
+
+/*
+** dump a function prototype (got from a Lua closure) as an aligned chunk
+** without touching the stack. It only reads fields of the prototype that
+** never change after it is created (the collector only writes its mark
+** and list fields), so 'L' may be a state of another thread; the caller
+** must keep the prototype alive and its state open until it returns.
+*/
+LUA_API int (lua_dumpproto) (lua_State *L, const void *p, lua_Writer writer,
+                             void *data, int strip);
+
+/*
+** push a new closure of the prototype of the Lua function at 'idx',
+** sharing all its upvalues except upvalue 'fresh' (1-based, 0 for none),
+** which gets a new closed upvalue set to nil (e.g. a private _ENV).
+*/
+LUA_API void (lua_cloneclosure) (lua_State *L, int idx, int fresh);
+
+
 /*
 ** coroutine functions
 */
@@ -141,8 +141,49 @@ static TString *loadString (LoadState *S, Proto *p) {
 }
 
 
+/*
+** When loading a shared chunk ('lua_loadshared') whose data is
+** contiguous in memory, return the input block in place (skipping it)
+** instead of copying it; NULL when it must be copied. The block must
+** be aligned for its element type.
+*/
+#define refVector(S,n,t)	cast(t *, refBlock(S, (n)*sizeof(t), sizeof(t)))
+
+static const void *refBlock (LoadState *S, size_t size, size_t align) {
+  ZIO *Z = S->Z;
+  const char *b = Z->p;
+  if (Z->ref == NULL || size == 0 || Z->n < size ||
+      (point2uint(b) & (align - 1)) != 0)
+    return NULL;
+  Z->n -= size;
+  Z->p += size;
+  return b;
+}
+
+
+/*
+** Mark an array of 'f' as referencing the shared chunk; the first one
+** takes a reference that is released by 'luaF_freeproto'.
+*/
+static void shareProto (LoadState *S, Proto *f, lu_byte flag) {
+  if (!f->shared) {
+    f->chunkref = S->Z->ref;
+    f->chunkud = S->Z->refud;
+    (*f->chunkref)(f->chunkud, 1);
+  }
+  f->shared |= flag;
+}
+
+
 static void loadCode (LoadState *S, Proto *f) {
   int n = loadInt(S);
+  Instruction *code = refVector(S, n, Instruction);
+  if (code != NULL) {
+    f->code = code;
+    f->sizecode = n;
+    shareProto(S, f, PF_SHAREDCODE);
+    return;
+  }
   f->code = luaM_newvectorchecked(S->L, n, Instruction);
   f->sizecode = n;
   loadVector(S, f->code, n);
@@ -227,9 +268,16 @@ static void loadUpvalues (LoadState *S, Proto *f) {
 static void loadDebug (LoadState *S, Proto *f) {
   int i, n;
   n = loadInt(S);
-  f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
-  f->sizelineinfo = n;
-  loadVector(S, f->lineinfo, n);
+  f->lineinfo = refVector(S, n, ls_byte);
+  if (f->lineinfo != NULL) {
+    f->sizelineinfo = n;
+    shareProto(S, f, PF_SHAREDLINE);
+  }
+  else {
+    f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
+    f->sizelineinfo = n;
+    loadVector(S, f->lineinfo, n);
+  }
   n = loadInt(S);
   f->abslineinfo = luaM_newvectorchecked(S->L, n, AbsLineInfo);
   f->sizeabslineinfo = n;
@@ -32,5 +32,7 @@ LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
                          void* data, int strip);
+LUAI_FUNC int luaU_dumpx (lua_State* L, const Proto* f, lua_Writer w,
+                          void* data, int strip, int align);
 
 #endif
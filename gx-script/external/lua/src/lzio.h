@@ -58,6 +58,8 @@ struct Zio {
   lua_Reader reader;		/* reader function */
   void *data;			/* additional data */
   lua_State *L;			/* Lua state (for reader) */
+  lua_ChunkRef ref;		/* set when the buffer may be referenced in place */
+  void *refud;			/* user data for 'ref' */
 };
 
 
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef GX_SCRIPT_PRELOAD_H
+#define GX_SCRIPT_PRELOAD_H
+
+#include <gx/gobject.h>
+
+#include <cstddef>
+
+
+#if defined(_WIN32) && defined(BUILD_SHARED_LIBS)
+#   ifdef GX_SCRIPT_EXPORTS
+#       define GX_SCRIPT_API __declspec(dllexport)
+#   else
+#       define GX_SCRIPT_API __declspec(dllimport)
+#   endif
+#else
+#   define GX_SCRIPT_API
+#endif
+
+/**
+ * @brief Register a precompiled Lua chunk held in read-only memory,
+ *        "requireLs" and the Lua plugin loader resolve the name from memory before searching files.
+ *        The data must stay valid for the lifetime of the process.
+ * @param name  Script name (relative path without suffix, e.g. "core/util")
+ * @param data  Lua bytecode
+ * @param size  Size of bytecode
+ */
+extern "C" GX_SCRIPT_API void gxScriptRegisterPreload(const char *name, const unsigned char *data, size_t size);
+
+GX_NS_BEGIN
+
+/**
+ * @brief Static registrar used by the sources generated by gx_script_embed()
+ */
+struct ScriptPreloadRegistrar
+{
+    ScriptPreloadRegistrar(const char *name, const unsigned char *data, size_t size)
+    {
+        gxScriptRegisterPreload(name, data, size);
+    }
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_PRELOAD_H
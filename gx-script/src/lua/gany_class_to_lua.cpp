@@ -24,6 +24,7 @@
 
 #include "lua_table.h"
 #include "gany_lua_vm.h"
+#include "lua_reclaimer.h"
 
 
 GX_NS_BEGIN
@@ -226,7 +227,7 @@ int GAnyClassToLua::regGC(lua_State *L)
         luaL_error(L, "Call GAnyClass __gc error: null object");
         return 0;
     }
-    GX_DELETE(self);
+    LuaReclaimer::retire(L, self);
 
     return 0;
 }
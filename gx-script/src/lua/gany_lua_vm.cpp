@@ -24,15 +24,29 @@
 
 #include "lua_function.h"
 #include "lua_table.h"
+#include "lua_code_cache.h"
+#include "lua_preload.h"
+#include "lua_chunk.h"
 
 #include "gany_to_lua.h"
 #include "gany_class_to_lua.h"
+#include "lua_async.h"
+#include "lua_json.h"
+#include "lua_msgpack.h"
+#include "lua_reclaimer.h"
+#include "lua_shared_table_to_lua.h"
+#include "lua_typed_buffer_to_lua.h"
+#include "lua_record_batch_to_lua.h"
+#include "lua_byte_view_to_lua.h"
 
 #include <gx/gfile.h>
 #include <gx/debug.h>
 
 #include <math.h>
+#include <time.h>
 
+#include <atomic>
+#include <chrono>
 #include <utility>
 
 #ifndef LUA_BUILD_AS_CPP
@@ -41,23 +55,29 @@ extern "C" {
 
 #include "lobject.h"
 #include "lstate.h"
+#include "lgc.h"
 
 #ifndef LUA_BUILD_AS_CPP
 }
 #endif
 
 
-#define HANDLE_EXCEPTION(e) \
+#define HANDLE_EXCEPTION_RET(e, ret) \
     do {                    \
         std::string exception = std::string("GAnyLuaVM Exception: ") + e; \
         if (sExceptionHandler) {    \
             sExceptionHandler(exception);   \
-            return GAny::undefined();    \
+            return ret;    \
         } else {    \
             throw GAnyException(exception);  \
         }   \
     } while(false)
 
+#define HANDLE_EXCEPTION(e) HANDLE_EXCEPTION_RET(e, GAny::undefined())
+
+/// Coroutines whose stack grew beyond this are not kept for reuse
+#define REQUEST_THREAD_MAX_STACK 4096
+
 
 GX_NS_BEGIN
 
@@ -65,13 +85,114 @@ GAnyLuaVM::ScriptReader GAnyLuaVM::sScriptReader = nullptr;
 
 GAnyLuaVM::ExceptionHandler GAnyLuaVM::sExceptionHandler = nullptr;
 
+std::shared_ptr<LuaCodeCache> GAnyLuaVM::sCodeCache = nullptr;
+
+static std::atomic<uint64_t> sNextVMId{1};
+
+static GMutex sExternalSizeLock;
+static std::unordered_map<std::string, GAnyLuaVM::ExternalSizeFunc> sExternalSizeFuncs;
+/// Lets pushGAny skip the lookup while no function is set
+static std::atomic<size_t> sExternalSizeFuncCount{0};
+
+/// Userdata of a GAny pushed with an external size, the GAny pointer stays first like in the plain userdata
+struct GAnySizedUserdata
+{
+    GAny *obj;
+    /// Key of the charge in GAnyLuaVM::mExternalCharges, nullptr once released
+    const void *chargeKey;
+};
+
+/// Snapshots of the Lua functions converted to GAny, keyed by the value of the GAny function
+struct SnapshotEntry
+{
+    std::weak_ptr<GAnyValue> func;
+    std::weak_ptr<LuaFunctionSnapshot> snapshot;
+};
+
+static GMutex sSnapshotLock;
+static std::unordered_map<const GAnyValue *, SnapshotEntry> sSnapshots;
+static size_t sSnapshotsPruneSize = 64;
+
+/// A type pushed to Lua as its own proxy userdata instead of a GAny userdata
+struct LuaProxyType
+{
+    bool (*is)(const GAny &value);
+    void (*push)(lua_State *L, const GAny &value);
+    bool (*isProxy)(lua_State *L, int idx);
+    GAny (*toGAny)(lua_State *L, int idx);
+};
+
+template<typename T, typename ToLua, void (*Push)(lua_State *, const T &)>
+static constexpr LuaProxyType makeProxyType()
+{
+    return {
+            [](const GAny &value) { return value.is<T>(); },
+            [](lua_State *L, const GAny &value) { Push(L, value.as<T>()); },
+            &ToLua::isProxy,
+            &ToLua::toGAny
+    };
+}
+
+/// Read-only or fixed-size data, always read in place through the proxy
+static const LuaProxyType sProxyTypes[] = {
+        makeProxyType<LuaSharedTable, LuaSharedTableToLua, &LuaSharedTableToLua::pushTable>(),
+        makeProxyType<LuaTypedBuffer, LuaTypedBufferToLua, &LuaTypedBufferToLua::pushBuffer>(),
+        makeProxyType<LuaRecordBatch, LuaRecordBatchToLua, &LuaRecordBatchToLua::pushBatch>(),
+        makeProxyType<LuaByteView, LuaByteViewToLua, &LuaByteViewToLua::pushView>(),
+};
+
+static const LuaProxyType *findProxyType(const GAny &value)
+{
+    if (!value.isUserObject()) {
+        return nullptr;
+    }
+    for (const auto &type: sProxyTypes) {
+        if (type.is(value)) {
+            return &type;
+        }
+    }
+    return nullptr;
+}
+
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// CPU time of the calling thread, time spent blocked or descheduled is not counted
+static int64_t threadCpuTimeUs()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts{};
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+#endif
+    // No per-thread clock on this platform, fall back to wall time
+    return nowUs();
+}
+
 GAnyLuaVM::GAnyLuaVM()
+        : mId(sNextVMId.fetch_add(1, std::memory_order_relaxed)),
+          mOwnerThread(std::this_thread::get_id()),
+          mTasks(std::make_shared<LuaTaskQueue>()),
+          mEventLoop(std::make_unique<LuaEventLoop>(mTasks))
 {
     mL = luaL_newstate();
+    // Coroutines created by lua_newthread inherit the extra space of the main thread
+    *static_cast<GAnyLuaVM **>(lua_getextraspace(mL)) = this;
     luaL_openlibs(mL);
 
     GAnyToLua::toLua(mL);
     GAnyClassToLua::toLua(mL);
+    LuaAsync::toLua(mL);
+    LuaJson::toLua(mL);
+    LuaMsgPack::toLua(mL);
+    LuaSharedTableToLua::toLua(mL);
+    LuaTypedBufferToLua::toLua(mL);
+    LuaRecordBatchToLua::toLua(mL);
+    LuaByteViewToLua::toLua(mL);
 }
 
 GAnyLuaVM::~GAnyLuaVM()
@@ -85,6 +206,52 @@ std::shared_ptr<GAnyLuaVM> GAnyLuaVM::threadLocal()
     return vm;
 }
 
+static std::vector<GAnyLuaVM *> &contextStack()
+{
+    thread_local std::vector<GAnyLuaVM *> sStack;
+    return sStack;
+}
+
+GAnyLuaVM::ContextScope::ContextScope(GAnyLuaVM *vm)
+{
+    contextStack().push_back(vm);
+}
+
+GAnyLuaVM::ContextScope::~ContextScope()
+{
+    contextStack().pop_back();
+}
+
+std::shared_ptr<GAnyLuaVM> GAnyLuaVM::create()
+{
+    return std::make_shared<GAnyLuaVM>();
+}
+
+GAnyLuaVM *GAnyLuaVM::current()
+{
+    auto &stack = contextStack();
+    if (!stack.empty()) {
+        return stack.back();
+    }
+    thread_local GAnyLuaVM *vm = threadLocal().get();
+    return vm;
+}
+
+GAnyLuaVM *GAnyLuaVM::fromLuaState(lua_State *L)
+{
+    return *static_cast<GAnyLuaVM **>(lua_getextraspace(L));
+}
+
+uint64_t GAnyLuaVM::id() const
+{
+    return mId;
+}
+
+bool GAnyLuaVM::isOwnerThread() const
+{
+    return std::this_thread::get_id() == mOwnerThread;
+}
+
 lua_State *GAnyLuaVM::getLuaState() const
 {
     return mL;
@@ -92,18 +259,43 @@ lua_State *GAnyLuaVM::getLuaState() const
 
 void GAnyLuaVM::shutdown()
 {
+    // Tasks and timers may hold requests and functions that release their references
+    mTasks->clear();
+    mEventLoop->clear();
+    mReadyRequests = decltype(mReadyRequests)();
+    if (mL) {
+        // Functions still held outside stay callable from other threads after the state is closed,
+        // the prototypes not dumped yet are alive as long as their wrappers are registered
+        for (auto &item: mFuncCodes) {
+            auto code = item.second.lock();
+            if (code) {
+                code->dump(mL);
+            }
+        }
+    }
+    mFuncCodes.clear();
+    mLFuncs.clear();
+    mRequestThreads.clear();
     {
-        GLockerGuard locker(mFuncsLock);
-        mLFuncs.clear();
+        // Waits for the dumps running on other threads, later ones see mClosed
+        GLockerGuard locker(mCloseLock);
+        mClosed = true;
     }
     if (mL) {
         lua_close(mL);
         mL = nullptr;
     }
+    // Closing the state released everything
+    mPendingRefs.clear();
+    LuaReclaimer::reclaim(mDeferred);
 }
 
 GAny GAnyLuaVM::requireLs(const std::string &name, const GAny &env)
 {
+    if (hasPreload(name)) {
+        return scriptPreload(name, env);
+    }
+
     std::string path = name;
     GFile file = [&]() {
         auto searchPaths = GAny::Import("getPluginSearchPaths")().castAs<std::vector<std::string>>();
@@ -172,12 +364,35 @@ GAny GAnyLuaVM::scriptFile(const std::string &filePath, const GAny &env)
             HANDLE_EXCEPTION("Run lua script error: file(" + filePath + ") does not exist.");
         }
 
+        auto codeCache = sCodeCache;
+        LuaCodeCache::SourceStat sourceStat;
+        if (codeCache) {
+            sourceStat = LuaCodeCache::statSource(filePath);
+            GByteArray byteCode = codeCache->load(filePath, sourceStat);
+            if (!byteCode.isEmpty()) {
+                return loadScriptFromBuffer(byteCode, "@" + filePath, env);
+            }
+        }
+
         if (file.open(GFile::ReadOnly | GFile::Binary)) {
             buffer = file.read();
             file.close();
         } else {
             HANDLE_EXCEPTION("Open file failure.");
         }
+
+        if (codeCache && LuaCodeCache::isSourceCode(buffer)) {
+            GByteArray byteCode = codeCache->match(filePath, buffer, sourceStat);
+            if (byteCode.isEmpty()) {
+                byteCode = compile(buffer, "@" + filePath, false);
+                if (!byteCode.isEmpty()) {
+                    codeCache->store(filePath, buffer, byteCode, sourceStat);
+                }
+            }
+            if (!byteCode.isEmpty()) {
+                buffer = byteCode;
+            }
+        }
     }
 
     if (!buffer.isEmpty()) {
@@ -197,16 +412,307 @@ GAny GAnyLuaVM::scriptBuffer(const GByteArray &buffer, std::string sourcePath, c
     return loadScriptFromBuffer(buffer, sourcePath, env);
 }
 
+GAny GAnyLuaVM::scriptPreload(const std::string &name, const GAny &env)
+{
+    std::string error;
+    auto chunk = LuaPreload::shared(name, &error);
+    if (!chunk) {
+        HANDLE_EXCEPTION("Run lua script error: " + error);
+    }
+    return scriptChunk(chunk, env);
+}
+
+GAny GAnyLuaVM::scriptChunk(const std::shared_ptr<LuaChunk> &chunk, const GAny &env)
+{
+    if (!chunk) {
+        HANDLE_EXCEPTION("Run lua script error: chunk is null.");
+    }
+    lua_State *L = mL;
+
+    if (chunk->load(L) != LUA_OK) {
+        const char *err = lua_tostring(L, -1);
+        HANDLE_EXCEPTION(err);
+    }
+
+    return runLoadedChunk(env);
+}
+
+std::shared_ptr<LuaChunk> GAnyLuaVM::createChunk(const GByteArray &buffer, std::string sourcePath)
+{
+    if (sourcePath.empty()) {
+        sourcePath = "@buffer://" + GByteArray::md5Sum(buffer).toHexString();
+    } else if (sourcePath[0] != '@') {
+        sourcePath = "@" + sourcePath;
+    }
+
+    std::string error;
+    auto chunk = LuaChunk::create((const char *) buffer.data(), (size_t) buffer.size(), sourcePath, &error);
+    if (!chunk) {
+        HANDLE_EXCEPTION_RET(error, nullptr);
+    }
+    return chunk;
+}
+
+int32_t GAnyLuaVM::loadRequestHandler(const std::string &script, std::string sourcePath, const GAny &env)
+{
+    if (sourcePath.empty()) {
+        GByteArray buffer;
+        buffer.write(script.data(), script.size());
+        sourcePath = "@handler://" + GByteArray::md5Sum(buffer).toHexString();
+    } else if (sourcePath[0] != '@') {
+        sourcePath = "@" + sourcePath;
+    }
+
+    lua_State *L = mL;
+    ContextScope scope(this);
+    int top = lua_gettop(L);
+
+    if (luaL_loadbuffer(L, script.data(), script.size(), sourcePath.c_str()) != LUA_OK) {
+        std::string err = lua_tostring(L, -1);
+        lua_settop(L, top);
+        HANDLE_EXCEPTION_RET(err, 0);
+    }
+    GAnyLuaVM::setEnvironment(L, env, lua_gettop(L));
+
+    if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
+        std::string err = lua_tostring(L, -1);
+        lua_settop(L, top);
+        HANDLE_EXCEPTION_RET(err, 0);
+    }
+    if (!lua_isfunction(L, -1)) {
+        lua_settop(L, top);
+        HANDLE_EXCEPTION_RET("Load request handler error: the script must return a function.", 0);
+    }
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+void GAnyLuaVM::unloadRequestHandler(int32_t handler)
+{
+    if (handler > 0) {
+        releaseLuaRef(handler);
+    }
+}
+
+std::shared_ptr<LuaRequest> GAnyLuaVM::request(int32_t handler, const GAny &env, const std::vector<GAny> &args)
+{
+    lua_State *L = mL;
+    if (!L) {
+        HANDLE_EXCEPTION_RET("Run request error: the lua vm is shut down.", nullptr);
+    }
+    ContextScope scope(this);
+    drainPendingRefs();
+
+    int top = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, handler);
+    if (handler <= 0 || !lua_isfunction(L, -1)) {
+        lua_settop(L, top);
+        HANDLE_EXCEPTION_RET("Run request error: invalid request handler.", nullptr);
+    }
+
+    /// Give the request a private _ENV by cloning the handler closure, the other up values stay shared
+    int funcIdx = lua_gettop(L);
+    int envUpIdx = lua_iscfunction(L, funcIdx) ? 0 : findUpValue(L, funcIdx, "_ENV");
+    if (envUpIdx > 0) {
+        lua_cloneclosure(L, funcIdx, envUpIdx);
+        lua_getupvalue(L, funcIdx, envUpIdx);
+        pushEnvironment(L, env, lua_gettop(L));
+        lua_setupvalue(L, funcIdx + 1, envUpIdx);
+        lua_pop(L, 1);
+        lua_remove(L, funcIdx);
+    }
+
+    return startRequest(args);
+}
+
+std::shared_ptr<LuaRequest> GAnyLuaVM::startRequest(const std::vector<GAny> &args)
+{
+    lua_State *L = mL;
+    auto request = std::make_shared<LuaRequest>(mNextRequestId++);
+    request->mLuaVM = weak_from_this();
+    if (!mRequestThreads.empty()) {
+        request->mThread = mRequestThreads.back().thread;
+        request->mThreadRef = mRequestThreads.back().ref;
+        mRequestThreads.pop_back();
+    } else {
+        request->mThread = lua_newthread(L);
+        request->mThreadRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    mActiveRequests.fetch_add(1, std::memory_order_relaxed);
+
+    lua_State *co = request->mThread;
+    lua_xmove(L, co, 1);
+    // Pooled coroutines keep the hook of their previous request
+    if (mTimeSliceUs > 0) {
+        lua_sethook(co, timeSliceHook, LUA_MASKCOUNT, mSliceCheckCount);
+    } else if (lua_gethook(co)) {
+        lua_sethook(co, nullptr, 0, 0);
+    }
+
+    for (const auto &arg: args) {
+        makeGAnyToLuaObject(co, arg);
+    }
+
+    runRequest(request, (int) args.size());
+    return request;
+}
+
+bool GAnyLuaVM::resumeRequest(const std::shared_ptr<LuaRequest> &request, const GAny &value)
+{
+    if (!request || !request->isSuspended() || request->isAwaiting() || request->isPreempted() || !request->mThread
+        || request->mLuaVM.lock().get() != this) {
+        return false;
+    }
+    ContextScope scope(this);
+    drainPendingRefs();
+
+    lua_State *co = request->mThread;
+    int nargs = 0;
+    if (!value.isUndefined()) {
+        makeGAnyToLuaObject(co, value);
+        nargs = 1;
+    }
+    runRequest(request, nargs);
+    return true;
+}
+
+void GAnyLuaVM::post(std::function<void()> task)
+{
+    mTasks->post(std::move(task));
+}
+
+size_t GAnyLuaVM::runPending(int32_t timeoutMs)
+{
+    if (!isOwnerThread()) {
+        HANDLE_EXCEPTION_RET("Run pending tasks error: not the thread of the lua vm.", 0);
+    }
+    ContextScope scope(this);
+    drainPendingRefs();
+    size_t count = mTasks->run(timeoutMs);
+    LuaReclaimer::reclaim(mDeferred);
+    return count;
+}
+
+bool GAnyLuaVM::hasPending() const
+{
+    return !mTasks->empty();
+}
+
+LuaEventLoop &GAnyLuaVM::eventLoop() const
+{
+    return *mEventLoop;
+}
+
+size_t GAnyLuaVM::runOnce(int32_t timeoutMs)
+{
+    if (!isOwnerThread()) {
+        HANDLE_EXCEPTION_RET("Run event loop error: not the thread of the lua vm.", 0);
+    }
+    ContextScope scope(this);
+    drainPendingRefs();
+    size_t count = mEventLoop->runOnce(timeoutMs);
+    LuaReclaimer::reclaim(mDeferred);
+    return count;
+}
+
+void GAnyLuaVM::runLoop()
+{
+    if (!isOwnerThread()) {
+        HANDLE_EXCEPTION_RET("Run event loop error: not the thread of the lua vm.", );
+    }
+    ContextScope scope(this);
+    drainPendingRefs();
+    mEventLoop->run();
+}
+
+void GAnyLuaVM::stopLoop()
+{
+    mEventLoop->stop();
+}
+
+GAny GAnyLuaVM::loopStats() const
+{
+    LuaEventLoop::Stats stats = mEventLoop->stats();
+    GAny obj = GAny::object();
+    obj["iterations"] = stats.iterations;
+    obj["tasksRun"] = stats.tasksRun;
+    obj["timersFired"] = stats.timersFired;
+    obj["fdEvents"] = stats.fdEvents;
+    obj["queueDepth"] = stats.queueDepth;
+    obj["timerCount"] = stats.timerCount;
+    obj["fdCount"] = stats.fdCount;
+    obj["lastLagUs"] = stats.lastLagUs;
+    obj["maxLagUs"] = stats.maxLagUs;
+    return obj;
+}
+
+void GAnyLuaVM::setTimeSlice(int64_t sliceUs, int32_t checkInstructions)
+{
+    mTimeSliceUs = std::max<int64_t>(0, sliceUs);
+    mSliceCheckCount = std::max(1, checkInstructions);
+}
+
+void GAnyLuaVM::setSchedulePolicy(SchedulePolicy policy)
+{
+    mSchedulePolicy = policy;
+}
+
+size_t GAnyLuaVM::readyRequestCount() const
+{
+    return mReadyRequests.size();
+}
+
+int64_t GAnyLuaVM::activeRequestCount() const
+{
+    return mActiveRequests.load(std::memory_order_relaxed);
+}
+
+void GAnyLuaVM::setRequestPoolSize(size_t size)
+{
+    mRequestPoolSize = size;
+    while (mRequestThreads.size() > mRequestPoolSize) {
+        releaseLuaRef(mRequestThreads.back().ref);
+        mRequestThreads.pop_back();
+    }
+}
+
+bool GAnyLuaVM::hasPreload(const std::string &name)
+{
+    LuaPreload::Chunk chunk;
+    return LuaPreload::find(name, chunk);
+}
+
 void GAnyLuaVM::gc()
 {
+    drainPendingRefs();
     lua_gc(mL, LUA_GCCOLLECT, 0);
+    LuaReclaimer::reclaim(mDeferred);
 }
 
 bool GAnyLuaVM::gcStep(int32_t kb)
 {
+    drainPendingRefs();
     return lua_gc(mL, LUA_GCSTEP, kb) != 0;
 }
 
+void GAnyLuaVM::setReclaimMode(LuaReclaimer::Mode mode)
+{
+    mReclaimMode = (int) mode;
+    if (mode != LuaReclaimer::Mode::Deferred) {
+        LuaReclaimer::reclaim(mDeferred);
+    }
+}
+
+LuaReclaimer::Mode GAnyLuaVM::reclaimMode() const
+{
+    int mode = mReclaimMode.load(std::memory_order_relaxed);
+    return mode < 0 ? LuaReclaimer::mode() : (LuaReclaimer::Mode) mode;
+}
+
+size_t GAnyLuaVM::reclaim()
+{
+    return LuaReclaimer::reclaim(mDeferred);
+}
+
 int32_t GAnyLuaVM::gcSetStepMul(int32_t mul)
 {
     return lua_gc(mL, LUA_GCSETSTEPMUL, mul);
@@ -234,7 +740,14 @@ bool GAnyLuaVM::gcIsRunning()
 
 int32_t GAnyLuaVM::gcGetCount()
 {
-    return lua_gc(mL, LUA_GCCOUNT, 0);
+    size_t bytes = (size_t) lua_gc(mL, LUA_GCCOUNT, 0) * 1024 + (size_t) lua_gc(mL, LUA_GCCOUNTB, 0);
+    bytes = bytes > mExternalBytes ? bytes - mExternalBytes : 0;
+    return (int32_t) (bytes / 1024);
+}
+
+int32_t GAnyLuaVM::gcGetExternalCount()
+{
+    return (int32_t) (mExternalBytes / 1024);
 }
 
 void GAnyLuaVM::gcModeGen()
@@ -257,11 +770,18 @@ void GAnyLuaVM::setScriptReader(GAnyLuaVM::ScriptReader reader)
     sScriptReader = std::move(reader);
 }
 
+void GAnyLuaVM::setCodeCacheDir(const std::string &cacheDir)
+{
+    if (cacheDir.empty()) {
+        sCodeCache = nullptr;
+    } else {
+        sCodeCache = std::make_shared<LuaCodeCache>(cacheDir);
+    }
+}
+
 
 GAny GAnyLuaVM::loadScriptFromBuffer(const GByteArray &buffer, const std::string &sourcePath, const GAny &env)
 {
-    lua_State *L = mL;
-
     if (buffer.size() - buffer.readPos() > 4) {
         char head[4];
         buffer.read(head, 4);
@@ -273,35 +793,32 @@ GAny GAnyLuaVM::loadScriptFromBuffer(const GByteArray &buffer, const std::string
                 data = GByteArray::uncompress(data);
             }
 
-            if (luaL_loadbuffer(
-                        L, (const char *) data.data(),
-                        (size_t) data.size(),
-                        (const char *) sourcePath.c_str()) != LUA_OK) {
-                const char *err = lua_tostring(L, -1);
-                HANDLE_EXCEPTION(err);
-            }
-
-            GAnyLuaVM::setEnvironment(L, env, lua_gettop(L));
-
-            if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
-                const char *err = lua_tostring(L, -1);
-                HANDLE_EXCEPTION(err);
-            }
-            GAny ret = makeLuaObjectToGAny(L, lua_gettop(L));
-            lua_pop(L, 1);
-            return ret;
+            return loadScriptFromMemory((const char *) data.data(), (size_t) data.size(), sourcePath, env);
         }
         buffer.seekReadPos(SEEK_CUR, -4);
     }
 
-    if (luaL_loadbuffer(
-                L, (const char *) buffer.data(),
-                (size_t) buffer.size(),
-                (const char *) sourcePath.c_str()) != LUA_OK) {
+    return loadScriptFromMemory((const char *) buffer.data(), (size_t) buffer.size(), sourcePath, env);
+}
+
+GAny GAnyLuaVM::loadScriptFromMemory(const char *data, size_t size, const std::string &sourcePath, const GAny &env)
+{
+    lua_State *L = mL;
+
+    if (luaL_loadbuffer(L, data, size, (const char *) sourcePath.c_str()) != LUA_OK) {
         const char *err = lua_tostring(L, -1);
         HANDLE_EXCEPTION(err);
     }
 
+    return runLoadedChunk(env);
+}
+
+GAny GAnyLuaVM::runLoadedChunk(const GAny &env)
+{
+    lua_State *L = mL;
+    ContextScope scope(this);
+    drainPendingRefs();
+
     GAnyLuaVM::setEnvironment(L, env, lua_gettop(L));
 
     if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
@@ -313,33 +830,375 @@ GAny GAnyLuaVM::loadScriptFromBuffer(const GByteArray &buffer, const std::string
     return ret;
 }
 
-void GAnyLuaVM::addLFunctionRef(const std::shared_ptr<LuaFunction> &ref)
+uint64_t GAnyLuaVM::addLFunctionRef(const std::shared_ptr<LuaFunction> &ref)
+{
+    return mLFuncs.add(ref);
+}
+
+std::shared_ptr<LuaChunk> GAnyLuaVM::dumpProto(lua_State *L, const void *proto, const std::string &chunkName)
+{
+    GLockerGuard locker(mCloseLock);
+    if (mClosed) {
+        return nullptr;
+    }
+    return LuaChunk::dumpProto(L, proto, chunkName);
+}
+
+std::shared_ptr<LuaFunctionCode> GAnyLuaVM::functionCode(const void *proto)
+{
+    // The prototype is alive while any wrapper of it is, so an unexpired entry always refers to the same prototype
+    auto &codeRef = mFuncCodes[proto];
+    auto code = codeRef.lock();
+    if (code) {
+        return code;
+    }
+
+    char name[48];
+    snprintf(name, sizeof(name), "LuaFunction<%p>", proto);
+    code = std::make_shared<LuaFunctionCode>(proto, name);
+    codeRef = code;
+
+    if (mFuncCodes.size() >= mFuncCodesSweep) {
+        for (auto it = mFuncCodes.begin(); it != mFuncCodes.end();) {
+            if (it->second.expired()) {
+                it = mFuncCodes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        mFuncCodesSweep = std::max<size_t>(64, mFuncCodes.size() * 2);
+    }
+    return code;
+}
+
+void GAnyLuaVM::removeLFunctionRef(uint64_t handle)
 {
-    GLockerGuard locker(mFuncsLock);
-    mLFuncs.push_back(ref);
+    // The function is released after the registry lock
+    mLFuncs.remove(handle);
+}
+
+void GAnyLuaVM::releaseLuaRef(int ref)
+{
+    if (isOwnerThread()) {
+        if (mL) {
+            luaL_unref(mL, LUA_REGISTRYINDEX, ref);
+        }
+        return;
+    }
+    mPendingRefs.push(ref);
 }
 
-void GAnyLuaVM::removeLFunctionRef(const std::shared_ptr<LuaFunction> &ref)
+void GAnyLuaVM::runRequest(const std::shared_ptr<LuaRequest> &request, int nargs)
 {
-    GLockerGuard locker(mFuncsLock);
-    auto fIt = std::find_if(
-            mLFuncs.begin(), mLFuncs.end(),
-            [&](const auto &v) {
-                return v == ref;
+    lua_State *co = request->mThread;
+    // Requests may be run from within another request
+    LuaRequest *previous = mRunningRequest;
+    int64_t previousSliceStart = mSliceStartUs;
+    mRunningRequest = request.get();
+    int64_t start = nowUs();
+    int64_t cpuStart = threadCpuTimeUs();
+    mSliceStartUs = start;
+    int nres = 0;
+    int status = lua_resume(co, mL, nargs, &nres);
+    int64_t end = nowUs();
+    request->mCpuTimeUs += threadCpuTimeUs() - cpuStart;
+    mRunningRequest = previous;
+    mSliceStartUs = previousSliceStart;
+    if (previous) {
+        // The slice of the outer request does not include the nested one
+        mSliceStartUs += end - start;
+    }
+
+    if (status == LUA_YIELD && request->mPreempted) {
+        request->mPreemptions++;
+        request->mStatus = LuaRequest::Status::Suspended;
+        int32_t priority = mSchedulePolicy == SchedulePolicy::Priority ? request->mPriority : 0;
+        mReadyRequests.push({priority, mReadySeq++, request});
+        scheduleReady();
+        return;
+    }
+
+    if (status == LUA_YIELD && request->mAwaiting) {
+        lua_pop(co, nres);
+        request->mResult = GAny::undefined();
+        request->mStatus = LuaRequest::Status::Suspended;
+
+        // The request continues on this thread when the future is completed. The request holds the future,
+        // the callback only references the request weakly: a request dropped by its owner is abandoned
+        // instead of being kept alive by a future that may never complete
+        std::weak_ptr<GAnyLuaVM> weakVM = weak_from_this();
+        std::weak_ptr<LuaTaskQueue> weakTasks = mTasks;
+        std::weak_ptr<LuaRequest> weakRequest = request;
+        request->mAwait.then([weakVM, weakTasks, weakRequest](const LuaFuture &) {
+            auto tasks = weakTasks.lock();
+            if (!tasks) {
+                return;
+            }
+            tasks->post([weakVM, weakRequest]() {
+                auto vm = weakVM.lock();
+                auto request = weakRequest.lock();
+                if (vm && request) {
+                    vm->resumeAwait(request);
+                }
             });
-    if (fIt != mLFuncs.end()) {
-        mLFuncs.erase(fIt);
+        });
+        return;
+    }
+
+    if (status == LUA_YIELD || status == LUA_OK) {
+        int top = lua_gettop(co);
+        request->mResult = nres > 0 ? makeLuaObjectToGAny(co, top - nres + 1) : GAny::undefined();
+        lua_pop(co, nres);
+        if (status == LUA_YIELD) {
+            request->mStatus = LuaRequest::Status::Suspended;
+            return;
+        }
+        request->mStatus = LuaRequest::Status::Finished;
+    } else {
+        const char *err = lua_tostring(co, -1);
+        request->mError = err ? err : "unknown error";
+        request->mStatus = LuaRequest::Status::Failed;
+        // Unwind the failed coroutine so that it can be reused
+        lua_closethread(co, mL);
+    }
+    recycleRequestThread(*request);
+}
+
+void GAnyLuaVM::runCallbackRequest(int funcRef)
+{
+    if (!mL) {
+        return;
+    }
+    ContextScope scope(this);
+    drainPendingRefs();
+
+    lua_rawgeti(mL, LUA_REGISTRYINDEX, funcRef);
+    auto request = startRequest({});
+    if (request->isFailed()) {
+        std::string exception = "GAnyLuaVM Exception: " + request->error();
+        if (sExceptionHandler) {
+            sExceptionHandler(exception);
+        } else {
+            LogE("%s", exception.c_str());
+        }
+    }
+}
+
+void GAnyLuaVM::timeSliceHook(lua_State *L, lua_Debug *ar)
+{
+    GAnyLuaVM *vm = fromLuaState(L);
+    LuaRequest *request = vm->mRunningRequest;
+    // Only the coroutine of the request yields, nested coroutines inherit the hook
+    if (!request || request->mThread != L || vm->mTimeSliceUs <= 0 || !lua_isyieldable(L)) {
+        return;
+    }
+    if (nowUs() - vm->mSliceStartUs < vm->mTimeSliceUs) {
+        return;
+    }
+    request->mPreempted = true;
+    lua_yield(L, 0);
+}
+
+void GAnyLuaVM::scheduleReady()
+{
+    if (mReadyScheduled || mReadyRequests.empty()) {
+        return;
     }
+    mReadyScheduled = true;
+    // One request per task, so that timers, descriptors and other tasks run between the slices
+    // Tasks are only run by this VM, and dropped by its shutdown
+    post([this]() {
+        runReady();
+    });
+}
+
+void GAnyLuaVM::runReady()
+{
+    mReadyScheduled = false;
+    if (mReadyRequests.empty() || !mL) {
+        return;
+    }
+    std::shared_ptr<LuaRequest> request = mReadyRequests.top().request;
+    mReadyRequests.pop();
+    request->mPreempted = false;
+
+    ContextScope scope(this);
+    drainPendingRefs();
+    runRequest(request, 0);
+    scheduleReady();
+}
+
+bool GAnyLuaVM::suspendRequest(lua_State *L, const LuaFuture &future)
+{
+    LuaRequest *request = mRunningRequest;
+    // Without a shared owner the continuation could not find the VM again
+    if (!request || request->mThread != L || !lua_isyieldable(L) || weak_from_this().expired()) {
+        return false;
+    }
+    request->mAwaiting = true;
+    request->mAwait = future;
+    return true;
+}
+
+void GAnyLuaVM::resumeAwait(const std::shared_ptr<LuaRequest> &request)
+{
+    if (!request->mAwaiting || !request->mThread || !mL) {
+        return;
+    }
+    request->mAwaiting = false;
+    request->mAwait = LuaFuture();
+
+    ContextScope scope(this);
+    // The continuation of Async.await reads the result from the future
+    runRequest(request, 0);
+}
+
+void GAnyLuaVM::waitFuture(const LuaFuture &future)
+{
+    if (!isOwnerThread()) {
+        future.wait();
+        return;
+    }
+    // Wake up the task queue on completion
+    std::weak_ptr<LuaTaskQueue> weakTasks = mTasks;
+    future.then([weakTasks](const LuaFuture &) {
+        auto tasks = weakTasks.lock();
+        if (tasks) {
+            tasks->post([]() {});
+        }
+    });
+    while (!future.isDone()) {
+        runOnce(-1);
+    }
+}
+
+void GAnyLuaVM::recycleRequestThread(LuaRequest &request)
+{
+    lua_State *co = request.mThread;
+    lua_settop(co, 0);
+    // A finished coroutine keeps its stack and is resumable again with a new function
+    if (mRequestThreads.size() < mRequestPoolSize && stacksize(co) <= REQUEST_THREAD_MAX_STACK) {
+        mRequestThreads.push_back({co, request.mThreadRef});
+    } else {
+        luaL_unref(mL, LUA_REGISTRYINDEX, request.mThreadRef);
+    }
+    request.mThread = nullptr;
+    request.mThreadRef = LUA_NOREF;
+    mActiveRequests.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void GAnyLuaVM::abandonRequest(int threadRef)
+{
+    mActiveRequests.fetch_sub(1, std::memory_order_relaxed);
+    releaseLuaRef(threadRef);
+}
+
+void GAnyLuaVM::drainPendingRefs()
+{
+    if (!mL || mPendingRefs.empty()) {
+        return;
+    }
+    lua_State *L = mL;
+    mPendingRefs.drain([L](int ref) {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    });
 }
 
 void GAnyLuaVM::pushGAny(lua_State *L, const GAny &v)
+{
+    pushGAny(L, v, externalSizeOf(v));
+}
+
+void GAnyLuaVM::pushGAny(lua_State *L, const GAny &v, size_t externalSize)
 {
     GAny *obj = GX_NEW(GAny, v);
 
-    void **p = (void **) lua_newuserdata(L, sizeof(void *));
-    *p = obj;
+    if (externalSize == 0) {
+        void **p = (void **) lua_newuserdata(L, sizeof(void *));
+        *p = obj;
+        luaL_getmetatable(L, "GAny");
+        lua_setmetatable(L, -2);
+        return;
+    }
+
+    auto *ud = (GAnySizedUserdata *) lua_newuserdata(L, sizeof(GAnySizedUserdata));
+    ud->obj = obj;
+    // Every userdata of the same value shares one charge, the memory is held once however often it is pushed
+    ud->chargeKey = obj->value().get();
     luaL_getmetatable(L, "GAny");
     lua_setmetatable(L, -2);
+
+    GAnyLuaVM *vm = fromLuaState(L);
+    ExternalCharge &charge = vm->mExternalCharges[ud->chargeKey];
+    if (charge.refs++ > 0) {
+        return;
+    }
+    // Counted as if Lua had allocated it, the last finalizer gives it back (see releaseExternalSize)
+    charge.size = externalSize;
+    G(L)->GCdebt += (l_mem) externalSize;
+    vm->mExternalBytes += externalSize;
+    luaC_checkGC(L);
+}
+
+void GAnyLuaVM::setExternalSizeFunc(const std::string &typeName, ExternalSizeFunc func)
+{
+    GLockerGuard locker(sExternalSizeLock);
+    if (func) {
+        sExternalSizeFuncs[typeName] = std::move(func);
+    } else {
+        sExternalSizeFuncs.erase(typeName);
+    }
+    sExternalSizeFuncCount = sExternalSizeFuncs.size();
+}
+
+size_t GAnyLuaVM::externalSizeOf(const GAny &v)
+{
+    if (v.is<GByteArray>()) {
+        return (size_t) v.as<GByteArray>().size();
+    }
+    if (sExternalSizeFuncCount.load(std::memory_order_relaxed) == 0) {
+        return 0;
+    }
+
+    ExternalSizeFunc func;
+    {
+        GLockerGuard locker(sExternalSizeLock);
+        auto it = sExternalSizeFuncs.find(v.typeName());
+        if (it == sExternalSizeFuncs.end()) {
+            return 0;
+        }
+        func = it->second;
+    }
+    try {
+        return func(v);
+    } catch (GAnyException &) {
+        return 0;
+    }
+}
+
+void GAnyLuaVM::releaseExternalSize(lua_State *L, int idx)
+{
+    if (lua_rawlen(L, idx) < sizeof(GAnySizedUserdata)) {
+        return;
+    }
+    auto *ud = (GAnySizedUserdata *) lua_touserdata(L, idx);
+    if (!ud->chargeKey) {
+        return;
+    }
+    GAnyLuaVM *vm = fromLuaState(L);
+    auto it = vm->mExternalCharges.find(ud->chargeKey);
+    ud->chargeKey = nullptr;
+    if (it == vm->mExternalCharges.end() || --it->second.refs > 0) {
+        return;
+    }
+    size_t size = it->second.size;
+    vm->mExternalCharges.erase(it);
+
+    global_State *g = G(L);
+    g->GCdebt -= (l_mem) size;
+    // The estimate of the cycle running the finalizers still includes it, the next pause would grow with it
+    g->GCestimate = g->GCestimate > size ? g->GCestimate - size : 0;
+    vm->mExternalBytes -= size;
 }
 
 int GAnyLuaVM::findUpValue(lua_State *L, int funcIdx, const char *name)
@@ -399,12 +1258,27 @@ void GAnyLuaVM::setEnvironment(lua_State *L, const GAny &env, int funcIdx)
     }
 
     int bTop = lua_gettop(L);
+    pushEnvironment(L, env);
+    const char *upName = lua_setupvalue(L, funcIdx, upIdx);
+
+    int eTop = lua_gettop(L);
+    if (eTop - bTop > 0) {
+        lua_pop(L, eTop - bTop);
+    }
+}
+
+void GAnyLuaVM::pushEnvironment(lua_State *L, const GAny &env, int parentIdx)
+{
     lua_newtable(L);
-    // _G -> metadata.__index
+    // _G (or parent) -> metadata.__index
     lua_newtable(L);
     int top = lua_gettop(L);
     lua_pushliteral(L, "__index");
-    lua_getglobal(L, "_G");
+    if (parentIdx > 0) {
+        lua_pushvalue(L, parentIdx);
+    } else {
+        lua_getglobal(L, "_G");
+    }
     lua_settable(L, top);
 
     // _ENV
@@ -417,16 +1291,16 @@ void GAnyLuaVM::setEnvironment(lua_State *L, const GAny &env, int funcIdx)
 
         env.call("forEach", [&](const std::string &k, const GAny &v) {
             lua_pushstring(L, k.c_str());
-            pushGAny(L, v);
+            const LuaProxyType *proxyType = findProxyType(v);
+            if (proxyType) {
+                // Pushed as their own userdata
+                proxyType->push(L, v);
+            } else {
+                pushGAny(L, v);
+            }
             lua_settable(L, top);
         });
     }
-    const char *upName = lua_setupvalue(L, funcIdx, upIdx);
-
-    int eTop = lua_gettop(L);
-    if (eTop - bTop > 0) {
-        lua_pop(L, eTop - bTop);
-    }
 }
 
 GAny GAnyLuaVM::getEnvironment(lua_State *L, int funcIdx)
@@ -499,82 +1373,30 @@ void GAnyLuaVM::storeUpValue(lua_State *L, int funcIdx, const std::vector<UpValu
 
 GAny GAnyLuaVM::makeLuaFunctionToGAny(lua_State *L, int idx)
 {
-    /// Dump the LEnv of a function
-    std::weak_ptr<GAnyValue> lEnvRef = getEnvironment(L, idx).value();
-    /// Dump the upper value of a function
-    std::vector<UpValueItem> upValues = dumpUpValue(L, idx);
+    auto snapshot = snapshotFunction(L, idx);
 
-    /// Dump function
-    auto vm = GAnyLuaVM::threadLocal();
-    auto lFunc = std::make_shared<LuaFunction>(L, idx);
-    vm->addLFunctionRef(lFunc);
-
-    auto funcRef = std::make_shared<GLuaFunctionRef>();
-    funcRef->byteCode = lFunc->dump();
-    funcRef->func = lFunc;
-
-    std::stringstream fns;
-    fns << "LuaFunction<" << std::hex << lFunc.get() << ">";
+    char fn[48];
+    snprintf(fn, sizeof(fn), "LuaFunction<%p>", (void *) snapshot->funcRef->func.lock().get());
 
-    std::string fn = fns.str();
     /// Build GAnyFunction, which will proxy the call from GAny to Lua function
     GAnyFunction func = GAnyFunction::createVariadicFunction(
             fn, "",
-            [funcRef, lEnvRef, fn, upValues](const GAny **args, int32_t argc) -> GAny {
-                auto vm = GAnyLuaVM::threadLocal();
+            [snapshot](const GAny **args, int32_t argc) -> GAny {
+                std::shared_ptr<GAnyLuaVM> ownerVM;
+                GAnyLuaVM *vm = callingVM(*snapshot, ownerVM);
                 if (!vm) {
                     HANDLE_EXCEPTION("Failed to get thread local lua vm!");
                 }
 
                 lua_State *L = vm->getLuaState();
+                ContextScope scope(vm);
 
-                auto lFunc = funcRef->func.lock();
-                auto lEnv = lEnvRef.lock();
-
-                while (lFunc) {
-                    /// If the current thread is the thread created by the Lua function, call it directly
-                    if (!lFunc->checkVM()) {
-                        break;
-                    }
-
-                    lFunc->push(L);
-                    if (lEnv) {
-                        GAnyLuaVM::setEnvironment(L, GAny(lEnv), lua_gettop(L));
-                    }
-
-                    /// Fill arguments
-                    for (int32_t i = 0; i < argc; i++) {
-                        makeGAnyToLuaObject(L, *args[i]);
-                    }
-
-                    /// Call
-                    if (lua_pcall(L, argc, 1, 0) != LUA_OK) {
-                        const char *err = lua_tostring(L, -1);
-                        HANDLE_EXCEPTION(err);
-                    }
-
-                    /// Conversion return value
-                    GAny ret = makeLuaObjectToGAny(L, lua_gettop(L));
+                if (!vm->pushSnapshot(*snapshot)) {
+                    std::string err = lua_tostring(L, -1);
                     lua_pop(L, 1);
-                    return ret;
-                }
-
-                /// If the current thread is not the thread where the Lua function was created,
-                /// call the function from the function bytecode.
-                if (luaL_loadbuffer(
-                            L, (const char *) funcRef->byteCode.data(),
-                            (size_t) funcRef->byteCode.size(),
-                            (const char *) fn.c_str()) != LUA_OK) {
-                    const char *err = lua_tostring(L, -1);
                     HANDLE_EXCEPTION(err);
                 }
 
-                if (lEnv) {
-                    GAnyLuaVM::setEnvironment(L, GAny(lEnv), lua_gettop(L));
-                }
-                /// Calling a function from bytecode requires filling in its up value
-                GAnyLuaVM::storeUpValue(L, lua_gettop(L), upValues);
-
                 /// Fill arguments
                 for (int32_t i = 0; i < argc; i++) {
                     makeGAnyToLuaObject(L, *args[i]);
@@ -592,7 +1414,174 @@ GAny GAnyLuaVM::makeLuaFunctionToGAny(lua_State *L, int idx)
                 return ret;
             });
 
-    return func;
+    GAny ret = func;
+    auto value = ret.value();
+    GLockerGuard locker(sSnapshotLock);
+    if (sSnapshots.size() >= sSnapshotsPruneSize) {
+        for (auto it = sSnapshots.begin(); it != sSnapshots.end();) {
+            it = it->second.func.expired() ? sSnapshots.erase(it) : std::next(it);
+        }
+        sSnapshotsPruneSize = std::max<size_t>(64, sSnapshots.size() * 2);
+    }
+    sSnapshots[value.get()] = SnapshotEntry{value, snapshot};
+    return ret;
+}
+
+std::shared_ptr<LuaFunctionSnapshot> GAnyLuaVM::findSnapshot(const GAny &func)
+{
+    if (!func.isFunction()) {
+        return nullptr;
+    }
+    auto value = func.value();
+    GLockerGuard locker(sSnapshotLock);
+    auto it = sSnapshots.find(value.get());
+    // The address may have been reused by another value after the function was released
+    if (it == sSnapshots.end() || it->second.func.lock() != value) {
+        return nullptr;
+    }
+    return it->second.snapshot.lock();
+}
+
+GAnyLuaVM *GAnyLuaVM::callingVM(const LuaFunctionSnapshot &snapshot, std::shared_ptr<GAnyLuaVM> &ownerVM)
+{
+    auto lFunc = snapshot.funcRef->func.lock();
+
+    GAnyLuaVM *vm = GAnyLuaVM::current();
+    if (lFunc && !lFunc->checkVM(vm)) {
+        /// The function may belong to another VM sharing this thread, route the call to it
+        ownerVM = lFunc->mLuaVM.lock();
+        if (ownerVM && ownerVM->isOwnerThread() && ownerVM->getLuaState()) {
+            vm = ownerVM.get();
+        }
+    }
+    if (!vm || !vm->getLuaState()) {
+        return nullptr;
+    }
+    return vm;
+}
+
+size_t GAnyLuaVM::callBatch(const GAny &func, const std::vector<std::vector<GAny>> &argsList,
+                            std::vector<GAny> &results, std::vector<std::string> *errors)
+{
+    results.assign(argsList.size(), GAny::undefined());
+    if (errors) {
+        errors->assign(argsList.size(), std::string());
+    }
+    size_t failed = 0;
+    auto setError = [&](size_t i, const std::string &error) {
+        failed++;
+        if (errors) {
+            (*errors)[i] = error;
+        }
+    };
+
+    auto snapshot = findSnapshot(func);
+    std::shared_ptr<GAnyLuaVM> ownerVM;
+    GAnyLuaVM *vm = snapshot ? callingVM(*snapshot, ownerVM) : nullptr;
+    if (!vm) {
+        /// Not a Lua function (or no VM on this thread), call it as a GAny function
+        for (size_t i = 0; i < argsList.size(); i++) {
+            try {
+                results[i] = func._call(argsList[i]);
+            } catch (GAnyException &e) {
+                setError(i, e.what());
+            }
+        }
+        return failed;
+    }
+
+    lua_State *L = vm->getLuaState();
+    ContextScope scope(vm);
+
+    int base = lua_gettop(L);
+    if (!vm->pushSnapshot(*snapshot)) {
+        std::string error = lua_tostring(L, -1);
+        lua_settop(L, base);
+        for (size_t i = 0; i < argsList.size(); i++) {
+            setError(i, error);
+        }
+        return failed;
+    }
+    int funcIdx = lua_gettop(L);
+
+    for (size_t i = 0; i < argsList.size(); i++) {
+        const auto &args = argsList[i];
+        lua_pushvalue(L, funcIdx);
+        for (const auto &arg: args) {
+            makeGAnyToLuaObject(L, arg);
+        }
+        if (lua_pcall(L, (int) args.size(), 1, 0) != LUA_OK) {
+            const char *error = lua_tostring(L, -1);
+            setError(i, error ? error : "Unknown error");
+        } else {
+            try {
+                results[i] = makeLuaObjectToGAny(L, lua_gettop(L));
+            } catch (GAnyException &e) {
+                setError(i, e.what());
+            }
+        }
+        lua_settop(L, funcIdx);
+    }
+
+    lua_settop(L, base);
+    return failed;
+}
+
+std::shared_ptr<LuaFunctionSnapshot> GAnyLuaVM::snapshotFunction(lua_State *L, int idx)
+{
+    auto snapshot = std::make_shared<LuaFunctionSnapshot>();
+    /// Dump the LEnv of a function
+    snapshot->lEnvRef = getEnvironment(L, idx).value();
+    /// Dump the upper value of a function
+    snapshot->upValues = dumpUpValue(L, idx);
+
+    /// Dump function
+    GAnyLuaVM *vm = GAnyLuaVM::fromLuaState(L);
+    vm->drainPendingRefs();
+    auto lFunc = std::make_shared<LuaFunction>(L, idx);
+    lFunc->mHandle = vm->addLFunctionRef(lFunc);
+
+    snapshot->funcRef = std::make_shared<GLuaFunctionRef>();
+    snapshot->funcRef->func = lFunc;
+    /// The bytecode is only dumped when the function is first called from another thread
+    if (!lua_iscfunction(L, idx)) {
+        snapshot->funcRef->code = vm->functionCode(static_cast<const LClosure *>(lua_topointer(L, idx))->p);
+    }
+    return snapshot;
+}
+
+bool GAnyLuaVM::pushSnapshot(const LuaFunctionSnapshot &snapshot)
+{
+    lua_State *L = mL;
+    auto lFunc = snapshot.funcRef->func.lock();
+    auto lEnv = snapshot.lEnvRef.lock();
+    drainPendingRefs();
+
+    /// If this is the VM created by the Lua function, use it directly
+    if (lFunc && lFunc->checkVM(this)) {
+        lFunc->push(L);
+        if (lEnv) {
+            GAnyLuaVM::setEnvironment(L, GAny(lEnv), lua_gettop(L));
+        }
+        return true;
+    }
+
+    /// Otherwise load the function from the function bytecode
+    auto chunk = snapshot.funcRef->code ? snapshot.funcRef->code->chunk(L, lFunc) : nullptr;
+    if (!chunk) {
+        lua_pushstring(L, "Lua function can not be called from other threads!");
+        return false;
+    }
+    if (chunk->load(L) != LUA_OK) {
+        return false;
+    }
+
+    if (lEnv) {
+        GAnyLuaVM::setEnvironment(L, GAny(lEnv), lua_gettop(L));
+    }
+    /// Calling a function from bytecode requires filling in its up value
+    GAnyLuaVM::storeUpValue(L, lua_gettop(L), snapshot.upValues);
+    return true;
 }
 
 constexpr double EPS = 1e-6;
@@ -610,8 +1599,16 @@ GAny GAnyLuaVM::makeLuaObjectToGAny(lua_State *L, int idx)
         case LUA_TBOOLEAN:
             return (bool) lua_toboolean(L, idx);
         case LUA_TLIGHTUSERDATA:
+            // Json.null and MsgPack.null
+            if (LuaJson::isNull(L, idx)) {
+                return GAny::null();
+            }
             HANDLE_EXCEPTION("Unexpected data type: lightuserdata.");
         case LUA_TNUMBER: {
+            // Integers above 2^53 are not exact in double
+            if (lua_isinteger(L, idx)) {
+                return (int64_t) lua_tointeger(L, idx);
+            }
             double num = lua_tonumber(L, idx);
             if (num - std::floor(num) < EPS) {
                 return (int64_t) num;
@@ -626,6 +1623,11 @@ GAny GAnyLuaVM::makeLuaObjectToGAny(lua_State *L, int idx)
         case LUA_TFUNCTION:
             return makeLuaFunctionToGAny(L, idx);
         case LUA_TUSERDATA:
+            for (const auto &type: sProxyTypes) {
+                if (type.isProxy(L, idx)) {
+                    return type.toGAny(L, idx);
+                }
+            }
             GAny *obj = glua_getcppobject(L, GAny, idx);
             return obj ? *obj : GAny::null();
     }
@@ -643,12 +1645,7 @@ int GAnyLuaVM::makeGAnyToLuaObject(lua_State *L, const GAny &value, bool useGAny
         return 1;
     }
     if (value.isInt64() || value.is<long>() || value.is<unsigned long>()) {
-        int64_t v = value.toInt64();
-        if (v < INT32_MAX) {
-            lua_pushinteger(L, (int) v);
-        } else {
-            lua_pushnumber(L, (double) v);
-        }
+        lua_pushinteger(L, (lua_Integer) value.toInt64());
         return 1;
     }
     if (value.isBoolean()) {
@@ -671,6 +1668,11 @@ int GAnyLuaVM::makeGAnyToLuaObject(lua_State *L, const GAny &value, bool useGAny
         value.as<LuaTable>().push(L);
         return 1;
     }
+    const LuaProxyType *proxyType = findProxyType(value);
+    if (proxyType) {
+        proxyType->push(L, value);
+        return 1;
+    }
 
     pushGAny(L, value);
     return 1;
@@ -764,11 +1766,14 @@ GByteArray GAnyLuaVM::compileFile(const std::string &filePath, bool strip)
 GByteArray GAnyLuaVM::compile(const GByteArray &buffer, const std::string &sourcePath, bool strip)
 {
     lua_State *L = mL;
+    // May be called while a C function of this VM is running (e.g. requireLs), only pop what is pushed here
+    int top = lua_gettop(L);
     if (luaL_loadbuffer(L, (const char *) buffer.data(),
                         (size_t) buffer.size(),
                         (const char *) sourcePath.c_str()) != LUA_OK) {
         const char *err = lua_tostring(L, -1);
         LogE("%s", err);
+        lua_settop(L, top);
         return GByteArray();
     }
 
@@ -779,7 +1784,7 @@ GByteArray GAnyLuaVM::compile(const GByteArray &buffer, const std::string &sourc
         buff.clear();
     }
 
-    lua_pop(L, lua_gettop(L));
+    lua_settop(L, top);
     return buff;
 }
 
@@ -25,18 +25,33 @@
 
 #include "gx/gobject.h"
 
+#include "lua_function.h"
+#include "lua_event_loop.h"
+#include "lua_future.h"
+#include "lua_reclaimer.h"
+#include "lua_request.h"
+#include "lua_task_queue.h"
+#include "mpsc_queue.h"
+
 #include <gx/gany.h>
 #include <gx/gbytearray.h>
 #include <gx/gmutex.h>
 
 #include <lua.hpp>
 
+#include <atomic>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
 
 #define glua_getcppobject(L, CLASS, i)  (lua_isuserdata(L, i) ? *(CLASS**)lua_touserdata(L, i) : nullptr)
 
 GX_NS_BEGIN
 
-class LuaFunction;
+class LuaCodeCache;
+
+class LuaChunk;
 
 struct UpValueItem
 {
@@ -45,6 +60,17 @@ struct UpValueItem
     bool luaType{};
 };
 
+/**
+ * @brief Snapshot of a Lua function held by GAny: the function, its bytecode, up values and LEnv. <br>
+ *        It can be instantiated in any virtual machine, the virtual machine of the function uses the function itself
+ */
+struct LuaFunctionSnapshot
+{
+    std::shared_ptr<GLuaFunctionRef> funcRef;
+    std::weak_ptr<GAnyValue> lEnvRef;
+    std::vector<UpValueItem> upValues;
+};
+
 /**
  * @class GAnyLuaVM
  * @brief Enhanced by GAny, Lua virtual machine supports true multithreading. <br>
@@ -58,24 +84,85 @@ struct UpValueItem
  * 7. Provide requireLs, which are more convenient and powerful than require; <br>
  * 8. You can directly call the types or returned functions created in Lua through GAny.
  */
-class GAnyLuaVM
+class GAnyLuaVM : public std::enable_shared_from_this<GAnyLuaVM>
 {
 public:
     using ScriptReader = std::function<GByteArray(const std::string &path)>;
 
     using ExceptionHandler = std::function<void(const std::string &exception)>;
 
+    /// Approximate size of the C++ memory held by a GAny, in bytes
+    using ExternalSizeFunc = std::function<size_t(const GAny &v)>;
+
+    enum class SchedulePolicy
+    {
+        /// Preempted requests continue in the order they were preempted
+        RoundRobin,
+        /// Preempted requests with a higher priority continue first, round robin among equal priorities
+        Priority,
+    };
+
+    /**
+     * @brief Make a virtual machine the current one of the thread within a scope,
+     *        scopes can be nested and GAnyLuaVM::current() returns the innermost one
+     */
+    class ContextScope
+    {
+    public:
+        explicit ContextScope(GAnyLuaVM *vm);
+
+        ~ContextScope();
+
+        ContextScope(const ContextScope &) = delete;
+
+        ContextScope &operator=(const ContextScope &) = delete;
+    };
+
 public:
     explicit GAnyLuaVM();
 
     ~GAnyLuaVM();
 
+    /**
+     * @brief Create an independent virtual machine owned by the current thread,
+     *        any number of virtual machines can share a thread
+     * @return
+     */
+    static std::shared_ptr<GAnyLuaVM> create();
+
     /**
      * @brief Get the current thread's GAnyLuaVM
      * @return
      */
     static std::shared_ptr<GAnyLuaVM> threadLocal();
 
+    /**
+     * @brief Get the current GAnyLuaVM of the thread without taking a reference:
+     *        the virtual machine running on the thread (see ContextScope), otherwise the thread's default one
+     * @return
+     */
+    static GAnyLuaVM *current();
+
+    /**
+     * @brief Get the GAnyLuaVM that owns the Lua state (stored in the extra space of the state,
+     *        shared by its coroutines), without taking a reference
+     * @param L
+     * @return
+     */
+    static GAnyLuaVM *fromLuaState(lua_State *L);
+
+    /**
+     * @brief Unique id of the virtual machine, never reused within the process
+     * @return
+     */
+    uint64_t id() const;
+
+    /**
+     * @brief Determine whether the calling thread is the thread that created the virtual machine
+     * @return
+     */
+    bool isOwnerThread() const;
+
     lua_State *getLuaState() const;
 
     /**
@@ -120,6 +207,174 @@ public:
      */
     GAny scriptBuffer(const GByteArray &buffer, std::string sourcePath = "", const GAny &env = GAny::object());
 
+    /**
+     * @brief Loading and Running a precompiled script embedded in the binary (see gx_script_embed)
+     * @param name  Script name
+     * @param env   The environment variable (data) passed to Lua program must be a GAnyObject
+     * @return Returns the return value of the script
+     */
+    GAny scriptPreload(const std::string &name, const GAny &env = GAny::object());
+
+    /**
+     * @brief Determine whether a precompiled script with the specified name is embedded
+     * @param name  Script name
+     * @return
+     */
+    static bool hasPreload(const std::string &name);
+
+    /**
+     * @brief Loading and Running a shared chunk. The code of the chunk is referenced in place,
+     *        so loading the same chunk into many virtual machines does not copy the bytecode
+     * @param chunk Shared chunk
+     * @param env   The environment variable (data) passed to Lua program must be a GAnyObject
+     * @return Returns the return value of the script
+     */
+    GAny scriptChunk(const std::shared_ptr<LuaChunk> &chunk, const GAny &env = GAny::object());
+
+    /**
+     * @brief Call a function once for each argument list. For a Lua function the virtual machine is looked up
+     *        and the function is pushed with its LEnv only once for the whole batch,
+     *        other functions are called one by one. A failed call does not stop the batch
+     * @param func      Function (usually a Lua function returned to C++)
+     * @param argsList  Argument lists
+     * @param results   Receives the return values in the order of the argument lists, undefined for failed calls
+     * @param errors    Receives the error messages in the same order, empty for successful calls (optional)
+     * @return Number of failed calls
+     */
+    static size_t callBatch(const GAny &func, const std::vector<std::vector<GAny>> &argsList,
+                            std::vector<GAny> &results, std::vector<std::string> *errors = nullptr);
+
+    /**
+     * @brief Create a shared chunk from Lua source code or bytecode, which can be run by any virtual machine
+     * @param buffer        Lua script or bytecode data stream Bytes Arrays
+     * @param sourcePath    Code source path (file path or URI)
+     * @return
+     */
+    static std::shared_ptr<LuaChunk> createChunk(const GByteArray &buffer, std::string sourcePath = "");
+
+    /**
+     * @brief Load a request handler: a Lua script that returns the function handling each request
+     * @param script        Lua script text
+     * @param sourcePath    Code source path (file path or URI)
+     * @param env           The environment variable (data) passed to the script must be a GAnyObject
+     * @return Handler id, 0 if failed
+     */
+    int32_t loadRequestHandler(const std::string &script, std::string sourcePath = "",
+                               const GAny &env = GAny::object());
+
+    /**
+     * @brief Release a request handler, requests in flight are not affected
+     * @param handler
+     */
+    void unloadRequestHandler(int32_t handler);
+
+    /**
+     * @brief Run a request in a pooled coroutine. The handler is called with the arguments
+     *        and a private environment (globals of the handler script are visible, LEnv is env),
+     *        it runs until it returns or yields. Errors of the handler are reported by the request. <br>
+     *        The caller owns the request, dropping it abandons the request, also while it awaits a future
+     * @param handler   Handler id (see loadRequestHandler)
+     * @param env       The environment variable (data) of this request must be a GAnyObject
+     * @param args      Arguments passed to the handler
+     * @return nullptr if the handler is invalid
+     */
+    std::shared_ptr<LuaRequest> request(int32_t handler, const GAny &env = GAny::object(),
+                                        const std::vector<GAny> &args = {});
+
+    /**
+     * @brief Continue a suspended request, value is returned by the yield of the request
+     * @param request
+     * @param value
+     * @return false if the request is not suspended or does not belong to this virtual machine
+     */
+    bool resumeRequest(const std::shared_ptr<LuaRequest> &request, const GAny &value = GAny::undefined());
+
+    /**
+     * @brief Post a task to be run by GAnyLuaVM::runPending on the thread of the virtual machine,
+     *        may be called from any thread
+     * @param task
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * @brief Run the posted tasks, including the continuation of requests whose awaited future is completed.
+     *        Only called on the thread of the virtual machine
+     * @param timeoutMs     Time to wait for a task when there is none, 0 does not wait, negative numbers wait forever
+     * @return Number of tasks run
+     */
+    size_t runPending(int32_t timeoutMs = 0);
+
+    /**
+     * @brief Determine whether there are posted tasks not yet run
+     * @return
+     */
+    bool hasPending() const;
+
+    /**
+     * @brief Event loop of the virtual machine: posted tasks, timers and descriptor readiness (see Async.sleep).
+     *        Only used on the thread of the virtual machine, except LuaEventLoop::stop
+     * @return
+     */
+    LuaEventLoop &eventLoop() const;
+
+    /**
+     * @brief Wait for events and run the ready tasks, timers and descriptor callbacks once,
+     *        the embedding application calls it from its own loop
+     * @param timeoutMs     Maximum waiting time, 0 does not wait, negative numbers wait until an event happens
+     * @return Number of callbacks run
+     */
+    size_t runOnce(int32_t timeoutMs = 0);
+
+    /**
+     * @brief Run the event loop until stopLoop is called, for a dedicated thread that owns the virtual machine
+     */
+    void runLoop();
+
+    /**
+     * @brief Make runLoop return, may be called from any thread
+     */
+    void stopLoop();
+
+    /**
+     * @brief Statistics of the event loop: iterations, tasksRun, timersFired, fdEvents, queueDepth,
+     *        timerCount, fdCount, lastLagUs and maxLagUs (delay of the timers in microseconds)
+     * @return GAnyObject
+     */
+    GAny loopStats() const;
+
+    /**
+     * @brief Enable time slicing of requests: a running request that used up its slice yields at the next
+     *        yieldable point and continues later from the event loop, so one busy request can not starve the others.
+     *        Not preempted while in a C function or a metamethod called from C
+     * @param sliceUs               Time slice in microseconds, 0 to disable
+     * @param checkInstructions     Number of instructions between two checks of the slice
+     */
+    void setTimeSlice(int64_t sliceUs, int32_t checkInstructions = 1000);
+
+    /**
+     * @brief Set the order in which preempted requests continue (default round robin)
+     * @param policy
+     */
+    void setSchedulePolicy(SchedulePolicy policy);
+
+    /**
+     * @brief Number of preempted requests waiting to continue
+     * @return
+     */
+    size_t readyRequestCount() const;
+
+    /**
+     * @brief Number of requests started and not yet done
+     * @return
+     */
+    int64_t activeRequestCount() const;
+
+    /**
+     * @brief Set the maximum number of idle coroutines kept for reuse by requests (default 64)
+     * @param size
+     */
+    void setRequestPoolSize(size_t size);
+
     /**
      * @brief Trigger garbage collection for Lua virtual machine
      */
@@ -132,6 +387,26 @@ public:
      */
     bool gcStep(int32_t kb);
 
+    /**
+     * @brief Set how the GAny released by the garbage collector of this virtual machine are deleted,
+     *        instead of the default mode of LuaReclaimer. Leaving Deferred deletes the deferred GAny
+     * @param mode
+     */
+    void setReclaimMode(LuaReclaimer::Mode mode);
+
+    /**
+     * @brief Get the reclamation mode of this virtual machine
+     * @return The default mode of LuaReclaimer if not set
+     */
+    LuaReclaimer::Mode reclaimMode() const;
+
+    /**
+     * @brief Delete the GAny deferred by the garbage collector of this virtual machine now (Deferred mode),
+     *        on the thread running it
+     * @return Number of GAny deleted
+     */
+    size_t reclaim();
+
     /**
      * @brief Set GC step rate, Only incremental mode is valid
      * @param mul
@@ -163,11 +438,21 @@ public:
     bool gcIsRunning();
 
     /**
-     * @brief Returns the amount of memory used by the current Lua virtual machine (in kb)
+     * @brief Returns the amount of memory used by the current Lua virtual machine (in kb),
+     *        without the external memory of the GAny userdata (see gcGetExternalCount)
      * @return
      */
     int32_t gcGetCount();
 
+    /**
+     * @brief Returns the approximate amount of C++ memory held by the live GAny userdata
+     *        of the current Lua virtual machine (in kb). <br>
+     *        It is added to the debt of the garbage collector, so it paces the collection like Lua memory,
+     *        and it is included in collectgarbage("count")
+     * @return
+     */
+    int32_t gcGetExternalCount();
+
     /**
      * @brief Switch garbage collector to generational mode
      */
@@ -197,12 +482,94 @@ public:
      */
     static void setScriptReader(ScriptReader reader);
 
+    /**
+     * @brief   Enable the on-disk bytecode cache. Lua source files loaded by "scriptFile" and "requireLs"
+     *          are compiled once and the bytecode is stored in the cache directory,
+     *          subsequent loads use the bytecode instead of parsing the source.
+     *          Not used when a custom script reader is set.
+     * @param cacheDir  Cache directory, empty to disable the cache
+     */
+    static void setCodeCacheDir(const std::string &cacheDir);
+
 private:
     GAny loadScriptFromBuffer(const GByteArray &buffer, const std::string &sourcePath, const GAny &env);
 
-    void addLFunctionRef(const std::shared_ptr<LuaFunction> &ref);
+    GAny loadScriptFromMemory(const char *data, size_t size, const std::string &sourcePath, const GAny &env);
 
-    void removeLFunctionRef(const std::shared_ptr<LuaFunction> &ref);
+    GAny runLoadedChunk(const GAny &env);
+
+    /**
+     * @brief Start a request running the function on the top of the stack, the function is popped
+     * @param args
+     * @return
+     */
+    std::shared_ptr<LuaRequest> startRequest(const std::vector<GAny> &args);
+
+    void runRequest(const std::shared_ptr<LuaRequest> &request, int nargs);
+
+    static void timeSliceHook(lua_State *L, lua_Debug *ar);
+
+    /**
+     * @brief Continue the preempted request at the head of the ready queue from the event loop
+     */
+    void scheduleReady();
+
+    void runReady();
+
+    /**
+     * @brief Run a function referenced by the registry as a request, errors are reported to the exception handler
+     * @param funcRef
+     */
+    void runCallbackRequest(int funcRef);
+
+    /**
+     * @brief Suspend the running request for Async.await if L is its coroutine
+     * @param L
+     * @param future
+     * @return false if L is not the coroutine of the running request, the caller has to wait in place
+     */
+    bool suspendRequest(lua_State *L, const LuaFuture &future);
+
+    void resumeAwait(const std::shared_ptr<LuaRequest> &request);
+
+    /**
+     * @brief Run the posted tasks until the future is completed
+     * @param future
+     */
+    void waitFuture(const LuaFuture &future);
+
+    void recycleRequestThread(LuaRequest &request);
+
+    void abandonRequest(int threadRef);
+
+    uint64_t addLFunctionRef(const std::shared_ptr<LuaFunction> &ref);
+
+    void removeLFunctionRef(uint64_t handle);
+
+    /**
+     * @brief Release a registry reference of the Lua state, references released on other threads
+     *        are queued and released by the thread of the VM at the next safe point
+     * @param ref
+     */
+    void releaseLuaRef(int ref);
+
+    /**
+     * @brief Release the queued references, only called on the thread of the VM
+     */
+    void drainPendingRefs();
+
+    std::shared_ptr<LuaFunctionCode> functionCode(const void *proto);
+
+    /**
+     * @brief Dump a function prototype of this virtual machine, may be called from any thread. <br>
+     *        The caller keeps the prototype alive (e.g. holds a LuaFunction of it),
+     *        shutdown waits for the dump to complete before the state is closed
+     * @param L             Lua state of the calling thread
+     * @param proto         Function prototype
+     * @param chunkName     Chunk name
+     * @return nullptr if the virtual machine is shut down or the dump failed
+     */
+    std::shared_ptr<LuaChunk> dumpProto(lua_State *L, const void *proto, const std::string &chunkName);
 
 public:    /// Tools
     /**
@@ -212,6 +579,40 @@ public:    /// Tools
      */
     static void pushGAny(lua_State *L, const GAny &v);
 
+    /**
+     * @brief Place a GAny object on the specified Lua stack, reporting the C++ memory it holds
+     *        to the garbage collector until the userdata is collected. <br>
+     *        The size is charged once per value: the userdata pushed for the same value (copies of one GAny)
+     *        share the charge of the first push, it is released with the last of them.
+     *        Later changes of the size of the value are not tracked
+     * @param L
+     * @param v
+     * @param externalSize  Approximate size in bytes, only used by the first push of the value
+     */
+    static void pushGAny(lua_State *L, const GAny &v, size_t externalSize);
+
+    /**
+     * @brief Set the function that reports the external size of the values of a class when pushed to Lua,
+     *        GByteArray values are sized without a function
+     * @param typeName  Type name of the values (GAny::typeName)
+     * @param func      nullptr to remove
+     */
+    static void setExternalSizeFunc(const std::string &typeName, ExternalSizeFunc func);
+
+    /**
+     * @brief Approximate size of the C++ memory held by a value, 0 if unknown
+     * @param v
+     * @return
+     */
+    static size_t externalSizeOf(const GAny &v);
+
+    /**
+     * @brief Release the external size reported for the GAny userdata at idx, called by its finalizer
+     * @param L
+     * @param idx
+     */
+    static void releaseExternalSize(lua_State *L, int idx);
+
     /**
      * @brief Find the up value of the specified name from the specified function on the specified Lua stack
      * @param L
@@ -248,6 +649,14 @@ public:    /// Tools
      */
     static void setEnvironment(lua_State *L, const GAny &env, int funcIdx);
 
+    /**
+     * @brief Push a new env(LEnv) table, globals not found in it are looked up in the table at parentIdx
+     * @param L
+     * @param env
+     * @param parentIdx     Index of the parent table, 0 for _G
+     */
+    static void pushEnvironment(lua_State *L, const GAny &env, int parentIdx = 0);
+
     /**
      * @brief Get env(LEnv) of the specified Lua function
      * @param L
@@ -280,6 +689,38 @@ public:    /// Tools
      */
     static GAny makeLuaFunctionToGAny(lua_State *L, int idx);
 
+    /**
+     * @brief Take a snapshot of the Lua function on the stack
+     * @param L
+     * @param idx
+     * @return
+     */
+    static std::shared_ptr<LuaFunctionSnapshot> snapshotFunction(lua_State *L, int idx);
+
+    /**
+     * @brief Push the function of a snapshot onto the stack of this virtual machine, with its LEnv.
+     *        In another virtual machine the function is loaded from its bytecode and the up values are filled
+     * @param snapshot
+     * @return false if failed, the error message is on the stack
+     */
+    bool pushSnapshot(const LuaFunctionSnapshot &snapshot);
+
+    /**
+     * @brief Find the snapshot of a Lua function converted to GAny by makeLuaFunctionToGAny
+     * @param func
+     * @return nullptr if func is not a Lua function
+     */
+    static std::shared_ptr<LuaFunctionSnapshot> findSnapshot(const GAny &func);
+
+    /**
+     * @brief Virtual machine of the calling thread that runs the function of a snapshot:
+     *        the VM owning the function if it shares the thread, otherwise the current one
+     * @param snapshot
+     * @param ownerVM   Keeps the owning VM alive during the call
+     * @return nullptr if there is none
+     */
+    static GAnyLuaVM *callingVM(const LuaFunctionSnapshot &snapshot, std::shared_ptr<GAnyLuaVM> &ownerVM);
+
     /**
      * @brief Make Lua object as GAny object
      * @param L
@@ -328,14 +769,79 @@ private:
 
 private:
     friend class GLuaFunctionRef;
+    friend class LuaAsync;
+    friend class LuaFunction;
+    friend class LuaFunctionCode;
+    friend class LuaReclaimer;
+    friend class LuaRequest;
 
     lua_State *mL = nullptr;
+    uint64_t mId = 0;
+    std::thread::id mOwnerThread;
+    /// Held by dumpProto, shutdown sets mClosed under it so the state is not closed during a dump
+    GMutex mCloseLock;
+    bool mClosed = false;
+    /// External size of the live GAny userdata, also counted in the debt of the garbage collector
+    size_t mExternalBytes = 0;
+
+    /// External size charged once per value (GAnyValue), shared by all its userdata
+    struct ExternalCharge
+    {
+        size_t size = 0;
+        size_t refs = 0;
+    };
+    std::unordered_map<const void *, ExternalCharge> mExternalCharges;
+
+    /// Own reclamation mode, -1 for the default one of LuaReclaimer
+    std::atomic<int> mReclaimMode{-1};
+    /// GAny deferred by the finalizers, deleted at the idle points
+    LuaReclaimer::DeferredList mDeferred;
 
-    std::vector<std::shared_ptr<LuaFunction>> mLFuncs;
-    GMutex mFuncsLock;
+    LuaFunctionRegistry mLFuncs;
+    MpscQueue<int> mPendingRefs;
+
+    struct RequestThread
+    {
+        lua_State *thread;
+        int ref;
+    };
+    /// Idle coroutines of requests, only accessed on the thread of the VM
+    std::vector<RequestThread> mRequestThreads;
+    size_t mRequestPoolSize = 64;
+    uint64_t mNextRequestId = 1;
+    std::atomic<int64_t> mActiveRequests{0};
+    LuaRequest *mRunningRequest = nullptr;
+
+    int64_t mTimeSliceUs = 0;
+    int32_t mSliceCheckCount = 1000;
+    int64_t mSliceStartUs = 0;
+    SchedulePolicy mSchedulePolicy = SchedulePolicy::RoundRobin;
+
+    struct ReadyRequest
+    {
+        int32_t priority;
+        uint64_t seq;
+        std::shared_ptr<LuaRequest> request;
+
+        bool operator<(const ReadyRequest &rhs) const
+        {
+            return priority < rhs.priority || (priority == rhs.priority && seq > rhs.seq);
+        }
+    };
+    std::priority_queue<ReadyRequest> mReadyRequests;
+    uint64_t mReadySeq = 0;
+    bool mReadyScheduled = false;
+
+    std::shared_ptr<LuaTaskQueue> mTasks;
+    std::unique_ptr<LuaEventLoop> mEventLoop;
+
+    /// Shared bytecode of the prototypes of wrapped functions, only accessed on the thread of the VM
+    std::unordered_map<const void *, std::weak_ptr<LuaFunctionCode>> mFuncCodes;
+    size_t mFuncCodesSweep = 64;
 
     static ScriptReader sScriptReader;
     static ExceptionHandler sExceptionHandler;
+    static std::shared_ptr<LuaCodeCache> sCodeCache;
 };
 
 GX_NS_END
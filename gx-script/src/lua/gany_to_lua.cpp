@@ -23,6 +23,8 @@
 #include "gany_to_lua.h"
 
 #include "lua_table.h"
+#include "lua_parallel.h"
+#include "lua_reclaimer.h"
 
 #include <gx/debug.h>
 
@@ -41,6 +43,8 @@ void GAnyToLua::toLua(lua_State *L)
             {"_equalTo",   regGAnyEqualTo},
             {"_import",    regGAnyImport},
             {"_export",    regGAnyExport},
+            {"_parallelMap",    regGAnyParallelMap},
+            {"_parallelReduce", regGAnyParallelReduce},
 
             {nullptr,      nullptr}
     };
@@ -364,8 +368,8 @@ int GAnyToLua::requireLs(lua_State *L)
             env = GAny::object();
         }
 
-        auto tlLua = GAnyLuaVM::threadLocal();
-        GAnyLuaVM::pushGAny(L, tlLua->requireLs(name, env));
+        GAnyLuaVM *vm = GAnyLuaVM::fromLuaState(L);
+        GAnyLuaVM::pushGAny(L, vm->requireLs(name, env));
 
         return 1;
     }
@@ -457,12 +461,7 @@ int GAnyToLua::regGAnyCreate(lua_State *L)
         return 0;
     }
 
-    GAny *obj = GX_NEW(GAny, argv);
-
-    void **p = (void **) lua_newuserdata(L, sizeof(void *));
-    *p = obj;
-    luaL_getmetatable(L, "GAny");
-    lua_setmetatable(L, -2);
+    GAnyLuaVM::pushGAny(L, argv);
 
     return 1;
 }
@@ -474,7 +473,8 @@ int GAnyToLua::regGAnyGC(lua_State *L)
         luaL_error(L, "Call GAny __gc error: null object");
         return 0;
     }
-    GX_DELETE(self);
+    GAnyLuaVM::releaseExternalSize(L, 1);
+    LuaReclaimer::retire(L, self);
 
     return 0;
 }
@@ -1944,4 +1944,66 @@ int GAnyToLua::regGAnyExport(lua_State *L)
     return 0;
 }
 
-GX_NS_END
\ No newline at end of file
+int GAnyToLua::regGAnyParallelMap(lua_State *L)
+{
+    if (!lua_isfunction(L, 2)) {
+        luaL_error(L, "GAny._parallelMap error: the arg2(func) requires a function");
+        return 0;
+    }
+    auto grain = (size_t) std::max<lua_Integer>(0, luaL_optinteger(L, 3, 0));
+
+    std::string error;
+    try {
+        GAny array;
+        if (toParallelArray(L, 1, array)) {
+            LuaParallel::Function func{GAny::undefined(), GAnyLuaVM::snapshotFunction(L, 2)};
+            GAnyLuaVM::pushGAny(L, LuaParallel::map(array, func, grain));
+            return 1;
+        }
+        error = "GAny._parallelMap error: the arg1(array) requires a GAny array or table";
+    } catch (GAnyException &e) {
+        error = e.what();
+    }
+    // Raised after the C++ objects are released
+    lua_pushstring(L, error.c_str());
+    return lua_error(L);
+}
+
+int GAnyToLua::regGAnyParallelReduce(lua_State *L)
+{
+    if (!lua_isfunction(L, 2)) {
+        luaL_error(L, "GAny._parallelReduce error: the arg2(func) requires a function");
+        return 0;
+    }
+    // Without combine the partial results are folded with func
+    int combineIdx = lua_isfunction(L, 3) ? 3 : 2;
+    auto grain = (size_t) std::max<lua_Integer>(0, luaL_optinteger(L, 4, 0));
+
+    std::string error;
+    try {
+        GAny array;
+        if (toParallelArray(L, 1, array)) {
+            LuaParallel::Function func{GAny::undefined(), GAnyLuaVM::snapshotFunction(L, 2)};
+            LuaParallel::Function combine{GAny::undefined(), GAnyLuaVM::snapshotFunction(L, combineIdx)};
+            GAnyLuaVM::makeGAnyToLuaObject(L, LuaParallel::reduce(array, func, combine, grain));
+            return 1;
+        }
+        error = "GAny._parallelReduce error: the arg1(array) requires a GAny array or table";
+    } catch (GAnyException &e) {
+        error = e.what();
+    }
+    lua_pushstring(L, error.c_str());
+    return lua_error(L);
+}
+
+bool GAnyToLua::toParallelArray(lua_State *L, int idx, GAny &array)
+{
+    if (GAnyLuaVM::isGAnyLuaObj(L, idx)) {
+        array = *glua_getcppobject(L, GAny, idx);
+    } else if (lua_istable(L, idx)) {
+        array = GAnyLuaVM::makeLuaObjectToGAny(L, idx).toObject();
+    }
+    return array.isArray();
+}
+
+GX_NS_END
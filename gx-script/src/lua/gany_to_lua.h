@@ -231,6 +231,12 @@ private:    /// ToLua
     static int regGAnyImport(lua_State *L);
 
     static int regGAnyExport(lua_State *L);
+
+    static int regGAnyParallelMap(lua_State *L);
+
+    static int regGAnyParallelReduce(lua_State *L);
+
+    static bool toParallelArray(lua_State *L, int idx, GAny &array);
 };
 
 GX_NS_END
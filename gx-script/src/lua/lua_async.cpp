@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_async.h"
+
+#include "lua_channel.h"
+#include "lua_future.h"
+
+#include <string.h>
+
+
+GX_NS_BEGIN
+
+void LuaAsync::toLua(lua_State *L)
+{
+    const luaL_Reg funcs[] = {
+            {"await",       await},
+            {"all",         all},
+            {"race",        race},
+            {"isFuture",    isFuture},
+            {"sleep",       sleep},
+            {"setTimeout",  setTimeout},
+            {"setInterval", setInterval},
+            {"clearTimer",  clearTimer},
+            {"waitFd",      waitFd},
+            {"recv",        recv},
+            {nullptr,       nullptr}
+    };
+    luaL_newlib(L, funcs);
+    lua_setglobal(L, "Async");
+}
+
+int LuaAsync::await(lua_State *L)
+{
+    luaL_checkany(L, 1);
+    lua_settop(L, 1);
+    if (!toFuture(L, 1)) {
+        // Awaiting a plain value gives the value
+        return 1;
+    }
+    return awaitFuture(L, 1, awaitContinue);
+}
+
+int LuaAsync::all(lua_State *L)
+{
+    bool valid;
+    {
+        std::vector<LuaFuture> futures;
+        valid = collectFutures(L, 1, futures);
+        if (valid) {
+            lua_settop(L, 1);
+            GAnyLuaVM::pushGAny(L, LuaFuture::all(futures));
+        }
+    }
+    if (!valid) {
+        return luaL_error(L, "Async.all error: the arg1 requires an array of futures");
+    }
+    return awaitFuture(L, 2, allContinue);
+}
+
+int LuaAsync::race(lua_State *L)
+{
+    bool valid;
+    {
+        std::vector<LuaFuture> futures;
+        valid = collectFutures(L, 1, futures) && !futures.empty();
+        if (valid) {
+            lua_settop(L, 1);
+            GAnyLuaVM::pushGAny(L, LuaFuture::race(futures));
+        }
+    }
+    if (!valid) {
+        return luaL_error(L, "Async.race error: the arg1 requires a non-empty array of futures");
+    }
+    return awaitFuture(L, 2, awaitContinue);
+}
+
+int LuaAsync::isFuture(lua_State *L)
+{
+    lua_pushboolean(L, toFuture(L, 1) != nullptr);
+    return 1;
+}
+
+int LuaAsync::sleep(lua_State *L)
+{
+    lua_Integer ms = luaL_checkinteger(L, 1);
+    lua_settop(L, 1);
+    {
+        LuaFuture future;
+        GAnyLuaVM::fromLuaState(L)->eventLoop().addTimer(ms, 0, [future]() mutable {
+            future.resolve();
+        });
+        GAnyLuaVM::pushGAny(L, future);
+    }
+    return awaitFuture(L, 2, awaitContinue);
+}
+
+int LuaAsync::setTimeout(lua_State *L)
+{
+    return addTimer(L, false);
+}
+
+int LuaAsync::setInterval(lua_State *L)
+{
+    return addTimer(L, true);
+}
+
+int LuaAsync::clearTimer(lua_State *L)
+{
+    auto id = (uint64_t) luaL_checkinteger(L, 1);
+    lua_pushboolean(L, GAnyLuaVM::fromLuaState(L)->eventLoop().cancelTimer(id));
+    return 1;
+}
+
+int LuaAsync::waitFd(lua_State *L)
+{
+    auto fd = (int) luaL_checkinteger(L, 1);
+    const char *mode = luaL_optstring(L, 2, "r");
+    uint32_t events = (strchr(mode, 'r') ? LuaEventLoop::FdRead : 0) | (strchr(mode, 'w') ? LuaEventLoop::FdWrite : 0);
+    if (events == 0) {
+        return luaL_error(L, "Async.waitFd error: the arg2(mode) requires \"r\", \"w\" or \"rw\"");
+    }
+    lua_settop(L, 2);
+
+    bool watched;
+    {
+        LuaFuture future;
+        LuaEventLoop &loop = GAnyLuaVM::fromLuaState(L)->eventLoop();
+        // One-shot, the ready events are the value of the future
+        watched = loop.watchFd(fd, events, [&loop, future](int readyFd, uint32_t ready) mutable {
+            loop.unwatchFd(readyFd);
+            std::string value;
+            if (ready & LuaEventLoop::FdRead) {
+                value += "r";
+            }
+            if (ready & LuaEventLoop::FdWrite) {
+                value += "w";
+            }
+            if (ready & LuaEventLoop::FdError) {
+                value += "e";
+            }
+            future.resolve(value);
+        });
+        if (watched) {
+            GAnyLuaVM::pushGAny(L, future);
+        }
+    }
+    if (!watched) {
+        return luaL_error(L, "Async.waitFd error: can not wait for the descriptor %d", fd);
+    }
+    return awaitFuture(L, 3, awaitContinue);
+}
+
+int LuaAsync::recv(lua_State *L)
+{
+    bool valid = false;
+    if (GAnyLuaVM::isGAnyLuaObj(L, 1)) {
+        GAny *obj = glua_getcppobject(L, GAny, 1);
+        if (obj && obj->is<LuaChannel>()) {
+            // Resolved with undefined (nil) when the channel is closed
+            LuaFuture future = obj->as<LuaChannel>().recvAsync();
+            lua_settop(L, 1);
+            GAnyLuaVM::pushGAny(L, future);
+            valid = true;
+        }
+    }
+    if (!valid) {
+        return luaL_error(L, "Async.recv error: the arg1 requires a LuaChannel");
+    }
+    return awaitFuture(L, 2, awaitContinue);
+}
+
+int LuaAsync::addTimer(lua_State *L, bool periodic)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    lua_Integer ms = luaL_checkinteger(L, 2);
+    lua_settop(L, 1);
+
+    // Capturing the raw VM is safe: the timers are owned by its event loop, which GAnyLuaVM::shutdown
+    // clears before closing the state, so neither the callback nor the deleter runs after the VM is gone
+    GAnyLuaVM *vm = GAnyLuaVM::fromLuaState(L);
+    uint64_t id;
+    {
+        // The function is released with the timer
+        std::shared_ptr<int> funcRef(new int(luaL_ref(L, LUA_REGISTRYINDEX)), [vm](int *ref) {
+            vm->releaseLuaRef(*ref);
+            delete ref;
+        });
+        id = vm->eventLoop().addTimer(ms, periodic ? ms : 0, [vm, funcRef]() {
+            vm->runCallbackRequest(*funcRef);
+        });
+    }
+    lua_pushinteger(L, (lua_Integer) id);
+    return 1;
+}
+
+const LuaFuture *LuaAsync::toFuture(lua_State *L, int idx)
+{
+    if (!GAnyLuaVM::isGAnyLuaObj(L, idx)) {
+        return nullptr;
+    }
+    GAny *obj = glua_getcppobject(L, GAny, idx);
+    if (!obj || !obj->is<LuaFuture>()) {
+        return nullptr;
+    }
+    return &obj->as<LuaFuture>();
+}
+
+bool LuaAsync::collectFutures(lua_State *L, int idx, std::vector<LuaFuture> &futures)
+{
+    if (!lua_istable(L, idx)) {
+        return false;
+    }
+    auto n = (lua_Integer) lua_rawlen(L, idx);
+    futures.reserve(n);
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_rawgeti(L, idx, i);
+        const LuaFuture *future = toFuture(L, -1);
+        if (future) {
+            futures.push_back(*future);
+        } else {
+            futures.push_back(LuaFuture::resolved(GAnyLuaVM::makeLuaObjectToGAny(L, lua_gettop(L))));
+        }
+        lua_pop(L, 1);
+    }
+    return true;
+}
+
+int LuaAsync::awaitFuture(lua_State *L, int idx, lua_KFunction k)
+{
+    // The future stays referenced by the stack slot while the coroutine is suspended
+    const LuaFuture *future = toFuture(L, idx);
+    if (!future->isDone()) {
+        GAnyLuaVM *vm = GAnyLuaVM::fromLuaState(L);
+        if (vm->suspendRequest(L, *future)) {
+            // Yielding from a C function unwinds it, no C++ object may be alive here
+            return lua_yieldk(L, 0, idx, k);
+        }
+        vm->waitFuture(*future);
+    }
+    return k(L, LUA_OK, idx);
+}
+
+int LuaAsync::awaitContinue(lua_State *L, int status, lua_KContext ctx)
+{
+    return pushResult(L, (int) ctx, false);
+}
+
+int LuaAsync::allContinue(lua_State *L, int status, lua_KContext ctx)
+{
+    return pushResult(L, (int) ctx, true);
+}
+
+int LuaAsync::pushResult(lua_State *L, int idx, bool asTable)
+{
+    const LuaFuture *future = toFuture(L, idx);
+    if (future->isRejected()) {
+        {
+            std::string error = future->error();
+            lua_pushlstring(L, error.data(), error.size());
+        }
+        return lua_error(L);
+    }
+
+    GAny value = future->value();
+    if (asTable && value.isArray()) {
+        auto n = (int32_t) value.size();
+        lua_createtable(L, n, 0);
+        for (int32_t i = 0; i < n; i++) {
+            GAnyLuaVM::makeGAnyToLuaObject(L, value[i]);
+            lua_rawseti(L, -2, i + 1);
+        }
+    } else {
+        GAnyLuaVM::makeGAnyToLuaObject(L, value);
+    }
+    return 1;
+}
+
+GX_NS_END
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_ASYNC_H
+#define GX_SCRIPT_LUA_ASYNC_H
+
+#include "gany_lua_vm.h"
+
+
+GX_NS_BEGIN
+
+class LuaFuture;
+
+/**
+ * @class LuaAsync
+ * @brief Register the Async table with Lua: await, all and race of LuaFuture,
+ *        sleep, timers and descriptor waits of the event loop of the virtual machine, receiving from a LuaChannel. <br>
+ *        In a request coroutine (see GAnyLuaVM::request) awaiting suspends the request
+ *        and it is resumed by GAnyLuaVM::runPending after the future is completed,
+ *        elsewhere awaiting runs the event loop of the virtual machine until the future is completed.
+ *        Timer functions run as requests, so they may await too.
+ */
+class LuaAsync
+{
+public:
+    static void toLua(lua_State *L);
+
+private:
+    static int await(lua_State *L);
+
+    static int all(lua_State *L);
+
+    static int race(lua_State *L);
+
+    static int isFuture(lua_State *L);
+
+    static int sleep(lua_State *L);
+
+    static int setTimeout(lua_State *L);
+
+    static int setInterval(lua_State *L);
+
+    static int clearTimer(lua_State *L);
+
+    static int waitFd(lua_State *L);
+
+    static int recv(lua_State *L);
+
+    static int addTimer(lua_State *L, bool periodic);
+
+    static const LuaFuture *toFuture(lua_State *L, int idx);
+
+    static bool collectFutures(lua_State *L, int idx, std::vector<LuaFuture> &futures);
+
+    static int awaitFuture(lua_State *L, int idx, lua_KFunction k);
+
+    static int awaitContinue(lua_State *L, int status, lua_KContext ctx);
+
+    static int allContinue(lua_State *L, int status, lua_KContext ctx);
+
+    static int pushResult(lua_State *L, int idx, bool asTable);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_ASYNC_H
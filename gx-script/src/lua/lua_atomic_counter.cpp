@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_atomic_counter.h"
+
+
+GX_NS_BEGIN
+
+LuaAtomicCounter::LuaAtomicCounter(int64_t value)
+        : mValue(std::make_shared<Cell>())
+{
+    mValue->value.store(value, std::memory_order_relaxed);
+}
+
+int64_t LuaAtomicCounter::get() const
+{
+    return mValue->value.load(std::memory_order_acquire);
+}
+
+void LuaAtomicCounter::set(int64_t value) const
+{
+    mValue->value.store(value, std::memory_order_release);
+}
+
+int64_t LuaAtomicCounter::add(int64_t delta) const
+{
+    return mValue->value.fetch_add(delta, std::memory_order_acq_rel) + delta;
+}
+
+int64_t LuaAtomicCounter::increment() const
+{
+    return add(1);
+}
+
+int64_t LuaAtomicCounter::decrement() const
+{
+    return add(-1);
+}
+
+int64_t LuaAtomicCounter::exchange(int64_t value) const
+{
+    return mValue->value.exchange(value, std::memory_order_acq_rel);
+}
+
+bool LuaAtomicCounter::compareAndSet(int64_t expected, int64_t desired) const
+{
+    return mValue->value.compare_exchange_strong(expected, desired, std::memory_order_acq_rel);
+}
+
+GX_NS_END
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_ATOMIC_COUNTER_H
+#define GX_SCRIPT_LUA_ATOMIC_COUNTER_H
+
+#include <gx/gobject.h>
+
+#include <atomic>
+#include <memory>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaAtomicCounter
+ * @brief Lock-free 64-bit counter shared between threads and virtual machines, copies share the same counter
+ */
+class LuaAtomicCounter
+{
+public:
+    explicit LuaAtomicCounter(int64_t value = 0);
+
+    LuaAtomicCounter(const LuaAtomicCounter &b) = default;
+
+    LuaAtomicCounter(LuaAtomicCounter &&b) noexcept = default;
+
+    LuaAtomicCounter &operator=(const LuaAtomicCounter &b) = default;
+
+    LuaAtomicCounter &operator=(LuaAtomicCounter &&b) noexcept = default;
+
+public:
+    int64_t get() const;
+
+    void set(int64_t value) const;
+
+    /**
+     * @brief Add to the counter
+     * @param delta
+     * @return The new value
+     */
+    int64_t add(int64_t delta) const;
+
+    int64_t increment() const;
+
+    int64_t decrement() const;
+
+    /**
+     * @brief Replace the value
+     * @param value
+     * @return The previous value
+     */
+    int64_t exchange(int64_t value) const;
+
+    /**
+     * @brief Replace the value only if it equals expected
+     * @param expected
+     * @param desired
+     * @return false if the value was not expected
+     */
+    bool compareAndSet(int64_t expected, int64_t desired) const;
+
+    bool operator==(const LuaAtomicCounter &rhs) const
+    {
+        return mValue == rhs.mValue;
+    }
+
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<int64_t> value;
+    };
+
+    std::shared_ptr<Cell> mValue;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_ATOMIC_COUNTER_H
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_byte_view.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+LuaByteView::LuaByteView() = default;
+
+LuaByteView::LuaByteView(size_t size)
+{
+    auto memory = std::make_shared<std::vector<uint8_t>>(size);
+    mData = memory->data();
+    mSize = size;
+    mOwner = std::move(memory);
+}
+
+LuaByteView LuaByteView::wrap(const GAny &byteArray)
+{
+    if (!byteArray.is<GByteArray>()) {
+        return {};
+    }
+    auto holder = std::make_shared<GAny>(byteArray);
+    LuaByteView view;
+    view.mByteArray = &holder->as<GByteArray>();
+    view.mSize = std::numeric_limits<size_t>::max();
+    view.mOwner = std::move(holder);
+    return view;
+}
+
+LuaByteView LuaByteView::wrap(void *data, size_t size, std::shared_ptr<void> owner)
+{
+    LuaByteView view;
+    view.mData = static_cast<uint8_t *>(data);
+    view.mSize = data ? size : 0;
+    view.mOwner = std::move(owner);
+    return view;
+}
+
+bool LuaByteView::isNativeBigEndian()
+{
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+    return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+#else
+    const uint16_t v = 1;
+    return *reinterpret_cast<const uint8_t *>(&v) == 0;
+#endif
+}
+
+uint8_t *LuaByteView::data() const
+{
+    if (mByteArray) {
+        return mOffset < (size_t) mByteArray->size() ? mByteArray->data() + mOffset : nullptr;
+    }
+    return mData;
+}
+
+size_t LuaByteView::size() const
+{
+    if (mByteArray) {
+        auto size = (size_t) mByteArray->size();
+        return mOffset < size ? std::min(mSize, size - mOffset) : 0;
+    }
+    return mSize;
+}
+
+bool LuaByteView::wrapsByteArray() const
+{
+    return mByteArray != nullptr;
+}
+
+LuaByteView LuaByteView::slice(size_t offset, size_t size) const
+{
+    if (!inRange(offset, size)) {
+        return {};
+    }
+    if (mByteArray) {
+        LuaByteView view = *this;
+        view.mOffset = mOffset + offset;
+        view.mSize = size;
+        return view;
+    }
+    return wrap(mData + offset, size, mOwner);
+}
+
+bool LuaByteView::readUInt(size_t offset, size_t size, bool bigEndian, uint64_t &value) const
+{
+    if (size == 0 || size > 8 || !inRange(offset, size)) {
+        return false;
+    }
+    // Assembled byte by byte, independent of the native byte order
+    const uint8_t *p = data() + offset;
+    uint64_t v = 0;
+    if (bigEndian) {
+        for (size_t i = 0; i < size; i++) {
+            v = (v << 8) | p[i];
+        }
+    } else {
+        for (size_t i = size; i > 0; i--) {
+            v = (v << 8) | p[i - 1];
+        }
+    }
+    value = v;
+    return true;
+}
+
+bool LuaByteView::readInt(size_t offset, size_t size, bool bigEndian, int64_t &value) const
+{
+    uint64_t v;
+    if (!readUInt(offset, size, bigEndian, v)) {
+        return false;
+    }
+    if (size < 8) {
+        const uint64_t sign = (uint64_t) 1 << (size * 8 - 1);
+        v = (v ^ sign) - sign;
+    }
+    value = (int64_t) v;
+    return true;
+}
+
+bool LuaByteView::readFloat(size_t offset, bool bigEndian, float &value) const
+{
+    uint64_t v;
+    if (!readUInt(offset, sizeof(float), bigEndian, v)) {
+        return false;
+    }
+    auto bits = (uint32_t) v;
+    memcpy(&value, &bits, sizeof(float));
+    return true;
+}
+
+bool LuaByteView::readDouble(size_t offset, bool bigEndian, double &value) const
+{
+    uint64_t v;
+    if (!readUInt(offset, sizeof(double), bigEndian, v)) {
+        return false;
+    }
+    memcpy(&value, &v, sizeof(double));
+    return true;
+}
+
+bool LuaByteView::writeUInt(size_t offset, size_t size, uint64_t value, bool bigEndian) const
+{
+    if (size == 0 || size > 8 || !inRange(offset, size)) {
+        return false;
+    }
+    uint8_t *p = data() + offset;
+    for (size_t i = 0; i < size; i++) {
+        p[bigEndian ? size - 1 - i : i] = (uint8_t) (value & 0xff);
+        value >>= 8;
+    }
+    return true;
+}
+
+bool LuaByteView::writeFloat(size_t offset, float value, bool bigEndian) const
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+    return writeUInt(offset, sizeof(float), bits, bigEndian);
+}
+
+bool LuaByteView::writeDouble(size_t offset, double value, bool bigEndian) const
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    return writeUInt(offset, sizeof(double), bits, bigEndian);
+}
+
+bool LuaByteView::write(size_t offset, const void *data, size_t size) const
+{
+    if (!inRange(offset, size)) {
+        return false;
+    }
+    if (size > 0) {
+        memcpy(this->data() + offset, data, size);
+    }
+    return true;
+}
+
+void LuaByteView::fill(uint8_t value) const
+{
+    size_t size = this->size();
+    if (size > 0) {
+        memset(data(), value, size);
+    }
+}
+
+GByteArray LuaByteView::toByteArray() const
+{
+    GByteArray buffer;
+    size_t size = this->size();
+    if (size > 0) {
+        buffer.write(data(), size);
+    }
+    return buffer;
+}
+
+std::string LuaByteView::toString() const
+{
+    return "LuaByteView(" + std::to_string(size()) + ")";
+}
+
+GX_NS_END
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_BYTE_VIEW_H
+#define GX_SCRIPT_LUA_BYTE_VIEW_H
+
+#include <gx/gobject.h>
+
+#include <gx/gany.h>
+#include <gx/gbytearray.h>
+
+#include <memory>
+#include <string>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaByteView
+ * @brief View of a range of bytes, wrapping a GByteArray or external memory without copying, or owning its memory. <br>
+ *        Reads and writes integers and floating point numbers of any endianness at byte offsets,
+ *        copies and slices share the same memory. Lua accesses it through a userdata with 0-based offsets,
+ *        including a string.unpack compatible bulk read. <br>
+ *        The memory of a wrapped GByteArray is looked up on every access, so the array may be written
+ *        or resized while it is wrapped, the size follows its size.
+ */
+class LuaByteView
+{
+public:
+    LuaByteView();
+
+    /**
+     * @brief Create a view owning zeroed memory
+     * @param size
+     */
+    explicit LuaByteView(size_t size);
+
+    /**
+     * @brief Wrap the memory of a GByteArray held by a GAny, the GAny is kept alive by the view.
+     *        The size is the size of the array at the time of each access
+     * @param byteArray GAny of GByteArray
+     * @return An empty view if byteArray is not a GByteArray
+     */
+    static LuaByteView wrap(const GAny &byteArray);
+
+    /**
+     * @brief Wrap external memory
+     * @param data
+     * @param size
+     * @param owner Keeps the memory alive
+     * @return
+     */
+    static LuaByteView wrap(void *data, size_t size, std::shared_ptr<void> owner);
+
+    static bool isNativeBigEndian();
+
+public:
+    /**
+     * @brief Current memory of the view, only valid until a wrapped GByteArray is changed
+     * @return
+     */
+    uint8_t *data() const;
+
+    size_t size() const;
+
+    bool wrapsByteArray() const;
+
+    /**
+     * @brief Create a view of a range sharing the memory
+     * @param offset
+     * @param size
+     * @return An empty view if out of range
+     */
+    LuaByteView slice(size_t offset, size_t size) const;
+
+    /**
+     * @brief Read an unsigned integer
+     * @param offset
+     * @param size      1 to 8 bytes
+     * @param bigEndian
+     * @param value
+     * @return false if out of range
+     */
+    bool readUInt(size_t offset, size_t size, bool bigEndian, uint64_t &value) const;
+
+    /**
+     * @brief Read a signed integer, sign-extended from size bytes
+     * @param offset
+     * @param size      1 to 8 bytes
+     * @param bigEndian
+     * @param value
+     * @return false if out of range
+     */
+    bool readInt(size_t offset, size_t size, bool bigEndian, int64_t &value) const;
+
+    bool readFloat(size_t offset, bool bigEndian, float &value) const;
+
+    bool readDouble(size_t offset, bool bigEndian, double &value) const;
+
+    /**
+     * @brief Write the low size bytes of an integer
+     * @param offset
+     * @param size      1 to 8 bytes
+     * @param value
+     * @param bigEndian
+     * @return false if out of range
+     */
+    bool writeUInt(size_t offset, size_t size, uint64_t value, bool bigEndian) const;
+
+    bool writeFloat(size_t offset, float value, bool bigEndian) const;
+
+    bool writeDouble(size_t offset, double value, bool bigEndian) const;
+
+    /**
+     * @brief Copy bytes into the view
+     * @param offset
+     * @param data
+     * @param size
+     * @return false if out of range
+     */
+    bool write(size_t offset, const void *data, size_t size) const;
+
+    void fill(uint8_t value) const;
+
+    /**
+     * @brief Copy to a new GByteArray
+     * @return
+     */
+    GByteArray toByteArray() const;
+
+    std::string toString() const;
+
+    bool operator==(const LuaByteView &rhs) const
+    {
+        return mData == rhs.mData && mByteArray == rhs.mByteArray && mOffset == rhs.mOffset && mSize == rhs.mSize;
+    }
+
+private:
+    bool inRange(size_t offset, size_t size) const
+    {
+        size_t total = this->size();
+        return offset <= total && size <= total - offset;
+    }
+
+private:
+    uint8_t *mData = nullptr;
+    /// Requested size, a wrapped GByteArray limits it to its current size
+    size_t mSize = 0;
+    /// Set when wrapping a GByteArray, then the memory starts at mOffset bytes into it instead of mData
+    GByteArray *mByteArray = nullptr;
+    size_t mOffset = 0;
+    std::shared_ptr<void> mOwner;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_BYTE_VIEW_H
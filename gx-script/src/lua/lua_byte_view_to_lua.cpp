@@ -0,0 +1,573 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_byte_view_to_lua.h"
+
+#include <cstring>
+
+
+GX_NS_BEGIN
+
+#define BYTE_VIEW_META "LuaByteView"
+
+/// Default of the '!' option of the pack format, the same as the bundled Lua library
+#define PACK_MAX_ALIGN 8
+
+/**
+ * @brief Userdata of a view. Starts with a GAny pointer like the other userdata,
+ *        the GAny is only created when the view is converted back to GAny
+ */
+struct LuaByteViewToLua::Proxy
+{
+    GAny *self = nullptr;
+    GAny object;
+    LuaByteView view;
+};
+
+enum class NumberKind
+{
+    Unsigned,
+    Signed,
+    Float,
+};
+
+struct NumberAccessor
+{
+    const char *read;
+    const char *write;
+    size_t size;
+    NumberKind kind;
+};
+
+static const NumberAccessor sNumberAccessors[] = {
+        {"u8",  "setU8",  1, NumberKind::Unsigned},
+        {"i8",  "setI8",  1, NumberKind::Signed},
+        {"u16", "setU16", 2, NumberKind::Unsigned},
+        {"i16", "setI16", 2, NumberKind::Signed},
+        {"u32", "setU32", 4, NumberKind::Unsigned},
+        {"i32", "setI32", 4, NumberKind::Signed},
+        {"i64", "setI64", 8, NumberKind::Signed},
+        {"f32", "setF32", 4, NumberKind::Float},
+        {"f64", "setF64", 8, NumberKind::Float},
+};
+
+void LuaByteViewToLua::toLua(lua_State *L)
+{
+    const luaL_Reg methods[] = {
+            {"slice",     regSlice},
+            {"string",    regString},
+            {"setString", regSetString},
+            {"fill",      regFill},
+            {"unpack",    regUnpack},
+            {nullptr,     nullptr}
+    };
+
+    const luaL_Reg metaMethods[] = {
+            {"__gc",       regGC},
+            {"__newindex", regNewIndex},
+            {"__len",      regLen},
+            {"__tostring", regToString},
+            {nullptr,      nullptr}
+    };
+
+    luaL_newmetatable(L, BYTE_VIEW_META);
+    int top = lua_gettop(L);
+
+    lua_pushliteral(L, "_name");
+    lua_pushstring(L, BYTE_VIEW_META);
+    lua_settable(L, top);
+
+    const luaL_Reg *f;
+    for (f = metaMethods; f->func; f++) {
+        lua_pushstring(L, f->name);
+        lua_pushcfunction(L, f->func);
+        lua_settable(L, top);
+    }
+
+    // __index reads bytes, other keys are looked up in the methods table (upvalue)
+    lua_pushliteral(L, "__index");
+    luaL_newlib(L, methods);
+    // The typed accessors share one function, the size and the kind are upvalues
+    for (const auto &accessor: sNumberAccessors) {
+        lua_pushinteger(L, (lua_Integer) accessor.size);
+        lua_pushinteger(L, (lua_Integer) accessor.kind);
+        lua_pushcclosure(L, regRead, 2);
+        lua_setfield(L, -2, accessor.read);
+
+        lua_pushinteger(L, (lua_Integer) accessor.size);
+        lua_pushinteger(L, (lua_Integer) accessor.kind);
+        lua_pushcclosure(L, regWrite, 2);
+        lua_setfield(L, -2, accessor.write);
+    }
+    lua_pushcclosure(L, regIndex, 1);
+    lua_settable(L, top);
+
+    lua_pop(L, 1);
+}
+
+void LuaByteViewToLua::pushView(lua_State *L, const LuaByteView &view)
+{
+    auto *proxy = new(lua_newuserdatauv(L, sizeof(Proxy), 0)) Proxy();
+    proxy->self = &proxy->object;
+    proxy->view = view;
+    luaL_getmetatable(L, BYTE_VIEW_META);
+    lua_setmetatable(L, -2);
+}
+
+bool LuaByteViewToLua::isProxy(lua_State *L, int idx)
+{
+    return luaL_testudata(L, idx, BYTE_VIEW_META) != nullptr;
+}
+
+GAny LuaByteViewToLua::toGAny(lua_State *L, int idx)
+{
+    auto *proxy = (Proxy *) luaL_testudata(L, idx, BYTE_VIEW_META);
+    if (!proxy) {
+        return GAny::undefined();
+    }
+    if (proxy->object.isUndefined()) {
+        proxy->object = proxy->view;
+    }
+    return proxy->object;
+}
+
+const uint8_t *LuaByteViewToLua::toBytes(lua_State *L, int idx, size_t &size)
+{
+    auto *proxy = (Proxy *) luaL_testudata(L, idx, BYTE_VIEW_META);
+    if (!proxy) {
+        size = 0;
+        return nullptr;
+    }
+    size = proxy->view.size();
+    return proxy->view.data();
+}
+
+LuaByteViewToLua::Proxy *LuaByteViewToLua::checkProxy(lua_State *L, int idx)
+{
+    return (Proxy *) luaL_checkudata(L, idx, BYTE_VIEW_META);
+}
+
+size_t LuaByteViewToLua::checkRange(lua_State *L, Proxy *proxy, int offsetIdx, size_t size)
+{
+    lua_Integer offset = luaL_checkinteger(L, offsetIdx);
+    // Looked up on every access, a wrapped GByteArray may have been resized
+    size_t total = proxy->view.size();
+    if (offset < 0 || (size_t) offset > total || size > total - (size_t) offset) {
+        luaL_error(L, "LuaByteView error: %I bytes at offset %I out of range [0, %I)",
+                   (lua_Integer) size, offset, (lua_Integer) total);
+    }
+    return (size_t) offset;
+}
+
+int LuaByteViewToLua::regGC(lua_State *L)
+{
+    checkProxy(L, 1)->~Proxy();
+    return 0;
+}
+
+int LuaByteViewToLua::regIndex(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    if (lua_isinteger(L, 2)) {
+        lua_Integer i = lua_tointeger(L, 2);
+        if (i < 0 || (size_t) i >= proxy->view.size()) {
+            lua_pushnil(L);
+        } else {
+            lua_pushinteger(L, proxy->view.data()[i]);
+        }
+        return 1;
+    }
+    lua_pushvalue(L, 2);
+    lua_gettable(L, lua_upvalueindex(1));
+    return 1;
+}
+
+int LuaByteViewToLua::regNewIndex(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    size_t offset = checkRange(L, proxy, 2, 1);
+    proxy->view.data()[offset] = (uint8_t) luaL_checkinteger(L, 3);
+    return 0;
+}
+
+int LuaByteViewToLua::regLen(lua_State *L)
+{
+    lua_pushinteger(L, (lua_Integer) checkProxy(L, 1)->view.size());
+    return 1;
+}
+
+int LuaByteViewToLua::regToString(lua_State *L)
+{
+    lua_pushfstring(L, "LuaByteView(%I)", (lua_Integer) checkProxy(L, 1)->view.size());
+    return 1;
+}
+
+int LuaByteViewToLua::regRead(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    auto size = (size_t) lua_tointeger(L, lua_upvalueindex(1));
+    auto kind = (NumberKind) lua_tointeger(L, lua_upvalueindex(2));
+    size_t offset = checkRange(L, proxy, 2, size);
+    bool bigEndian = lua_toboolean(L, 3);
+
+    switch (kind) {
+        case NumberKind::Unsigned: {
+            uint64_t value = 0;
+            proxy->view.readUInt(offset, size, bigEndian, value);
+            lua_pushinteger(L, (lua_Integer) value);
+            break;
+        }
+        case NumberKind::Signed: {
+            int64_t value = 0;
+            proxy->view.readInt(offset, size, bigEndian, value);
+            lua_pushinteger(L, (lua_Integer) value);
+            break;
+        }
+        case NumberKind::Float:
+            if (size == sizeof(float)) {
+                float value = 0;
+                proxy->view.readFloat(offset, bigEndian, value);
+                lua_pushnumber(L, value);
+            } else {
+                double value = 0;
+                proxy->view.readDouble(offset, bigEndian, value);
+                lua_pushnumber(L, value);
+            }
+            break;
+    }
+    return 1;
+}
+
+int LuaByteViewToLua::regWrite(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    auto size = (size_t) lua_tointeger(L, lua_upvalueindex(1));
+    auto kind = (NumberKind) lua_tointeger(L, lua_upvalueindex(2));
+    size_t offset = checkRange(L, proxy, 2, size);
+    bool bigEndian = lua_toboolean(L, 4);
+
+    if (kind == NumberKind::Float) {
+        lua_Number value = luaL_checknumber(L, 3);
+        if (size == sizeof(float)) {
+            proxy->view.writeFloat(offset, (float) value, bigEndian);
+        } else {
+            proxy->view.writeDouble(offset, value, bigEndian);
+        }
+    } else {
+        proxy->view.writeUInt(offset, size, (uint64_t) luaL_checkinteger(L, 3), bigEndian);
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+int LuaByteViewToLua::regSlice(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    size_t total = proxy->view.size();
+    lua_Integer size = luaL_optinteger(L, 3, (lua_Integer) total - offset);
+    if (offset < 0 || size < 0 || (size_t) offset > total || (size_t) size > total - offset) {
+        return luaL_error(L, "LuaByteView.slice error: range out of bounds");
+    }
+    pushView(L, proxy->view.slice((size_t) offset, (size_t) size));
+    return 1;
+}
+
+int LuaByteViewToLua::regString(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_Integer offset = luaL_optinteger(L, 2, 0);
+    size_t total = proxy->view.size();
+    lua_Integer size = luaL_optinteger(L, 3, (lua_Integer) total - offset);
+    if (offset < 0 || size < 0 || (size_t) offset > total || (size_t) size > total - offset) {
+        return luaL_error(L, "LuaByteView.string error: range out of bounds");
+    }
+    lua_pushlstring(L, reinterpret_cast<const char *>(proxy->view.data() + offset), (size_t) size);
+    return 1;
+}
+
+int LuaByteViewToLua::regSetString(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    size_t len;
+    const char *str = luaL_checklstring(L, 3, &len);
+    size_t offset = checkRange(L, proxy, 2, len);
+    proxy->view.write(offset, str, len);
+    lua_settop(L, 1);
+    return 1;
+}
+
+int LuaByteViewToLua::regFill(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    proxy->view.fill((uint8_t) luaL_checkinteger(L, 2));
+    lua_settop(L, 1);
+    return 1;
+}
+
+// Format of string.unpack, parsed the same way as lstrlib.c
+
+enum class PackOption
+{
+    Int,
+    UInt,
+    Float,
+    Double,
+    Char,
+    String,
+    Zstr,
+    Padding,
+    PaddAlign,
+    Nop,
+};
+
+struct PackHeader
+{
+    bool bigEndian;
+    size_t maxAlign;
+};
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static size_t getNum(const char **fmt, size_t df)
+{
+    if (!isDigit(**fmt)) {
+        return df;
+    }
+    size_t a = 0;
+    do {
+        a = a * 10 + (size_t) (*((*fmt)++) - '0');
+    } while (isDigit(**fmt) && a <= ((size_t) INT32_MAX - 9) / 10);
+    return a;
+}
+
+static size_t getNumLimit(lua_State *L, const char **fmt, size_t df)
+{
+    size_t size = getNum(fmt, df);
+    if (size > 16 || size == 0) {
+        luaL_error(L, "integral size (%d) out of limits [1,16]", (int) size);
+    }
+    return size;
+}
+
+static PackOption getOption(lua_State *L, PackHeader &h, const char **fmt, size_t &size)
+{
+    char opt = *((*fmt)++);
+    size = 0;
+    switch (opt) {
+        case 'b':
+            size = 1;
+            return PackOption::Int;
+        case 'B':
+            size = 1;
+            return PackOption::UInt;
+        case 'h':
+            size = sizeof(short);
+            return PackOption::Int;
+        case 'H':
+            size = sizeof(short);
+            return PackOption::UInt;
+        case 'l':
+            size = sizeof(long);
+            return PackOption::Int;
+        case 'L':
+            size = sizeof(long);
+            return PackOption::UInt;
+        case 'j':
+            size = sizeof(lua_Integer);
+            return PackOption::Int;
+        case 'J':
+            size = sizeof(lua_Integer);
+            return PackOption::UInt;
+        case 'T':
+            size = sizeof(size_t);
+            return PackOption::UInt;
+        case 'f':
+            size = sizeof(float);
+            return PackOption::Float;
+        case 'n':
+            size = sizeof(lua_Number);
+            return PackOption::Double;
+        case 'd':
+            size = sizeof(double);
+            return PackOption::Double;
+        case 'i':
+            size = getNumLimit(L, fmt, sizeof(int));
+            return PackOption::Int;
+        case 'I':
+            size = getNumLimit(L, fmt, sizeof(int));
+            return PackOption::UInt;
+        case 's':
+            size = getNumLimit(L, fmt, sizeof(size_t));
+            return PackOption::String;
+        case 'c':
+            size = getNum(fmt, (size_t) -1);
+            if (size == (size_t) -1) {
+                luaL_error(L, "missing size for format option 'c'");
+            }
+            return PackOption::Char;
+        case 'z':
+            return PackOption::Zstr;
+        case 'x':
+            size = 1;
+            return PackOption::Padding;
+        case 'X':
+            return PackOption::PaddAlign;
+        case ' ':
+            break;
+        case '<':
+            h.bigEndian = false;
+            break;
+        case '>':
+            h.bigEndian = true;
+            break;
+        case '=':
+            h.bigEndian = LuaByteView::isNativeBigEndian();
+            break;
+        case '!':
+            h.maxAlign = getNumLimit(L, fmt, PACK_MAX_ALIGN);
+            break;
+        default:
+            luaL_error(L, "invalid format option '%c'", opt);
+    }
+    return PackOption::Nop;
+}
+
+static PackOption getDetails(lua_State *L, PackHeader &h, size_t totalSize, const char **fmt,
+                             size_t &size, size_t &toAlign)
+{
+    PackOption opt = getOption(L, h, fmt, size);
+    size_t align = size;
+    if (opt == PackOption::PaddAlign) {
+        if (**fmt == '\0' || getOption(L, h, fmt, align) == PackOption::Char || align == 0) {
+            luaL_argerror(L, 2, "invalid next option for option 'X'");
+        }
+    }
+    if (align <= 1 || opt == PackOption::Char) {
+        toAlign = 0;
+    } else {
+        if (align > h.maxAlign) {
+            align = h.maxAlign;
+        }
+        if ((align & (align - 1)) != 0) {
+            luaL_argerror(L, 2, "format asks for alignment not power of 2");
+        }
+        toAlign = (align - (totalSize & (align - 1))) & (align - 1);
+    }
+    return opt;
+}
+
+static lua_Integer unpackInt(lua_State *L, const uint8_t *p, bool bigEndian, size_t size, bool isSigned)
+{
+    uint64_t res = 0;
+    size_t limit = size <= 8 ? size : 8;
+    for (size_t i = limit; i-- > 0;) {
+        res <<= 8;
+        res |= p[bigEndian ? size - 1 - i : i];
+    }
+    if (size < 8) {
+        if (isSigned) {
+            const uint64_t sign = (uint64_t) 1 << (size * 8 - 1);
+            res = (res ^ sign) - sign;
+        }
+    } else if (size > 8) {
+        // The extra bytes must be the sign extension
+        uint8_t mask = (!isSigned || (int64_t) res >= 0) ? 0 : 0xff;
+        for (size_t i = limit; i < size; i++) {
+            if (p[bigEndian ? size - 1 - i : i] != mask) {
+                luaL_error(L, "%d-byte integer does not fit into Lua Integer", (int) size);
+            }
+        }
+    }
+    return (lua_Integer) res;
+}
+
+int LuaByteViewToLua::regUnpack(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    const char *fmt = luaL_checkstring(L, 2);
+    lua_Integer init = luaL_optinteger(L, 3, 0);
+    luaL_argcheck(L, init >= 0 && (size_t) init <= proxy->view.size(), 3, "initial position out of view");
+
+    const uint8_t *data = proxy->view.data();
+    size_t ld = proxy->view.size();
+    size_t pos = (size_t) init;
+    PackHeader h{LuaByteView::isNativeBigEndian(), 1};
+    int n = 0;
+    while (*fmt != '\0') {
+        size_t size, toAlign;
+        PackOption opt = getDetails(L, h, pos, &fmt, size, toAlign);
+        luaL_argcheck(L, toAlign + size <= ld - pos, 2, "data string too short");
+        pos += toAlign;
+        luaL_checkstack(L, 2, "too many results");
+        n++;
+        switch (opt) {
+            case PackOption::Int:
+            case PackOption::UInt:
+                lua_pushinteger(L, unpackInt(L, data + pos, h.bigEndian, size, opt == PackOption::Int));
+                break;
+            case PackOption::Float: {
+                float f;
+                proxy->view.readFloat(pos, h.bigEndian, f);
+                lua_pushnumber(L, f);
+                break;
+            }
+            case PackOption::Double: {
+                double d;
+                proxy->view.readDouble(pos, h.bigEndian, d);
+                lua_pushnumber(L, d);
+                break;
+            }
+            case PackOption::Char:
+                lua_pushlstring(L, reinterpret_cast<const char *>(data + pos), size);
+                break;
+            case PackOption::String: {
+                auto len = (size_t) unpackInt(L, data + pos, h.bigEndian, size, false);
+                luaL_argcheck(L, len <= ld - pos - size, 2, "data string too short");
+                lua_pushlstring(L, reinterpret_cast<const char *>(data + pos + size), len);
+                pos += len;
+                break;
+            }
+            case PackOption::Zstr: {
+                const void *end = pos < ld ? memchr(data + pos, 0, ld - pos) : nullptr;
+                luaL_argcheck(L, end != nullptr, 2, "unfinished string for format 'z'");
+                size_t len = static_cast<const uint8_t *>(end) - (data + pos);
+                lua_pushlstring(L, reinterpret_cast<const char *>(data + pos), len);
+                pos += len + 1;
+                break;
+            }
+            case PackOption::PaddAlign:
+            case PackOption::Padding:
+            case PackOption::Nop:
+                n--;
+                break;
+        }
+        pos += size;
+    }
+    lua_pushinteger(L, (lua_Integer) pos);
+    return n + 1;
+}
+
+GX_NS_END
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_BYTE_VIEW_TO_LUA_H
+#define GX_SCRIPT_LUA_BYTE_VIEW_TO_LUA_H
+
+#include "lua_byte_view.h"
+
+#include <lua.hpp>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaByteViewToLua
+ * @brief Bind LuaByteView to Lua as a userdata. <br>
+ *        view[i] reads and writes bytes in place (0-based, nil out of range), #view is the size. <br>
+ *        view:u8/i8/u16/i16/u32/i32/i64/f32/f64(offset, bigEndian) read a number at a byte offset,
+ *        view:setU8/.../setF64(offset, value, bigEndian) write one, little-endian unless bigEndian is true. <br>
+ *        view:unpack(fmt, offset) reads like string.unpack with the same format, returning the values
+ *        and the 0-based offset after them. Other methods: slice, string, setString and fill.
+ */
+class LuaByteViewToLua
+{
+public:
+    static void toLua(lua_State *L);
+
+    static void pushView(lua_State *L, const LuaByteView &view);
+
+    static bool isProxy(lua_State *L, int idx);
+
+    /**
+     * @brief Convert a proxy to a GAny of LuaByteView
+     * @param L
+     * @param idx
+     * @return
+     */
+    static GAny toGAny(lua_State *L, int idx);
+
+    /**
+     * @brief Memory of a proxy, valid while the proxy is alive
+     * @param L
+     * @param idx
+     * @param size  Receives the size
+     * @return nullptr if not a proxy
+     */
+    static const uint8_t *toBytes(lua_State *L, int idx, size_t &size);
+
+private:
+    struct Proxy;
+
+    static Proxy *checkProxy(lua_State *L, int idx);
+
+    static size_t checkRange(lua_State *L, Proxy *proxy, int offsetIdx, size_t size);
+
+private:
+    static int regGC(lua_State *L);
+
+    static int regIndex(lua_State *L);
+
+    static int regNewIndex(lua_State *L);
+
+    static int regLen(lua_State *L);
+
+    static int regToString(lua_State *L);
+
+    static int regRead(lua_State *L);
+
+    static int regWrite(lua_State *L);
+
+    static int regSlice(lua_State *L);
+
+    static int regString(lua_State *L);
+
+    static int regSetString(lua_State *L);
+
+    static int regFill(lua_State *L);
+
+    static int regUnpack(lua_State *L);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_BYTE_VIEW_TO_LUA_H
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_channel.h"
+
+#include <chrono>
+
+
+GX_NS_BEGIN
+
+LuaChannel::SharedState::SharedState(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    buffer.reset(new Cell[size]);
+    mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool LuaChannel::SharedState::push(GAny &value)
+{
+    Cell *cell;
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        cell = &buffer[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        auto diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full
+            return false;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool LuaChannel::SharedState::pop(GAny &value)
+{
+    Cell *cell;
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        cell = &buffer[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        auto diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Empty
+            return false;
+        } else {
+            pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+    value = std::move(cell->value);
+    cell->value = GAny();
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+}
+
+void LuaChannel::SharedState::notifyReceivers()
+{
+    // Pairs with the fence of a receiver that registers before checking the buffer again
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (recvWaiting.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    std::vector<std::pair<LuaFuture, GAny>> ready;
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        while (!recvFutures.empty()) {
+            GAny value;
+            if (!pop(value)) {
+                break;
+            }
+            ready.emplace_back(std::move(recvFutures.front()), std::move(value));
+            recvFutures.pop_front();
+            recvWaiting.fetch_sub(1, std::memory_order_relaxed);
+        }
+        notEmpty.notify_one();
+    }
+    // Resolved outside the lock, the callbacks may post to other threads
+    for (auto &item: ready) {
+        item.first.resolve(item.second);
+    }
+    if (!ready.empty()) {
+        notifySenders();
+    }
+}
+
+void LuaChannel::SharedState::notifySenders()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sendWaiting.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(lock);
+    notFull.notify_one();
+}
+
+LuaChannel::LuaChannel(size_t capacity)
+        : mState(std::make_shared<SharedState>(capacity))
+{
+}
+
+bool LuaChannel::send(GAny value, int32_t timeoutMs) const
+{
+    if (value.isUndefined() || mState->closed.load(std::memory_order_acquire)) {
+        return false;
+    }
+    // The value is only moved out when pushed
+    if (mState->push(value)) {
+        mState->notifyReceivers();
+        return true;
+    }
+    if (timeoutMs == 0) {
+        return false;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    bool sent = false;
+    {
+        std::unique_lock<std::mutex> locker(mState->lock);
+        mState->sendWaiting.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!mState->closed.load(std::memory_order_acquire)) {
+            if (mState->push(value)) {
+                sent = true;
+                break;
+            }
+            if (timeoutMs < 0) {
+                mState->notFull.wait(locker);
+            } else if (mState->notFull.wait_until(locker, deadline) == std::cv_status::timeout) {
+                sent = mState->push(value);
+                break;
+            }
+        }
+        mState->sendWaiting.fetch_sub(1);
+    }
+    if (sent) {
+        mState->notifyReceivers();
+    }
+    return sent;
+}
+
+bool LuaChannel::trySend(GAny value) const
+{
+    if (value.isUndefined() || mState->closed.load(std::memory_order_acquire)) {
+        return false;
+    }
+    if (!mState->push(value)) {
+        return false;
+    }
+    mState->notifyReceivers();
+    return true;
+}
+
+bool LuaChannel::recv(GAny &value, int32_t timeoutMs) const
+{
+    if (tryRecv(value)) {
+        return true;
+    }
+    if (timeoutMs == 0) {
+        return false;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    bool received = false;
+    {
+        std::unique_lock<std::mutex> locker(mState->lock);
+        mState->recvWaiting.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (;;) {
+            if (mState->pop(value)) {
+                received = true;
+                break;
+            }
+            if (mState->closed.load(std::memory_order_acquire)) {
+                break;
+            }
+            if (timeoutMs < 0) {
+                mState->notEmpty.wait(locker);
+            } else if (mState->notEmpty.wait_until(locker, deadline) == std::cv_status::timeout) {
+                received = mState->pop(value);
+                break;
+            }
+        }
+        mState->recvWaiting.fetch_sub(1);
+    }
+    if (received) {
+        mState->notifySenders();
+    }
+    return received;
+}
+
+bool LuaChannel::tryRecv(GAny &value) const
+{
+    if (!mState->pop(value)) {
+        return false;
+    }
+    mState->notifySenders();
+    return true;
+}
+
+LuaFuture LuaChannel::recvAsync() const
+{
+    GAny value;
+    if (tryRecv(value)) {
+        return LuaFuture::resolved(value);
+    }
+
+    bool received;
+    {
+        std::lock_guard<std::mutex> locker(mState->lock);
+        mState->recvWaiting.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        received = mState->pop(value);
+        if (!received) {
+            if (mState->closed.load(std::memory_order_acquire)) {
+                mState->recvWaiting.fetch_sub(1);
+                return LuaFuture::resolved(GAny::undefined());
+            }
+            LuaFuture future;
+            mState->recvFutures.push_back(future);
+            return future;
+        }
+        mState->recvWaiting.fetch_sub(1);
+    }
+    mState->notifySenders();
+    return LuaFuture::resolved(value);
+}
+
+void LuaChannel::close() const
+{
+    if (mState->closed.exchange(true)) {
+        return;
+    }
+
+    std::vector<std::pair<LuaFuture, GAny>> ready;
+    {
+        std::lock_guard<std::mutex> locker(mState->lock);
+        // Pending futures take the remaining messages, the others are resolved with undefined
+        while (!mState->recvFutures.empty()) {
+            GAny value;
+            mState->pop(value);
+            ready.emplace_back(std::move(mState->recvFutures.front()), std::move(value));
+            mState->recvFutures.pop_front();
+            mState->recvWaiting.fetch_sub(1);
+        }
+        mState->notEmpty.notify_all();
+        mState->notFull.notify_all();
+    }
+    for (auto &item: ready) {
+        item.first.resolve(item.second);
+    }
+}
+
+bool LuaChannel::isClosed() const
+{
+    return mState->closed.load(std::memory_order_acquire);
+}
+
+size_t LuaChannel::size() const
+{
+    size_t enqueue = mState->enqueuePos.load(std::memory_order_relaxed);
+    size_t dequeue = mState->dequeuePos.load(std::memory_order_relaxed);
+    return enqueue > dequeue ? enqueue - dequeue : 0;
+}
+
+size_t LuaChannel::capacity() const
+{
+    return mState->mask + 1;
+}
+
+GX_NS_END
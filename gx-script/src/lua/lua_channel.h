@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_CHANNEL_H
+#define GX_SCRIPT_LUA_CHANNEL_H
+
+#include <gx/gobject.h>
+
+#include <gx/gany.h>
+
+#include "lua_future.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaChannel
+ * @brief Bounded multi-producer multi-consumer channel passing GAny messages between threads and virtual machines. <br>
+ *        Messages go through a lock-free ring buffer and are moved in and out of it, so a LuaTable payload
+ *        changes owner without being copied; the lock is only taken to block or wake a waiting side. <br>
+ *        Copies share the same channel. Lua receives without blocking the thread with Async.recv,
+ *        which suspends a request coroutine until a message arrives.
+ */
+class LuaChannel
+{
+public:
+    /**
+     * @brief Create a channel
+     * @param capacity  Maximum number of buffered messages, rounded up to a power of two
+     */
+    explicit LuaChannel(size_t capacity = 64);
+
+    LuaChannel(const LuaChannel &b) = default;
+
+    LuaChannel(LuaChannel &&b) noexcept = default;
+
+    LuaChannel &operator=(const LuaChannel &b) = default;
+
+    LuaChannel &operator=(LuaChannel &&b) noexcept = default;
+
+public:
+    /**
+     * @brief Send a message, blocking while the channel is full
+     * @param value         Message, undefined can not be sent
+     * @param timeoutMs     Maximum waiting time, negative numbers wait forever
+     * @return false if the channel is closed or timed out
+     */
+    bool send(GAny value, int32_t timeoutMs = -1) const;
+
+    /**
+     * @brief Send a message without blocking
+     * @param value
+     * @return false if the channel is full or closed
+     */
+    bool trySend(GAny value) const;
+
+    /**
+     * @brief Receive a message, blocking while the channel is empty
+     * @param value         Receives the message
+     * @param timeoutMs     Maximum waiting time, negative numbers wait forever
+     * @return false if the channel is closed and empty, or timed out
+     */
+    bool recv(GAny &value, int32_t timeoutMs = -1) const;
+
+    /**
+     * @brief Receive a message without blocking
+     * @param value
+     * @return false if the channel is empty
+     */
+    bool tryRecv(GAny &value) const;
+
+    /**
+     * @brief Receive a message asynchronously. The future is resolved with the message,
+     *        or with undefined if the channel is closed while it is waiting
+     * @return
+     */
+    LuaFuture recvAsync() const;
+
+    /**
+     * @brief Close the channel, sending fails from now on and receivers get the buffered messages,
+     *        then fail instead of waiting
+     */
+    void close() const;
+
+    bool isClosed() const;
+
+    /**
+     * @brief Number of buffered messages, approximate while other threads are using the channel
+     * @return
+     */
+    size_t size() const;
+
+    size_t capacity() const;
+
+    bool operator==(const LuaChannel &rhs) const
+    {
+        return mState == rhs.mState;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        GAny value;
+    };
+
+    struct SharedState
+    {
+        explicit SharedState(size_t capacity);
+
+        bool push(GAny &value);
+
+        bool pop(GAny &value);
+
+        /**
+         * @brief Wake receivers after a push, delivering messages to the pending futures first
+         */
+        void notifyReceivers();
+
+        /**
+         * @brief Wake a sender after a pop
+         */
+        void notifySenders();
+
+        std::unique_ptr<Cell[]> buffer;
+        size_t mask;
+        alignas(64) std::atomic<size_t> enqueuePos{0};
+        alignas(64) std::atomic<size_t> dequeuePos{0};
+        alignas(64) std::atomic<bool> closed{false};
+
+        // Counts of blocked or pending receivers and blocked senders, so the lock is skipped when nobody waits
+        std::atomic<size_t> recvWaiting{0};
+        std::atomic<size_t> sendWaiting{0};
+
+        std::mutex lock;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        std::deque<LuaFuture> recvFutures;
+    };
+
+private:
+    std::shared_ptr<SharedState> mState;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_CHANNEL_H
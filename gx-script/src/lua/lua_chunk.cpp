@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_chunk.h"
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+/**
+ * @brief Aligned bytecode shared by the chunk object and the prototypes loaded from it,
+ *        each holds one reference. A static image references memory that outlives the process instead
+ */
+struct LuaChunk::Image
+{
+    std::atomic<int32_t> refCount{1};
+    std::vector<uint64_t> words;
+    const char *staticData = nullptr;
+    size_t size = 0;
+
+    const char *data() const
+    {
+        return staticData ? staticData : reinterpret_cast<const char *>(words.data());
+    }
+
+    static void ref(void *ud, int delta)
+    {
+        auto *image = static_cast<Image *>(ud);
+        if (image->refCount.fetch_add(delta, std::memory_order_acq_rel) + delta == 0) {
+            delete image;
+        }
+    }
+
+    static void staticRef(void *, int)
+    {
+    }
+};
+
+static int chunkWriter(lua_State *, const void *p, size_t sz, void *ud)
+{
+    auto &buffer = *static_cast<std::string *>(ud);
+    buffer.append(static_cast<const char *>(p), sz);
+    return 0;
+}
+
+std::shared_ptr<LuaChunk> LuaChunk::create(const char *data, size_t size,
+                                           const std::string &chunkName, std::string *error)
+{
+    // Compile or re-dump in a scratch state, the aligned dump lets every code array be referenced in place
+    lua_State *L = luaL_newstate();
+    if (!L) {
+        if (error) {
+            *error = "not enough memory";
+        }
+        return nullptr;
+    }
+
+    std::string buffer;
+    if (luaL_loadbuffer(L, data, size, chunkName.c_str()) != LUA_OK
+        || lua_dumpaligned(L, chunkWriter, &buffer, 0) != LUA_OK) {
+        if (error) {
+            const char *err = lua_tostring(L, -1);
+            *error = err ? err : "dump lua code failure";
+        }
+        lua_close(L);
+        return nullptr;
+    }
+    lua_close(L);
+
+    return fromDump(buffer, chunkName);
+}
+
+std::shared_ptr<LuaChunk> LuaChunk::wrapStatic(const char *data, size_t size, const std::string &chunkName)
+{
+    auto *image = new Image();
+    image->staticData = data;
+    image->size = size;
+    return std::shared_ptr<LuaChunk>(new LuaChunk(image, chunkName));
+}
+
+std::shared_ptr<LuaChunk> LuaChunk::dumpProto(lua_State *L, const void *proto, const std::string &chunkName)
+{
+    std::string buffer;
+    if (lua_dumpproto(L, proto, chunkWriter, &buffer, 0) != LUA_OK) {
+        return nullptr;
+    }
+    return fromDump(buffer, chunkName);
+}
+
+std::shared_ptr<LuaChunk> LuaChunk::fromDump(const std::string &buffer, const std::string &chunkName)
+{
+    auto *image = new Image();
+    image->size = buffer.size();
+    image->words.resize((buffer.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    memcpy(image->words.data(), buffer.data(), buffer.size());
+
+    return std::shared_ptr<LuaChunk>(new LuaChunk(image, chunkName));
+}
+
+LuaChunk::LuaChunk(Image *image, std::string chunkName)
+        : mImage(image), mChunkName(std::move(chunkName))
+{
+}
+
+LuaChunk::~LuaChunk()
+{
+    Image::ref(mImage, -1);
+}
+
+const std::string &LuaChunk::chunkName() const
+{
+    return mChunkName;
+}
+
+size_t LuaChunk::size() const
+{
+    return mImage->size;
+}
+
+int LuaChunk::load(lua_State *L) const
+{
+    return lua_loadshared(L, mImage->data(), mImage->size, mChunkName.c_str(),
+                          mImage->staticData ? Image::staticRef : Image::ref, mImage);
+}
+
+GX_NS_END
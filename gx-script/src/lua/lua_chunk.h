@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_CHUNK_H
+#define GX_SCRIPT_LUA_CHUNK_H
+
+#include <gx/gobject.h>
+
+#include <lua.hpp>
+
+#include <memory>
+#include <string>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaChunk
+ * @brief Immutable precompiled Lua chunk that can be loaded into any number of virtual machines. <br>
+ *        The functions loaded from it reference its bytecode and line information in place instead of copying them,
+ *        the data is released after the chunk object and the last function prototype using it are gone.
+ */
+class LuaChunk
+{
+public:
+    /**
+     * @brief Create a chunk from Lua source code or bytecode
+     * @param data          Lua source code or bytecode
+     * @param size          Data size
+     * @param chunkName     Code source path (file path or URI)
+     * @param error         Receives the compile error when failed
+     * @return nullptr if failed
+     */
+    static std::shared_ptr<LuaChunk> create(const char *data, size_t size,
+                                            const std::string &chunkName, std::string *error = nullptr);
+
+    /**
+     * @brief Create a chunk that loads bytecode in place from memory that stays valid and unchanged
+     *        for the lifetime of the process (e.g. embedded in the binary), nothing is copied or compiled.
+     *        Code arrays are referenced only when they are aligned (see lua_dumpaligned and luac -a), otherwise copied.
+     *        The bytecode is checked when it is loaded
+     * @param data          Lua bytecode
+     * @param size          Data size
+     * @param chunkName     Code source path (file path or URI)
+     * @return
+     */
+    static std::shared_ptr<LuaChunk> wrapStatic(const char *data, size_t size, const std::string &chunkName);
+
+    /**
+     * @brief Create a chunk from a loaded function prototype by dumping it directly.
+     *        Only reads the prototype, may be called from any thread as long as the prototype is alive
+     * @param L             Lua state used for the dump (any state)
+     * @param proto         Function prototype
+     * @param chunkName     Code source path (file path or URI)
+     * @return nullptr if failed
+     */
+    static std::shared_ptr<LuaChunk> dumpProto(lua_State *L, const void *proto, const std::string &chunkName);
+
+    ~LuaChunk();
+
+    LuaChunk(const LuaChunk &) = delete;
+
+    LuaChunk &operator=(const LuaChunk &) = delete;
+
+    const std::string &chunkName() const;
+
+    /**
+     * @brief Size of the shared bytecode
+     * @return
+     */
+    size_t size() const;
+
+    /**
+     * @brief Load the chunk as a function on the top of the stack of L
+     * @param L
+     * @return Lua status code, the error message is on the stack if not LUA_OK
+     */
+    int load(lua_State *L) const;
+
+private:
+    struct Image;
+
+    LuaChunk(Image *image, std::string chunkName);
+
+    static std::shared_ptr<LuaChunk> fromDump(const std::string &buffer, const std::string &chunkName);
+
+private:
+    Image *mImage;
+    std::string mChunkName;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_CHUNK_H
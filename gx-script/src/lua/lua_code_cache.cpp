@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_code_cache.h"
+
+#include <gx/gfile.h>
+#include <gx/debug.h>
+
+#include <lua.hpp>
+
+#include <atomic>
+#include <filesystem>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+
+#define CACHE_MAGIC         0x434c5847  // "GXLC"
+#define CACHE_FORMAT        2           // Entries carry the md5 of their bytecode
+#define CACHE_FILE_SUFFIX   ".lcc"
+
+namespace fs = std::filesystem;
+
+GX_NS_BEGIN
+
+static int64_t processId()
+{
+#if defined(_WIN32)
+    return (int64_t) _getpid();
+#else
+    return (int64_t) getpid();
+#endif
+}
+
+struct CacheEntry
+{
+    LuaCodeCache::SourceStat stat;
+    GByteArray hash;
+    GByteArray codeHash;
+    GByteArray byteCode;
+};
+
+static bool readCacheEntry(const std::string &cachePath, CacheEntry &entry)
+{
+    GFile file(cachePath);
+    if (!file.exists() || !file.open(GFile::ReadOnly | GFile::Binary)) {
+        return false;
+    }
+    GByteArray buffer = file.read();
+    file.close();
+
+    if (buffer.size() < (int32_t) (sizeof(int32_t) * 3 + sizeof(int64_t) * 2)) {
+        return false;
+    }
+    int32_t magic = 0;
+    int32_t format = 0;
+    int32_t version = 0;
+    buffer.read(magic);
+    buffer.read(format);
+    buffer.read(version);
+    if (magic != CACHE_MAGIC || format != CACHE_FORMAT || version != LUA_VERSION_RELEASE_NUM) {
+        return false;
+    }
+    buffer.read(entry.stat.size);
+    buffer.read(entry.stat.mtime);
+    buffer >> entry.hash;
+    buffer >> entry.codeHash;
+    buffer >> entry.byteCode;
+    if (entry.byteCode.isEmpty()) {
+        return false;
+    }
+    // Truncated or damaged entries are a miss, they would otherwise fail to load until deleted by hand
+    if (GByteArray::md5Sum(entry.byteCode).toHexString() != entry.codeHash.toHexString()) {
+        std::error_code ec;
+        fs::remove(cachePath, ec);
+        return false;
+    }
+    return true;
+}
+
+
+LuaCodeCache::LuaCodeCache(std::string cacheDir)
+        : mCacheDir(std::move(cacheDir))
+{
+    std::error_code ec;
+    fs::create_directories(mCacheDir, ec);
+    if (ec) {
+        LogW("LuaCodeCache: cannot create cache directory %s", mCacheDir.c_str());
+    }
+}
+
+const std::string &LuaCodeCache::cacheDir() const
+{
+    return mCacheDir;
+}
+
+LuaCodeCache::SourceStat LuaCodeCache::statSource(const std::string &filePath)
+{
+    SourceStat st;
+    std::error_code ec;
+    auto size = fs::file_size(filePath, ec);
+    if (ec) {
+        return st;
+    }
+    auto mtime = fs::last_write_time(filePath, ec);
+    if (ec) {
+        return st;
+    }
+    st.size = (int64_t) size;
+    st.mtime = (int64_t) mtime.time_since_epoch().count();
+    return st;
+}
+
+GByteArray LuaCodeCache::load(const std::string &filePath, const SourceStat &st) const
+{
+    if (st.size < 0) {
+        return GByteArray();
+    }
+    CacheEntry entry;
+    if (!readCacheEntry(cacheFilePath(filePath), entry)) {
+        return GByteArray();
+    }
+    if (entry.stat.size != st.size || entry.stat.mtime != st.mtime) {
+        return GByteArray();
+    }
+    return entry.byteCode;
+}
+
+GByteArray LuaCodeCache::match(const std::string &filePath, const GByteArray &source, const SourceStat &stat) const
+{
+    CacheEntry entry;
+    if (!readCacheEntry(cacheFilePath(filePath), entry)) {
+        return GByteArray();
+    }
+    GByteArray hash = GByteArray::md5Sum(source);
+    if (entry.hash.toHexString() != hash.toHexString()) {
+        return GByteArray();
+    }
+    // Content unchanged (e.g. touched or checked out again), refresh the recorded stat
+    write(filePath, hash, entry.byteCode, stat);
+    return entry.byteCode;
+}
+
+bool LuaCodeCache::store(const std::string &filePath, const GByteArray &source, const GByteArray &byteCode,
+                         const SourceStat &stat) const
+{
+    return write(filePath, GByteArray::md5Sum(source), byteCode, stat);
+}
+
+bool LuaCodeCache::isSourceCode(const GByteArray &buffer)
+{
+    if (buffer.size() >= 4) {
+        const uint8_t *head = buffer.data();
+        if (head[0] == 0xff && head[1] == 'l' && head[2] == 's' && head[3] == 0xee) {
+            return false;
+        }
+    }
+    return !(buffer.size() >= 1 && buffer.data()[0] == LUA_SIGNATURE[0]);
+}
+
+std::string LuaCodeCache::cacheFilePath(const std::string &filePath) const
+{
+    std::error_code ec;
+    fs::path absPath = fs::absolute(filePath, ec);
+    std::string key = (ec ? filePath : absPath.generic_string()) + "|" LUA_RELEASE;
+
+    GByteArray keyBuffer;
+    keyBuffer.write(key.data(), (int32_t) key.size());
+    return (fs::path(mCacheDir) / (GByteArray::md5Sum(keyBuffer).toHexString() + CACHE_FILE_SUFFIX)).string();
+}
+
+bool LuaCodeCache::write(const std::string &filePath, const GByteArray &hash, const GByteArray &byteCode,
+                         const SourceStat &st) const
+{
+    if (st.size < 0) {
+        return false;
+    }
+
+    GByteArray buffer;
+    buffer.write((int32_t) CACHE_MAGIC);
+    buffer.write((int32_t) CACHE_FORMAT);
+    buffer.write((int32_t) LUA_VERSION_RELEASE_NUM);
+    buffer.write(st.size);
+    buffer.write(st.mtime);
+    buffer << hash;
+    buffer << GByteArray::md5Sum(byteCode);
+    buffer << byteCode;
+
+    // Write to a unique temporary file first and rename it over the cache file,
+    // readers in other processes never see a partially written cache
+    const std::string cachePath = cacheFilePath(filePath);
+    // The process id keeps processes sharing the directory apart, the counter the threads of this process
+    static std::atomic<uint64_t> sTmpCounter{0};
+    const std::string tmpPath = cachePath + "." + std::to_string(processId()) + "."
+                                + std::to_string(sTmpCounter.fetch_add(1, std::memory_order_relaxed)) + ".tmp";
+
+    GFile tmpFile(tmpPath);
+    if (!tmpFile.open(GFile::WriteOnly | GFile::Binary)) {
+        return false;
+    }
+    bool written = tmpFile.write(buffer) == buffer.size();
+    tmpFile.close();
+
+    std::error_code ec;
+    if (!written) {
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+    fs::rename(tmpPath, cachePath, ec);
+    if (ec) {
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
+GX_NS_END
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_CODE_CACHE_H
+#define GX_SCRIPT_LUA_CODE_CACHE_H
+
+#include <gx/gobject.h>
+
+#include <gx/gbytearray.h>
+
+#include <string>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaCodeCache
+ * @brief On-disk cache of compiled Lua source files. <br>
+ *        Each source file is cached in one file named after its path and the Lua version,
+ *        which records the source size, modification time and content hash, and the hash of the bytecode. <br>
+ *        Cache files are replaced atomically, so the cache directory can be shared by concurrent processes.
+ */
+class LuaCodeCache
+{
+public:
+    /**
+     * @brief Size and modification time of a source file, taken before the source is read
+     */
+    struct SourceStat
+    {
+        int64_t size = -1;
+        int64_t mtime = 0;
+    };
+
+public:
+    explicit LuaCodeCache(std::string cacheDir);
+
+    const std::string &cacheDir() const;
+
+    /**
+     * @brief Stat a source file, to be called before reading it so that a later change of the file
+     *        does not get recorded with the content read before it
+     * @param filePath  Path to Lua source code file
+     * @return size is -1 if the file cannot be stat
+     */
+    static SourceStat statSource(const std::string &filePath);
+
+    /**
+     * @brief Load the cached bytecode of a source file without reading the source,
+     *        valid only if the size and modification time of the source have not changed
+     * @param filePath  Path to Lua source code file
+     * @param stat      Stat of the source file
+     * @return bytecode, empty if there is no valid cache
+     */
+    GByteArray load(const std::string &filePath, const SourceStat &stat) const;
+
+    /**
+     * @brief Load the cached bytecode of a source file by its content hash.
+     *        If the content is unchanged, the cached size and modification time are refreshed
+     * @param filePath  Path to Lua source code file
+     * @param source    Content of source file
+     * @param stat      Stat of the source file taken before reading it
+     * @return bytecode, empty if there is no valid cache
+     */
+    GByteArray match(const std::string &filePath, const GByteArray &source, const SourceStat &stat) const;
+
+    /**
+     * @brief Write the bytecode of a source file to the cache
+     * @param filePath  Path to Lua source code file
+     * @param source    Content of source file
+     * @param byteCode  Compiled bytecode
+     * @param stat      Stat of the source file taken before reading it
+     * @return
+     */
+    bool store(const std::string &filePath, const GByteArray &source, const GByteArray &byteCode,
+               const SourceStat &stat) const;
+
+    /**
+     * @brief Determine whether the buffer is Lua source code (not bytecode or lsc)
+     * @param buffer
+     * @return
+     */
+    static bool isSourceCode(const GByteArray &buffer);
+
+private:
+    std::string cacheFilePath(const std::string &filePath) const;
+
+    bool write(const std::string &filePath, const GByteArray &hash, const GByteArray &byteCode,
+               const SourceStat &stat) const;
+
+private:
+    std::string mCacheDir;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_CODE_CACHE_H
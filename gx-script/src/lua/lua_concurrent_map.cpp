@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_concurrent_map.h"
+
+#include <vector>
+
+
+GX_NS_BEGIN
+
+LuaConcurrentMap::LuaConcurrentMap(size_t shardCount)
+        : mState(std::make_shared<SharedState>())
+{
+    size_t count = 1;
+    while (count < shardCount) {
+        count <<= 1;
+    }
+    mState->shards.reset(new Shard[count]);
+    mState->mask = count - 1;
+}
+
+GAny LuaConcurrentMap::get(const std::string &key) const
+{
+    Shard &s = shard(key);
+    GLockerGuard locker(s.lock);
+    auto it = s.map.find(key);
+    return it != s.map.end() ? it->second : GAny::undefined();
+}
+
+void LuaConcurrentMap::set(const std::string &key, const GAny &value) const
+{
+    Shard &s = shard(key);
+    GLockerGuard locker(s.lock);
+    if (s.map.insert_or_assign(key, value).second) {
+        mState->size.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool LuaConcurrentMap::setIfAbsent(const std::string &key, const GAny &value) const
+{
+    Shard &s = shard(key);
+    GLockerGuard locker(s.lock);
+    if (!s.map.emplace(key, value).second) {
+        return false;
+    }
+    mState->size.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool LuaConcurrentMap::compareAndSet(const std::string &key, const GAny &expected, const GAny &desired) const
+{
+    Shard &s = shard(key);
+    GLockerGuard locker(s.lock);
+    auto it = s.map.find(key);
+    if (it == s.map.end()) {
+        if (!expected.isUndefined()) {
+            return false;
+        }
+        if (!desired.isUndefined()) {
+            s.map.emplace(key, desired);
+            mState->size.fetch_add(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    if (expected.isUndefined() || it->second != expected) {
+        return false;
+    }
+    if (desired.isUndefined()) {
+        s.map.erase(it);
+        mState->size.fetch_sub(1, std::memory_order_relaxed);
+    } else {
+        it->second = desired;
+    }
+    return true;
+}
+
+GAny LuaConcurrentMap::add(const std::string &key, const GAny &delta) const
+{
+    if (!delta.isNumber()) {
+        return GAny::undefined();
+    }
+    bool isInteger = !delta.isFloat() && !delta.isDouble();
+
+    Shard &s = shard(key);
+    GLockerGuard locker(s.lock);
+    auto it = s.map.find(key);
+    if (it == s.map.end()) {
+        it = s.map.emplace(key, isInteger ? GAny(delta.toInt64()) : GAny(delta.toDouble())).first;
+        mState->size.fetch_add(1, std::memory_order_relaxed);
+        return it->second;
+    }
+
+    const GAny &current = it->second;
+    if (!current.isNumber()) {
+        return GAny::undefined();
+    }
+    if (isInteger && !current.isFloat() && !current.isDouble()) {
+        it->second = current.toInt64() + delta.toInt64();
+    } else {
+        it->second = current.toDouble() + delta.toDouble();
+    }
+    return it->second;
+}
+
+bool LuaConcurrentMap::remove(const std::string &key) const
+{
+    Shard &s = shard(key);
+    GLockerGuard locker(s.lock);
+    if (s.map.erase(key) == 0) {
+        return false;
+    }
+    mState->size.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool LuaConcurrentMap::contains(const std::string &key) const
+{
+    Shard &s = shard(key);
+    GLockerGuard locker(s.lock);
+    return s.map.find(key) != s.map.end();
+}
+
+size_t LuaConcurrentMap::size() const
+{
+    return mState->size.load(std::memory_order_relaxed);
+}
+
+void LuaConcurrentMap::clear() const
+{
+    for (size_t i = 0; i <= mState->mask; i++) {
+        Shard &s = mState->shards[i];
+        GLockerGuard locker(s.lock);
+        mState->size.fetch_sub(s.map.size(), std::memory_order_relaxed);
+        s.map.clear();
+    }
+}
+
+GAny LuaConcurrentMap::snapshot() const
+{
+    GAny obj = GAny::object();
+    forEach([&obj](const std::string &key, const GAny &value) {
+        obj[key] = value;
+    });
+    return obj;
+}
+
+void LuaConcurrentMap::forEach(const ForEachFunc &func) const
+{
+    std::vector<std::pair<std::string, GAny>> items;
+    for (size_t i = 0; i <= mState->mask; i++) {
+        Shard &s = mState->shards[i];
+        items.clear();
+        {
+            GLockerGuard locker(s.lock);
+            items.assign(s.map.begin(), s.map.end());
+        }
+        // Called without the lock, func may update the map
+        for (const auto &item: items) {
+            func(item.first, item.second);
+        }
+    }
+}
+
+LuaConcurrentMap::Shard &LuaConcurrentMap::shard(const std::string &key) const
+{
+    size_t hash = std::hash<std::string>()(key);
+    // Mix the high bits in, the low bits of some string hashes are weak
+    hash ^= hash >> 17;
+    return mState->shards[hash & mState->mask];
+}
+
+GX_NS_END
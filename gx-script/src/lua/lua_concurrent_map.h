@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_CONCURRENT_MAP_H
+#define GX_SCRIPT_LUA_CONCURRENT_MAP_H
+
+#include <gx/gobject.h>
+
+#include <gx/gany.h>
+#include <gx/gmutex.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaConcurrentMap
+ * @brief Hash map shared between threads and virtual machines, copies share the same map. <br>
+ *        Keys are strings (other keys are converted with toString), the map is split into shards with their own lock,
+ *        so updates of different keys rarely wait for each other. Each operation on a key is atomic.
+ */
+class LuaConcurrentMap
+{
+public:
+    using ForEachFunc = std::function<void(const std::string &key, const GAny &value)>;
+
+public:
+    /**
+     * @brief Create a map
+     * @param shardCount    Number of shards, rounded up to a power of two
+     */
+    explicit LuaConcurrentMap(size_t shardCount = 32);
+
+    LuaConcurrentMap(const LuaConcurrentMap &b) = default;
+
+    LuaConcurrentMap(LuaConcurrentMap &&b) noexcept = default;
+
+    LuaConcurrentMap &operator=(const LuaConcurrentMap &b) = default;
+
+    LuaConcurrentMap &operator=(LuaConcurrentMap &&b) noexcept = default;
+
+public:
+    /**
+     * @brief Get the value of a key
+     * @param key
+     * @return undefined if not found
+     */
+    GAny get(const std::string &key) const;
+
+    void set(const std::string &key, const GAny &value) const;
+
+    /**
+     * @brief Set the value only if the key is not in the map
+     * @param key
+     * @param value
+     * @return false if the key already exists
+     */
+    bool setIfAbsent(const std::string &key, const GAny &value) const;
+
+    /**
+     * @brief Replace the value only if the current value equals expected, undefined means that the key is absent
+     * @param key
+     * @param expected
+     * @param desired   undefined to remove the key
+     * @return false if the current value was not expected
+     */
+    bool compareAndSet(const std::string &key, const GAny &expected, const GAny &desired) const;
+
+    /**
+     * @brief Add to the number of a key, an absent key counts as 0
+     * @param key
+     * @param delta     Integer or floating point number
+     * @return The new value
+     */
+    GAny add(const std::string &key, const GAny &delta) const;
+
+    /**
+     * @brief Remove a key
+     * @param key
+     * @return false if not found
+     */
+    bool remove(const std::string &key) const;
+
+    bool contains(const std::string &key) const;
+
+    size_t size() const;
+
+    void clear() const;
+
+    /**
+     * @brief Copy the content to GAnyObject, each shard is copied at once
+     * @return
+     */
+    GAny snapshot() const;
+
+    /**
+     * @brief Call func for each item of a snapshot, the map may be changed during the iteration
+     * @param func
+     */
+    void forEach(const ForEachFunc &func) const;
+
+    bool operator==(const LuaConcurrentMap &rhs) const
+    {
+        return mState == rhs.mState;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        GMutex lock;
+        std::unordered_map<std::string, GAny> map;
+    };
+
+    struct SharedState
+    {
+        std::unique_ptr<Shard[]> shards;
+        size_t mask = 0;
+        std::atomic<size_t> size{0};
+    };
+
+    Shard &shard(const std::string &key) const;
+
+private:
+    std::shared_ptr<SharedState> mState;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_CONCURRENT_MAP_H
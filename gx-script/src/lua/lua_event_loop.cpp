@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_event_loop.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(__linux__)
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#endif
+
+#define EPOLL_MAX_EVENTS 64
+
+
+GX_NS_BEGIN
+
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LuaEventLoop::LuaEventLoop(std::shared_ptr<LuaTaskQueue> tasks)
+        : mTasks(std::move(tasks))
+{
+#if defined(__linux__)
+    int wakeFd = mTasks->wakeFd();
+    if (wakeFd >= 0) {
+        mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    if (mEpollFd >= 0) {
+        // Level triggered, readable until the task queue takes its tasks
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeFd;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, wakeFd, &ev) != 0) {
+            close(mEpollFd);
+            mEpollFd = -1;
+        }
+    }
+#endif
+}
+
+LuaEventLoop::~LuaEventLoop()
+{
+    clear();
+#if defined(__linux__)
+    if (mEpollFd >= 0) {
+        close(mEpollFd);
+    }
+#endif
+}
+
+uint64_t LuaEventLoop::addTimer(int64_t delayMs, int64_t intervalMs, TimerCallback callback)
+{
+    uint64_t id = mNextTimerId++;
+    mTimers.emplace(id, Timer{std::max<int64_t>(0, intervalMs) * 1000, std::move(callback)});
+    mTimerQueue.push({nowUs() + std::max<int64_t>(0, delayMs) * 1000, id});
+    return id;
+}
+
+bool LuaEventLoop::cancelTimer(uint64_t id)
+{
+    return mTimers.erase(id) > 0;
+}
+
+bool LuaEventLoop::watchFd(int fd, uint32_t events, FdCallback callback)
+{
+#if defined(__linux__)
+    if (mEpollFd < 0 || fd < 0 || mFdWatches.count(fd) > 0) {
+        return false;
+    }
+    epoll_event ev{};
+    ev.events = ((events & FdRead) ? EPOLLIN : 0) | ((events & FdWrite) ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        return false;
+    }
+    mFdWatches.emplace(fd, FdWatch{events, std::move(callback)});
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool LuaEventLoop::unwatchFd(int fd)
+{
+    auto it = mFdWatches.find(fd);
+    if (it == mFdWatches.end()) {
+        return false;
+    }
+    mFdWatches.erase(it);
+#if defined(__linux__)
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+    return true;
+}
+
+size_t LuaEventLoop::runOnce(int32_t timeoutMs)
+{
+    mStats.iterations++;
+    int32_t wait = waitTimeout(timeoutMs);
+
+    size_t count = 0;
+    size_t tasks = 0;
+    if (mEpollFd >= 0) {
+        count += pollFds(wait);
+    } else if (wait != 0) {
+        // Without epoll the task queue does the waiting, posting a task wakes it up
+        tasks += mTasks->run(wait);
+    }
+    count += fireTimers();
+    tasks += mTasks->run(0);
+    mStats.tasksRun += tasks;
+    return count + tasks;
+}
+
+void LuaEventLoop::run()
+{
+    while (!mStopped.load()) {
+        runOnce(-1);
+    }
+    mStopped.store(false);
+}
+
+void LuaEventLoop::stop()
+{
+    mStopped.store(true);
+    mTasks->post([]() {});
+}
+
+bool LuaEventLoop::hasWork() const
+{
+    return !mTimers.empty() || !mFdWatches.empty() || !mTasks->empty();
+}
+
+void LuaEventLoop::clear()
+{
+    // Callbacks may own resources released through the loop, take them out first
+    std::unordered_map<uint64_t, Timer> timers;
+    timers.swap(mTimers);
+    mTimerQueue = decltype(mTimerQueue)();
+
+    std::unordered_map<int, FdWatch> watches;
+    watches.swap(mFdWatches);
+#if defined(__linux__)
+    for (const auto &watch: watches) {
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, watch.first, nullptr);
+    }
+#endif
+}
+
+LuaEventLoop::Stats LuaEventLoop::stats() const
+{
+    Stats stats = mStats;
+    stats.queueDepth = mTasks->size();
+    stats.timerCount = mTimers.size();
+    stats.fdCount = mFdWatches.size();
+    return stats;
+}
+
+int32_t LuaEventLoop::waitTimeout(int32_t timeoutMs)
+{
+    if (timeoutMs == 0 || !mTasks->empty() || mStopped.load()) {
+        return 0;
+    }
+    while (!mTimerQueue.empty() && mTimers.count(mTimerQueue.top().id) == 0) {
+        mTimerQueue.pop();
+    }
+    if (mTimerQueue.empty()) {
+        return timeoutMs;
+    }
+    int64_t untilUs = mTimerQueue.top().deadline - nowUs();
+    auto untilMs = (int32_t) std::max<int64_t>(0, (untilUs + 999) / 1000);
+    return timeoutMs < 0 ? untilMs : std::min(timeoutMs, untilMs);
+}
+
+size_t LuaEventLoop::fireTimers()
+{
+    if (mTimerQueue.empty()) {
+        return 0;
+    }
+    struct Due
+    {
+        uint64_t id;
+        bool periodic;
+        TimerCallback callback;
+    };
+    std::vector<Due> due;
+
+    // Timers added by the callbacks wait for the next iteration
+    int64_t now = nowUs();
+    while (!mTimerQueue.empty() && mTimerQueue.top().deadline <= now) {
+        TimerEntry entry = mTimerQueue.top();
+        mTimerQueue.pop();
+        auto it = mTimers.find(entry.id);
+        if (it == mTimers.end()) {
+            continue;
+        }
+        int64_t lag = now - entry.deadline;
+        mStats.lastLagUs = lag;
+        mStats.maxLagUs = std::max(mStats.maxLagUs, lag);
+
+        if (it->second.intervalUs > 0) {
+            // Skip the missed periods instead of firing them in a burst
+            int64_t next = entry.deadline + it->second.intervalUs;
+            if (next <= now) {
+                next = now + it->second.intervalUs;
+            }
+            mTimerQueue.push({next, entry.id});
+            due.push_back({entry.id, true, it->second.callback});
+        } else {
+            // Kept until its callback runs, so that an earlier callback of this batch can still cancel it
+            due.push_back({entry.id, false, nullptr});
+        }
+    }
+
+    size_t count = 0;
+    for (auto &timer: due) {
+        // An earlier callback may have cancelled the timer
+        auto it = mTimers.find(timer.id);
+        if (it == mTimers.end()) {
+            continue;
+        }
+        if (!timer.periodic) {
+            timer.callback = std::move(it->second.callback);
+            mTimers.erase(it);
+        }
+        timer.callback();
+        count++;
+    }
+    mStats.timersFired += count;
+    return count;
+}
+
+size_t LuaEventLoop::pollFds(int32_t timeoutMs)
+{
+#if defined(__linux__)
+    epoll_event events[EPOLL_MAX_EVENTS];
+    int n = epoll_wait(mEpollFd, events, EPOLL_MAX_EVENTS, timeoutMs);
+
+    size_t count = 0;
+    int wakeFd = mTasks->wakeFd();
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wakeFd) {
+            continue;
+        }
+        // Unwatched by an earlier callback
+        auto it = mFdWatches.find(fd);
+        if (it == mFdWatches.end()) {
+            continue;
+        }
+        uint32_t ready = 0;
+        if (events[i].events & EPOLLIN) {
+            ready |= FdRead;
+        }
+        if (events[i].events & EPOLLOUT) {
+            ready |= FdWrite;
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            ready |= FdError;
+        }
+        FdCallback callback = it->second.callback;
+        callback(fd, ready);
+        count++;
+    }
+    mStats.fdEvents += count;
+    return count;
+#else
+    return 0;
+#endif
+}
+
+GX_NS_END
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_EVENT_LOOP_H
+#define GX_SCRIPT_LUA_EVENT_LOOP_H
+
+#include <gx/gobject.h>
+
+#include "lua_task_queue.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaEventLoop
+ * @brief Event loop of a virtual machine: posted tasks, timers and file descriptor readiness. <br>
+ *        Driven by the thread of the virtual machine with runOnce, or by run on a dedicated thread
+ *        that owns the virtual machine. Descriptors are waited with epoll on Linux,
+ *        other platforms only support tasks and timers.
+ */
+class LuaEventLoop
+{
+public:
+    enum FdEvent : uint32_t
+    {
+        FdRead = 1,
+        FdWrite = 2,
+        FdError = 4,
+    };
+
+    using TimerCallback = std::function<void()>;
+
+    using FdCallback = std::function<void(int fd, uint32_t events)>;
+
+    struct Stats
+    {
+        uint64_t iterations = 0;
+        uint64_t tasksRun = 0;
+        uint64_t timersFired = 0;
+        uint64_t fdEvents = 0;
+        /// Tasks posted and not yet run
+        size_t queueDepth = 0;
+        size_t timerCount = 0;
+        size_t fdCount = 0;
+        /// Delay between the deadline of a timer and its callback, in microseconds
+        int64_t lastLagUs = 0;
+        int64_t maxLagUs = 0;
+    };
+
+public:
+    explicit LuaEventLoop(std::shared_ptr<LuaTaskQueue> tasks);
+
+    ~LuaEventLoop();
+
+    LuaEventLoop(const LuaEventLoop &) = delete;
+
+    LuaEventLoop &operator=(const LuaEventLoop &) = delete;
+
+    /**
+     * @brief Add a timer
+     * @param delayMs       Time until the first call
+     * @param intervalMs    Period of the following calls, 0 for a one-shot timer
+     * @param callback
+     * @return Timer id
+     */
+    uint64_t addTimer(int64_t delayMs, int64_t intervalMs, TimerCallback callback);
+
+    /**
+     * @brief Cancel a timer, the callback is released immediately
+     * @param id
+     * @return false if the timer does not exist or a one-shot timer has already fired
+     */
+    bool cancelTimer(uint64_t id);
+
+    /**
+     * @brief Call the callback whenever the descriptor is ready, one watch per descriptor
+     * @param fd
+     * @param events    Combination of FdRead and FdWrite
+     * @param callback  Receives the ready events, FdError on error or hang up
+     * @return false if not supported or the descriptor is already watched
+     */
+    bool watchFd(int fd, uint32_t events, FdCallback callback);
+
+    /**
+     * @brief Stop watching a descriptor, must be called before closing it
+     * @param fd
+     * @return
+     */
+    bool unwatchFd(int fd);
+
+    /**
+     * @brief Wait for events and run the ready tasks, timers and descriptor callbacks once
+     * @param timeoutMs     Maximum waiting time, 0 does not wait, negative numbers wait until an event happens
+     * @return Number of callbacks run
+     */
+    size_t runOnce(int32_t timeoutMs = 0);
+
+    /**
+     * @brief Run until stop is called
+     */
+    void run();
+
+    /**
+     * @brief Make run return, may be called from any thread
+     */
+    void stop();
+
+    /**
+     * @brief Determine whether there are timers, watched descriptors or pending tasks
+     * @return
+     */
+    bool hasWork() const;
+
+    /**
+     * @brief Release all timers and descriptor watches
+     */
+    void clear();
+
+    Stats stats() const;
+
+private:
+    int32_t waitTimeout(int32_t timeoutMs);
+
+    size_t fireTimers();
+
+    size_t pollFds(int32_t timeoutMs);
+
+private:
+    struct Timer
+    {
+        int64_t intervalUs;
+        TimerCallback callback;
+    };
+
+    struct TimerEntry
+    {
+        int64_t deadline;
+        uint64_t id;
+
+        bool operator>(const TimerEntry &rhs) const
+        {
+            return deadline > rhs.deadline || (deadline == rhs.deadline && id > rhs.id);
+        }
+    };
+
+    std::shared_ptr<LuaTaskQueue> mTasks;
+
+    std::unordered_map<uint64_t, Timer> mTimers;
+    /// Cancelled timers stay in the queue until their deadline and are skipped
+    std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<TimerEntry>> mTimerQueue;
+    uint64_t mNextTimerId = 1;
+
+    struct FdWatch
+    {
+        uint32_t events;
+        FdCallback callback;
+    };
+    std::unordered_map<int, FdWatch> mFdWatches;
+    int mEpollFd = -1;
+
+    std::atomic<bool> mStopped{false};
+    Stats mStats;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_EVENT_LOOP_H
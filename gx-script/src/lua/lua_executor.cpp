@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_executor.h"
+
+#include "gany_lua_vm.h"
+#include "lua_chunk.h"
+
+#include <gx/debug.h>
+
+#include <chrono>
+
+
+GX_NS_BEGIN
+
+/// Worker of the calling thread, tasks submitted by a worker go to its own deque
+static thread_local const void *tCurrentExecutor = nullptr;
+static thread_local void *tCurrentWorker = nullptr;
+
+LuaExecutor::LuaExecutor(size_t workerCount, WorkerInit init)
+        : mInit(std::move(init))
+{
+    if (workerCount == 0) {
+        workerCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < workerCount; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->index = i;
+        mWorkers.push_back(std::move(worker));
+    }
+    // Start after all workers exist, they steal from each other
+    for (auto &worker: mWorkers) {
+        Worker *w = worker.get();
+        w->thread = std::thread([this, w]() {
+            workerMain(*w);
+        });
+    }
+}
+
+LuaExecutor::~LuaExecutor()
+{
+    shutdown();
+}
+
+std::shared_ptr<LuaExecutor> LuaExecutor::create(size_t workerCount)
+{
+    return std::make_shared<LuaExecutor>(workerCount);
+}
+
+LuaFuture LuaExecutor::submit(const GAny &func, const std::vector<GAny> &args)
+{
+    return post([func, args](Worker &worker) {
+        GAnyLuaVM::ContextScope scope(worker.vm.get());
+        return func._call(args);
+    });
+}
+
+LuaFuture LuaExecutor::submitChunk(const std::shared_ptr<LuaChunk> &chunk, const std::vector<GAny> &args)
+{
+    if (!chunk) {
+        return LuaFuture::rejected("LuaExecutor: invalid chunk.");
+    }
+    return post([chunk, args](Worker &worker) {
+        GAnyLuaVM::ContextScope scope(worker.vm.get());
+        auto it = worker.chunks.find(chunk.get());
+        if (it == worker.chunks.end()) {
+            GAny func = worker.vm->scriptChunk(chunk);
+            if (!func.isFunction()) {
+                throw GAnyException("LuaExecutor: the chunk " + chunk->chunkName() + " must return a function.");
+            }
+            it = worker.chunks.emplace(chunk.get(), std::make_pair(chunk, func)).first;
+        }
+        return it->second.second._call(args);
+    });
+}
+
+LuaFuture LuaExecutor::submitModule(const std::string &module, const std::string &entry, const std::vector<GAny> &args)
+{
+    return post([module, entry, args](Worker &worker) {
+        GAnyLuaVM::ContextScope scope(worker.vm.get());
+        auto it = worker.modules.find(module);
+        if (it == worker.modules.end()) {
+            it = worker.modules.emplace(module, worker.vm->requireLs(module, GAny::object())).first;
+        }
+        GAny func = it->second.getItem(entry);
+        if (!func.isFunction()) {
+            throw GAnyException("LuaExecutor: the module " + module + " has no function " + entry + ".");
+        }
+        return func._call(args);
+    });
+}
+
+LuaFuture LuaExecutor::execute(std::function<GAny(GAnyLuaVM &vm)> task)
+{
+    return post([task](Worker &worker) {
+        GAnyLuaVM::ContextScope scope(worker.vm.get());
+        return task(*worker.vm);
+    });
+}
+
+size_t LuaExecutor::workerCount() const
+{
+    return mWorkers.size();
+}
+
+bool LuaExecutor::isWorkerThread() const
+{
+    return tCurrentExecutor == this;
+}
+
+size_t LuaExecutor::pendingCount() const
+{
+    return mPending.load(std::memory_order_relaxed);
+}
+
+uint64_t LuaExecutor::stolenCount() const
+{
+    return mStolen.load(std::memory_order_relaxed);
+}
+
+void LuaExecutor::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> locker(mIdleLock);
+        if (mStopped.exchange(true)) {
+            return;
+        }
+    }
+    mIdleCond.notify_all();
+    for (auto &worker: mWorkers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    // Submissions check the stop flag under the deque lock, nothing is added after this
+    for (auto &worker: mWorkers) {
+        std::deque<Task> tasks;
+        {
+            std::lock_guard<std::mutex> locker(worker->lock);
+            tasks.swap(worker->tasks);
+        }
+        mPending.fetch_sub(tasks.size());
+        tasks.clear();
+    }
+}
+
+LuaFuture LuaExecutor::post(std::function<GAny(Worker &worker)> func)
+{
+    LuaFuture future;
+    // The task owns the future, dropping it unrun rejects the future
+    struct Completion
+    {
+        LuaFuture future;
+
+        ~Completion()
+        {
+            future.reject("LuaExecutor: the executor is shut down.");
+        }
+    };
+    std::shared_ptr<Completion> completion(new Completion{future});
+    Task task = [completion, func](Worker &worker) {
+        try {
+            completion->future.resolve(func(worker));
+        } catch (std::exception &e) {
+            completion->future.reject(e.what());
+        }
+    };
+
+    Worker *target;
+    if (tCurrentExecutor == this) {
+        target = static_cast<Worker *>(tCurrentWorker);
+    } else {
+        target = mWorkers[mNextWorker.fetch_add(1, std::memory_order_relaxed) % mWorkers.size()].get();
+    }
+    {
+        std::lock_guard<std::mutex> locker(target->lock);
+        if (mStopped.load()) {
+            return LuaFuture::rejected("LuaExecutor: the executor is shut down.");
+        }
+        target->tasks.push_back(std::move(task));
+        mPending.fetch_add(1);
+    }
+    {
+        // Orders the push before a worker that is about to wait
+        std::lock_guard<std::mutex> locker(mIdleLock);
+    }
+    mIdleCond.notify_one();
+    return future;
+}
+
+void LuaExecutor::workerMain(Worker &worker)
+{
+    tCurrentExecutor = this;
+    tCurrentWorker = &worker;
+
+    worker.vm = GAnyLuaVM::create();
+    if (mInit) {
+        try {
+            mInit(*worker.vm);
+        } catch (std::exception &e) {
+            LogE("LuaExecutor worker init error: %s", e.what());
+        }
+    }
+
+    Task task;
+    while (true) {
+        if (takeTask(worker, task)) {
+            mPending.fetch_sub(1);
+            task(worker);
+            task = nullptr;
+            if (worker.vm->eventLoop().hasWork()) {
+                worker.vm->runOnce(0);
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> locker(mIdleLock);
+        if (mStopped.load()) {
+            break;
+        }
+        if (mPending.load() > 0) {
+            // Queued in a deque, possibly being taken by another worker
+            continue;
+        }
+        if (worker.vm->eventLoop().hasWork()) {
+            // Keep the timers and descriptors of the virtual machine going while idle
+            mIdleCond.wait_for(locker, std::chrono::milliseconds(1));
+            locker.unlock();
+            worker.vm->runOnce(0);
+        } else {
+            mIdleCond.wait(locker);
+        }
+    }
+
+    worker.chunks.clear();
+    worker.modules.clear();
+    worker.vm->shutdown();
+    worker.vm.reset();
+
+    tCurrentExecutor = nullptr;
+    tCurrentWorker = nullptr;
+}
+
+bool LuaExecutor::takeTask(Worker &worker, Task &task)
+{
+    {
+        std::lock_guard<std::mutex> locker(worker.lock);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+    size_t count = mWorkers.size();
+    for (size_t i = 1; i < count; i++) {
+        Worker &victim = *mWorkers[(worker.index + i) % count];
+        std::lock_guard<std::mutex> locker(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            mStolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+GX_NS_END
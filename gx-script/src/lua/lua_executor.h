@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_EXECUTOR_H
+#define GX_SCRIPT_LUA_EXECUTOR_H
+
+#include <gx/gobject.h>
+
+#include "lua_future.h"
+
+#include <gx/gany.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+class GAnyLuaVM;
+
+class LuaChunk;
+
+/**
+ * @class LuaExecutor
+ * @brief Run Lua tasks on a set of worker threads, each owning a GAnyLuaVM. <br>
+ *        Tasks submitted by a worker go to its own deque, other submissions are spread over the workers.
+ *        An idle worker takes the newest task of its own deque, otherwise steals the oldest task of another worker.
+ *        Chunks and modules are loaded once per worker and reused by the following tasks.
+ *        A task must not block its worker waiting for other tasks of the same executor.
+ */
+class LuaExecutor
+{
+public:
+    using WorkerInit = std::function<void(GAnyLuaVM &vm)>;
+
+public:
+    /**
+     * @brief Start the workers
+     * @param workerCount   Number of workers, 0 for the number of hardware threads
+     * @param init          Called by each worker with its virtual machine before running tasks
+     */
+    explicit LuaExecutor(size_t workerCount = 0, WorkerInit init = nullptr);
+
+    ~LuaExecutor();
+
+    LuaExecutor(const LuaExecutor &) = delete;
+
+    LuaExecutor &operator=(const LuaExecutor &) = delete;
+
+    static std::shared_ptr<LuaExecutor> create(size_t workerCount = 0);
+
+    /**
+     * @brief Call a function on a worker, a Lua function is run by the virtual machine of the worker
+     * @param func
+     * @param args
+     * @return Resolved with the return value, rejected with the error
+     */
+    LuaFuture submit(const GAny &func, const std::vector<GAny> &args = {});
+
+    /**
+     * @brief Call the function returned by a chunk on a worker,
+     *        the chunk is run once per worker and its function is kept for the following tasks
+     * @param chunk
+     * @param args
+     * @return Resolved with the return value, rejected with the error
+     */
+    LuaFuture submitChunk(const std::shared_ptr<LuaChunk> &chunk, const std::vector<GAny> &args = {});
+
+    /**
+     * @brief Call an entry point of a module loaded by requireLs on a worker,
+     *        the module is loaded once per worker and kept for the following tasks
+     * @param module    Module name (see GAnyLuaVM::requireLs)
+     * @param entry     Name of the function in the module
+     * @param args
+     * @return Resolved with the return value, rejected with the error
+     */
+    LuaFuture submitModule(const std::string &module, const std::string &entry, const std::vector<GAny> &args = {});
+
+    /**
+     * @brief Run a C++ task on a worker, the virtual machine of the worker is the current one during the task
+     * @param task
+     * @return Resolved with the return value, rejected with the error
+     */
+    LuaFuture execute(std::function<GAny(GAnyLuaVM &vm)> task);
+
+    size_t workerCount() const;
+
+    /**
+     * @brief Determine whether the calling thread is a worker of this executor
+     * @return
+     */
+    bool isWorkerThread() const;
+
+    /**
+     * @brief Number of tasks submitted and not yet started
+     * @return
+     */
+    size_t pendingCount() const;
+
+    /**
+     * @brief Number of tasks taken from the deque of another worker
+     * @return
+     */
+    uint64_t stolenCount() const;
+
+    /**
+     * @brief Stop the workers after their running tasks, the pending tasks are rejected
+     */
+    void shutdown();
+
+private:
+    struct Worker;
+
+    using Task = std::function<void(Worker &worker)>;
+
+    struct Worker
+    {
+        size_t index;
+        std::thread thread;
+        std::mutex lock;
+        std::deque<Task> tasks;
+
+        /// Only accessed by the thread of the worker
+        std::shared_ptr<GAnyLuaVM> vm;
+        std::unordered_map<const LuaChunk *, std::pair<std::shared_ptr<LuaChunk>, GAny>> chunks;
+        std::unordered_map<std::string, GAny> modules;
+    };
+
+    LuaFuture post(std::function<GAny(Worker &worker)> func);
+
+    void workerMain(Worker &worker);
+
+    bool takeTask(Worker &worker, Task &task);
+
+private:
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    WorkerInit mInit;
+
+    std::mutex mIdleLock;
+    std::condition_variable mIdleCond;
+    std::atomic<size_t> mPending{0};
+    std::atomic<size_t> mNextWorker{0};
+    std::atomic<uint64_t> mStolen{0};
+    std::atomic<bool> mStopped{false};
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_EXECUTOR_H
@@ -23,6 +23,7 @@
 #include "lua_function.h"
 
 #include "gany_lua_vm.h"
+#include "lua_chunk.h"
 
 #include <gx/debug.h>
 
@@ -37,12 +38,15 @@ int luaDumpWriter(lua_State *, const void *p, size_t sz, void *ud)
 }
 
 LuaFunction::LuaFunction(lua_State *L, int idx)
-        : mLuaVM(GAnyLuaVM::threadLocal())
 {
     if (!lua_isfunction(L, idx)) {
-        mLuaVM.reset();
         return;
     }
+    GAnyLuaVM *vm = GAnyLuaVM::fromLuaState(L);
+    mLuaVM = vm->weak_from_this();
+    mVM = vm;
+    mVMId = vm->id();
+
     lua_pushvalue(L, idx);
     mFunRef = luaL_ref(L, LUA_REGISTRYINDEX);
 }
@@ -51,7 +55,8 @@ LuaFunction::~LuaFunction()
 {
     auto vm = mLuaVM.lock();
     if (vm && mFunRef != 0) {
-        luaL_unref(vm->getLuaState(), LUA_REGISTRYINDEX, mFunRef);
+        // May be released on any thread, the VM defers the unref to its own thread
+        vm->releaseLuaRef(mFunRef);
     }
 }
 
@@ -62,7 +67,12 @@ bool LuaFunction::valid() const
 
 bool LuaFunction::checkVM() const
 {
-    return mLuaVM.lock() == GAnyLuaVM::threadLocal();
+    return checkVM(GAnyLuaVM::current());
+}
+
+bool LuaFunction::checkVM(const GAnyLuaVM *vm) const
+{
+    return vm && mVM == vm && mVMId == vm->id();
 }
 
 void LuaFunction::push(lua_State *L) const
@@ -86,15 +96,117 @@ GByteArray LuaFunction::dump() const
     return buff;
 }
 
+LuaFunctionCode::LuaFunctionCode(const void *proto, std::string name)
+        : mProto(proto), mName(std::move(name))
+{
+}
+
+const std::string &LuaFunctionCode::name() const
+{
+    return mName;
+}
+
+std::shared_ptr<LuaChunk> LuaFunctionCode::chunk(lua_State *L, const std::shared_ptr<LuaFunction> &func)
+{
+    if (mDumped.load(std::memory_order_acquire)) {
+        return mChunk;
+    }
+
+    GLockerGuard locker(mLock);
+    if (!mDumped.load(std::memory_order_relaxed)) {
+        // After all wrappers are released the prototype may have been collected
+        if (!func || func->mFunRef == 0) {
+            return nullptr;
+        }
+        auto vm = func->mLuaVM.lock();
+        if (!vm) {
+            return nullptr;
+        }
+        mChunk = vm->dumpProto(L, mProto, mName);
+        mDumped.store(true, std::memory_order_release);
+    }
+    return mChunk;
+}
+
+void LuaFunctionCode::dump(lua_State *L)
+{
+    if (mDumped.load(std::memory_order_acquire)) {
+        return;
+    }
+    GLockerGuard locker(mLock);
+    if (!mDumped.load(std::memory_order_relaxed)) {
+        mChunk = LuaChunk::dumpProto(L, mProto, mName);
+        mDumped.store(true, std::memory_order_release);
+    }
+}
+
 GLuaFunctionRef::~GLuaFunctionRef()
 {
     auto funcRef = func.lock();
     if (funcRef) {
         auto vm = funcRef->mLuaVM.lock();
         if (vm) {
-            vm->removeLFunctionRef(funcRef);
+            vm->removeLFunctionRef(funcRef->mHandle);
         }
     }
 }
 
+LuaFunctionRegistry::Handle LuaFunctionRegistry::add(const std::shared_ptr<LuaFunction> &func)
+{
+    GLockerGuard locker(mLock);
+    uint32_t index;
+    if (mFreeHead != kNoSlot) {
+        index = mFreeHead;
+        mFreeHead = mSlots[index].nextFree;
+    } else {
+        index = (uint32_t) mSlots.size();
+        mSlots.emplace_back();
+    }
+    Slot &slot = mSlots[index];
+    slot.func = func;
+    slot.nextFree = kNoSlot;
+    mSize++;
+    return ((Handle) slot.generation << 32) | index;
+}
+
+std::shared_ptr<LuaFunction> LuaFunctionRegistry::remove(Handle handle)
+{
+    auto index = (uint32_t) (handle & 0xffffffff);
+    auto generation = (uint32_t) (handle >> 32);
+
+    GLockerGuard locker(mLock);
+    if (index >= mSlots.size() || mSlots[index].generation != generation || !mSlots[index].func) {
+        return nullptr;
+    }
+    Slot &slot = mSlots[index];
+    std::shared_ptr<LuaFunction> func = std::move(slot.func);
+    slot.func = nullptr;
+    // Skip 0 on wrap around, so that a handle is never 0
+    if (++slot.generation == 0) {
+        slot.generation = 1;
+    }
+    slot.nextFree = mFreeHead;
+    mFreeHead = index;
+    mSize--;
+    return func;
+}
+
+void LuaFunctionRegistry::clear()
+{
+    std::vector<Slot> slots;
+    {
+        GLockerGuard locker(mLock);
+        slots.swap(mSlots);
+        mFreeHead = kNoSlot;
+        mSize = 0;
+    }
+    // Functions are released here, outside the lock
+}
+
+size_t LuaFunctionRegistry::size() const
+{
+    GLockerGuard locker(mLock);
+    return mSize;
+}
+
 GX_NS_END
\ No newline at end of file
@@ -27,7 +27,12 @@
 
 #include <gx/gbytearray.h>
 
+#include <gx/gmutex.h>
+
+#include <atomic>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <lua.hpp>
 
@@ -36,6 +41,8 @@ GX_NS_BEGIN
 
 class GAnyLuaVM;
 
+class LuaChunk;
+
 /**
  * @brief Wrapping Lua functions to assist in persisting and multithreading Lua functions
  */
@@ -73,6 +80,13 @@ public:
      */
     bool checkVM() const;
 
+    /**
+     * @brief Determine whether the current function belongs to the specified Lua vm
+     * @param vm
+     * @return
+     */
+    bool checkVM(const GAnyLuaVM *vm) const;
+
     /**
      * @brief Push the current Lua function onto the stack
      * @param L
@@ -87,9 +101,107 @@ public:
 
 private:
     friend class GLuaFunctionRef;
+    friend class GAnyLuaVM;
+    friend class LuaFunctionCode;
 
     std::weak_ptr<GAnyLuaVM> mLuaVM;
+    /// Non-owning, only compared together with the id, use mLuaVM to access the VM from other threads
+    const GAnyLuaVM *mVM = nullptr;
+    uint64_t mVMId = 0;
     int mFunRef = 0;
+    uint64_t mHandle = 0;
+};
+
+/**
+ * @brief Registry of the Lua functions of a virtual machine held by GAny. <br>
+ *        A generational slot map, adding and removing are O(1) and stale handles are ignored
+ */
+class LuaFunctionRegistry
+{
+public:
+    using Handle = uint64_t;
+
+    /**
+     * @brief Add a function
+     * @param func
+     * @return Handle of the function, never 0
+     */
+    Handle add(const std::shared_ptr<LuaFunction> &func);
+
+    /**
+     * @brief Remove a function. The function is returned so that it is released outside the lock
+     * @param handle
+     * @return nullptr if the handle is stale
+     */
+    std::shared_ptr<LuaFunction> remove(Handle handle);
+
+    /**
+     * @brief Remove all functions
+     */
+    void clear();
+
+    size_t size() const;
+
+private:
+    struct Slot
+    {
+        std::shared_ptr<LuaFunction> func;
+        uint32_t generation = 1;
+        uint32_t nextFree = 0;
+    };
+
+    static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+    mutable GMutex mLock;
+    std::vector<Slot> mSlots;
+    uint32_t mFreeHead = kNoSlot;
+    size_t mSize = 0;
+};
+
+/**
+ * @brief Bytecode of a Lua function prototype, used to call the function from other threads. <br>
+ *        Dumped on the first call from another thread and shared by all wrappers of the same prototype
+ */
+class LuaFunctionCode
+{
+public:
+    /**
+     * @brief Constructor
+     * @param proto     Function prototype, must outlive this object (held by the wrapped functions)
+     * @param name      Chunk name
+     */
+    explicit LuaFunctionCode(const void *proto, std::string name);
+
+    LuaFunctionCode(const LuaFunctionCode &) = delete;
+
+    LuaFunctionCode &operator=(const LuaFunctionCode &) = delete;
+
+    const std::string &name() const;
+
+    /**
+     * @brief Get the bytecode chunk, dump it on first use (thread safe). <br>
+     *        The caller holds func during the call: its reference keeps the prototype from being collected,
+     *        and the owner VM is kept open until the dump is complete (see GAnyLuaVM::dumpProto)
+     * @param L     Lua state of the calling thread
+     * @param func  A wrapper of the prototype
+     * @return nullptr if the prototype cannot be dumped
+     */
+    std::shared_ptr<LuaChunk> chunk(lua_State *L, const std::shared_ptr<LuaFunction> &func);
+
+    /**
+     * @brief Dump the bytecode now if not done yet, called by the owner VM before it is shut down
+     *        so that the functions held outside it stay callable from other threads
+     * @param L     Lua state of the owner VM, the prototype must be alive
+     */
+    void dump(lua_State *L);
+
+private:
+    const void *mProto;
+    std::string mName;
+
+    GMutex mLock;
+    std::atomic<bool> mDumped{false};
+    std::shared_ptr<LuaChunk> mChunk;
 };
 
 /**
@@ -97,7 +209,7 @@ private:
  */
 struct GLuaFunctionRef
 {
-    GByteArray byteCode;
+    std::shared_ptr<LuaFunctionCode> code;
     std::weak_ptr<LuaFunction> func;
 
     ~GLuaFunctionRef();
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_future.h"
+
+#include <chrono>
+#include <mutex>
+
+
+GX_NS_BEGIN
+
+LuaFuture::LuaFuture()
+        : mState(std::make_shared<SharedState>())
+{
+}
+
+LuaFuture LuaFuture::resolved(const GAny &value)
+{
+    LuaFuture future;
+    future.resolve(value);
+    return future;
+}
+
+LuaFuture LuaFuture::rejected(const std::string &error)
+{
+    LuaFuture future;
+    future.reject(error);
+    return future;
+}
+
+LuaFuture LuaFuture::all(const std::vector<LuaFuture> &futures)
+{
+    if (futures.empty()) {
+        return resolved(GAny::array());
+    }
+
+    struct Gather
+    {
+        GMutex lock;
+        std::vector<GAny> values;
+        size_t remaining;
+    };
+    auto gather = std::make_shared<Gather>();
+    gather->values.resize(futures.size());
+    gather->remaining = futures.size();
+
+    LuaFuture result;
+    for (size_t i = 0; i < futures.size(); i++) {
+        futures[i].then([result, gather, i](const LuaFuture &future) mutable {
+            if (future.isRejected()) {
+                result.reject(future.error());
+                return;
+            }
+            bool last;
+            {
+                GLockerGuard locker(gather->lock);
+                gather->values[i] = future.value();
+                last = --gather->remaining == 0;
+            }
+            if (last) {
+                result.resolve(GAny::array(gather->values));
+            }
+        });
+    }
+    return result;
+}
+
+LuaFuture LuaFuture::race(const std::vector<LuaFuture> &futures)
+{
+    LuaFuture result;
+    for (const auto &future: futures) {
+        future.then([result](const LuaFuture &f) mutable {
+            if (f.isRejected()) {
+                result.reject(f.error());
+            } else {
+                result.resolve(f.value());
+            }
+        });
+    }
+    return result;
+}
+
+bool LuaFuture::resolve(const GAny &value)
+{
+    return complete(State::Resolved, value, "");
+}
+
+bool LuaFuture::reject(const std::string &error)
+{
+    return complete(State::Rejected, GAny::undefined(), error);
+}
+
+void LuaFuture::then(Callback callback) const
+{
+    {
+        GLockerGuard locker(mState->lock);
+        if (mState->state == State::Pending) {
+            mState->callbacks.push_back(std::move(callback));
+            return;
+        }
+    }
+    callback(*this);
+}
+
+LuaFuture::State LuaFuture::state() const
+{
+    GLockerGuard locker(mState->lock);
+    return mState->state;
+}
+
+bool LuaFuture::isDone() const
+{
+    return state() != State::Pending;
+}
+
+bool LuaFuture::isResolved() const
+{
+    return state() == State::Resolved;
+}
+
+bool LuaFuture::isRejected() const
+{
+    return state() == State::Rejected;
+}
+
+GAny LuaFuture::value() const
+{
+    GLockerGuard locker(mState->lock);
+    return mState->value;
+}
+
+std::string LuaFuture::error() const
+{
+    GLockerGuard locker(mState->lock);
+    return mState->error;
+}
+
+bool LuaFuture::wait(int32_t timeoutMs) const
+{
+    std::unique_lock<GMutex> locker(mState->lock);
+    auto done = [this] { return mState->state != State::Pending; };
+    if (timeoutMs < 0) {
+        mState->cond.wait(locker, done);
+        return true;
+    }
+    return mState->cond.wait_for(locker, std::chrono::milliseconds(timeoutMs), done);
+}
+
+bool LuaFuture::complete(State state, const GAny &value, const std::string &error)
+{
+    std::vector<Callback> callbacks;
+    {
+        GLockerGuard locker(mState->lock);
+        if (mState->state != State::Pending) {
+            return false;
+        }
+        mState->state = state;
+        mState->value = value;
+        mState->error = error;
+        callbacks.swap(mState->callbacks);
+    }
+    mState->cond.notify_all();
+
+    // Callbacks run without the lock, they may inspect or chain the future
+    for (auto &callback: callbacks) {
+        callback(*this);
+    }
+    return true;
+}
+
+GX_NS_END
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_FUTURE_H
+#define GX_SCRIPT_LUA_FUTURE_H
+
+#include <gx/gobject.h>
+
+#include <gx/gany.h>
+
+#include <gx/gmutex.h>
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaFuture
+ * @brief The result of an asynchronous operation, it is completed once by resolve or reject from any thread. <br>
+ *        Copies share the same state, so a C++ function can return it as a GAny and complete it later. <br>
+ *        Lua awaits it with Async.await, which suspends a request coroutine instead of blocking the thread.
+ */
+class LuaFuture
+{
+public:
+    enum class State
+    {
+        Pending,
+        Resolved,
+        Rejected,
+    };
+
+    using Callback = std::function<void(const LuaFuture &future)>;
+
+public:
+    LuaFuture();
+
+    LuaFuture(const LuaFuture &b) = default;
+
+    LuaFuture(LuaFuture &&b) noexcept = default;
+
+    LuaFuture &operator=(const LuaFuture &b) = default;
+
+    LuaFuture &operator=(LuaFuture &&b) noexcept = default;
+
+    /**
+     * @brief Create a future that is already resolved
+     * @param value
+     * @return
+     */
+    static LuaFuture resolved(const GAny &value);
+
+    /**
+     * @brief Create a future that is already rejected
+     * @param error
+     * @return
+     */
+    static LuaFuture rejected(const std::string &error);
+
+    /**
+     * @brief Create a future resolved with the array of values when all futures are resolved,
+     *        rejected as soon as one of them is rejected
+     * @param futures
+     * @return
+     */
+    static LuaFuture all(const std::vector<LuaFuture> &futures);
+
+    /**
+     * @brief Create a future settled like the first of the futures to be settled
+     * @param futures
+     * @return
+     */
+    static LuaFuture race(const std::vector<LuaFuture> &futures);
+
+public:
+    /**
+     * @brief Complete the future with a value
+     * @param value
+     * @return false if already completed
+     */
+    bool resolve(const GAny &value = GAny::undefined());
+
+    /**
+     * @brief Complete the future with an error
+     * @param error
+     * @return false if already completed
+     */
+    bool reject(const std::string &error);
+
+    /**
+     * @brief Add a callback called once when the future is completed, on the thread that completes it.
+     *        Called immediately if the future is already completed
+     * @param callback
+     */
+    void then(Callback callback) const;
+
+    State state() const;
+
+    bool isDone() const;
+
+    bool isResolved() const;
+
+    bool isRejected() const;
+
+    /**
+     * @brief Value of the resolved future
+     * @return
+     */
+    GAny value() const;
+
+    /**
+     * @brief Error of the rejected future
+     * @return
+     */
+    std::string error() const;
+
+    /**
+     * @brief Block the calling thread until the future is completed
+     * @param timeoutMs     Maximum waiting time, negative numbers wait forever
+     * @return false if timed out
+     */
+    bool wait(int32_t timeoutMs = -1) const;
+
+    bool operator==(const LuaFuture &rhs) const
+    {
+        return mState == rhs.mState;
+    }
+
+private:
+    struct SharedState
+    {
+        mutable GMutex lock;
+        /// gx has no condition variable, condition_variable_any waits on the GMutex directly
+        std::condition_variable_any cond;
+        State state = State::Pending;
+        GAny value;
+        std::string error;
+        std::vector<Callback> callbacks;
+    };
+
+    bool complete(State state, const GAny &value, const std::string &error);
+
+private:
+    std::shared_ptr<SharedState> mState;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_FUTURE_H
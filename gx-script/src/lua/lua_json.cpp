@@ -0,0 +1,927 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_json.h"
+
+#include "gany_lua_vm.h"
+#include "lua_byte_view_to_lua.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+GX_NS_BEGIN
+
+#define JSON_ARRAY_META "LuaJsonArray"
+#define JSON_WRITER_META "LuaJsonWriter"
+
+/// Deepest nesting of arrays and objects, also stops the encoding of tables referencing themselves
+#define JSON_MAX_DEPTH 1000
+
+/// Number of elements kept on the stack before they are moved into the table being parsed
+#define JSON_BATCH 128
+
+/// Json.null
+#define JSON_NULL nullptr
+
+enum SaxCallback
+{
+    SaxStartObject,
+    SaxEndObject,
+    SaxStartArray,
+    SaxEndArray,
+    SaxKey,
+    SaxValue,
+    SaxCount,
+};
+
+static const char *const sSaxNames[SaxCount] = {
+        "startObject", "endObject", "startArray", "endArray", "key", "value"
+};
+
+struct JsonParser
+{
+    lua_State *L;
+    const char *begin;
+    const char *p;
+    const char *end;
+    int depth;
+    /// Stack index of the first SAX callback, 0 when building tables
+    int handler;
+    bool stopped;
+};
+
+/**
+ * @brief Output buffer of encode, a userdata so that it is freed by the GC when an error is raised
+ */
+struct JsonWriter
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+// Parser
+
+static void parseError(JsonParser &ps, const char *at, const char *msg)
+{
+    luaL_error(ps.L, "Json error: %s at offset %I", msg, (lua_Integer) (at - ps.begin));
+}
+
+static void skipWhitespace(JsonParser &ps)
+{
+    const char *p = ps.p;
+    while (p < ps.end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+        p++;
+    }
+    ps.p = p;
+}
+
+static void emit(JsonParser &ps, SaxCallback callback, int nargs)
+{
+    lua_State *L = ps.L;
+    int func = ps.handler + callback;
+    if (ps.stopped || lua_isnil(L, func)) {
+        lua_pop(L, nargs);
+        return;
+    }
+    lua_pushvalue(L, func);
+    lua_insert(L, -(nargs + 1));
+    lua_call(L, nargs, 1);
+    if (lua_isboolean(L, -1) && !lua_toboolean(L, -1)) {
+        ps.stopped = true;
+    }
+    lua_pop(L, 1);
+}
+
+static uint32_t parseHex4(JsonParser &ps, const char *&q)
+{
+    if (ps.end - q < 4) {
+        parseError(ps, q, "invalid \\u escape");
+    }
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *q++;
+        v <<= 4;
+        if (c >= '0' && c <= '9') {
+            v |= (uint32_t) (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            v |= (uint32_t) (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            v |= (uint32_t) (c - 'A' + 10);
+        } else {
+            parseError(ps, q - 1, "invalid \\u escape");
+        }
+    }
+    return v;
+}
+
+static void addUtf8(luaL_Buffer *b, uint32_t cp)
+{
+    char buf[4];
+    size_t n;
+    if (cp < 0x80) {
+        buf[0] = (char) cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        buf[0] = (char) (0xC0 | (cp >> 6));
+        buf[1] = (char) (0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        buf[0] = (char) (0xE0 | (cp >> 12));
+        buf[1] = (char) (0x80 | ((cp >> 6) & 0x3F));
+        buf[2] = (char) (0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        buf[0] = (char) (0xF0 | (cp >> 18));
+        buf[1] = (char) (0x80 | ((cp >> 12) & 0x3F));
+        buf[2] = (char) (0x80 | ((cp >> 6) & 0x3F));
+        buf[3] = (char) (0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    luaL_addlstring(b, buf, n);
+}
+
+/**
+ * @brief Push the string starting at ps.p (the opening quote). Without escapes it is pushed straight from the source
+ */
+static void parseString(JsonParser &ps)
+{
+    lua_State *L = ps.L;
+    const char *start = ps.p + 1;
+    const char *q = start;
+    while (q < ps.end) {
+        auto c = (unsigned char) *q;
+        if (c == '"') {
+            lua_pushlstring(L, start, q - start);
+            ps.p = q + 1;
+            return;
+        }
+        if (c == '\\') {
+            break;
+        }
+        if (c < 0x20) {
+            parseError(ps, q, "control character in string");
+        }
+        q++;
+    }
+    if (q >= ps.end) {
+        parseError(ps, ps.p, "unterminated string");
+    }
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    luaL_addlstring(&b, start, q - start);
+    while (true) {
+        if (q >= ps.end) {
+            parseError(ps, ps.p, "unterminated string");
+        }
+        auto c = (unsigned char) *q++;
+        if (c == '"') {
+            break;
+        }
+        if (c < 0x20) {
+            parseError(ps, q - 1, "control character in string");
+        }
+        if (c != '\\') {
+            luaL_addchar(&b, (char) c);
+            continue;
+        }
+        if (q >= ps.end) {
+            parseError(ps, ps.p, "unterminated string");
+        }
+        char e = *q++;
+        switch (e) {
+            case '"':
+            case '\\':
+            case '/':
+                luaL_addchar(&b, e);
+                break;
+            case 'b':
+                luaL_addchar(&b, '\b');
+                break;
+            case 'f':
+                luaL_addchar(&b, '\f');
+                break;
+            case 'n':
+                luaL_addchar(&b, '\n');
+                break;
+            case 'r':
+                luaL_addchar(&b, '\r');
+                break;
+            case 't':
+                luaL_addchar(&b, '\t');
+                break;
+            case 'u': {
+                uint32_t cp = parseHex4(ps, q);
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (ps.end - q < 2 || q[0] != '\\' || q[1] != 'u') {
+                        parseError(ps, q, "missing low surrogate");
+                    }
+                    q += 2;
+                    uint32_t lo = parseHex4(ps, q);
+                    if (lo < 0xDC00 || lo > 0xDFFF) {
+                        parseError(ps, q - 4, "invalid low surrogate");
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    parseError(ps, q - 4, "unexpected low surrogate");
+                }
+                addUtf8(&b, cp);
+                break;
+            }
+            default:
+                parseError(ps, q - 1, "invalid escape");
+        }
+    }
+    luaL_pushresult(&b);
+    ps.p = q;
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static void parseNumber(JsonParser &ps)
+{
+    lua_State *L = ps.L;
+    const char *start = ps.p;
+    const char *q = start;
+    bool negative = false;
+    if (q < ps.end && *q == '-') {
+        negative = true;
+        q++;
+    }
+    if (q >= ps.end || !isDigit(*q)) {
+        parseError(ps, q, "invalid number");
+    }
+    const char *digits = q;
+    if (*q == '0') {
+        q++;
+    } else {
+        while (q < ps.end && isDigit(*q)) {
+            q++;
+        }
+    }
+    size_t intDigits = q - digits;
+    bool isInteger = true;
+    if (q < ps.end && *q == '.') {
+        isInteger = false;
+        q++;
+        if (q >= ps.end || !isDigit(*q)) {
+            parseError(ps, q, "invalid number");
+        }
+        while (q < ps.end && isDigit(*q)) {
+            q++;
+        }
+    }
+    if (q < ps.end && (*q == 'e' || *q == 'E')) {
+        isInteger = false;
+        q++;
+        if (q < ps.end && (*q == '+' || *q == '-')) {
+            q++;
+        }
+        if (q >= ps.end || !isDigit(*q)) {
+            parseError(ps, q, "invalid number");
+        }
+        while (q < ps.end && isDigit(*q)) {
+            q++;
+        }
+    }
+    ps.p = q;
+
+    // Up to 18 digits always fit in lua_Integer
+    if (isInteger && intDigits <= 18) {
+        lua_Integer v = 0;
+        for (const char *d = digits; d < q; d++) {
+            v = v * 10 + (*d - '0');
+        }
+        lua_pushinteger(L, negative ? -v : v);
+        return;
+    }
+
+    // The source may not be terminated, convert a terminated copy
+    char buf[64];
+    size_t len = q - start;
+    if (len < sizeof(buf)) {
+        memcpy(buf, start, len);
+        buf[len] = '\0';
+        if (lua_stringtonumber(L, buf) == 0) {
+            parseError(ps, start, "invalid number");
+        }
+    } else {
+        lua_pushlstring(L, start, len);
+        if (lua_stringtonumber(L, lua_tostring(L, -1)) == 0) {
+            parseError(ps, start, "invalid number");
+        }
+        lua_remove(L, -2);
+    }
+}
+
+static void expectLiteral(JsonParser &ps, const char *literal, size_t len)
+{
+    if ((size_t) (ps.end - ps.p) < len || memcmp(ps.p, literal, len) != 0) {
+        parseError(ps, ps.p, "unexpected character");
+    }
+    ps.p += len;
+}
+
+static void parseValue(JsonParser &ps);
+
+/**
+ * @brief Move the values on the top of the stack into the table, the table is created below them first
+ * @param ps
+ * @param tableIdx  Table index, 0 if not created yet, receives the created index
+ * @param pending   Number of values (array) or key-value pairs (object) on the stack
+ * @param count     Elements already in the array
+ * @param isArray
+ */
+static void flushPending(JsonParser &ps, int &tableIdx, int pending, lua_Integer count, bool isArray)
+{
+    lua_State *L = ps.L;
+    int slots = isArray ? pending : pending * 2;
+    if (tableIdx == 0) {
+        if (isArray) {
+            lua_createtable(L, pending, 0);
+        } else {
+            lua_createtable(L, 0, pending);
+        }
+        lua_insert(L, -(slots + 1));
+        tableIdx = lua_gettop(L) - slots;
+    }
+    int base = lua_gettop(L) - slots + 1;
+    if (isArray) {
+        for (int i = 0; i < pending; i++) {
+            lua_pushvalue(L, base + i);
+            lua_rawseti(L, tableIdx, count + i + 1);
+        }
+    } else {
+        // In source order so that the last of duplicate keys wins
+        for (int i = 0; i < pending; i++) {
+            lua_pushvalue(L, base + i * 2);
+            lua_pushvalue(L, base + i * 2 + 1);
+            lua_rawset(L, tableIdx);
+        }
+    }
+    lua_settop(L, base - 1);
+}
+
+static void parseContainer(JsonParser &ps, bool isArray)
+{
+    lua_State *L = ps.L;
+    const char close = isArray ? ']' : '}';
+    if (++ps.depth > JSON_MAX_DEPTH) {
+        parseError(ps, ps.p, "nesting too deep");
+    }
+    luaL_checkstack(L, JSON_BATCH * 2 + 8, "Json nesting too deep");
+    ps.p++;
+
+    const bool building = ps.handler == 0;
+    if (!building) {
+        emit(ps, isArray ? SaxStartArray : SaxStartObject, 0);
+    }
+
+    int tableIdx = 0;
+    int pending = 0;
+    lua_Integer count = 0;
+
+    skipWhitespace(ps);
+    if (ps.p < ps.end && *ps.p == close) {
+        ps.p++;
+    } else {
+        while (!ps.stopped) {
+            if (!isArray) {
+                skipWhitespace(ps);
+                if (ps.p >= ps.end || *ps.p != '"') {
+                    parseError(ps, ps.p, "expected string key");
+                }
+                parseString(ps);
+                if (!building) {
+                    emit(ps, SaxKey, 1);
+                }
+                skipWhitespace(ps);
+                if (ps.p >= ps.end || *ps.p != ':') {
+                    parseError(ps, ps.p, "expected ':'");
+                }
+                ps.p++;
+            }
+            parseValue(ps);
+            if (building && ++pending == JSON_BATCH) {
+                flushPending(ps, tableIdx, pending, count, isArray);
+                count += pending;
+                pending = 0;
+            }
+            skipWhitespace(ps);
+            if (ps.p < ps.end && *ps.p == ',') {
+                ps.p++;
+                continue;
+            }
+            if (ps.p < ps.end && *ps.p == close) {
+                ps.p++;
+                break;
+            }
+            parseError(ps, ps.p, isArray ? "expected ',' or ']'" : "expected ',' or '}'");
+        }
+    }
+
+    ps.depth--;
+    if (!building) {
+        emit(ps, isArray ? SaxEndArray : SaxEndObject, 0);
+        return;
+    }
+    flushPending(ps, tableIdx, pending, count, isArray);
+    if (isArray) {
+        LuaJson::markArray(L);
+    }
+}
+
+static void parseValue(JsonParser &ps)
+{
+    lua_State *L = ps.L;
+    skipWhitespace(ps);
+    if (ps.p >= ps.end) {
+        parseError(ps, ps.p, "unexpected end");
+    }
+    switch (*ps.p) {
+        case '{':
+            parseContainer(ps, false);
+            return;
+        case '[':
+            parseContainer(ps, true);
+            return;
+        case '"':
+            parseString(ps);
+            break;
+        case 't':
+            expectLiteral(ps, "true", 4);
+            lua_pushboolean(L, 1);
+            break;
+        case 'f':
+            expectLiteral(ps, "false", 5);
+            lua_pushboolean(L, 0);
+            break;
+        case 'n':
+            expectLiteral(ps, "null", 4);
+            LuaJson::pushNull(L);
+            break;
+        default:
+            if (*ps.p != '-' && !isDigit(*ps.p)) {
+                parseError(ps, ps.p, "unexpected character");
+            }
+            parseNumber(ps);
+            break;
+    }
+    if (ps.handler != 0) {
+        emit(ps, SaxValue, 1);
+    }
+}
+
+static void initParser(lua_State *L, JsonParser &ps, int idx)
+{
+    size_t size = 0;
+    const char *data;
+    if (lua_type(L, idx) == LUA_TSTRING) {
+        data = lua_tolstring(L, idx, &size);
+    } else if (LuaByteViewToLua::isProxy(L, idx)) {
+        data = reinterpret_cast<const char *>(LuaByteViewToLua::toBytes(L, idx, size));
+    } else {
+        luaL_typeerror(L, idx, "string or LuaByteView");
+        return;
+    }
+    ps.L = L;
+    ps.begin = data;
+    ps.p = data;
+    ps.end = data + size;
+    ps.depth = 0;
+    ps.handler = 0;
+    ps.stopped = false;
+}
+
+// Writer
+
+static void reserve(lua_State *L, JsonWriter *w, size_t n)
+{
+    if (w->capacity - w->size >= n) {
+        return;
+    }
+    size_t capacity = w->capacity < 256 ? 256 : w->capacity * 2;
+    while (capacity - w->size < n) {
+        capacity *= 2;
+    }
+    auto *data = (char *) realloc(w->data, capacity);
+    if (!data) {
+        luaL_error(L, "Json.encode error: out of memory");
+    }
+    w->data = data;
+    w->capacity = capacity;
+}
+
+static void append(lua_State *L, JsonWriter *w, const char *s, size_t n)
+{
+    reserve(L, w, n);
+    memcpy(w->data + w->size, s, n);
+    w->size += n;
+}
+
+static void appendChar(lua_State *L, JsonWriter *w, char c)
+{
+    reserve(L, w, 1);
+    w->data[w->size++] = c;
+}
+
+static void appendString(lua_State *L, JsonWriter *w, const char *s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    // Worst case every byte is written as \u00XX
+    reserve(L, w, len * 6 + 2);
+    char *out = w->data + w->size;
+    *out++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        auto c = (unsigned char) s[i];
+        switch (c) {
+            case '"':
+                *out++ = '\\';
+                *out++ = '"';
+                break;
+            case '\\':
+                *out++ = '\\';
+                *out++ = '\\';
+                break;
+            case '\b':
+                *out++ = '\\';
+                *out++ = 'b';
+                break;
+            case '\f':
+                *out++ = '\\';
+                *out++ = 'f';
+                break;
+            case '\n':
+                *out++ = '\\';
+                *out++ = 'n';
+                break;
+            case '\r':
+                *out++ = '\\';
+                *out++ = 'r';
+                break;
+            case '\t':
+                *out++ = '\\';
+                *out++ = 't';
+                break;
+            default:
+                if (c < 0x20) {
+                    memcpy(out, "\\u00", 4);
+                    out[4] = hex[c >> 4];
+                    out[5] = hex[c & 0xF];
+                    out += 6;
+                } else {
+                    *out++ = (char) c;
+                }
+                break;
+        }
+    }
+    *out++ = '"';
+    w->size = out - w->data;
+}
+
+static void appendNumber(lua_State *L, JsonWriter *w, int idx)
+{
+    char buf[64];
+    int n;
+    if (lua_isinteger(L, idx)) {
+        n = snprintf(buf, sizeof(buf), LUA_INTEGER_FMT, (LUAI_UACINT) lua_tointeger(L, idx));
+    } else {
+        lua_Number v = lua_tonumber(L, idx);
+        if (!isfinite(v)) {
+            luaL_error(L, "Json.encode error: cannot encode %s", isnan(v) ? "nan" : "inf");
+            return;
+        }
+        // The shortest of 15 or 17 digits that reads back the same value
+        n = snprintf(buf, sizeof(buf), "%.15g", v);
+        if (strtod(buf, nullptr) != v) {
+            n = snprintf(buf, sizeof(buf), "%.17g", v);
+        }
+        // Keep floats distinguishable from integers
+        if (strpbrk(buf, ".eE") == nullptr) {
+            buf[n++] = '.';
+            buf[n++] = '0';
+        }
+    }
+    append(L, w, buf, (size_t) n);
+}
+
+static void appendIndent(lua_State *L, JsonWriter *w, int indent, int level)
+{
+    if (indent < 0) {
+        return;
+    }
+    reserve(L, w, (size_t) (indent * level) + 1);
+    w->data[w->size++] = '\n';
+    memset(w->data + w->size, ' ', (size_t) (indent * level));
+    w->size += (size_t) (indent * level);
+}
+
+bool LuaJson::isArrayTable(lua_State *L, int idx, lua_Integer &length)
+{
+    length = (lua_Integer) lua_rawlen(L, idx);
+    if (lua_getmetatable(L, idx)) {
+        luaL_getmetatable(L, JSON_ARRAY_META);
+        bool marked = lua_rawequal(L, -1, -2);
+        lua_pop(L, 2);
+        if (marked) {
+            return true;
+        }
+    }
+    if (length == 0) {
+        return false;
+    }
+    // A sequence 1..n without other keys
+    lua_Integer keys = 0;
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        lua_pop(L, 1);
+        if (++keys > length) {
+            lua_pop(L, 1);
+            return false;
+        }
+    }
+    return keys == length;
+}
+
+static void encodeValue(lua_State *L, JsonWriter *w, int idx, int depth, int indent);
+
+static void encodeTable(lua_State *L, JsonWriter *w, int idx, int depth, int indent)
+{
+    if (depth >= JSON_MAX_DEPTH) {
+        luaL_error(L, "Json.encode error: nesting too deep (table referencing itself?)");
+        return;
+    }
+    luaL_checkstack(L, 4, "Json.encode nesting too deep");
+
+    lua_Integer length;
+    if (LuaJson::isArrayTable(L, idx, length)) {
+        appendChar(L, w, '[');
+        for (lua_Integer i = 1; i <= length; i++) {
+            if (i > 1) {
+                appendChar(L, w, ',');
+            }
+            appendIndent(L, w, indent, depth + 1);
+            lua_rawgeti(L, idx, i);
+            encodeValue(L, w, lua_gettop(L), depth + 1, indent);
+            lua_pop(L, 1);
+        }
+        if (length > 0) {
+            appendIndent(L, w, indent, depth);
+        }
+        appendChar(L, w, ']');
+        return;
+    }
+
+    appendChar(L, w, '{');
+    bool first = true;
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        if (!first) {
+            appendChar(L, w, ',');
+        }
+        first = false;
+        appendIndent(L, w, indent, depth + 1);
+        int keyType = lua_type(L, -2);
+        if (keyType == LUA_TSTRING) {
+            size_t len;
+            const char *key = lua_tolstring(L, -2, &len);
+            appendString(L, w, key, len);
+        } else if (keyType == LUA_TNUMBER) {
+            // Converted on a copy, lua_next needs the original key
+            lua_pushvalue(L, -2);
+            size_t len;
+            const char *key = lua_tolstring(L, -1, &len);
+            appendString(L, w, key, len);
+            lua_pop(L, 1);
+        } else {
+            luaL_error(L, "Json.encode error: table key must be a string or a number, got %s",
+                       luaL_typename(L, -2));
+            return;
+        }
+        appendChar(L, w, ':');
+        if (indent >= 0) {
+            appendChar(L, w, ' ');
+        }
+        encodeValue(L, w, lua_gettop(L), depth + 1, indent);
+        lua_pop(L, 1);
+    }
+    if (!first) {
+        appendIndent(L, w, indent, depth);
+    }
+    appendChar(L, w, '}');
+}
+
+static void encodeValue(lua_State *L, JsonWriter *w, int idx, int depth, int indent)
+{
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            append(L, w, "null", 4);
+            return;
+        case LUA_TBOOLEAN:
+            if (lua_toboolean(L, idx)) {
+                append(L, w, "true", 4);
+            } else {
+                append(L, w, "false", 5);
+            }
+            return;
+        case LUA_TNUMBER:
+            appendNumber(L, w, idx);
+            return;
+        case LUA_TSTRING: {
+            size_t len;
+            const char *s = lua_tolstring(L, idx, &len);
+            appendString(L, w, s, len);
+            return;
+        }
+        case LUA_TLIGHTUSERDATA:
+            if (LuaJson::isNull(L, idx)) {
+                append(L, w, "null", 4);
+                return;
+            }
+            break;
+        case LUA_TTABLE:
+            encodeTable(L, w, idx, depth, indent);
+            return;
+        case LUA_TUSERDATA:
+            if (GAnyLuaVM::isGAnyLuaObj(L, idx)) {
+                bool ok = true;
+                {
+                    std::string json;
+                    try {
+                        json = GAnyLuaVM::makeLuaObjectToGAny(L, idx).toJsonString();
+                    } catch (GAnyException &e) {
+                        json = e.what();
+                        ok = false;
+                    }
+                    lua_pushlstring(L, json.data(), json.size());
+                }
+                if (!ok) {
+                    lua_error(L);
+                    return;
+                }
+                size_t len;
+                const char *s = lua_tolstring(L, -1, &len);
+                append(L, w, s, len);
+                lua_pop(L, 1);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    luaL_error(L, "Json.encode error: cannot encode %s", luaL_typename(L, idx));
+}
+
+// Lua functions
+
+void LuaJson::markArray(lua_State *L)
+{
+    luaL_setmetatable(L, JSON_ARRAY_META);
+}
+
+void LuaJson::pushNull(lua_State *L)
+{
+    lua_pushlightuserdata(L, JSON_NULL);
+}
+
+bool LuaJson::isNull(lua_State *L, int idx)
+{
+    return lua_type(L, idx) == LUA_TLIGHTUSERDATA && lua_touserdata(L, idx) == JSON_NULL;
+}
+
+void LuaJson::toLua(lua_State *L)
+{
+    const luaL_Reg funcs[] = {
+            {"decode",  decode},
+            {"encode",  encode},
+            {"sax",     sax},
+            {"array",   array},
+            {"isArray", isArray},
+            {nullptr,   nullptr}
+    };
+
+    luaL_newmetatable(L, JSON_ARRAY_META);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, JSON_WRITER_META);
+    lua_pushcfunction(L, writerGC);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    luaL_newlib(L, funcs);
+    pushNull(L);
+    lua_setfield(L, -2, "null");
+    lua_setglobal(L, "Json");
+}
+
+int LuaJson::decode(lua_State *L)
+{
+    JsonParser ps{};
+    initParser(L, ps, 1);
+    lua_settop(L, 1);
+    parseValue(ps);
+    skipWhitespace(ps);
+    if (ps.p != ps.end) {
+        parseError(ps, ps.p, "unexpected trailing characters");
+    }
+    return 1;
+}
+
+int LuaJson::encode(lua_State *L)
+{
+    luaL_checkany(L, 1);
+    int indent = (int) luaL_optinteger(L, 2, -1);
+    lua_settop(L, 1);
+
+    auto *w = (JsonWriter *) lua_newuserdatauv(L, sizeof(JsonWriter), 0);
+    w->data = nullptr;
+    w->size = 0;
+    w->capacity = 0;
+    luaL_setmetatable(L, JSON_WRITER_META);
+
+    encodeValue(L, w, 1, 0, indent);
+    lua_pushlstring(L, w->data ? w->data : "", w->size);
+    return 1;
+}
+
+int LuaJson::sax(lua_State *L)
+{
+    JsonParser ps{};
+    initParser(L, ps, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+
+    // The callbacks at fixed stack slots
+    luaL_checkstack(L, SaxCount, nullptr);
+    ps.handler = lua_gettop(L) + 1;
+    for (const char *name: sSaxNames) {
+        lua_getfield(L, 2, name);
+    }
+
+    parseValue(ps);
+    if (!ps.stopped) {
+        skipWhitespace(ps);
+        if (ps.p != ps.end) {
+            parseError(ps, ps.p, "unexpected trailing characters");
+        }
+    }
+    lua_pushboolean(L, !ps.stopped);
+    lua_pushinteger(L, (lua_Integer) (ps.p - ps.begin));
+    return 2;
+}
+
+int LuaJson::array(lua_State *L)
+{
+    if (lua_isnoneornil(L, 1)) {
+        lua_settop(L, 0);
+        lua_newtable(L);
+    } else {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        lua_settop(L, 1);
+    }
+    luaL_setmetatable(L, JSON_ARRAY_META);
+    return 1;
+}
+
+int LuaJson::isArray(lua_State *L)
+{
+    lua_Integer length;
+    lua_pushboolean(L, lua_type(L, 1) == LUA_TTABLE && isArrayTable(L, 1, length));
+    return 1;
+}
+
+int LuaJson::writerGC(lua_State *L)
+{
+    auto *w = (JsonWriter *) luaL_checkudata(L, 1, JSON_WRITER_META);
+    free(w->data);
+    w->data = nullptr;
+    return 0;
+}
+
+GX_NS_END
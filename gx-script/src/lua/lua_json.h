@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_JSON_H
+#define GX_SCRIPT_LUA_JSON_H
+
+#include <gx/gobject.h>
+
+#include <lua.hpp>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaJson
+ * @brief Register the Json table with Lua: a JSON codec working directly on Lua values,
+ *        without the GAny tree of GAny._parseJson and _toJsonString. <br>
+ *        Json.decode(source) parses a string or a LuaByteView into Lua tables, created with the size of the
+ *        elements parsed so far. JSON null is Json.null and arrays get the Json array metatable,
+ *        so empty arrays are encoded back as []. <br>
+ *        Json.encode(value, indent) writes Lua values to a string, a table is an array if it is marked
+ *        by Json.array or its keys are exactly 1..#t, GAny userdata are written by their toJsonString. <br>
+ *        Json.sax(source, handler) parses without building tables, calling the optional functions
+ *        startObject, endObject, startArray, endArray, key(name) and value(v) of the handler,
+ *        a callback returning false stops the parse.
+ */
+class LuaJson
+{
+public:
+    static void toLua(lua_State *L);
+
+    /**
+     * @brief Determine whether a table is written as an array: marked by Json.array or with exactly the keys 1..#t
+     * @param L
+     * @param idx       Table index
+     * @param length    Receives #t
+     * @return
+     */
+    static bool isArrayTable(lua_State *L, int idx, lua_Integer &length);
+
+    /**
+     * @brief Set the Json array metatable on the table on the top of the stack
+     * @param L
+     */
+    static void markArray(lua_State *L);
+
+    /**
+     * @brief Push Json.null
+     * @param L
+     */
+    static void pushNull(lua_State *L);
+
+    static bool isNull(lua_State *L, int idx);
+
+private:
+    static int decode(lua_State *L);
+
+    static int encode(lua_State *L);
+
+    static int sax(lua_State *L);
+
+    static int array(lua_State *L);
+
+    static int isArray(lua_State *L);
+
+    static int writerGC(lua_State *L);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_JSON_H
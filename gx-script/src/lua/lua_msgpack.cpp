@@ -0,0 +1,963 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_msgpack.h"
+
+#include "gany_lua_vm.h"
+#include "lua_byte_view.h"
+#include "lua_byte_view_to_lua.h"
+#include "lua_json.h"
+#include "lua_table.h"
+
+#include <string.h>
+
+
+GX_NS_BEGIN
+
+#define MSGPACK_UNPACKER_META "LuaMsgPackUnpacker"
+#define MSGPACK_WRITER_META "LuaMsgPackWriter"
+
+/// Deepest nesting of arrays and maps, also stops the encoding of tables referencing themselves
+#define MSGPACK_MAX_DEPTH 1000
+
+/**
+ * @brief Stream of MsgPack.unpacker, bytes from offset on are not decoded yet
+ */
+struct MsgPackUnpacker
+{
+    std::string buffer;
+    size_t offset = 0;
+};
+
+// Writer, shared by the GAny and the Lua encoders
+
+static void putBE(std::string &out, uint64_t v, int n)
+{
+    char buf[8];
+    for (int i = 0; i < n; i++) {
+        buf[i] = (char) (v >> (8 * (n - 1 - i)));
+    }
+    out.append(buf, n);
+}
+
+static void packHeader(std::string &out, uint8_t type, uint64_t v, int n)
+{
+    out.push_back((char) type);
+    putBE(out, v, n);
+}
+
+static void packNil(std::string &out)
+{
+    out.push_back((char) 0xc0);
+}
+
+static void packBool(std::string &out, bool v)
+{
+    out.push_back((char) (v ? 0xc3 : 0xc2));
+}
+
+static void packInt(std::string &out, int64_t v)
+{
+    if (v >= 0) {
+        if (v <= 0x7f) {
+            out.push_back((char) v);
+        } else if (v <= 0xff) {
+            packHeader(out, 0xcc, (uint64_t) v, 1);
+        } else if (v <= 0xffff) {
+            packHeader(out, 0xcd, (uint64_t) v, 2);
+        } else if (v <= 0xffffffffLL) {
+            packHeader(out, 0xce, (uint64_t) v, 4);
+        } else {
+            packHeader(out, 0xcf, (uint64_t) v, 8);
+        }
+    } else {
+        if (v >= -32) {
+            out.push_back((char) (int8_t) v);
+        } else if (v >= INT8_MIN) {
+            packHeader(out, 0xd0, (uint64_t) v, 1);
+        } else if (v >= INT16_MIN) {
+            packHeader(out, 0xd1, (uint64_t) v, 2);
+        } else if (v >= INT32_MIN) {
+            packHeader(out, 0xd2, (uint64_t) v, 4);
+        } else {
+            packHeader(out, 0xd3, (uint64_t) v, 8);
+        }
+    }
+}
+
+static void packDouble(std::string &out, double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(double));
+    packHeader(out, 0xcb, bits, 8);
+}
+
+static void packStr(std::string &out, const void *data, size_t len)
+{
+    if (len < 32) {
+        out.push_back((char) (0xa0 | len));
+    } else if (len <= 0xff) {
+        packHeader(out, 0xd9, len, 1);
+    } else if (len <= 0xffff) {
+        packHeader(out, 0xda, len, 2);
+    } else {
+        packHeader(out, 0xdb, len, 4);
+    }
+    out.append(static_cast<const char *>(data), len);
+}
+
+static void packBin(std::string &out, const void *data, size_t len)
+{
+    if (len <= 0xff) {
+        packHeader(out, 0xc4, len, 1);
+    } else if (len <= 0xffff) {
+        packHeader(out, 0xc5, len, 2);
+    } else {
+        packHeader(out, 0xc6, len, 4);
+    }
+    if (len > 0) {
+        out.append(static_cast<const char *>(data), len);
+    }
+}
+
+static void packArrayHeader(std::string &out, size_t n)
+{
+    if (n < 16) {
+        out.push_back((char) (0x90 | n));
+    } else if (n <= 0xffff) {
+        packHeader(out, 0xdc, n, 2);
+    } else {
+        packHeader(out, 0xdd, n, 4);
+    }
+}
+
+static void packMapHeader(std::string &out, size_t n)
+{
+    if (n < 16) {
+        out.push_back((char) (0x80 | n));
+    } else if (n <= 0xffff) {
+        packHeader(out, 0xde, n, 2);
+    } else {
+        packHeader(out, 0xdf, n, 4);
+    }
+}
+
+static void encodeGAny(const GAny &value, std::string &out, int depth)
+{
+    if (value.isUndefined() || value.isNull() || depth > MSGPACK_MAX_DEPTH) {
+        packNil(out);
+    } else if (value.isBoolean()) {
+        packBool(out, value.toBool());
+    } else if (value.isFloat() || value.isDouble()) {
+        packDouble(out, value.toDouble());
+    } else if (value.isNumber()) {
+        packInt(out, value.toInt64());
+    } else if (value.isString()) {
+        const std::string &str = value.as<std::string>();
+        packStr(out, str.data(), str.size());
+    } else if (value.is<GByteArray>()) {
+        const auto &ba = value.as<GByteArray>();
+        packBin(out, ba.data(), (size_t) ba.size());
+    } else if (value.is<LuaByteView>()) {
+        const auto &view = value.as<LuaByteView>();
+        packBin(out, view.data(), view.size());
+    } else if (value.is<LuaTable>()) {
+        encodeGAny(value.toObject(), out, depth + 1);
+    } else if (value.isArray()) {
+        auto n = (size_t) value.size();
+        packArrayHeader(out, n);
+        for (size_t i = 0; i < n; i++) {
+            encodeGAny(value[(int32_t) i], out, depth + 1);
+        }
+    } else if (value.isObject()) {
+        packMapHeader(out, (size_t) value.size());
+        value.call("forEach", [&](const std::string &k, const GAny &v) {
+            packStr(out, k.data(), k.size());
+            encodeGAny(v, out, depth + 1);
+        });
+    } else {
+        packNil(out);
+    }
+}
+
+// Readers
+
+static bool readLength(const uint8_t *data, size_t size, size_t &pos, int n, uint64_t &v)
+{
+    if (size - pos < (size_t) n) {
+        return false;
+    }
+    v = 0;
+    for (int i = 0; i < n; i++) {
+        v = (v << 8) | data[pos++];
+    }
+    return true;
+}
+
+struct GAnyReader
+{
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    std::string error;
+};
+
+static bool readFail(GAnyReader &r, const char *msg)
+{
+    r.error = std::string("MsgPack error: ") + msg + " at offset " + std::to_string(r.pos);
+    return false;
+}
+
+static bool decodeGAny(GAnyReader &r, GAny &value, int depth)
+{
+    if (depth > MSGPACK_MAX_DEPTH) {
+        return readFail(r, "nesting too deep");
+    }
+    uint64_t v;
+    if (!readLength(r.data, r.size, r.pos, 1, v)) {
+        return readFail(r, "truncated data");
+    }
+    auto b = (uint8_t) v;
+    uint64_t n = 0;
+    enum { Scalar, Str, Bin, Array, Map } kind = Scalar;
+
+    if (b <= 0x7f) {
+        value = (int32_t) b;
+        return true;
+    } else if (b >= 0xe0) {
+        value = (int32_t) (int8_t) b;
+        return true;
+    } else if ((b & 0xe0) == 0xa0) {
+        kind = Str;
+        n = b & 0x1f;
+    } else if ((b & 0xf0) == 0x90) {
+        kind = Array;
+        n = b & 0x0f;
+    } else if ((b & 0xf0) == 0x80) {
+        kind = Map;
+        n = b & 0x0f;
+    } else {
+        int len;
+        switch (b) {
+            case 0xc0:
+                value = GAny::null();
+                return true;
+            case 0xc2:
+            case 0xc3:
+                value = b == 0xc3;
+                return true;
+            case 0xcc:
+            case 0xcd:
+            case 0xce:
+            case 0xcf:
+                len = 1 << (b - 0xcc);
+                if (!readLength(r.data, r.size, r.pos, len, v)) {
+                    return readFail(r, "truncated data");
+                }
+                value = v > (uint64_t) INT64_MAX ? GAny(v) : GAny((int64_t) v);
+                return true;
+            case 0xd0:
+            case 0xd1:
+            case 0xd2:
+            case 0xd3: {
+                len = 1 << (b - 0xd0);
+                if (!readLength(r.data, r.size, r.pos, len, v)) {
+                    return readFail(r, "truncated data");
+                }
+                // Sign-extend from len bytes
+                const uint64_t sign = len < 8 ? (uint64_t) 1 << (len * 8 - 1) : 0;
+                value = (int64_t) (len < 8 ? (v ^ sign) - sign : v);
+                return true;
+            }
+            case 0xca: {
+                if (!readLength(r.data, r.size, r.pos, 4, v)) {
+                    return readFail(r, "truncated data");
+                }
+                auto bits = (uint32_t) v;
+                float f;
+                memcpy(&f, &bits, sizeof(float));
+                value = f;
+                return true;
+            }
+            case 0xcb: {
+                if (!readLength(r.data, r.size, r.pos, 8, v)) {
+                    return readFail(r, "truncated data");
+                }
+                double d;
+                memcpy(&d, &v, sizeof(double));
+                value = d;
+                return true;
+            }
+            case 0xd9:
+            case 0xda:
+            case 0xdb:
+                kind = Str;
+                len = 1 << (b - 0xd9);
+                break;
+            case 0xc4:
+            case 0xc5:
+            case 0xc6:
+                kind = Bin;
+                len = 1 << (b - 0xc4);
+                break;
+            case 0xdc:
+            case 0xdd:
+                kind = Array;
+                len = b == 0xdc ? 2 : 4;
+                break;
+            case 0xde:
+            case 0xdf:
+                kind = Map;
+                len = b == 0xde ? 2 : 4;
+                break;
+            default:
+                r.pos--;
+                return readFail(r, "unsupported type (extension types are not supported)");
+        }
+        if (!readLength(r.data, r.size, r.pos, len, n)) {
+            return readFail(r, "truncated data");
+        }
+    }
+
+    switch (kind) {
+        case Str:
+        case Bin:
+            if (r.size - r.pos < n) {
+                return readFail(r, "truncated data");
+            }
+            if (kind == Str) {
+                value = std::string(reinterpret_cast<const char *>(r.data + r.pos), (size_t) n);
+            } else {
+                GByteArray ba;
+                if (n > 0) {
+                    ba.write(r.data + r.pos, (size_t) n);
+                }
+                value = ba;
+            }
+            r.pos += (size_t) n;
+            return true;
+        case Array: {
+            // Every element takes at least one byte
+            if (r.size - r.pos < n) {
+                return readFail(r, "truncated data");
+            }
+            GAny array = GAny::array();
+            for (uint64_t i = 0; i < n; i++) {
+                GAny item;
+                if (!decodeGAny(r, item, depth + 1)) {
+                    return false;
+                }
+                array.pushBack(item);
+            }
+            value = array;
+            return true;
+        }
+        case Map: {
+            if ((r.size - r.pos) / 2 < n) {
+                return readFail(r, "truncated data");
+            }
+            GAny object = GAny::object();
+            for (uint64_t i = 0; i < n; i++) {
+                GAny key, item;
+                if (!decodeGAny(r, key, depth + 1) || !decodeGAny(r, item, depth + 1)) {
+                    return false;
+                }
+                object[key.isString() ? key.as<std::string>() : key.toString()] = item;
+            }
+            value = object;
+            return true;
+        }
+        case Scalar:
+        default:
+            return true;
+    }
+}
+
+struct LuaReader
+{
+    lua_State *L;
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    int depth;
+};
+
+static void luaReadFail(LuaReader &r, const char *msg)
+{
+    luaL_error(r.L, "MsgPack error: %s at offset %I", msg, (lua_Integer) r.pos);
+}
+
+static uint64_t luaRead(LuaReader &r, int n)
+{
+    uint64_t v = 0;
+    if (!readLength(r.data, r.size, r.pos, n, v)) {
+        luaReadFail(r, "truncated data");
+    }
+    return v;
+}
+
+static void decodeLua(LuaReader &r, bool inContainer);
+
+static void decodeLuaString(LuaReader &r, uint64_t n)
+{
+    if (r.size - r.pos < n) {
+        luaReadFail(r, "truncated data");
+    }
+    lua_pushlstring(r.L, reinterpret_cast<const char *>(r.data + r.pos), (size_t) n);
+    r.pos += (size_t) n;
+}
+
+static void decodeLuaContainer(LuaReader &r, uint64_t n, bool isMap)
+{
+    lua_State *L = r.L;
+    if (++r.depth > MSGPACK_MAX_DEPTH) {
+        luaReadFail(r, "nesting too deep");
+    }
+    // Every element takes at least one byte, checked before the table is allocated
+    if ((r.size - r.pos) / (isMap ? 2 : 1) < n) {
+        luaReadFail(r, "truncated data");
+    }
+    luaL_checkstack(L, 4, "MsgPack nesting too deep");
+    if (isMap) {
+        lua_createtable(L, 0, (int) n);
+        for (uint64_t i = 0; i < n; i++) {
+            decodeLua(r, true);
+            decodeLua(r, true);
+            lua_rawset(L, -3);
+        }
+    } else {
+        lua_createtable(L, (int) n, 0);
+        for (uint64_t i = 0; i < n; i++) {
+            decodeLua(r, true);
+            lua_rawseti(L, -2, (lua_Integer) i + 1);
+        }
+        LuaJson::markArray(L);
+    }
+    r.depth--;
+}
+
+static void decodeLua(LuaReader &r, bool inContainer)
+{
+    lua_State *L = r.L;
+    auto b = (uint8_t) luaRead(r, 1);
+    if (b <= 0x7f) {
+        lua_pushinteger(L, b);
+        return;
+    }
+    if (b >= 0xe0) {
+        lua_pushinteger(L, (int8_t) b);
+        return;
+    }
+    if ((b & 0xe0) == 0xa0) {
+        decodeLuaString(r, b & 0x1f);
+        return;
+    }
+    if ((b & 0xf0) == 0x90) {
+        decodeLuaContainer(r, b & 0x0f, false);
+        return;
+    }
+    if ((b & 0xf0) == 0x80) {
+        decodeLuaContainer(r, b & 0x0f, true);
+        return;
+    }
+    switch (b) {
+        case 0xc0:
+            if (inContainer) {
+                LuaJson::pushNull(L);
+            } else {
+                lua_pushnil(L);
+            }
+            break;
+        case 0xc2:
+        case 0xc3:
+            lua_pushboolean(L, b == 0xc3);
+            break;
+        case 0xcc:
+        case 0xcd:
+        case 0xce:
+            lua_pushinteger(L, (lua_Integer) luaRead(r, 1 << (b - 0xcc)));
+            break;
+        case 0xcf: {
+            uint64_t v = luaRead(r, 8);
+            if (v > (uint64_t) INT64_MAX) {
+                lua_pushnumber(L, (lua_Number) v);
+            } else {
+                lua_pushinteger(L, (lua_Integer) v);
+            }
+            break;
+        }
+        case 0xd0:
+            lua_pushinteger(L, (int8_t) luaRead(r, 1));
+            break;
+        case 0xd1:
+            lua_pushinteger(L, (int16_t) luaRead(r, 2));
+            break;
+        case 0xd2:
+            lua_pushinteger(L, (int32_t) luaRead(r, 4));
+            break;
+        case 0xd3:
+            lua_pushinteger(L, (lua_Integer) luaRead(r, 8));
+            break;
+        case 0xca: {
+            auto bits = (uint32_t) luaRead(r, 4);
+            float f;
+            memcpy(&f, &bits, sizeof(float));
+            lua_pushnumber(L, f);
+            break;
+        }
+        case 0xcb: {
+            uint64_t bits = luaRead(r, 8);
+            double d;
+            memcpy(&d, &bits, sizeof(double));
+            lua_pushnumber(L, d);
+            break;
+        }
+        case 0xd9:
+        case 0xda:
+        case 0xdb:
+            decodeLuaString(r, luaRead(r, 1 << (b - 0xd9)));
+            break;
+        case 0xc4:
+        case 0xc5:
+        case 0xc6:
+            decodeLuaString(r, luaRead(r, 1 << (b - 0xc4)));
+            break;
+        case 0xdc:
+        case 0xdd:
+            decodeLuaContainer(r, luaRead(r, b == 0xdc ? 2 : 4), false);
+            break;
+        case 0xde:
+        case 0xdf:
+            decodeLuaContainer(r, luaRead(r, b == 0xde ? 2 : 4), true);
+            break;
+        default:
+            r.pos--;
+            luaReadFail(r, "unsupported type (extension types are not supported)");
+    }
+}
+
+static void encodeLua(lua_State *L, std::string &out, int idx, int depth)
+{
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            packNil(out);
+            return;
+        case LUA_TBOOLEAN:
+            packBool(out, lua_toboolean(L, idx));
+            return;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, idx)) {
+                packInt(out, (int64_t) lua_tointeger(L, idx));
+            } else {
+                packDouble(out, (double) lua_tonumber(L, idx));
+            }
+            return;
+        case LUA_TSTRING: {
+            size_t len;
+            const char *s = lua_tolstring(L, idx, &len);
+            packStr(out, s, len);
+            return;
+        }
+        case LUA_TLIGHTUSERDATA:
+            if (LuaJson::isNull(L, idx)) {
+                packNil(out);
+                return;
+            }
+            break;
+        case LUA_TTABLE: {
+            if (depth >= MSGPACK_MAX_DEPTH) {
+                luaL_error(L, "MsgPack.encode error: nesting too deep (table referencing itself?)");
+                return;
+            }
+            luaL_checkstack(L, 4, "MsgPack.encode nesting too deep");
+            lua_Integer length;
+            if (LuaJson::isArrayTable(L, idx, length)) {
+                packArrayHeader(out, (size_t) length);
+                for (lua_Integer i = 1; i <= length; i++) {
+                    lua_rawgeti(L, idx, i);
+                    encodeLua(L, out, lua_gettop(L), depth + 1);
+                    lua_pop(L, 1);
+                }
+                return;
+            }
+            size_t count = 0;
+            lua_pushnil(L);
+            while (lua_next(L, idx) != 0) {
+                lua_pop(L, 1);
+                count++;
+            }
+            packMapHeader(out, count);
+            lua_pushnil(L);
+            while (lua_next(L, idx) != 0) {
+                int top = lua_gettop(L);
+                encodeLua(L, out, top - 1, depth + 1);
+                encodeLua(L, out, top, depth + 1);
+                lua_pop(L, 1);
+            }
+            return;
+        }
+        case LUA_TUSERDATA: {
+            // GAny userdata and the special userdata (LuaByteView, LuaTypedBuffer, ...) through GAny,
+            // they are the ones with a _name in the metatable
+            if (luaL_getmetafield(L, idx, "_name") == LUA_TNIL) {
+                break;
+            }
+            lua_pop(L, 1);
+            bool ok = true;
+            {
+                std::string error;
+                try {
+                    encodeGAny(GAnyLuaVM::makeLuaObjectToGAny(L, idx), out, depth);
+                } catch (GAnyException &e) {
+                    error = e.what();
+                    ok = false;
+                }
+                if (!ok) {
+                    lua_pushlstring(L, error.data(), error.size());
+                }
+            }
+            if (!ok) {
+                lua_error(L);
+            }
+            return;
+        }
+        default:
+            break;
+    }
+    luaL_error(L, "MsgPack.encode error: cannot encode %s", luaL_typename(L, idx));
+}
+
+static const uint8_t *checkSource(lua_State *L, int idx, size_t &size)
+{
+    if (lua_type(L, idx) == LUA_TSTRING) {
+        return reinterpret_cast<const uint8_t *>(lua_tolstring(L, idx, &size));
+    }
+    if (LuaByteViewToLua::isProxy(L, idx)) {
+        return LuaByteViewToLua::toBytes(L, idx, size);
+    }
+    if (GAnyLuaVM::isGAnyLuaObj(L, idx)) {
+        GAny *obj = glua_getcppobject(L, GAny, idx);
+        if (obj && obj->is<GByteArray>()) {
+            auto &ba = obj->as<GByteArray>();
+            size = (size_t) ba.size();
+            return ba.data();
+        }
+    }
+    luaL_typeerror(L, idx, "string, LuaByteView or GByteArray");
+    return nullptr;
+}
+
+// C++ interface
+
+void LuaMsgPack::encode(const GAny &value, GByteArray &out)
+{
+    std::string buffer;
+    encodeGAny(value, buffer, 0);
+    out.write(buffer.data(), buffer.size());
+}
+
+bool LuaMsgPack::decode(const uint8_t *data, size_t size, size_t &offset, GAny &value, std::string *error)
+{
+    if (offset > size) {
+        if (error) {
+            *error = "MsgPack error: offset out of range";
+        }
+        return false;
+    }
+    GAnyReader reader{data, size, offset, {}};
+    if (!decodeGAny(reader, value, 0)) {
+        if (error) {
+            *error = reader.error;
+        }
+        return false;
+    }
+    offset = reader.pos;
+    return true;
+}
+
+int64_t LuaMsgPack::measure(const uint8_t *data, size_t size)
+{
+    size_t pos = 0;
+    uint64_t remaining = 1;
+    while (remaining > 0) {
+        if (pos >= size) {
+            return 0;
+        }
+        uint8_t b = data[pos++];
+        remaining--;
+        uint64_t skip = 0;
+        uint64_t items = 0;
+        uint64_t n;
+        if (b <= 0x7f || b >= 0xe0 || b == 0xc0 || b == 0xc2 || b == 0xc3) {
+            // Single byte
+        } else if ((b & 0xe0) == 0xa0) {
+            skip = b & 0x1f;
+        } else if ((b & 0xf0) == 0x90) {
+            items = b & 0x0f;
+        } else if ((b & 0xf0) == 0x80) {
+            items = (uint64_t) (b & 0x0f) * 2;
+        } else {
+            switch (b) {
+                case 0xcc:
+                case 0xd0:
+                    skip = 1;
+                    break;
+                case 0xcd:
+                case 0xd1:
+                    skip = 2;
+                    break;
+                case 0xce:
+                case 0xd2:
+                case 0xca:
+                    skip = 4;
+                    break;
+                case 0xcf:
+                case 0xd3:
+                case 0xcb:
+                    skip = 8;
+                    break;
+                case 0xd4:
+                    skip = 2;
+                    break;
+                case 0xd5:
+                    skip = 3;
+                    break;
+                case 0xd6:
+                    skip = 5;
+                    break;
+                case 0xd7:
+                    skip = 9;
+                    break;
+                case 0xd8:
+                    skip = 17;
+                    break;
+                case 0xd9:
+                case 0xc4:
+                case 0xc7:
+                case 0xda:
+                case 0xc5:
+                case 0xc8:
+                case 0xdb:
+                case 0xc6:
+                case 0xc9: {
+                    int len = (b == 0xd9 || b == 0xc4 || b == 0xc7) ? 1 : (b == 0xda || b == 0xc5 || b == 0xc8) ? 2 : 4;
+                    if (!readLength(data, size, pos, len, n)) {
+                        return 0;
+                    }
+                    // Extensions have a type byte after the length
+                    skip = (b == 0xc7 || b == 0xc8 || b == 0xc9) ? n + 1 : n;
+                    break;
+                }
+                case 0xdc:
+                case 0xdd:
+                    if (!readLength(data, size, pos, b == 0xdc ? 2 : 4, n)) {
+                        return 0;
+                    }
+                    items = n;
+                    break;
+                case 0xde:
+                case 0xdf:
+                    if (!readLength(data, size, pos, b == 0xde ? 2 : 4, n)) {
+                        return 0;
+                    }
+                    items = n * 2;
+                    break;
+                default:
+                    return -1;
+            }
+        }
+        if (size - pos < skip) {
+            return 0;
+        }
+        pos += (size_t) skip;
+        remaining += items;
+    }
+    return (int64_t) pos;
+}
+
+// Lua interface
+
+void LuaMsgPack::toLua(lua_State *L)
+{
+    const luaL_Reg funcs[] = {
+            {"encode",   regEncode},
+            {"decode",   regDecode},
+            {"messages", regMessages},
+            {"unpacker", regUnpacker},
+            {nullptr,    nullptr}
+    };
+
+    const luaL_Reg unpackerMethods[] = {
+            {"feed",    regUnpackerFeed},
+            {"next",    regUnpackerNext},
+            {"pending", regUnpackerPending},
+            {nullptr,   nullptr}
+    };
+
+    luaL_newmetatable(L, MSGPACK_UNPACKER_META);
+    lua_pushcfunction(L, regUnpackerGC);
+    lua_setfield(L, -2, "__gc");
+    luaL_newlib(L, unpackerMethods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, MSGPACK_WRITER_META);
+    lua_pushcfunction(L, regWriterGC);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    luaL_newlib(L, funcs);
+    LuaJson::pushNull(L);
+    lua_setfield(L, -2, "null");
+    lua_setglobal(L, "MsgPack");
+}
+
+int LuaMsgPack::regEncode(lua_State *L)
+{
+    luaL_checkany(L, 1);
+    GAny *target = nullptr;
+    if (!lua_isnoneornil(L, 2)) {
+        target = GAnyLuaVM::isGAnyLuaObj(L, 2) ? glua_getcppobject(L, GAny, 2) : nullptr;
+        if (!target || !target->is<GByteArray>()) {
+            return luaL_typeerror(L, 2, "GByteArray");
+        }
+    }
+    lua_settop(L, 2);
+
+    // The output is owned by a userdata, so that it is freed when an error is raised
+    auto *out = new(lua_newuserdatauv(L, sizeof(std::string), 0)) std::string();
+    luaL_setmetatable(L, MSGPACK_WRITER_META);
+
+    encodeLua(L, *out, 1, 0);
+    if (target) {
+        target->as<GByteArray>().write(out->data(), out->size());
+        lua_pushvalue(L, 2);
+    } else {
+        lua_pushlstring(L, out->data(), out->size());
+    }
+    return 1;
+}
+
+int LuaMsgPack::regDecode(lua_State *L)
+{
+    size_t size;
+    const uint8_t *data = checkSource(L, 1, size);
+    lua_Integer offset = luaL_optinteger(L, 2, 0);
+    luaL_argcheck(L, offset >= 0 && (size_t) offset <= size, 2, "offset out of range");
+
+    LuaReader reader{L, data, size, (size_t) offset, 0};
+    decodeLua(reader, false);
+    lua_pushinteger(L, (lua_Integer) reader.pos);
+    return 2;
+}
+
+int LuaMsgPack::regMessages(lua_State *L)
+{
+    size_t size;
+    checkSource(L, 1, size);
+    lua_pushcfunction(L, regMessagesNext);
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, 0);
+    return 3;
+}
+
+int LuaMsgPack::regMessagesNext(lua_State *L)
+{
+    size_t size;
+    const uint8_t *data = checkSource(L, 1, size);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    if (offset < 0 || (size_t) offset >= size) {
+        return 0;
+    }
+    LuaReader reader{L, data, size, (size_t) offset, 0};
+    decodeLua(reader, false);
+    lua_pushinteger(L, (lua_Integer) reader.pos);
+    lua_insert(L, -2);
+    return 2;
+}
+
+int LuaMsgPack::regUnpacker(lua_State *L)
+{
+    new(lua_newuserdatauv(L, sizeof(MsgPackUnpacker), 0)) MsgPackUnpacker();
+    luaL_setmetatable(L, MSGPACK_UNPACKER_META);
+    return 1;
+}
+
+int LuaMsgPack::regUnpackerFeed(lua_State *L)
+{
+    auto *unpacker = (MsgPackUnpacker *) luaL_checkudata(L, 1, MSGPACK_UNPACKER_META);
+    size_t size;
+    const uint8_t *data = checkSource(L, 2, size);
+    // Drop the decoded bytes once they are the larger part of the buffer
+    if (unpacker->offset > 0 && unpacker->offset >= unpacker->buffer.size() / 2) {
+        unpacker->buffer.erase(0, unpacker->offset);
+        unpacker->offset = 0;
+    }
+    unpacker->buffer.append(reinterpret_cast<const char *>(data), size);
+    lua_settop(L, 1);
+    return 1;
+}
+
+int LuaMsgPack::regUnpackerNext(lua_State *L)
+{
+    auto *unpacker = (MsgPackUnpacker *) luaL_checkudata(L, 1, MSGPACK_UNPACKER_META);
+    const auto *data = reinterpret_cast<const uint8_t *>(unpacker->buffer.data()) + unpacker->offset;
+    size_t size = unpacker->buffer.size() - unpacker->offset;
+    int64_t length = measure(data, size);
+    if (length < 0) {
+        return luaL_error(L, "MsgPack error: malformed data at offset %I", (lua_Integer) unpacker->offset);
+    }
+    if (length == 0) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    // Skipped even if decoding fails, the next call continues after it
+    unpacker->offset += (size_t) length;
+    lua_pushboolean(L, 1);
+    LuaReader reader{L, data, (size_t) length, 0, 0};
+    decodeLua(reader, false);
+    return 2;
+}
+
+int LuaMsgPack::regUnpackerPending(lua_State *L)
+{
+    auto *unpacker = (MsgPackUnpacker *) luaL_checkudata(L, 1, MSGPACK_UNPACKER_META);
+    lua_pushinteger(L, (lua_Integer) (unpacker->buffer.size() - unpacker->offset));
+    return 1;
+}
+
+int LuaMsgPack::regUnpackerGC(lua_State *L)
+{
+    auto *unpacker = (MsgPackUnpacker *) luaL_checkudata(L, 1, MSGPACK_UNPACKER_META);
+    unpacker->~MsgPackUnpacker();
+    return 0;
+}
+
+int LuaMsgPack::regWriterGC(lua_State *L)
+{
+    using std::string;
+    auto *out = (string *) luaL_checkudata(L, 1, MSGPACK_WRITER_META);
+    out->~string();
+    return 0;
+}
+
+GX_NS_END
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_MSGPACK_H
+#define GX_SCRIPT_LUA_MSGPACK_H
+
+#include <gx/gany.h>
+#include <gx/gbytearray.h>
+
+#include <lua.hpp>
+
+#include <string>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaMsgPack
+ * @brief MessagePack codec for GAny (including LuaTable) and for Lua values. <br>
+ *        Integers are written as MessagePack integers and floating point numbers as float 64,
+ *        so int64 and double survive the round trip. GByteArray and LuaByteView are written as bin. <br>
+ *        The MsgPack table of Lua: MsgPack.encode(value, byteArray) returns a string or appends to a GByteArray,
+ *        MsgPack.decode(source, offset) reads one message from a string, LuaByteView or GByteArray
+ *        and returns it with the 0-based offset after it, MsgPack.messages(source) iterates concatenated messages
+ *        and MsgPack.unpacker() returns a stream: feed(data) adds bytes and next() returns true and the next
+ *        complete message, or false when more bytes are needed. <br>
+ *        nil inside arrays and maps is MsgPack.null (the same value as Json.null), arrays get the Json array metatable.
+ */
+class LuaMsgPack
+{
+public:
+    static void toLua(lua_State *L);
+
+    /**
+     * @brief Append the encoding of a value, values that cannot be represented are written as nil
+     * @param value
+     * @param out
+     */
+    static void encode(const GAny &value, GByteArray &out);
+
+    /**
+     * @brief Decode one message, arrays become GAnyArray and maps GAnyObject with string keys
+     * @param data
+     * @param size
+     * @param offset    Start of the message, receives the offset after it
+     * @param value     Receives the value
+     * @param error     Receives the error message when failed
+     * @return false if the data is malformed or incomplete
+     */
+    static bool decode(const uint8_t *data, size_t size, size_t &offset, GAny &value, std::string *error = nullptr);
+
+    /**
+     * @brief Size of the complete message at the start of the data, without decoding it
+     * @param data
+     * @param size
+     * @return The size, 0 if incomplete, -1 if malformed
+     */
+    static int64_t measure(const uint8_t *data, size_t size);
+
+private:
+    static int regEncode(lua_State *L);
+
+    static int regDecode(lua_State *L);
+
+    static int regMessages(lua_State *L);
+
+    static int regMessagesNext(lua_State *L);
+
+    static int regUnpacker(lua_State *L);
+
+    static int regUnpackerFeed(lua_State *L);
+
+    static int regUnpackerNext(lua_State *L);
+
+    static int regUnpackerPending(lua_State *L);
+
+    static int regUnpackerGC(lua_State *L);
+
+    static int regWriterGC(lua_State *L);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_MSGPACK_H
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_parallel.h"
+
+#include "gany_lua_vm.h"
+#include "lua_executor.h"
+
+#include <gx/gmutex.h>
+
+#include <algorithm>
+
+
+/// Smallest partition chosen automatically, smaller arrays run serially
+#define PARALLEL_MIN_GRAIN 256
+/// Partitions per worker chosen automatically, so that stealing can balance uneven elements
+#define PARALLEL_PARTITIONS_PER_WORKER 4
+
+GX_NS_BEGIN
+
+static GMutex sExecutorLock;
+static std::shared_ptr<LuaExecutor> sExecutor;
+
+/**
+ * @brief A function instantiated in a virtual machine for the duration of a partition
+ */
+class BoundFunction
+{
+public:
+    BoundFunction(const LuaParallel::Function &func, GAnyLuaVM *vm)
+            : mFunc(func), mVM(vm)
+    {
+        if (!mFunc.snapshot) {
+            // A Lua function converted to GAny is instantiated like one passed from Lua
+            mFunc.snapshot = GAnyLuaVM::findSnapshot(mFunc.func);
+        }
+        if (mFunc.snapshot) {
+            lua_State *L = mVM->getLuaState();
+            if (!mVM->pushSnapshot(*mFunc.snapshot)) {
+                std::string err = lua_tostring(L, -1);
+                lua_pop(L, 1);
+                throw GAnyException(err);
+            }
+            mRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        }
+    }
+
+    ~BoundFunction()
+    {
+        if (mRef != LUA_NOREF && mVM->getLuaState()) {
+            luaL_unref(mVM->getLuaState(), LUA_REGISTRYINDEX, mRef);
+        }
+    }
+
+    BoundFunction(const BoundFunction &) = delete;
+
+    BoundFunction &operator=(const BoundFunction &) = delete;
+
+    GAny call(const GAny &a) const
+    {
+        const GAny *args[] = {&a};
+        return invoke(args, 1);
+    }
+
+    GAny call(const GAny &a, const GAny &b) const
+    {
+        const GAny *args[] = {&a, &b};
+        return invoke(args, 2);
+    }
+
+private:
+    GAny invoke(const GAny **args, int32_t argc) const
+    {
+        if (mRef == LUA_NOREF) {
+            std::vector<GAny> argv;
+            argv.reserve(argc);
+            for (int32_t i = 0; i < argc; i++) {
+                argv.push_back(*args[i]);
+            }
+            return mFunc.func._call(argv);
+        }
+
+        lua_State *L = mVM->getLuaState();
+        lua_rawgeti(L, LUA_REGISTRYINDEX, mRef);
+        for (int32_t i = 0; i < argc; i++) {
+            GAnyLuaVM::makeGAnyToLuaObject(L, *args[i]);
+        }
+        if (lua_pcall(L, argc, 1, 0) != LUA_OK) {
+            std::string err = lua_tostring(L, -1);
+            lua_pop(L, 1);
+            throw GAnyException(err);
+        }
+        GAny ret = GAnyLuaVM::makeLuaObjectToGAny(L, lua_gettop(L));
+        lua_pop(L, 1);
+        return ret;
+    }
+
+private:
+    LuaParallel::Function mFunc;
+    GAnyLuaVM *mVM;
+    int mRef = LUA_NOREF;
+};
+
+using PartitionBody = std::function<GAny(GAnyLuaVM &vm, size_t begin, size_t end)>;
+
+/**
+ * @brief Run the body for each range, the first range on the calling thread
+ * @return Results of the ranges in order
+ */
+static std::vector<GAny> runPartitions(const std::vector<std::pair<size_t, size_t>> &ranges,
+                                       const std::shared_ptr<LuaExecutor> &executor,
+                                       const PartitionBody &body)
+{
+    std::vector<LuaFuture> futures;
+    for (size_t i = 1; i < ranges.size(); i++) {
+        auto range = ranges[i];
+        futures.push_back(executor->execute([body, range](GAnyLuaVM &vm) {
+            return body(vm, range.first, range.second);
+        }));
+    }
+
+    std::vector<GAny> results(ranges.size());
+    std::string error;
+    try {
+        results[0] = body(*GAnyLuaVM::current(), ranges[0].first, ranges[0].second);
+    } catch (std::exception &e) {
+        error = e.what();
+    }
+    // The partitions share the element and result arrays, wait for all of them even after an error
+    for (size_t i = 0; i < futures.size(); i++) {
+        futures[i].wait();
+        if (futures[i].isRejected()) {
+            if (error.empty()) {
+                error = futures[i].error();
+            }
+        } else {
+            results[i + 1] = futures[i].value();
+        }
+    }
+    if (!error.empty()) {
+        throw GAnyException(error);
+    }
+    return results;
+}
+
+GAny LuaParallel::map(const GAny &array, const Function &func, size_t grain)
+{
+    auto items = std::make_shared<const std::vector<GAny>>(elements(array));
+    if (items->empty()) {
+        return GAny::array();
+    }
+    auto results = std::make_shared<std::vector<GAny>>(items->size());
+
+    std::shared_ptr<LuaExecutor> exec;
+    auto ranges = partition(items->size(), grain, exec);
+    runPartitions(ranges, exec, [func, items, results](GAnyLuaVM &vm, size_t begin, size_t end) {
+        BoundFunction f(func, &vm);
+        // Partitions write disjoint slots of the results
+        for (size_t i = begin; i < end; i++) {
+            (*results)[i] = f.call((*items)[i]);
+        }
+        return GAny::undefined();
+    });
+    return GAny::array(*results);
+}
+
+GAny LuaParallel::reduce(const GAny &array, const Function &func, const Function &combine, size_t grain)
+{
+    auto items = std::make_shared<const std::vector<GAny>>(elements(array));
+    if (items->empty()) {
+        return GAny::undefined();
+    }
+
+    std::shared_ptr<LuaExecutor> exec;
+    auto ranges = partition(items->size(), grain, exec);
+    auto partials = runPartitions(ranges, exec, [func, items](GAnyLuaVM &vm, size_t begin, size_t end) {
+        BoundFunction f(func, &vm);
+        GAny acc = (*items)[begin];
+        for (size_t i = begin + 1; i < end; i++) {
+            acc = f.call(acc, (*items)[i]);
+        }
+        return acc;
+    });
+
+    GAny acc = partials[0];
+    if (partials.size() > 1) {
+        BoundFunction c(combine, GAnyLuaVM::current());
+        for (size_t i = 1; i < partials.size(); i++) {
+            acc = c.call(acc, partials[i]);
+        }
+    }
+    return acc;
+}
+
+void LuaParallel::setExecutor(const std::shared_ptr<LuaExecutor> &executor)
+{
+    GLockerGuard locker(sExecutorLock);
+    sExecutor = executor;
+}
+
+std::shared_ptr<LuaExecutor> LuaParallel::executor()
+{
+    GLockerGuard locker(sExecutorLock);
+    if (!sExecutor) {
+        sExecutor = LuaExecutor::create();
+    }
+    return sExecutor;
+}
+
+std::vector<GAny> LuaParallel::elements(const GAny &array)
+{
+    if (!array.isArray()) {
+        throw GAnyException("LuaParallel: the arg1 requires an array.");
+    }
+    // Copied once, the partitions read them from several threads
+    std::vector<GAny> items;
+    auto size = (int32_t) array.size();
+    items.reserve(size);
+    for (int32_t i = 0; i < size; i++) {
+        items.push_back(array[i]);
+    }
+    return items;
+}
+
+std::vector<std::pair<size_t, size_t>> LuaParallel::partition(size_t size, size_t grain,
+                                                              std::shared_ptr<LuaExecutor> &executor)
+{
+    std::vector<std::pair<size_t, size_t>> ranges;
+    // The executor is not created for small arrays
+    if (size <= (grain > 0 ? grain : PARALLEL_MIN_GRAIN)) {
+        ranges.emplace_back(0, size);
+        return ranges;
+    }
+    executor = LuaParallel::executor();
+    // A worker waiting for its own executor could wait forever
+    if (executor->isWorkerThread()) {
+        executor = nullptr;
+        ranges.emplace_back(0, size);
+        return ranges;
+    }
+    if (grain == 0) {
+        size_t partitions = executor->workerCount() * PARALLEL_PARTITIONS_PER_WORKER;
+        grain = std::max<size_t>(PARALLEL_MIN_GRAIN, (size + partitions - 1) / partitions);
+    }
+    for (size_t begin = 0; begin < size; begin += grain) {
+        ranges.emplace_back(begin, std::min(size, begin + grain));
+    }
+    return ranges;
+}
+
+GX_NS_END
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_PARALLEL_H
+#define GX_SCRIPT_LUA_PARALLEL_H
+
+#include <gx/gobject.h>
+
+#include <gx/gany.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+class LuaExecutor;
+
+struct LuaFunctionSnapshot;
+
+/**
+ * @class LuaParallel
+ * @brief Data parallel map and reduce over GAny arrays. <br>
+ *        The array is split into partitions run by the workers of an executor, the calling thread runs the first one.
+ *        A Lua function is instantiated once per partition in the virtual machine of the worker,
+ *        from its bytecode and a snapshot of its up values, so changes to up values are not shared between partitions.
+ *        Small arrays and calls from a worker of the executor run serially on the calling thread.
+ */
+class LuaParallel
+{
+public:
+    /**
+     * @brief Function applied to the elements: a snapshot of a Lua function, or any GAny function
+     */
+    struct Function
+    {
+        GAny func;
+        std::shared_ptr<LuaFunctionSnapshot> snapshot;
+    };
+
+public:
+    /**
+     * @brief Call func for each element
+     * @param array     GAnyArray
+     * @param func      func(value) -> mapped value
+     * @param grain     Number of elements per partition, 0 to choose from the size and the number of workers
+     * @return GAnyArray of the results in the order of the elements
+     */
+    static GAny map(const GAny &array, const Function &func, size_t grain = 0);
+
+    /**
+     * @brief Fold each partition with func starting from its first element, then fold the results of the partitions
+     *        in order with combine
+     * @param array     GAnyArray
+     * @param func      func(accumulator, value) -> accumulator
+     * @param combine   combine(accumulator, accumulator) -> accumulator
+     * @param grain     Number of elements per partition, 0 to choose from the size and the number of workers
+     * @return undefined if the array is empty
+     */
+    static GAny reduce(const GAny &array, const Function &func, const Function &combine, size_t grain = 0);
+
+    /**
+     * @brief Set the executor used by map and reduce, by default one with a worker per hardware thread
+     *        is created on first use
+     * @param executor  nullptr releases the current executor and restores the default
+     */
+    static void setExecutor(const std::shared_ptr<LuaExecutor> &executor);
+
+    static std::shared_ptr<LuaExecutor> executor();
+
+private:
+    static std::vector<GAny> elements(const GAny &array);
+
+    /**
+     * @brief Split the array into ranges, a single range when it runs serially
+     * @param size
+     * @param grain
+     * @param executor  Receives the executor when it runs in parallel
+     * @return
+     */
+    static std::vector<std::pair<size_t, size_t>> partition(size_t size, size_t grain,
+                                                            std::shared_ptr<LuaExecutor> &executor);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_PARALLEL_H
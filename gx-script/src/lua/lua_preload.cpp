@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_preload.h"
+#include "lua_chunk.h"
+
+#include "gx/script_preload.h"
+
+#include <gx/gmutex.h>
+
+#include <unordered_map>
+
+
+GX_NS_BEGIN
+
+struct PreloadRegistry
+{
+    GMutex lock;
+    std::unordered_map<std::string, LuaPreload::Chunk> chunks;
+    std::unordered_map<std::string, std::shared_ptr<LuaChunk>> sharedChunks;
+};
+
+// Registrations run from static initializers of other modules, construct on first use
+static PreloadRegistry &registry()
+{
+    static PreloadRegistry sRegistry;
+    return sRegistry;
+}
+
+void LuaPreload::add(const std::string &name, const unsigned char *data, size_t size)
+{
+    auto &reg = registry();
+    GLockerGuard locker(reg.lock);
+    reg.chunks[name] = Chunk{data, size};
+    reg.sharedChunks.erase(name);
+}
+
+static std::string chunkKey(const std::string &name)
+{
+    std::string key = name;
+    if (key.size() > 4) {
+        std::string suffix = key.substr(key.size() - 4);
+        if (suffix == ".lua" || suffix == ".lsc") {
+            key.resize(key.size() - 4);
+        }
+    }
+    return key;
+}
+
+bool LuaPreload::find(const std::string &name, Chunk &chunk)
+{
+    std::string key = chunkKey(name);
+
+    auto &reg = registry();
+    GLockerGuard locker(reg.lock);
+    auto it = reg.chunks.find(key);
+    if (it == reg.chunks.end()) {
+        return false;
+    }
+    chunk = it->second;
+    return true;
+}
+
+std::shared_ptr<LuaChunk> LuaPreload::shared(const std::string &name, std::string *error)
+{
+    std::string key = chunkKey(name);
+
+    auto &reg = registry();
+    GLockerGuard locker(reg.lock);
+    auto sIt = reg.sharedChunks.find(key);
+    if (sIt != reg.sharedChunks.end()) {
+        return sIt->second;
+    }
+    auto it = reg.chunks.find(key);
+    if (it == reg.chunks.end()) {
+        if (error) {
+            *error = "preload(" + name + ") does not exist.";
+        }
+        return nullptr;
+    }
+
+    const Chunk &data = it->second;
+    std::shared_ptr<LuaChunk> chunk;
+    if (data.size > 0 && data.data[0] == LUA_SIGNATURE[0]) {
+        // Bytecode in static memory (gx_script_embed emits aligned dumps), loaded in place
+        chunk = LuaChunk::wrapStatic((const char *) data.data, data.size, "@preload://" + key);
+    } else {
+        chunk = LuaChunk::create((const char *) data.data, data.size, "@preload://" + key, error);
+    }
+    if (chunk) {
+        reg.sharedChunks[key] = chunk;
+    }
+    return chunk;
+}
+
+GX_NS_END
+
+void gxScriptRegisterPreload(const char *name, const unsigned char *data, size_t size)
+{
+    if (name && data && size > 0) {
+        gx::LuaPreload::add(name, data, size);
+    }
+}
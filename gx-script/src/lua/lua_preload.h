@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_PRELOAD_H
+#define GX_SCRIPT_LUA_PRELOAD_H
+
+#include <gx/gobject.h>
+
+#include <memory>
+#include <string>
+
+
+GX_NS_BEGIN
+
+class LuaChunk;
+
+/**
+ * @class LuaPreload
+ * @brief Registry of precompiled Lua chunks embedded in the binary (see gx_script_embed)
+ */
+class LuaPreload
+{
+public:
+    struct Chunk
+    {
+        const unsigned char *data = nullptr;
+        size_t size = 0;
+    };
+
+public:
+    static void add(const std::string &name, const unsigned char *data, size_t size);
+
+    /**
+     * @brief Find a registered chunk, the ".lua" and ".lsc" suffixes of the name are ignored
+     * @param name
+     * @param chunk
+     * @return
+     */
+    static bool find(const std::string &name, Chunk &chunk);
+
+    /**
+     * @brief Get the shared chunk of a registered script, created on first use and reused by all virtual machines.
+     *        Bytecode is loaded in place from the registered data, source code is compiled once
+     * @param name
+     * @param error Receives the error when the chunk cannot be created
+     * @return nullptr if not registered or invalid
+     */
+    static std::shared_ptr<LuaChunk> shared(const std::string &name, std::string *error = nullptr);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_PRELOAD_H
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_reclaimer.h"
+
+#include "gany_lua_vm.h"
+#include "mpsc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+
+GX_NS_BEGIN
+
+/// Constant-initialized, so they are still valid while other static objects are destroyed
+static std::atomic<int> sMode{(int) LuaReclaimer::Mode::Immediate};
+static std::atomic<bool> sExiting{false};
+
+struct ReclaimerState
+{
+    /// Shared queue of the Background mode
+    MpscQueue<GAny *> queue;
+    /// GAny in the shared queue, the pending ones also include the deferred lists
+    std::atomic<uint64_t> queued{0};
+    /// Only one thread consumes the queue at a time
+    std::mutex drainLock;
+
+    std::atomic<uint64_t> pending{0};
+    std::atomic<uint64_t> maxPending{0};
+    std::atomic<uint64_t> retired{0};
+    std::atomic<uint64_t> reclaimed{0};
+    std::atomic<uint64_t> batches{0};
+
+    std::atomic<size_t> batchSize{256};
+    std::atomic<int32_t> intervalMs{50};
+
+    /// Serializes the mode changes and the start of the thread
+    std::mutex modeLock;
+    std::mutex threadLock;
+    std::condition_variable cond;
+    std::thread thread;
+    bool stop = false;
+    std::atomic<bool> running{false};
+
+    ~ReclaimerState()
+    {
+        // Finalizers running after this point delete immediately, the pending GAny are left to the process exit
+        sExiting = true;
+        sMode = (int) LuaReclaimer::Mode::Immediate;
+        stopThread();
+    }
+
+    void startThread()
+    {
+        {
+            std::lock_guard<std::mutex> locker(threadLock);
+            stop = false;
+        }
+        thread = std::thread([this] {
+            std::unique_lock<std::mutex> locker(threadLock);
+            while (!stop) {
+                cond.wait_for(locker, std::chrono::milliseconds(intervalMs.load()), [this] {
+                    return stop || queued.load() >= batchSize.load();
+                });
+                if (stop) {
+                    break;
+                }
+                locker.unlock();
+                LuaReclaimer::reclaim();
+                locker.lock();
+            }
+        });
+        running = true;
+    }
+
+    /// Started by the first GAny queued by a virtual machine using Background when the default mode is another one
+    void ensureThread()
+    {
+        std::lock_guard<std::mutex> locker(modeLock);
+        if (!thread.joinable() && !sExiting.load()) {
+            startThread();
+        }
+    }
+
+    void stopThread()
+    {
+        if (!thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> locker(threadLock);
+            stop = true;
+        }
+        cond.notify_all();
+        thread.join();
+        running = false;
+    }
+};
+
+static ReclaimerState &state()
+{
+    static ReclaimerState sState;
+    return sState;
+}
+
+void LuaReclaimer::setMode(Mode mode)
+{
+    ReclaimerState &s = state();
+    std::lock_guard<std::mutex> locker(s.modeLock);
+    auto old = (Mode) sMode.load();
+    if (old == mode) {
+        return;
+    }
+    if (s.thread.joinable()) {
+        s.stopThread();
+    }
+    sMode = (int) mode;
+    if (mode == Mode::Background) {
+        s.startThread();
+    } else {
+        reclaim();
+    }
+}
+
+LuaReclaimer::Mode LuaReclaimer::mode()
+{
+    return (Mode) sMode.load();
+}
+
+bool LuaReclaimer::parseMode(const std::string &name, Mode &mode)
+{
+    if (name == "immediate") {
+        mode = Mode::Immediate;
+    } else if (name == "deferred") {
+        mode = Mode::Deferred;
+    } else if (name == "background") {
+        mode = Mode::Background;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string LuaReclaimer::modeName(Mode mode)
+{
+    switch (mode) {
+        case Mode::Deferred:
+            return "deferred";
+        case Mode::Background:
+            return "background";
+        case Mode::Immediate:
+        default:
+            return "immediate";
+    }
+}
+
+void LuaReclaimer::setBatchSize(size_t count)
+{
+    state().batchSize = count > 0 ? count : 1;
+}
+
+void LuaReclaimer::setInterval(int32_t ms)
+{
+    state().intervalMs = ms > 0 ? ms : 1;
+}
+
+void LuaReclaimer::retire(lua_State *L, GAny *obj)
+{
+    GAnyLuaVM *vm = GAnyLuaVM::fromLuaState(L);
+    Mode mode = vm ? vm->reclaimMode() : (Mode) sMode.load(std::memory_order_relaxed);
+    if (mode == Mode::Immediate || (mode == Mode::Deferred && !vm) || sExiting.load(std::memory_order_relaxed)) {
+        GX_DELETE(obj);
+        return;
+    }
+
+    ReclaimerState &s = state();
+    // Counted before the push, so that a concurrent reclaim never takes more than pending
+    s.retired.fetch_add(1, std::memory_order_relaxed);
+    uint64_t pending = s.pending.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint64_t max = s.maxPending.load(std::memory_order_relaxed);
+    while (pending > max && !s.maxPending.compare_exchange_weak(max, pending, std::memory_order_relaxed)) {
+    }
+    if (mode == Mode::Deferred) {
+        vm->mDeferred.push_back(obj);
+        return;
+    }
+    uint64_t queued = s.queued.fetch_add(1, std::memory_order_relaxed) + 1;
+    s.queue.push(obj);
+    if (!s.running.load(std::memory_order_relaxed)) {
+        s.ensureThread();
+    }
+    if (queued == s.batchSize.load(std::memory_order_relaxed)) {
+        s.cond.notify_one();
+    }
+}
+
+size_t LuaReclaimer::reclaim()
+{
+    ReclaimerState &s = state();
+    std::unique_lock<std::mutex> locker(s.drainLock, std::try_to_lock);
+    if (!locker.owns_lock()) {
+        return 0;
+    }
+    size_t count = s.queue.drain([](GAny *&obj) {
+        GX_DELETE(obj);
+    });
+    if (count > 0) {
+        s.queued.fetch_sub(count, std::memory_order_relaxed);
+        s.pending.fetch_sub(count, std::memory_order_relaxed);
+        s.reclaimed.fetch_add(count, std::memory_order_relaxed);
+        s.batches.fetch_add(1, std::memory_order_relaxed);
+    }
+    return count;
+}
+
+size_t LuaReclaimer::reclaim(DeferredList &list)
+{
+    if (list.empty()) {
+        return 0;
+    }
+    DeferredList batch;
+    batch.swap(list);
+    for (GAny *obj: batch) {
+        GX_DELETE(obj);
+    }
+    ReclaimerState &s = state();
+    s.pending.fetch_sub(batch.size(), std::memory_order_relaxed);
+    s.reclaimed.fetch_add(batch.size(), std::memory_order_relaxed);
+    s.batches.fetch_add(1, std::memory_order_relaxed);
+    return batch.size();
+}
+
+LuaReclaimer::Stats LuaReclaimer::stats()
+{
+    ReclaimerState &s = state();
+    Stats stats;
+    stats.pending = s.pending.load();
+    stats.maxPending = s.maxPending.load();
+    stats.retired = s.retired.load();
+    stats.reclaimed = s.reclaimed.load();
+    stats.batches = s.batches.load();
+    return stats;
+}
+
+GX_NS_END
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_RECLAIMER_H
+#define GX_SCRIPT_LUA_RECLAIMER_H
+
+#include <gx/gobject.h>
+
+#include <gx/gany.h>
+
+#include <lua.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaReclaimer
+ * @brief Destruction of the GAny held by collected Lua userdata (GAny objects and classes). <br>
+ *        Immediate (default): deleted by the finalizer on the Lua thread, during the GC step. <br>
+ *        Deferred: the finalizer only queues the GAny in a list of its virtual machine, they are deleted in batches
+ *        at the idle points of that virtual machine (runPending, runOnce and gc), on its thread. <br>
+ *        Background: queued in a queue shared by all virtual machines, and deleted in batches by a background thread,
+ *        the destructors of the objects released by Lua must then be safe to run on another thread. <br>
+ *        Each virtual machine uses the process default mode unless it sets its own (GAnyLuaVM::setReclaimMode).
+ */
+class LuaReclaimer
+{
+public:
+    enum class Mode
+    {
+        Immediate,
+        Deferred,
+        Background,
+    };
+
+    /// GAny deferred by the finalizers of one virtual machine, only accessed on the thread running it
+    using DeferredList = std::vector<GAny *>;
+
+    struct Stats
+    {
+        /// GAny queued and not deleted yet
+        uint64_t pending = 0;
+        /// Highest number of pending GAny
+        uint64_t maxPending = 0;
+        /// GAny queued since the start
+        uint64_t retired = 0;
+        /// Queued GAny deleted since the start
+        uint64_t reclaimed = 0;
+        /// Number of non-empty reclaim batches
+        uint64_t batches = 0;
+    };
+
+public:
+    /**
+     * @brief Change the default mode of the virtual machines. Leaving Background deletes the GAny of the shared queue
+     *        and stops the thread, the first GAny queued by a virtual machine still using Background starts it again.
+     *        The deferred GAny stay in the lists of their virtual machines until their next idle point
+     * @param mode
+     */
+    static void setMode(Mode mode);
+
+    static Mode mode();
+
+    static bool parseMode(const std::string &name, Mode &mode);
+
+    static std::string modeName(Mode mode);
+
+    /**
+     * @brief Number of pending GAny that wakes up the background thread before its interval (default 256)
+     * @param count
+     */
+    static void setBatchSize(size_t count);
+
+    /**
+     * @brief Longest time the background thread waits between two batches (default 50 ms)
+     * @param ms
+     */
+    static void setInterval(int32_t ms);
+
+    /**
+     * @brief Delete a GAny of a collected userdata according to the mode of the virtual machine of L,
+     *        called by the finalizers
+     * @param L
+     * @param obj
+     */
+    static void retire(lua_State *L, GAny *obj);
+
+    /**
+     * @brief Delete the GAny of the shared queue (Background mode) now, may be called from any thread.
+     *        Returns at once if another thread is reclaiming
+     * @return Number of GAny deleted
+     */
+    static size_t reclaim();
+
+    /**
+     * @brief Delete the GAny deferred by a virtual machine, on its thread
+     * @param list
+     * @return Number of GAny deleted
+     */
+    static size_t reclaim(DeferredList &list);
+
+    static Stats stats();
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_RECLAIMER_H
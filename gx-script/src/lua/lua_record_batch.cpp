@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_record_batch.h"
+
+
+GX_NS_BEGIN
+
+LuaRecordBatch::LuaRecordBatch(size_t rowCount)
+        : mState(std::make_shared<State>())
+{
+    mState->rowCount = rowCount;
+}
+
+LuaRecordBatch LuaRecordBatch::fromRecords(const GAny &records)
+{
+    if (!records.isArray()) {
+        return LuaRecordBatch();
+    }
+    auto rows = (size_t) records.size();
+    LuaRecordBatch batch(rows);
+
+    // First pass: the fields and their kinds, a field with any floating point number is a f64 column
+    struct Field
+    {
+        std::string name;
+        Kind kind;
+        bool isFloat;
+    };
+    std::vector<Field> fields;
+    std::unordered_map<std::string, size_t> fieldIndexes;
+    for (size_t r = 0; r < rows; r++) {
+        GAny record = records[(int32_t) r];
+        if (!record.isObject()) {
+            continue;
+        }
+        record.call("forEach", [&](const std::string &k, const GAny &v) {
+            Kind kind;
+            if (v.isBoolean()) {
+                kind = Kind::Boolean;
+            } else if (v.isNumber()) {
+                kind = Kind::Number;
+            } else if (v.isString()) {
+                kind = Kind::String;
+            } else {
+                return;
+            }
+            auto it = fieldIndexes.find(k);
+            if (it == fieldIndexes.end()) {
+                fieldIndexes.emplace(k, fields.size());
+                fields.push_back({k, kind, v.isFloat() || v.isDouble()});
+            } else if (kind == Kind::Number && fields[it->second].kind == Kind::Number) {
+                fields[it->second].isFloat |= v.isFloat() || v.isDouble();
+            }
+        });
+    }
+
+    // Second pass: fill the columns
+    for (const auto &field: fields) {
+        Column column;
+        column.name = field.name;
+        column.kind = field.kind;
+        if (field.kind == Kind::String) {
+            column.strings.resize(rows);
+        } else {
+            auto type = field.kind == Kind::Boolean ? LuaTypedBuffer::Type::I32 :
+                        field.isFloat ? LuaTypedBuffer::Type::F64 : LuaTypedBuffer::Type::I64;
+            column.numbers = LuaTypedBuffer(type, rows);
+        }
+        for (size_t r = 0; r < rows; r++) {
+            GAny v = records[(int32_t) r][field.name];
+            switch (field.kind) {
+                case Kind::Number:
+                    if (!v.isNumber()) {
+                        break;
+                    }
+                    if (field.isFloat) {
+                        column.numbers.set(r, v.toDouble());
+                    } else {
+                        column.numbers.setInt(r, v.toInt64());
+                    }
+                    break;
+                case Kind::Boolean:
+                    column.numbers.setInt(r, v.isBoolean() && v.toBool() ? 1 : 0);
+                    break;
+                case Kind::String:
+                    if (v.isString()) {
+                        column.strings[r] = v.toString();
+                    }
+                    break;
+            }
+        }
+        batch.addColumn(std::move(column));
+    }
+    return batch;
+}
+
+bool LuaRecordBatch::addColumn(const std::string &name, const LuaTypedBuffer &values)
+{
+    Column column;
+    column.name = name;
+    column.kind = Kind::Number;
+    column.numbers = values;
+    return addColumn(std::move(column));
+}
+
+bool LuaRecordBatch::addBooleanColumn(const std::string &name, const LuaTypedBuffer &values)
+{
+    if (values.type() != LuaTypedBuffer::Type::I32) {
+        return false;
+    }
+    Column column;
+    column.name = name;
+    column.kind = Kind::Boolean;
+    column.numbers = values;
+    return addColumn(std::move(column));
+}
+
+bool LuaRecordBatch::addStringColumn(const std::string &name, std::vector<std::string> values)
+{
+    Column column;
+    column.name = name;
+    column.kind = Kind::String;
+    column.strings = std::move(values);
+    return addColumn(std::move(column));
+}
+
+bool LuaRecordBatch::addColumn(Column column)
+{
+    // The rows of a batch are fixed, a wrapped GByteArray could be resized under the cursors
+    if (column.numbers.wrapsByteArray()) {
+        column.numbers = column.numbers.copy(column.numbers.type());
+    }
+    size_t length = column.kind == Kind::String ? column.strings.size() : column.numbers.length();
+    if (length != mState->rowCount || mState->indexes.count(column.name) > 0) {
+        return false;
+    }
+    mState->indexes.emplace(column.name, mState->columns.size());
+    mState->columns.push_back(std::move(column));
+    return true;
+}
+
+size_t LuaRecordBatch::rowCount() const
+{
+    return mState->rowCount;
+}
+
+size_t LuaRecordBatch::columnCount() const
+{
+    return mState->columns.size();
+}
+
+int32_t LuaRecordBatch::columnIndex(const std::string &name) const
+{
+    auto it = mState->indexes.find(name);
+    return it != mState->indexes.end() ? (int32_t) it->second : -1;
+}
+
+const LuaRecordBatch::Column &LuaRecordBatch::column(size_t index) const
+{
+    return mState->columns.at(index);
+}
+
+std::vector<std::string> LuaRecordBatch::columnNames() const
+{
+    std::vector<std::string> names;
+    names.reserve(mState->columns.size());
+    for (const auto &column: mState->columns) {
+        names.push_back(column.name);
+    }
+    return names;
+}
+
+GAny LuaRecordBatch::value(size_t row, size_t column) const
+{
+    if (row >= mState->rowCount || column >= mState->columns.size()) {
+        return GAny::undefined();
+    }
+    const Column &c = mState->columns[column];
+    switch (c.kind) {
+        case Kind::Boolean:
+            return c.numbers.getInt(row) != 0;
+        case Kind::String:
+            return c.strings[row];
+        case Kind::Number:
+        default:
+            if (c.numbers.type() == LuaTypedBuffer::Type::I32 || c.numbers.type() == LuaTypedBuffer::Type::I64) {
+                return c.numbers.getInt(row);
+            }
+            return c.numbers.get(row);
+    }
+}
+
+GAny LuaRecordBatch::row(size_t row) const
+{
+    if (row >= mState->rowCount) {
+        return GAny::undefined();
+    }
+    GAny obj = GAny::object();
+    for (size_t i = 0; i < mState->columns.size(); i++) {
+        obj[mState->columns[i].name] = value(row, i);
+    }
+    return obj;
+}
+
+GAny LuaRecordBatch::toRecords() const
+{
+    GAny array = GAny::array();
+    for (size_t r = 0; r < mState->rowCount; r++) {
+        array.pushBack(row(r));
+    }
+    return array;
+}
+
+std::string LuaRecordBatch::toString() const
+{
+    return "LuaRecordBatch(rows: " + std::to_string(mState->rowCount) +
+           ", columns: " + std::to_string(mState->columns.size()) + ")";
+}
+
+GX_NS_END
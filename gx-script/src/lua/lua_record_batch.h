@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_RECORD_BATCH_H
+#define GX_SCRIPT_LUA_RECORD_BATCH_H
+
+#include "lua_typed_buffer.h"
+
+#include <gx/gany.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaRecordBatch
+ * @brief Columnar batch of records: every field is a typed column (numbers in a LuaTypedBuffer,
+ *        booleans or strings) of the same number of rows. <br>
+ *        Lua reads it through a row cursor that returns the fields directly from the column storage,
+ *        looked up by a column index resolved once per cursor, so a loop over the rows does not allocate per field. <br>
+ *        Copies share the same columns.
+ */
+class LuaRecordBatch
+{
+public:
+    enum class Kind
+    {
+        Number,
+        Boolean,
+        String,
+    };
+
+    struct Column
+    {
+        std::string name;
+        Kind kind = Kind::Number;
+        /// Values of Number columns, and of Boolean columns as i32
+        LuaTypedBuffer numbers;
+        std::vector<std::string> strings;
+    };
+
+public:
+    /**
+     * @brief Create an empty batch
+     * @param rowCount  Number of rows of every column
+     */
+    explicit LuaRecordBatch(size_t rowCount = 0);
+
+    /**
+     * @brief Build a batch from an array of GAnyObject records. The columns are the fields of the records,
+     *        integers become i64 columns, other numbers f64 columns, missing fields are 0, false or ""
+     * @param records
+     * @return
+     */
+    static LuaRecordBatch fromRecords(const GAny &records);
+
+public:
+    /**
+     * @brief Add a number column, the buffer is referenced without copying unless it wraps a GByteArray
+     * @param name
+     * @param values    Must have rowCount elements
+     * @return false if the name exists or the length is wrong
+     */
+    bool addColumn(const std::string &name, const LuaTypedBuffer &values);
+
+    /**
+     * @brief Add a boolean column
+     * @param name
+     * @param values    i32 buffer of 0 and 1 with rowCount elements
+     * @return false if the name exists, the type or the length is wrong
+     */
+    bool addBooleanColumn(const std::string &name, const LuaTypedBuffer &values);
+
+    bool addStringColumn(const std::string &name, std::vector<std::string> values);
+
+    size_t rowCount() const;
+
+    size_t columnCount() const;
+
+    /**
+     * @brief Index of a column
+     * @param name
+     * @return -1 if not found
+     */
+    int32_t columnIndex(const std::string &name) const;
+
+    /**
+     * @brief Column at an index, the batch must not get new columns while the reference is used
+     * @param index
+     * @return
+     */
+    const Column &column(size_t index) const;
+
+    std::vector<std::string> columnNames() const;
+
+    /**
+     * @brief Value of a field
+     * @param row
+     * @param column
+     * @return undefined if out of range
+     */
+    GAny value(size_t row, size_t column) const;
+
+    /**
+     * @brief Copy a row to GAnyObject
+     * @param row
+     * @return
+     */
+    GAny row(size_t row) const;
+
+    /**
+     * @brief Copy all rows to a GAnyArray of GAnyObject
+     * @return
+     */
+    GAny toRecords() const;
+
+    std::string toString() const;
+
+    bool operator==(const LuaRecordBatch &rhs) const
+    {
+        return mState == rhs.mState;
+    }
+
+private:
+    bool addColumn(Column column);
+
+private:
+    struct State
+    {
+        size_t rowCount = 0;
+        std::vector<Column> columns;
+        std::unordered_map<std::string, size_t> indexes;
+    };
+
+    std::shared_ptr<State> mState;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_RECORD_BATCH_H
@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_record_batch_to_lua.h"
+#include "lua_typed_buffer_to_lua.h"
+
+
+GX_NS_BEGIN
+
+#define RECORD_BATCH_META "LuaRecordBatch"
+#define RECORD_CURSOR_META "LuaRecordCursor"
+
+/**
+ * @brief Userdata of a batch. The user value is the table of column names to column indexes
+ */
+struct LuaRecordBatchToLua::Proxy
+{
+    GAny *self = nullptr;
+    GAny object;
+    LuaRecordBatch batch;
+};
+
+/**
+ * @brief Userdata of a row cursor. The columns are resolved to their storage when the cursor is created,
+ *        the user value is the column index table of the batch
+ */
+struct LuaRecordBatchToLua::Cursor
+{
+    struct ColumnRef
+    {
+        LuaRecordBatch::Kind kind;
+        LuaTypedBuffer::Type type;
+        const void *data;
+        const std::string *strings;
+    };
+
+    GAny *self = nullptr;
+    GAny object;
+    LuaRecordBatch batch;
+    std::vector<ColumnRef> columns;
+    lua_Integer rowCount = 0;
+    lua_Integer row = -1;
+};
+
+static void newMetatable(lua_State *L, const char *name,
+                         const luaL_Reg *metaMethods, const luaL_Reg *methods, lua_CFunction index)
+{
+    luaL_newmetatable(L, name);
+    int top = lua_gettop(L);
+
+    lua_pushliteral(L, "_name");
+    lua_pushstring(L, name);
+    lua_settable(L, top);
+
+    const luaL_Reg *f;
+    for (f = metaMethods; f->func; f++) {
+        lua_pushstring(L, f->name);
+        lua_pushcfunction(L, f->func);
+        lua_settable(L, top);
+    }
+
+    // __index reads fields, other keys are looked up in the methods table (upvalue)
+    lua_pushliteral(L, "__index");
+    lua_newtable(L);
+    luaL_setfuncs(L, methods, 0);
+    lua_pushcclosure(L, index, 1);
+    lua_settable(L, top);
+
+    lua_pop(L, 1);
+}
+
+void LuaRecordBatchToLua::toLua(lua_State *L)
+{
+    const luaL_Reg methods[] = {
+            {"rows",        regRows},
+            {"cursor",      regCursor},
+            {"columnIndex", regColumnIndex},
+            {"column",      regColumn},
+            {"columns",     regColumns},
+            {nullptr,       nullptr}
+    };
+    const luaL_Reg metaMethods[] = {
+            {"__gc",       regGC},
+            {"__len",      regLen},
+            {"__tostring", regToString},
+            {nullptr,      nullptr}
+    };
+    newMetatable(L, RECORD_BATCH_META, metaMethods, methods, regIndex);
+
+    const luaL_Reg cursorMethods[] = {
+            {"next",  regCursorNext},
+            {"seek",  regCursorSeek},
+            {"index", regCursorRow},
+            {nullptr, nullptr}
+    };
+    const luaL_Reg cursorMetaMethods[] = {
+            {"__gc",       regCursorGC},
+            {"__newindex", regCursorNewIndex},
+            {"__tostring", regCursorToString},
+            {nullptr,      nullptr}
+    };
+    newMetatable(L, RECORD_CURSOR_META, cursorMetaMethods, cursorMethods, regCursorIndex);
+}
+
+void LuaRecordBatchToLua::pushBatch(lua_State *L, const LuaRecordBatch &batch)
+{
+    auto *proxy = new(lua_newuserdatauv(L, sizeof(Proxy), 1)) Proxy();
+    proxy->self = &proxy->object;
+    proxy->batch = batch;
+    luaL_getmetatable(L, RECORD_BATCH_META);
+    lua_setmetatable(L, -2);
+
+    size_t count = batch.columnCount();
+    lua_createtable(L, 0, (int) count);
+    for (size_t i = 0; i < count; i++) {
+        const std::string &name = batch.column(i).name;
+        lua_pushlstring(L, name.data(), name.size());
+        lua_pushinteger(L, (lua_Integer) i);
+        lua_rawset(L, -3);
+    }
+    lua_setiuservalue(L, -2, 1);
+}
+
+bool LuaRecordBatchToLua::isProxy(lua_State *L, int idx)
+{
+    return luaL_testudata(L, idx, RECORD_BATCH_META) != nullptr
+           || luaL_testudata(L, idx, RECORD_CURSOR_META) != nullptr;
+}
+
+GAny LuaRecordBatchToLua::toGAny(lua_State *L, int idx)
+{
+    if (auto *proxy = (Proxy *) luaL_testudata(L, idx, RECORD_BATCH_META)) {
+        if (proxy->object.isUndefined()) {
+            proxy->object = proxy->batch;
+        }
+        return proxy->object;
+    }
+    if (auto *cursor = (Cursor *) luaL_testudata(L, idx, RECORD_CURSOR_META)) {
+        return cursor->batch.row((size_t) cursor->row);
+    }
+    return GAny::undefined();
+}
+
+LuaRecordBatchToLua::Proxy *LuaRecordBatchToLua::checkProxy(lua_State *L, int idx)
+{
+    return (Proxy *) luaL_checkudata(L, idx, RECORD_BATCH_META);
+}
+
+LuaRecordBatchToLua::Cursor *LuaRecordBatchToLua::checkCursor(lua_State *L, int idx)
+{
+    return (Cursor *) luaL_checkudata(L, idx, RECORD_CURSOR_META);
+}
+
+void LuaRecordBatchToLua::pushCursor(lua_State *L, int batchIdx, lua_Integer row)
+{
+    batchIdx = lua_absindex(L, batchIdx);
+    Proxy *proxy = checkProxy(L, batchIdx);
+
+    auto *cursor = new(lua_newuserdatauv(L, sizeof(Cursor), 1)) Cursor();
+    cursor->self = &cursor->object;
+    cursor->batch = proxy->batch;
+    cursor->rowCount = (lua_Integer) proxy->batch.rowCount();
+    cursor->row = row;
+    size_t count = proxy->batch.columnCount();
+    cursor->columns.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        const LuaRecordBatch::Column &column = proxy->batch.column(i);
+        cursor->columns.push_back({column.kind, column.numbers.type(), column.numbers.data(), column.strings.data()});
+    }
+    luaL_getmetatable(L, RECORD_CURSOR_META);
+    lua_setmetatable(L, -2);
+
+    lua_getiuservalue(L, batchIdx, 1);
+    lua_setiuservalue(L, -2, 1);
+}
+
+void LuaRecordBatchToLua::pushField(lua_State *L, const Cursor *cursor, lua_Integer column)
+{
+    lua_Integer row = cursor->row;
+    if (row < 0 || row >= cursor->rowCount || column < 0 || (size_t) column >= cursor->columns.size()) {
+        lua_pushnil(L);
+        return;
+    }
+    const Cursor::ColumnRef &ref = cursor->columns[column];
+    switch (ref.kind) {
+        case LuaRecordBatch::Kind::Boolean:
+            lua_pushboolean(L, static_cast<const int32_t *>(ref.data)[row] != 0);
+            return;
+        case LuaRecordBatch::Kind::String: {
+            const std::string &str = ref.strings[row];
+            lua_pushlstring(L, str.data(), str.size());
+            return;
+        }
+        case LuaRecordBatch::Kind::Number:
+            break;
+    }
+    switch (ref.type) {
+        case LuaTypedBuffer::Type::F32:
+            lua_pushnumber(L, static_cast<const float *>(ref.data)[row]);
+            break;
+        case LuaTypedBuffer::Type::F64:
+            lua_pushnumber(L, static_cast<const double *>(ref.data)[row]);
+            break;
+        case LuaTypedBuffer::Type::I32:
+            lua_pushinteger(L, static_cast<const int32_t *>(ref.data)[row]);
+            break;
+        case LuaTypedBuffer::Type::I64:
+            lua_pushinteger(L, static_cast<const int64_t *>(ref.data)[row]);
+            break;
+    }
+}
+
+int LuaRecordBatchToLua::regGC(lua_State *L)
+{
+    checkProxy(L, 1)->~Proxy();
+    return 0;
+}
+
+int LuaRecordBatchToLua::regIndex(lua_State *L)
+{
+    checkProxy(L, 1);
+    lua_pushvalue(L, 2);
+    lua_gettable(L, lua_upvalueindex(1));
+    return 1;
+}
+
+int LuaRecordBatchToLua::regLen(lua_State *L)
+{
+    lua_pushinteger(L, (lua_Integer) checkProxy(L, 1)->batch.rowCount());
+    return 1;
+}
+
+int LuaRecordBatchToLua::regToString(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_pushstring(L, proxy->batch.toString().c_str());
+    return 1;
+}
+
+int LuaRecordBatchToLua::regRows(lua_State *L)
+{
+    checkProxy(L, 1);
+    lua_pushcfunction(L, regRowsNext);
+    pushCursor(L, 1, -1);
+    return 2;
+}
+
+int LuaRecordBatchToLua::regCursor(lua_State *L)
+{
+    checkProxy(L, 1);
+    pushCursor(L, 1, luaL_optinteger(L, 2, -1));
+    return 1;
+}
+
+int LuaRecordBatchToLua::regColumnIndex(lua_State *L)
+{
+    checkProxy(L, 1);
+    luaL_checkstring(L, 2);
+    lua_getiuservalue(L, 1, 1);
+    lua_pushvalue(L, 2);
+    if (lua_rawget(L, -2) == LUA_TNIL) {
+        lua_pushinteger(L, -1);
+    }
+    return 1;
+}
+
+int LuaRecordBatchToLua::regColumn(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_Integer index;
+    if (lua_type(L, 2) == LUA_TSTRING) {
+        index = proxy->batch.columnIndex(lua_tostring(L, 2));
+    } else {
+        index = luaL_checkinteger(L, 2);
+    }
+    if (index < 0 || (size_t) index >= proxy->batch.columnCount()) {
+        lua_pushnil(L);
+        return 1;
+    }
+    const LuaRecordBatch::Column &column = proxy->batch.column((size_t) index);
+    if (column.kind != LuaRecordBatch::Kind::String) {
+        LuaTypedBufferToLua::pushBuffer(L, column.numbers);
+        return 1;
+    }
+    lua_createtable(L, (int) column.strings.size(), 0);
+    for (size_t i = 0; i < column.strings.size(); i++) {
+        lua_pushlstring(L, column.strings[i].data(), column.strings[i].size());
+        lua_rawseti(L, -2, (lua_Integer) i + 1);
+    }
+    return 1;
+}
+
+int LuaRecordBatchToLua::regColumns(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    size_t count = proxy->batch.columnCount();
+    lua_createtable(L, (int) count, 0);
+    for (size_t i = 0; i < count; i++) {
+        const std::string &name = proxy->batch.column(i).name;
+        lua_pushlstring(L, name.data(), name.size());
+        lua_rawseti(L, -2, (lua_Integer) i + 1);
+    }
+    return 1;
+}
+
+int LuaRecordBatchToLua::regCursorGC(lua_State *L)
+{
+    checkCursor(L, 1)->~Cursor();
+    return 0;
+}
+
+int LuaRecordBatchToLua::regCursorIndex(lua_State *L)
+{
+    Cursor *cursor = checkCursor(L, 1);
+    if (lua_isinteger(L, 2)) {
+        pushField(L, cursor, lua_tointeger(L, 2));
+        return 1;
+    }
+    lua_getiuservalue(L, 1, 1);
+    lua_pushvalue(L, 2);
+    if (lua_rawget(L, -2) == LUA_TNUMBER) {
+        pushField(L, cursor, lua_tointeger(L, -1));
+        return 1;
+    }
+    lua_pushvalue(L, 2);
+    lua_gettable(L, lua_upvalueindex(1));
+    return 1;
+}
+
+int LuaRecordBatchToLua::regCursorNewIndex(lua_State *L)
+{
+    checkCursor(L, 1);
+    return luaL_error(L, "LuaRecordBatch error: rows are read-only");
+}
+
+int LuaRecordBatchToLua::regCursorToString(lua_State *L)
+{
+    Cursor *cursor = checkCursor(L, 1);
+    lua_pushfstring(L, "LuaRecordCursor(%I/%I)", cursor->row, cursor->rowCount);
+    return 1;
+}
+
+int LuaRecordBatchToLua::regCursorNext(lua_State *L)
+{
+    Cursor *cursor = checkCursor(L, 1);
+    if (cursor->row < cursor->rowCount) {
+        cursor->row++;
+    }
+    lua_pushboolean(L, cursor->row < cursor->rowCount);
+    return 1;
+}
+
+int LuaRecordBatchToLua::regCursorSeek(lua_State *L)
+{
+    Cursor *cursor = checkCursor(L, 1);
+    lua_Integer row = luaL_checkinteger(L, 2);
+    cursor->row = row < -1 ? -1 : (row > cursor->rowCount ? cursor->rowCount : row);
+    lua_pushboolean(L, cursor->row >= 0 && cursor->row < cursor->rowCount);
+    return 1;
+}
+
+int LuaRecordBatchToLua::regCursorRow(lua_State *L)
+{
+    lua_pushinteger(L, checkCursor(L, 1)->row);
+    return 1;
+}
+
+int LuaRecordBatchToLua::regRowsNext(lua_State *L)
+{
+    Cursor *cursor = checkCursor(L, 1);
+    if (cursor->row < cursor->rowCount) {
+        cursor->row++;
+    }
+    if (cursor->row >= cursor->rowCount) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+GX_NS_END
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_RECORD_BATCH_TO_LUA_H
+#define GX_SCRIPT_LUA_RECORD_BATCH_TO_LUA_H
+
+#include "lua_record_batch.h"
+
+#include <lua.hpp>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaRecordBatchToLua
+ * @brief Bind LuaRecordBatch to Lua as a userdata. <br>
+ *        #batch is the row count, batch:rows() iterates the rows with one cursor: <br>
+ *        for row in batch:rows() do sum = sum + row.price end <br>
+ *        row.name and row[columnIndex] read the field directly from the column, the names are resolved
+ *        to column indexes once per batch. Other methods: cursor, columnIndex, column, columns.
+ *        Cursor methods (hidden by columns of the same name): next, seek, index.
+ */
+class LuaRecordBatchToLua
+{
+public:
+    static void toLua(lua_State *L);
+
+    static void pushBatch(lua_State *L, const LuaRecordBatch &batch);
+
+    static bool isProxy(lua_State *L, int idx);
+
+    /**
+     * @brief Convert a batch to a GAny of LuaRecordBatch, or a cursor to a GAnyObject copy of its row
+     * @param L
+     * @param idx
+     * @return
+     */
+    static GAny toGAny(lua_State *L, int idx);
+
+private:
+    struct Proxy;
+    struct Cursor;
+
+    static Proxy *checkProxy(lua_State *L, int idx);
+
+    static Cursor *checkCursor(lua_State *L, int idx);
+
+    static void pushCursor(lua_State *L, int batchIdx, lua_Integer row);
+
+    static void pushField(lua_State *L, const Cursor *cursor, lua_Integer column);
+
+private:
+    static int regGC(lua_State *L);
+
+    static int regIndex(lua_State *L);
+
+    static int regLen(lua_State *L);
+
+    static int regToString(lua_State *L);
+
+    static int regRows(lua_State *L);
+
+    static int regCursor(lua_State *L);
+
+    static int regColumnIndex(lua_State *L);
+
+    static int regColumn(lua_State *L);
+
+    static int regColumns(lua_State *L);
+
+    static int regCursorGC(lua_State *L);
+
+    static int regCursorIndex(lua_State *L);
+
+    static int regCursorNewIndex(lua_State *L);
+
+    static int regCursorToString(lua_State *L);
+
+    static int regCursorNext(lua_State *L);
+
+    static int regCursorSeek(lua_State *L);
+
+    static int regCursorRow(lua_State *L);
+
+    static int regRowsNext(lua_State *L);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_RECORD_BATCH_TO_LUA_H
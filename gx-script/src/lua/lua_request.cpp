@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_request.h"
+
+#include "gany_lua_vm.h"
+
+
+GX_NS_BEGIN
+
+LuaRequest::LuaRequest(uint64_t id)
+        : mId(id)
+{
+}
+
+LuaRequest::~LuaRequest()
+{
+    // Abandoned while suspended, the coroutine can not be reused
+    if (mThreadRef != LUA_NOREF) {
+        auto vm = mLuaVM.lock();
+        if (vm) {
+            vm->abandonRequest(mThreadRef);
+        }
+    }
+}
+
+uint64_t LuaRequest::id() const
+{
+    return mId;
+}
+
+LuaRequest::Status LuaRequest::status() const
+{
+    return mStatus;
+}
+
+bool LuaRequest::isSuspended() const
+{
+    return mStatus == Status::Suspended;
+}
+
+bool LuaRequest::isFinished() const
+{
+    return mStatus == Status::Finished;
+}
+
+bool LuaRequest::isFailed() const
+{
+    return mStatus == Status::Failed;
+}
+
+bool LuaRequest::isDone() const
+{
+    return mStatus != Status::Suspended;
+}
+
+bool LuaRequest::isAwaiting() const
+{
+    return mAwaiting;
+}
+
+bool LuaRequest::isPreempted() const
+{
+    return mPreempted;
+}
+
+void LuaRequest::setPriority(int32_t priority)
+{
+    mPriority = priority;
+}
+
+int32_t LuaRequest::priority() const
+{
+    return mPriority;
+}
+
+int64_t LuaRequest::cpuTimeUs() const
+{
+    return mCpuTimeUs;
+}
+
+uint64_t LuaRequest::preemptions() const
+{
+    return mPreemptions;
+}
+
+const GAny &LuaRequest::result() const
+{
+    return mResult;
+}
+
+const std::string &LuaRequest::error() const
+{
+    return mError;
+}
+
+GX_NS_END
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_REQUEST_H
+#define GX_SCRIPT_LUA_REQUEST_H
+
+#include <gx/gobject.h>
+
+#include "lua_future.h"
+
+#include <gx/gany.h>
+
+#include <lua.hpp>
+
+#include <memory>
+#include <string>
+
+
+GX_NS_BEGIN
+
+class GAnyLuaVM;
+
+/**
+ * @class LuaRequest
+ * @brief A request running in a pooled coroutine of a GAnyLuaVM (see GAnyLuaVM::request). <br>
+ *        The request runs until it finishes or yields. A suspended request only holds its coroutine,
+ *        it is continued by GAnyLuaVM::resumeRequest on the thread of the virtual machine.
+ *        A request suspended by Async.await is continued by GAnyLuaVM::runPending after the awaited future is completed,
+ *        a request preempted by time slicing (see GAnyLuaVM::setTimeSlice) is continued by the scheduler of the VM.
+ */
+class LuaRequest
+{
+public:
+    enum class Status
+    {
+        Suspended,
+        Finished,
+        Failed,
+    };
+
+public:
+    explicit LuaRequest(uint64_t id);
+
+    ~LuaRequest();
+
+    LuaRequest(const LuaRequest &) = delete;
+
+    LuaRequest &operator=(const LuaRequest &) = delete;
+
+    uint64_t id() const;
+
+    Status status() const;
+
+    bool isSuspended() const;
+
+    bool isFinished() const;
+
+    bool isFailed() const;
+
+    /**
+     * @brief Determine whether the request has finished or failed
+     * @return
+     */
+    bool isDone() const;
+
+    /**
+     * @brief Determine whether the request is suspended by Async.await, such a request can not be resumed manually
+     * @return
+     */
+    bool isAwaiting() const;
+
+    /**
+     * @brief Determine whether the request used up its time slice and waits in the ready queue of the scheduler
+     * @return
+     */
+    bool isPreempted() const;
+
+    /**
+     * @brief Priority used by the priority scheduling policy, higher runs first, takes effect the next time it is queued
+     * @param priority
+     */
+    void setPriority(int32_t priority);
+
+    int32_t priority() const;
+
+    /**
+     * @brief CPU time spent running the request on the thread of the virtual machine, in microseconds. <br>
+     *        Time the thread is blocked or descheduled is not counted (wall time on platforms without a thread clock)
+     * @return
+     */
+    int64_t cpuTimeUs() const;
+
+    /**
+     * @brief Number of times the request was preempted
+     * @return
+     */
+    uint64_t preemptions() const;
+
+    /**
+     * @brief The return value of the finished request, or the value yielded by the suspended request
+     * @return
+     */
+    const GAny &result() const;
+
+    /**
+     * @brief Error message of the failed request
+     * @return
+     */
+    const std::string &error() const;
+
+private:
+    friend class GAnyLuaVM;
+
+    uint64_t mId;
+    Status mStatus = Status::Suspended;
+    GAny mResult;
+    std::string mError;
+
+    bool mAwaiting = false;
+    LuaFuture mAwait;
+
+    bool mPreempted = false;
+    int32_t mPriority = 0;
+    int64_t mCpuTimeUs = 0;
+    uint64_t mPreemptions = 0;
+
+    std::weak_ptr<GAnyLuaVM> mLuaVM;
+    lua_State *mThread = nullptr;
+    int mThreadRef = LUA_NOREF;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_REQUEST_H
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_shared_table.h"
+
+#include "lua_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+/// Deepest nesting of tables, also stops the building of tables referencing themselves
+#define SHARED_TABLE_MAX_DEPTH 1000
+
+
+GX_NS_BEGIN
+
+const LuaSharedTable::Value *LuaSharedTable::Node::at(int64_t index) const
+{
+    if (index < 1 || index > (int64_t) array.size()) {
+        return nullptr;
+    }
+    return &array[index - 1];
+}
+
+const LuaSharedTable::Value *LuaSharedTable::Node::find(std::string_view key) const
+{
+    size_t i = indexOf(key);
+    return i < fields.size() ? &fields[i].second : nullptr;
+}
+
+size_t LuaSharedTable::Node::indexOf(std::string_view key) const
+{
+    auto it = std::lower_bound(fields.begin(), fields.end(), key,
+                               [](const std::pair<std::string, Value> &item, std::string_view k) {
+                                   return std::string_view(item.first) < k;
+                               });
+    if (it == fields.end() || it->first != key) {
+        return fields.size();
+    }
+    return it - fields.begin();
+}
+
+LuaSharedTable::LuaSharedTable(const GAny &data)
+        : LuaSharedTable(build(data))
+{
+}
+
+LuaSharedTable::LuaSharedTable(NodePtr root)
+        : mState(std::make_shared<SharedState>())
+{
+    mState->root = root ? std::move(root) : std::make_shared<const Node>();
+}
+
+void LuaSharedTable::publish(const GAny &data)
+{
+    NodePtr root = build(data);
+    std::atomic_store_explicit(&mState->root, std::move(root), std::memory_order_release);
+    // Readers check the version before loading the root again
+    mState->version.fetch_add(1, std::memory_order_release);
+}
+
+LuaSharedTable::NodePtr LuaSharedTable::current() const
+{
+    return std::atomic_load_explicit(&mState->root, std::memory_order_acquire);
+}
+
+uint64_t LuaSharedTable::version() const
+{
+    return mState->version.load(std::memory_order_acquire);
+}
+
+GAny LuaSharedTable::getItem(const GAny &key) const
+{
+    NodePtr root = current();
+    const Value *value;
+    int64_t index;
+    if (isIndex(key, index)) {
+        value = root->at(index);
+        if (!value) {
+            value = root->find(key.toString());
+        }
+    } else {
+        value = root->find(key.toString());
+    }
+    return value ? toGAny(*value) : GAny::undefined();
+}
+
+size_t LuaSharedTable::length() const
+{
+    return current()->array.size();
+}
+
+GAny LuaSharedTable::toObject() const
+{
+    return toObject(*current());
+}
+
+std::string LuaSharedTable::toString() const
+{
+    return "LuaSharedTable(version: " + std::to_string(version()) + ")";
+}
+
+LuaSharedTable::NodePtr LuaSharedTable::build(const GAny &data)
+{
+    return build(data, 0);
+}
+
+LuaSharedTable::NodePtr LuaSharedTable::build(const GAny &data, int depth)
+{
+    if (data.is<LuaSharedTable>()) {
+        return data.as<LuaSharedTable>().current();
+    }
+
+    if (depth >= SHARED_TABLE_MAX_DEPTH) {
+        throw GAnyException("LuaSharedTable: nesting too deep (table referencing itself?)");
+    }
+
+    auto node = std::make_shared<Node>();
+    if (data.is<LuaTable>()) {
+        // Integer keys from 1 without gaps form the array part, other keys are converted to strings
+        std::map<int64_t, Value> indexes;
+        auto iterator = data.as<LuaTable>().iterator();
+        while (iterator->hasNext()) {
+            auto item = iterator->next();
+            int64_t index;
+            if (isIndex(item.first, index) && index >= 1) {
+                indexes.emplace(index, buildValue(item.second, depth));
+            } else {
+                node->fields.emplace_back(item.first.toString(), buildValue(item.second, depth));
+            }
+        }
+        for (auto &item: indexes) {
+            if (item.first == (int64_t) node->array.size() + 1) {
+                node->array.push_back(std::move(item.second));
+            } else {
+                node->fields.emplace_back(std::to_string(item.first), std::move(item.second));
+            }
+        }
+    } else if (data.isArray()) {
+        node->array.reserve(data.size());
+        for (int32_t i = 0; i < (int32_t) data.size(); i++) {
+            node->array.push_back(buildValue(data[i], depth));
+        }
+    } else if (data.isObject()) {
+        data.call("forEach", [&](const std::string &k, const GAny &v) {
+            node->fields.emplace_back(k, buildValue(v, depth));
+        });
+    }
+
+    std::sort(node->fields.begin(), node->fields.end(),
+              [](const std::pair<std::string, Value> &a, const std::pair<std::string, Value> &b) {
+                  return a.first < b.first;
+              });
+    return node;
+}
+
+GAny LuaSharedTable::toObject(const Node &node)
+{
+    if (node.fields.empty() && !node.array.empty()) {
+        GAny array = GAny::array();
+        for (const auto &value: node.array) {
+            array.pushBack(value.table ? toObject(*value.table) : value.value);
+        }
+        return array;
+    }
+
+    GAny obj = GAny::object();
+    for (size_t i = 0; i < node.array.size(); i++) {
+        const Value &value = node.array[i];
+        obj[std::to_string(i + 1)] = value.table ? toObject(*value.table) : value.value;
+    }
+    for (const auto &item: node.fields) {
+        obj[item.first] = item.second.table ? toObject(*item.second.table) : item.second.value;
+    }
+    return obj;
+}
+
+GAny LuaSharedTable::toGAny(const Value &value)
+{
+    if (value.table) {
+        return LuaSharedTable(value.table);
+    }
+    return value.value;
+}
+
+LuaSharedTable::Value LuaSharedTable::buildValue(const GAny &value, int depth)
+{
+    if (value.is<LuaSharedTable>() || value.is<LuaTable>() || value.isArray() || value.isObject()) {
+        return {GAny::undefined(), build(value, depth + 1)};
+    }
+    return {value, nullptr};
+}
+
+bool LuaSharedTable::isIndex(const GAny &key, int64_t &index)
+{
+    if (!key.isNumber()) {
+        return false;
+    }
+    double number = key.toDouble();
+    if (std::floor(number) != number) {
+        return false;
+    }
+    index = (int64_t) number;
+    return true;
+}
+
+GX_NS_END
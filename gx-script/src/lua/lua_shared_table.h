@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_SHARED_TABLE_H
+#define GX_SCRIPT_LUA_SHARED_TABLE_H
+
+#include <gx/gobject.h>
+
+#include <gx/gany.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaSharedTable
+ * @brief Immutable table shared by all virtual machines and threads without copying. <br>
+ *        The data is converted once into a read-only tree, Lua reads it in place through a userdata proxy,
+ *        so the memory does not grow with the number of virtual machines. <br>
+ *        Writers publish a whole new version atomically (read-copy-update), a version is released
+ *        when the last reader holding it is gone. <br>
+ *        A proxy of the table follows the published versions, a nested table read from it
+ *        stays on the version it was read from.
+ */
+class LuaSharedTable
+{
+public:
+    struct Node;
+
+    using NodePtr = std::shared_ptr<const Node>;
+
+    /**
+     * @brief Value of a node: a scalar or a nested table
+     */
+    struct Value
+    {
+        GAny value;
+        NodePtr table;
+    };
+
+    struct Node
+    {
+        /// Values of the keys 1..n
+        std::vector<Value> array;
+        /// Other keys as strings, sorted
+        std::vector<std::pair<std::string, Value>> fields;
+
+        /**
+         * @brief Value of an array index
+         * @param index Lua index, starting from 1
+         * @return nullptr if out of range
+         */
+        const Value *at(int64_t index) const;
+
+        const Value *find(std::string_view key) const;
+
+        /**
+         * @brief Position of a field in fields
+         * @param key
+         * @return fields.size() if not found
+         */
+        size_t indexOf(std::string_view key) const;
+    };
+
+public:
+    /**
+     * @brief Create a table with the first version
+     * @param data  GAnyObject, GAnyArray or LuaTable
+     */
+    explicit LuaSharedTable(const GAny &data = GAny::object());
+
+    /**
+     * @brief Create a table fixed on a node
+     * @param root
+     */
+    explicit LuaSharedTable(NodePtr root);
+
+    LuaSharedTable(const LuaSharedTable &b) = default;
+
+    LuaSharedTable(LuaSharedTable &&b) noexcept = default;
+
+    LuaSharedTable &operator=(const LuaSharedTable &b) = default;
+
+    LuaSharedTable &operator=(LuaSharedTable &&b) noexcept = default;
+
+public:
+    /**
+     * @brief Publish a new version, readers see it on their next access
+     * @param data  GAnyObject, GAnyArray or LuaTable
+     */
+    void publish(const GAny &data);
+
+    /**
+     * @brief Current version of the data, it stays valid as long as it is held
+     * @return
+     */
+    NodePtr current() const;
+
+    /**
+     * @brief Number of the current version, increased by each publish
+     * @return
+     */
+    uint64_t version() const;
+
+    /**
+     * @brief Get a value of the current version, a nested table is returned as a LuaSharedTable on its node
+     * @param key
+     * @return undefined if not found
+     */
+    GAny getItem(const GAny &key) const;
+
+    /**
+     * @brief Length of the array part of the current version
+     * @return
+     */
+    size_t length() const;
+
+    /**
+     * @brief Copy the current version to GAnyObject or GAnyArray
+     * @return
+     */
+    GAny toObject() const;
+
+    std::string toString() const;
+
+    bool operator==(const LuaSharedTable &rhs) const
+    {
+        return mState == rhs.mState;
+    }
+
+public:
+    /**
+     * @brief Build an immutable node from data, nested LuaSharedTable values are shared instead of copied.
+     *        Throws GAnyException if the data is nested too deep, which includes tables referencing themselves
+     * @param data
+     * @return
+     */
+    static NodePtr build(const GAny &data);
+
+    static GAny toObject(const Node &node);
+
+    static GAny toGAny(const Value &value);
+
+private:
+    static NodePtr build(const GAny &data, int depth);
+
+    static Value buildValue(const GAny &value, int depth);
+
+    static bool isIndex(const GAny &key, int64_t &index);
+
+private:
+    struct SharedState
+    {
+        NodePtr root;
+        std::atomic<uint64_t> version{1};
+    };
+
+    std::shared_ptr<SharedState> mState;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_SHARED_TABLE_H
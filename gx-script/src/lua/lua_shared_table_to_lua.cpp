@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_shared_table_to_lua.h"
+
+#include "gany_lua_vm.h"
+
+#include <string.h>
+
+
+GX_NS_BEGIN
+
+#define SHARED_TABLE_META "LuaSharedTable"
+
+/**
+ * @brief Userdata of a proxy. Starts with a GAny pointer like the other userdata,
+ *        the GAny is only created when the proxy is converted back to GAny
+ */
+struct LuaSharedTableToLua::Proxy
+{
+    GAny *self = nullptr;
+    GAny object;
+    std::unique_ptr<LuaSharedTable> table;
+    LuaSharedTable::NodePtr node;
+    uint64_t version = 0;
+};
+
+void LuaSharedTableToLua::toLua(lua_State *L)
+{
+    const luaL_Reg methods[] = {
+            {"__gc",       regGC},
+            {"__index",    regIndex},
+            {"__newindex", regNewIndex},
+            {"__len",      regLen},
+            {"__pairs",    regPairs},
+            {"__tostring", regToString},
+            {nullptr,      nullptr}
+    };
+
+    luaL_newmetatable(L, SHARED_TABLE_META);
+    int top = lua_gettop(L);
+
+    lua_pushliteral(L, "_name");
+    lua_pushstring(L, SHARED_TABLE_META);
+    lua_settable(L, top);
+
+    const luaL_Reg *f;
+    for (f = methods; f->func; f++) {
+        lua_pushstring(L, f->name);
+        lua_pushcfunction(L, f->func);
+        lua_settable(L, top);
+    }
+    lua_pop(L, 1);
+}
+
+void LuaSharedTableToLua::pushTable(lua_State *L, const LuaSharedTable &table)
+{
+    Proxy *proxy = newProxy(L);
+    proxy->table = std::make_unique<LuaSharedTable>(table);
+    proxy->version = table.version();
+    proxy->node = table.current();
+}
+
+void LuaSharedTableToLua::pushNode(lua_State *L, LuaSharedTable::NodePtr node)
+{
+    Proxy *proxy = newProxy(L);
+    proxy->node = std::move(node);
+}
+
+bool LuaSharedTableToLua::isProxy(lua_State *L, int idx)
+{
+    return luaL_testudata(L, idx, SHARED_TABLE_META) != nullptr;
+}
+
+GAny LuaSharedTableToLua::toGAny(lua_State *L, int idx)
+{
+    auto *proxy = (Proxy *) luaL_testudata(L, idx, SHARED_TABLE_META);
+    if (!proxy) {
+        return GAny::undefined();
+    }
+    if (proxy->object.isUndefined()) {
+        if (proxy->table) {
+            proxy->object = *proxy->table;
+        } else {
+            proxy->object = LuaSharedTable(proxy->node);
+        }
+    }
+    return proxy->object;
+}
+
+LuaSharedTableToLua::Proxy *LuaSharedTableToLua::newProxy(lua_State *L)
+{
+    auto *proxy = new(lua_newuserdatauv(L, sizeof(Proxy), 0)) Proxy();
+    proxy->self = &proxy->object;
+    luaL_getmetatable(L, SHARED_TABLE_META);
+    lua_setmetatable(L, -2);
+    return proxy;
+}
+
+const LuaSharedTable::Node *LuaSharedTableToLua::node(lua_State *L, int idx)
+{
+    auto *proxy = (Proxy *) luaL_checkudata(L, idx, SHARED_TABLE_META);
+    if (proxy->table) {
+        // Only an atomic load while the version is unchanged
+        uint64_t version = proxy->table->version();
+        if (version != proxy->version) {
+            proxy->node = proxy->table->current();
+            proxy->version = version;
+        }
+    }
+    return proxy->node.get();
+}
+
+void LuaSharedTableToLua::pushValue(lua_State *L, const LuaSharedTable::Value &value)
+{
+    if (value.table) {
+        pushNode(L, value.table);
+    } else {
+        GAnyLuaVM::makeGAnyToLuaObject(L, value.value);
+    }
+}
+
+int LuaSharedTableToLua::regGC(lua_State *L)
+{
+    auto *proxy = (Proxy *) luaL_checkudata(L, 1, SHARED_TABLE_META);
+    proxy->~Proxy();
+    return 0;
+}
+
+int LuaSharedTableToLua::regIndex(lua_State *L)
+{
+    const LuaSharedTable::Node *n = node(L, 1);
+    const LuaSharedTable::Value *value = nullptr;
+    if (lua_isinteger(L, 2)) {
+        value = n->at(lua_tointeger(L, 2));
+    }
+    if (!value && (lua_type(L, 2) == LUA_TSTRING || lua_type(L, 2) == LUA_TNUMBER)) {
+        // Numbers outside the array part are stored as strings, converted on a copy of the key
+        lua_pushvalue(L, 2);
+        size_t len;
+        const char *key = lua_tolstring(L, -1, &len);
+        value = n->find(std::string_view(key, len));
+        lua_pop(L, 1);
+    }
+    if (!value) {
+        lua_pushnil(L);
+        return 1;
+    }
+    pushValue(L, *value);
+    return 1;
+}
+
+int LuaSharedTableToLua::regNewIndex(lua_State *L)
+{
+    luaL_error(L, "LuaSharedTable is read-only, publish a new version from its owner instead");
+    return 0;
+}
+
+int LuaSharedTableToLua::regLen(lua_State *L)
+{
+    lua_pushinteger(L, (lua_Integer) node(L, 1)->array.size());
+    return 1;
+}
+
+int LuaSharedTableToLua::regPairs(lua_State *L)
+{
+    auto *proxy = (Proxy *) luaL_checkudata(L, 1, SHARED_TABLE_META);
+    node(L, 1);
+    lua_pushcfunction(L, regNext);
+    // Iterate over a fixed proxy, so the loop is not affected by a publish
+    pushNode(L, proxy->node);
+    lua_pushnil(L);
+    return 3;
+}
+
+int LuaSharedTableToLua::regNext(lua_State *L)
+{
+    const LuaSharedTable::Node *n = node(L, 1);
+    size_t arraySize = n->array.size();
+
+    // Position of the next item: array part first, then the fields
+    size_t pos = 0;
+    if (lua_isinteger(L, 2)) {
+        pos = (size_t) lua_tointeger(L, 2);
+    } else if (lua_type(L, 2) == LUA_TSTRING) {
+        size_t len;
+        const char *key = lua_tolstring(L, 2, &len);
+        size_t i = n->indexOf(std::string_view(key, len));
+        if (i >= n->fields.size()) {
+            return luaL_error(L, "invalid key to 'next'");
+        }
+        pos = arraySize + i + 1;
+    }
+
+    if (pos < arraySize) {
+        lua_pushinteger(L, (lua_Integer) pos + 1);
+        pushValue(L, n->array[pos]);
+        return 2;
+    }
+    size_t i = pos - arraySize;
+    if (i < n->fields.size()) {
+        const auto &item = n->fields[i];
+        lua_pushlstring(L, item.first.data(), item.first.size());
+        pushValue(L, item.second);
+        return 2;
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+int LuaSharedTableToLua::regToString(lua_State *L)
+{
+    auto *proxy = (Proxy *) luaL_checkudata(L, 1, SHARED_TABLE_META);
+    if (proxy->table) {
+        lua_pushfstring(L, "LuaSharedTable(version: %I)", (lua_Integer) proxy->table->version());
+    } else {
+        lua_pushfstring(L, "LuaSharedTable(%p)", proxy->node.get());
+    }
+    return 1;
+}
+
+GX_NS_END
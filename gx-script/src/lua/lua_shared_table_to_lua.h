@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_SHARED_TABLE_TO_LUA_H
+#define GX_SCRIPT_LUA_SHARED_TABLE_TO_LUA_H
+
+#include "lua_shared_table.h"
+
+#include <lua.hpp>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaSharedTableToLua
+ * @brief Bind LuaSharedTable to Lua as a read-only userdata proxy. <br>
+ *        Reads look up the shared nodes directly, the proxy only reloads the root when the version changes.
+ *        pairs iterates over the version current at the start of the loop.
+ */
+class LuaSharedTableToLua
+{
+public:
+    static void toLua(lua_State *L);
+
+    /**
+     * @brief Push a proxy following the versions of the table
+     * @param L
+     * @param table
+     */
+    static void pushTable(lua_State *L, const LuaSharedTable &table);
+
+    /**
+     * @brief Push a proxy of a fixed node
+     * @param L
+     * @param node
+     */
+    static void pushNode(lua_State *L, LuaSharedTable::NodePtr node);
+
+    static bool isProxy(lua_State *L, int idx);
+
+    /**
+     * @brief Convert a proxy to a GAny of LuaSharedTable
+     * @param L
+     * @param idx
+     * @return
+     */
+    static GAny toGAny(lua_State *L, int idx);
+
+private:
+    struct Proxy;
+
+    static Proxy *newProxy(lua_State *L);
+
+    static const LuaSharedTable::Node *node(lua_State *L, int idx);
+
+    static void pushValue(lua_State *L, const LuaSharedTable::Value &value);
+
+private:
+    static int regGC(lua_State *L);
+
+    static int regIndex(lua_State *L);
+
+    static int regNewIndex(lua_State *L);
+
+    static int regLen(lua_State *L);
+
+    static int regPairs(lua_State *L);
+
+    static int regNext(lua_State *L);
+
+    static int regToString(lua_State *L);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_SHARED_TABLE_TO_LUA_H
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_task_queue.h"
+
+#include <chrono>
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#endif
+
+
+GX_NS_BEGIN
+
+LuaTaskQueue::LuaTaskQueue()
+{
+#if defined(__linux__)
+    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+}
+
+LuaTaskQueue::~LuaTaskQueue()
+{
+#if defined(__linux__)
+    if (mWakeFd >= 0) {
+        close(mWakeFd);
+    }
+#endif
+}
+
+void LuaTaskQueue::post(Task task)
+{
+    mTasks.push(std::move(task));
+    mSize.fetch_add(1);
+
+    if (mWakeFd >= 0) {
+#if defined(__linux__)
+        // One signal is enough until the consumer takes the tasks
+        if (!mWakePending.exchange(true)) {
+            uint64_t one = 1;
+            ssize_t ret = write(mWakeFd, &one, sizeof(one));
+            (void) ret;
+        }
+#endif
+        return;
+    }
+    // Taking the lock orders the push before a consumer that is about to wait
+    std::lock_guard<std::mutex> locker(mWaitLock);
+    mWaitCond.notify_one();
+}
+
+bool LuaTaskQueue::empty() const
+{
+    return mTasks.empty();
+}
+
+size_t LuaTaskQueue::size() const
+{
+    return mSize.load(std::memory_order_relaxed);
+}
+
+int LuaTaskQueue::wakeFd() const
+{
+    return mWakeFd;
+}
+
+size_t LuaTaskQueue::run(int32_t timeoutMs)
+{
+    if (timeoutMs != 0 && mTasks.empty()) {
+        wait(timeoutMs);
+    }
+    consumeWake();
+    size_t count = mTasks.drain([this](Task &task) {
+        mSize.fetch_sub(1, std::memory_order_relaxed);
+        task();
+    });
+    return count;
+}
+
+void LuaTaskQueue::clear()
+{
+    consumeWake();
+    mTasks.drain([this](Task &) {
+        mSize.fetch_sub(1, std::memory_order_relaxed);
+    });
+}
+
+void LuaTaskQueue::wait(int32_t timeoutMs)
+{
+#if defined(__linux__)
+    if (mWakeFd >= 0) {
+        pollfd pfd{mWakeFd, POLLIN, 0};
+        poll(&pfd, 1, timeoutMs < 0 ? -1 : timeoutMs);
+        return;
+    }
+#endif
+    std::unique_lock<std::mutex> locker(mWaitLock);
+    auto ready = [this] { return !mTasks.empty(); };
+    if (timeoutMs < 0) {
+        mWaitCond.wait(locker, ready);
+    } else {
+        mWaitCond.wait_for(locker, std::chrono::milliseconds(timeoutMs), ready);
+    }
+}
+
+void LuaTaskQueue::consumeWake()
+{
+#if defined(__linux__)
+    // Reset before taking the tasks, a task posted later signals again
+    if (mWakeFd >= 0 && mWakePending.exchange(false)) {
+        uint64_t value;
+        ssize_t ret = read(mWakeFd, &value, sizeof(value));
+        (void) ret;
+    }
+#endif
+}
+
+GX_NS_END
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_TASK_QUEUE_H
+#define GX_SCRIPT_LUA_TASK_QUEUE_H
+
+#include <gx/gobject.h>
+
+#include "mpsc_queue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaTaskQueue
+ * @brief Tasks posted from any thread and run by the thread of a virtual machine. <br>
+ *        On Linux the consumer is woken up through an eventfd, which an event loop can wait on with other descriptors.
+ */
+class LuaTaskQueue
+{
+public:
+    using Task = std::function<void()>;
+
+public:
+    LuaTaskQueue();
+
+    ~LuaTaskQueue();
+
+    LuaTaskQueue(const LuaTaskQueue &) = delete;
+
+    LuaTaskQueue &operator=(const LuaTaskQueue &) = delete;
+
+    /**
+     * @brief Add a task and wake up the consumer, may be called from any thread
+     * @param task
+     */
+    void post(Task task);
+
+    bool empty() const;
+
+    /**
+     * @brief Number of tasks posted and not yet run
+     * @return
+     */
+    size_t size() const;
+
+    /**
+     * @brief Descriptor that becomes readable when a task is posted, -1 if not supported on the platform
+     * @return
+     */
+    int wakeFd() const;
+
+    /**
+     * @brief Run the pending tasks in post order, only called by the consumer
+     * @param timeoutMs     Time to wait for a task when there is none, 0 does not wait, negative numbers wait forever
+     * @return Number of tasks run
+     */
+    size_t run(int32_t timeoutMs = 0);
+
+    /**
+     * @brief Discard all pending tasks
+     */
+    void clear();
+
+private:
+    void wait(int32_t timeoutMs);
+
+    void consumeWake();
+
+private:
+    MpscQueue<Task> mTasks;
+    std::atomic<size_t> mSize{0};
+
+    int mWakeFd = -1;
+    std::atomic<bool> mWakePending{false};
+
+    std::mutex mWaitLock;
+    std::condition_variable mWaitCond;
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_TASK_QUEUE_H
@@ -0,0 +1,658 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_typed_buffer.h"
+
+#include <gx/gbytearray.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TYPED_BUFFER_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TYPED_BUFFER_SIMD_SSE2 1
+#endif
+
+/// Alignment of owned memory, enough for aligned AVX loads
+#define TYPED_BUFFER_ALIGN 32
+
+
+GX_NS_BEGIN
+
+/**
+ * @brief Vector operations of one element type, only specialized where SIMD is available
+ */
+template<typename T>
+struct Simd
+{
+    static constexpr bool enabled = false;
+};
+
+#if defined(TYPED_BUFFER_SIMD_AVX)
+
+template<>
+struct Simd<float>
+{
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 8;
+    using V = __m256;
+
+    static V load(const float *p) { return _mm256_loadu_ps(p); }
+
+    static void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+
+    static V set1(float a) { return _mm256_set1_ps(a); }
+
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+};
+
+template<>
+struct Simd<double>
+{
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 4;
+    using V = __m256d;
+
+    static V load(const double *p) { return _mm256_loadu_pd(p); }
+
+    static void store(double *p, V v) { _mm256_storeu_pd(p, v); }
+
+    static V set1(double a) { return _mm256_set1_pd(a); }
+
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+
+    static V min(V a, V b) { return _mm256_min_pd(a, b); }
+
+    static V max(V a, V b) { return _mm256_max_pd(a, b); }
+};
+
+#elif defined(TYPED_BUFFER_SIMD_SSE2)
+
+template<>
+struct Simd<float>
+{
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 4;
+    using V = __m128;
+
+    static V load(const float *p) { return _mm_loadu_ps(p); }
+
+    static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+
+    static V set1(float a) { return _mm_set1_ps(a); }
+
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+};
+
+template<>
+struct Simd<double>
+{
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 2;
+    using V = __m128d;
+
+    static V load(const double *p) { return _mm_loadu_pd(p); }
+
+    static void store(double *p, V v) { _mm_storeu_pd(p, v); }
+
+    static V set1(double a) { return _mm_set1_pd(a); }
+
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+
+    static V min(V a, V b) { return _mm_min_pd(a, b); }
+
+    static V max(V a, V b) { return _mm_max_pd(a, b); }
+};
+
+#endif
+
+/**
+ * @brief Kernels of one element type, the vector loops handle full SIMD blocks and the scalar loops the rest
+ */
+template<typename T>
+struct Kernels
+{
+    using S = Simd<T>;
+
+    template<typename V>
+    static T horizontal(V v, T (*op)(T, T))
+    {
+        alignas(TYPED_BUFFER_ALIGN) T lanes[sizeof(V) / sizeof(T)];
+        S::store(lanes, v);
+        T r = lanes[0];
+        for (size_t i = 1; i < sizeof(V) / sizeof(T); i++) {
+            r = op(r, lanes[i]);
+        }
+        return r;
+    }
+
+    static T opAdd(T a, T b) { return a + b; }
+
+    static T opMin(T a, T b) { return b < a ? b : a; }
+
+    static T opMax(T a, T b) { return a < b ? b : a; }
+
+    static double sum(const T *p, size_t n)
+    {
+        size_t i = 0;
+        double r = 0;
+        if constexpr (S::enabled) {
+            // Two accumulators hide the latency of the additions
+            auto acc0 = S::set1(0), acc1 = S::set1(0);
+            for (; i + 2 * S::width <= n; i += 2 * S::width) {
+                acc0 = S::add(acc0, S::load(p + i));
+                acc1 = S::add(acc1, S::load(p + i + S::width));
+            }
+            r = horizontal(S::add(acc0, acc1), opAdd);
+        }
+        for (; i < n; i++) {
+            r += p[i];
+        }
+        return r;
+    }
+
+    static double dot(const T *a, const T *b, size_t n)
+    {
+        size_t i = 0;
+        double r = 0;
+        if constexpr (S::enabled) {
+            auto acc0 = S::set1(0), acc1 = S::set1(0);
+            for (; i + 2 * S::width <= n; i += 2 * S::width) {
+                acc0 = S::add(acc0, S::mul(S::load(a + i), S::load(b + i)));
+                acc1 = S::add(acc1, S::mul(S::load(a + i + S::width), S::load(b + i + S::width)));
+            }
+            r = horizontal(S::add(acc0, acc1), opAdd);
+        }
+        for (; i < n; i++) {
+            r += (double) a[i] * b[i];
+        }
+        return r;
+    }
+
+    static void axpy(T *y, T a, const T *x, size_t n)
+    {
+        size_t i = 0;
+        if constexpr (S::enabled) {
+            auto va = S::set1(a);
+            for (; i + S::width <= n; i += S::width) {
+                S::store(y + i, S::add(S::load(y + i), S::mul(va, S::load(x + i))));
+            }
+        }
+        for (; i < n; i++) {
+            y[i] += a * x[i];
+        }
+    }
+
+    static void scale(T *y, T a, size_t n)
+    {
+        size_t i = 0;
+        if constexpr (S::enabled) {
+            auto va = S::set1(a);
+            for (; i + S::width <= n; i += S::width) {
+                S::store(y + i, S::mul(S::load(y + i), va));
+            }
+        }
+        for (; i < n; i++) {
+            y[i] *= a;
+        }
+    }
+
+    static T min(const T *p, size_t n)
+    {
+        if (n == 0) {
+            return 0;
+        }
+        size_t i = 0;
+        T r = p[0];
+        if constexpr (S::enabled) {
+            if (n >= S::width) {
+                auto acc = S::load(p);
+                for (i = S::width; i + S::width <= n; i += S::width) {
+                    acc = S::min(acc, S::load(p + i));
+                }
+                r = horizontal(acc, opMin);
+            }
+        }
+        for (; i < n; i++) {
+            r = opMin(r, p[i]);
+        }
+        return r;
+    }
+
+    static T max(const T *p, size_t n)
+    {
+        if (n == 0) {
+            return 0;
+        }
+        size_t i = 0;
+        T r = p[0];
+        if constexpr (S::enabled) {
+            if (n >= S::width) {
+                auto acc = S::load(p);
+                for (i = S::width; i + S::width <= n; i += S::width) {
+                    acc = S::max(acc, S::load(p + i));
+                }
+                r = horizontal(acc, opMax);
+            }
+        }
+        for (; i < n; i++) {
+            r = opMax(r, p[i]);
+        }
+        return r;
+    }
+
+    /// Integers are compared in double precision, rounding the threshold would change the result of < and >
+    using C = std::conditional_t<std::is_integral<T>::value, double, T>;
+
+    template<typename Compare>
+    static void selectWith(T *out, const T *p, size_t n, Compare cmp, C threshold, T ifTrue, T ifFalse)
+    {
+        // Branch-free form, vectorized by the compiler
+        for (size_t i = 0; i < n; i++) {
+            out[i] = cmp((C) p[i], threshold) ? ifTrue : ifFalse;
+        }
+    }
+
+    static void select(T *out, const T *p, size_t n, LuaTypedBuffer::CompareOp op,
+                       C threshold, T ifTrue, T ifFalse)
+    {
+        switch (op) {
+            case LuaTypedBuffer::CompareOp::Less:
+                selectWith(out, p, n, [](C a, C b) { return a < b; }, threshold, ifTrue, ifFalse);
+                break;
+            case LuaTypedBuffer::CompareOp::LessEqual:
+                selectWith(out, p, n, [](C a, C b) { return a <= b; }, threshold, ifTrue, ifFalse);
+                break;
+            case LuaTypedBuffer::CompareOp::Greater:
+                selectWith(out, p, n, [](C a, C b) { return a > b; }, threshold, ifTrue, ifFalse);
+                break;
+            case LuaTypedBuffer::CompareOp::GreaterEqual:
+                selectWith(out, p, n, [](C a, C b) { return a >= b; }, threshold, ifTrue, ifFalse);
+                break;
+            case LuaTypedBuffer::CompareOp::Equal:
+                selectWith(out, p, n, [](C a, C b) { return a == b; }, threshold, ifTrue, ifFalse);
+                break;
+            case LuaTypedBuffer::CompareOp::NotEqual:
+                selectWith(out, p, n, [](C a, C b) { return a != b; }, threshold, ifTrue, ifFalse);
+                break;
+        }
+    }
+};
+
+/// Call func with a typed pointer to the data of the buffer
+template<typename Func>
+static auto dispatch(LuaTypedBuffer::Type type, void *data, Func &&func)
+{
+    switch (type) {
+        case LuaTypedBuffer::Type::F32:
+            return func(static_cast<float *>(data));
+        case LuaTypedBuffer::Type::I32:
+            return func(static_cast<int32_t *>(data));
+        case LuaTypedBuffer::Type::I64:
+            return func(static_cast<int64_t *>(data));
+        case LuaTypedBuffer::Type::F64:
+        default:
+            return func(static_cast<double *>(data));
+    }
+}
+
+template<typename T>
+static T castTo(double value)
+{
+    if constexpr (std::is_integral<T>::value) {
+        return (T) std::llround(value);
+    } else {
+        return (T) value;
+    }
+}
+
+LuaTypedBuffer::LuaTypedBuffer() = default;
+
+LuaTypedBuffer::LuaTypedBuffer(Type type, size_t length)
+        : mType(type), mLength(length)
+{
+    size_t bytes = std::max<size_t>(elementSize() * length, TYPED_BUFFER_ALIGN);
+    bytes = (bytes + TYPED_BUFFER_ALIGN - 1) / TYPED_BUFFER_ALIGN * TYPED_BUFFER_ALIGN;
+#if defined(_MSC_VER)
+    void *p = _aligned_malloc(bytes, TYPED_BUFFER_ALIGN);
+    mOwner = std::shared_ptr<void>(p, [](void *ptr) { _aligned_free(ptr); });
+#else
+    void *p = aligned_alloc(TYPED_BUFFER_ALIGN, bytes);
+    mOwner = std::shared_ptr<void>(p, [](void *ptr) { free(ptr); });
+#endif
+    if (!p) {
+        mLength = 0;
+        return;
+    }
+    memset(p, 0, bytes);
+    mData = static_cast<uint8_t *>(p);
+}
+
+LuaTypedBuffer LuaTypedBuffer::wrap(Type type, const GAny &byteArray)
+{
+    if (!byteArray.is<GByteArray>()) {
+        return {};
+    }
+    auto holder = std::make_shared<GAny>(byteArray);
+    LuaTypedBuffer buffer;
+    buffer.mType = type;
+    buffer.mByteArray = &holder->as<GByteArray>();
+    buffer.mLength = std::numeric_limits<size_t>::max();
+    buffer.mOwner = std::move(holder);
+    return buffer;
+}
+
+LuaTypedBuffer LuaTypedBuffer::wrap(Type type, void *data, size_t length, std::shared_ptr<void> owner)
+{
+    LuaTypedBuffer buffer;
+    buffer.mType = type;
+    buffer.mData = static_cast<uint8_t *>(data);
+    buffer.mLength = data ? length : 0;
+    buffer.mOwner = std::move(owner);
+    return buffer;
+}
+
+bool LuaTypedBuffer::parseType(const std::string &name, Type &type)
+{
+    if (name == "f32") {
+        type = Type::F32;
+    } else if (name == "f64") {
+        type = Type::F64;
+    } else if (name == "i32") {
+        type = Type::I32;
+    } else if (name == "i64") {
+        type = Type::I64;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool LuaTypedBuffer::parseCompareOp(const std::string &name, CompareOp &op)
+{
+    if (name == "<") {
+        op = CompareOp::Less;
+    } else if (name == "<=") {
+        op = CompareOp::LessEqual;
+    } else if (name == ">") {
+        op = CompareOp::Greater;
+    } else if (name == ">=") {
+        op = CompareOp::GreaterEqual;
+    } else if (name == "==") {
+        op = CompareOp::Equal;
+    } else if (name == "~=" || name == "!=") {
+        op = CompareOp::NotEqual;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+LuaTypedBuffer::Type LuaTypedBuffer::type() const
+{
+    return mType;
+}
+
+std::string LuaTypedBuffer::typeName() const
+{
+    switch (mType) {
+        case Type::F32:
+            return "f32";
+        case Type::I32:
+            return "i32";
+        case Type::I64:
+            return "i64";
+        case Type::F64:
+        default:
+            return "f64";
+    }
+}
+
+size_t LuaTypedBuffer::length() const
+{
+    if (mByteArray) {
+        auto size = (size_t) mByteArray->size();
+        return mOffset < size ? std::min(mLength, (size - mOffset) / elementSize()) : 0;
+    }
+    return mLength;
+}
+
+size_t LuaTypedBuffer::elementSize() const
+{
+    return (mType == Type::F32 || mType == Type::I32) ? 4 : 8;
+}
+
+void *LuaTypedBuffer::data() const
+{
+    if (mByteArray) {
+        return mOffset < (size_t) mByteArray->size() ? mByteArray->data() + mOffset : nullptr;
+    }
+    return mData;
+}
+
+bool LuaTypedBuffer::wrapsByteArray() const
+{
+    return mByteArray != nullptr;
+}
+
+LuaTypedBuffer LuaTypedBuffer::slice(size_t offset, size_t length) const
+{
+    size_t n = this->length();
+    if (offset > n || length > n - offset) {
+        return {};
+    }
+    if (mByteArray) {
+        LuaTypedBuffer buffer = *this;
+        buffer.mOffset = mOffset + offset * elementSize();
+        buffer.mLength = length;
+        return buffer;
+    }
+    return wrap(mType, mData + offset * elementSize(), length, mOwner);
+}
+
+LuaTypedBuffer LuaTypedBuffer::copy(Type type) const
+{
+    size_t n = length();
+    LuaTypedBuffer buffer(type, n);
+    if (n == 0) {
+        return buffer;
+    }
+    if (type == mType) {
+        memcpy(buffer.mData, data(), n * elementSize());
+        return buffer;
+    }
+    dispatch(mType, data(), [&](auto *src) {
+        dispatch(type, buffer.mData, [&](auto *dst) {
+            using D = std::remove_pointer_t<decltype(dst)>;
+            for (size_t i = 0; i < n; i++) {
+                dst[i] = (D) src[i];
+            }
+        });
+    });
+    return buffer;
+}
+
+double LuaTypedBuffer::get(size_t index) const
+{
+    if (index >= length()) {
+        return 0;
+    }
+    return dispatch(mType, data(), [index](auto *p) {
+        return (double) p[index];
+    });
+}
+
+int64_t LuaTypedBuffer::getInt(size_t index) const
+{
+    if (index >= length()) {
+        return 0;
+    }
+    return dispatch(mType, data(), [index](auto *p) {
+        return (int64_t) p[index];
+    });
+}
+
+void LuaTypedBuffer::set(size_t index, double value) const
+{
+    if (index >= length()) {
+        return;
+    }
+    dispatch(mType, data(), [index, value](auto *p) {
+        p[index] = castTo<std::remove_pointer_t<decltype(p)>>(value);
+    });
+}
+
+void LuaTypedBuffer::setInt(size_t index, int64_t value) const
+{
+    if (index >= length()) {
+        return;
+    }
+    dispatch(mType, data(), [index, value](auto *p) {
+        p[index] = (std::remove_pointer_t<decltype(p)>) value;
+    });
+}
+
+void LuaTypedBuffer::fill(double value) const
+{
+    size_t n = length();
+    dispatch(mType, data(), [n, value](auto *p) {
+        std::fill(p, p + n, castTo<std::remove_pointer_t<decltype(p)>>(value));
+    });
+}
+
+double LuaTypedBuffer::sum() const
+{
+    size_t n = length();
+    return dispatch(mType, data(), [n](auto *p) {
+        return Kernels<std::remove_pointer_t<decltype(p)>>::sum(p, n);
+    });
+}
+
+double LuaTypedBuffer::dot(const LuaTypedBuffer &b) const
+{
+    if (b.mType != mType) {
+        return LuaTypedBuffer::dot(b.copy(mType));
+    }
+    size_t n = std::min(length(), b.length());
+    return dispatch(mType, data(), [&b, n](auto *p) {
+        using T = std::remove_pointer_t<decltype(p)>;
+        return Kernels<T>::dot(p, static_cast<const T *>(b.data()), n);
+    });
+}
+
+bool LuaTypedBuffer::axpy(double a, const LuaTypedBuffer &x) const
+{
+    if (x.mType != mType) {
+        return false;
+    }
+    size_t n = std::min(length(), x.length());
+    dispatch(mType, data(), [a, &x, n](auto *p) {
+        using T = std::remove_pointer_t<decltype(p)>;
+        Kernels<T>::axpy(p, castTo<T>(a), static_cast<const T *>(x.data()), n);
+    });
+    return true;
+}
+
+void LuaTypedBuffer::scale(double a) const
+{
+    size_t n = length();
+    dispatch(mType, data(), [n, a](auto *p) {
+        using T = std::remove_pointer_t<decltype(p)>;
+        if constexpr (std::is_integral<T>::value) {
+            // Scaling integers by a fraction is done in double precision
+            for (size_t i = 0; i < n; i++) {
+                p[i] = castTo<T>((double) p[i] * a);
+            }
+        } else {
+            Kernels<T>::scale(p, (T) a, n);
+        }
+    });
+}
+
+double LuaTypedBuffer::min() const
+{
+    size_t n = length();
+    return dispatch(mType, data(), [n](auto *p) {
+        return (double) Kernels<std::remove_pointer_t<decltype(p)>>::min(p, n);
+    });
+}
+
+double LuaTypedBuffer::max() const
+{
+    size_t n = length();
+    return dispatch(mType, data(), [n](auto *p) {
+        return (double) Kernels<std::remove_pointer_t<decltype(p)>>::max(p, n);
+    });
+}
+
+LuaTypedBuffer LuaTypedBuffer::select(CompareOp op, double threshold, double ifTrue, double ifFalse) const
+{
+    size_t n = length();
+    LuaTypedBuffer out(mType, n);
+    dispatch(mType, data(), [&](auto *p) {
+        using T = std::remove_pointer_t<decltype(p)>;
+        Kernels<T>::select(reinterpret_cast<T *>(out.mData), p, n, op,
+                           (typename Kernels<T>::C) threshold, castTo<T>(ifTrue), castTo<T>(ifFalse));
+    });
+    return out;
+}
+
+GAny LuaTypedBuffer::toArray() const
+{
+    GAny array = GAny::array();
+    size_t n = length();
+    dispatch(mType, data(), [&](auto *p) {
+        for (size_t i = 0; i < n; i++) {
+            array.pushBack(p[i]);
+        }
+    });
+    return array;
+}
+
+std::string LuaTypedBuffer::toString() const
+{
+    return "LuaTypedBuffer<" + typeName() + ">(" + std::to_string(length()) + ")";
+}
+
+GX_NS_END
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_TYPED_BUFFER_H
+#define GX_SCRIPT_LUA_TYPED_BUFFER_H
+
+#include <gx/gobject.h>
+
+#include <gx/gany.h>
+#include <gx/gbytearray.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaTypedBuffer
+ * @brief Contiguous array of f32, f64, i32 or i64 numbers with vectorized kernels (SSE2/AVX where available). <br>
+ *        The buffer can own its memory, or wrap a GByteArray or a C++ vector without copying,
+ *        copies and slices share the same memory. Lua accesses it through a userdata with 0-based indexes. <br>
+ *        The memory of a wrapped GByteArray is looked up on every access, so the array may be written
+ *        or resized while it is wrapped, the length follows its size.
+ */
+class LuaTypedBuffer
+{
+public:
+    enum class Type
+    {
+        F32,
+        F64,
+        I32,
+        I64,
+    };
+
+    enum class CompareOp
+    {
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+    };
+
+public:
+    LuaTypedBuffer();
+
+    /**
+     * @brief Create a buffer owning zeroed memory
+     * @param type
+     * @param length    Number of elements
+     */
+    LuaTypedBuffer(Type type, size_t length);
+
+    /**
+     * @brief Wrap the memory of a GByteArray held by a GAny, the GAny is kept alive by the buffer.
+     *        The length is the number of whole elements in the array at the time of each access
+     * @param type
+     * @param byteArray GAny of GByteArray
+     * @return An empty buffer if byteArray is not a GByteArray
+     */
+    static LuaTypedBuffer wrap(Type type, const GAny &byteArray);
+
+    /**
+     * @brief Wrap external memory
+     * @param type
+     * @param data
+     * @param length    Number of elements
+     * @param owner     Keeps the memory alive
+     * @return
+     */
+    static LuaTypedBuffer wrap(Type type, void *data, size_t length, std::shared_ptr<void> owner);
+
+    /**
+     * @brief Wrap a C++ vector, the vector must not be resized while a buffer references it
+     * @tparam T    float, double, int32_t or int64_t
+     * @param vec
+     * @return
+     */
+    template<typename T>
+    static LuaTypedBuffer wrap(const std::shared_ptr<std::vector<T>> &vec)
+    {
+        return wrap(typeOf<T>(), vec->data(), vec->size(), vec);
+    }
+
+    static bool parseType(const std::string &name, Type &type);
+
+    static bool parseCompareOp(const std::string &name, CompareOp &op);
+
+public:
+    Type type() const;
+
+    std::string typeName() const;
+
+    size_t length() const;
+
+    size_t elementSize() const;
+
+    /**
+     * @brief Current memory of the buffer, only valid until a wrapped GByteArray is changed
+     * @return
+     */
+    void *data() const;
+
+    bool wrapsByteArray() const;
+
+    /**
+     * @brief Create a view of a range sharing the memory
+     * @param offset
+     * @param length
+     * @return An empty buffer if out of range
+     */
+    LuaTypedBuffer slice(size_t offset, size_t length) const;
+
+    /**
+     * @brief Copy to a new buffer owning its memory, optionally converting the type
+     * @param type
+     * @return
+     */
+    LuaTypedBuffer copy(Type type) const;
+
+    double get(size_t index) const;
+
+    int64_t getInt(size_t index) const;
+
+    void set(size_t index, double value) const;
+
+    void setInt(size_t index, int64_t value) const;
+
+    void fill(double value) const;
+
+public:
+    double sum() const;
+
+    /**
+     * @brief Dot product with a buffer of the same type, over the shorter length
+     * @param b
+     * @return
+     */
+    double dot(const LuaTypedBuffer &b) const;
+
+    /**
+     * @brief this = this + a * x, over the shorter length. x must have the same type
+     * @param a
+     * @param x
+     * @return false if the types are different
+     */
+    bool axpy(double a, const LuaTypedBuffer &x) const;
+
+    /**
+     * @brief this = this * a
+     * @param a
+     */
+    void scale(double a) const;
+
+    /**
+     * @brief Minimum element
+     * @return 0 if empty
+     */
+    double min() const;
+
+    /**
+     * @brief Maximum element
+     * @return 0 if empty
+     */
+    double max() const;
+
+    /**
+     * @brief Compare each element with a threshold and select one of two values
+     * @param op
+     * @param threshold
+     * @param ifTrue
+     * @param ifFalse
+     * @return New buffer of the same type
+     */
+    LuaTypedBuffer select(CompareOp op, double threshold, double ifTrue, double ifFalse) const;
+
+    GAny toArray() const;
+
+    std::string toString() const;
+
+    bool operator==(const LuaTypedBuffer &rhs) const
+    {
+        return mData == rhs.mData && mByteArray == rhs.mByteArray && mOffset == rhs.mOffset &&
+               mLength == rhs.mLength && mType == rhs.mType;
+    }
+
+private:
+    template<typename T>
+    static constexpr Type typeOf();
+
+private:
+    Type mType = Type::F64;
+    uint8_t *mData = nullptr;
+    /// Requested length, a wrapped GByteArray limits it to its current size
+    size_t mLength = 0;
+    /// Set when wrapping a GByteArray, then the memory starts at mOffset bytes into it instead of mData
+    GByteArray *mByteArray = nullptr;
+    size_t mOffset = 0;
+    std::shared_ptr<void> mOwner;
+};
+
+template<>
+constexpr LuaTypedBuffer::Type LuaTypedBuffer::typeOf<float>()
+{
+    return Type::F32;
+}
+
+template<>
+constexpr LuaTypedBuffer::Type LuaTypedBuffer::typeOf<double>()
+{
+    return Type::F64;
+}
+
+template<>
+constexpr LuaTypedBuffer::Type LuaTypedBuffer::typeOf<int32_t>()
+{
+    return Type::I32;
+}
+
+template<>
+constexpr LuaTypedBuffer::Type LuaTypedBuffer::typeOf<int64_t>()
+{
+    return Type::I64;
+}
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_TYPED_BUFFER_H
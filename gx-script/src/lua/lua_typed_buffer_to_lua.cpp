@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lua_typed_buffer_to_lua.h"
+
+
+GX_NS_BEGIN
+
+#define TYPED_BUFFER_META "LuaTypedBuffer"
+
+/**
+ * @brief Userdata of a buffer. Starts with a GAny pointer like the other userdata,
+ *        the GAny is only created when the buffer is converted back to GAny
+ */
+struct LuaTypedBufferToLua::Proxy
+{
+    GAny *self = nullptr;
+    GAny object;
+    LuaTypedBuffer buffer;
+    LuaTypedBuffer::Type type = LuaTypedBuffer::Type::F64;
+};
+
+void LuaTypedBufferToLua::toLua(lua_State *L)
+{
+    const luaL_Reg methods[] = {
+            {"sum",     regSum},
+            {"dot",     regDot},
+            {"axpy",    regAxpy},
+            {"scale",   regScale},
+            {"min",     regMin},
+            {"max",     regMax},
+            {"select",  regSelect},
+            {"fill",    regFill},
+            {"slice",   regSlice},
+            {"copy",    regCopy},
+            {"type",    regType},
+            {"totable", regToTable},
+            {nullptr,   nullptr}
+    };
+
+    const luaL_Reg metaMethods[] = {
+            {"__gc",       regGC},
+            {"__newindex", regNewIndex},
+            {"__len",      regLen},
+            {"__tostring", regToString},
+            {nullptr,      nullptr}
+    };
+
+    luaL_newmetatable(L, TYPED_BUFFER_META);
+    int top = lua_gettop(L);
+
+    lua_pushliteral(L, "_name");
+    lua_pushstring(L, TYPED_BUFFER_META);
+    lua_settable(L, top);
+
+    const luaL_Reg *f;
+    for (f = metaMethods; f->func; f++) {
+        lua_pushstring(L, f->name);
+        lua_pushcfunction(L, f->func);
+        lua_settable(L, top);
+    }
+
+    // __index reads elements, other keys are looked up in the methods table (upvalue)
+    lua_pushliteral(L, "__index");
+    luaL_newlib(L, methods);
+    lua_pushcclosure(L, regIndex, 1);
+    lua_settable(L, top);
+
+    lua_pop(L, 1);
+}
+
+void LuaTypedBufferToLua::pushBuffer(lua_State *L, const LuaTypedBuffer &buffer)
+{
+    auto *proxy = new(lua_newuserdatauv(L, sizeof(Proxy), 0)) Proxy();
+    proxy->self = &proxy->object;
+    proxy->buffer = buffer;
+    proxy->type = buffer.type();
+    luaL_getmetatable(L, TYPED_BUFFER_META);
+    lua_setmetatable(L, -2);
+}
+
+bool LuaTypedBufferToLua::isProxy(lua_State *L, int idx)
+{
+    return luaL_testudata(L, idx, TYPED_BUFFER_META) != nullptr;
+}
+
+GAny LuaTypedBufferToLua::toGAny(lua_State *L, int idx)
+{
+    auto *proxy = (Proxy *) luaL_testudata(L, idx, TYPED_BUFFER_META);
+    if (!proxy) {
+        return GAny::undefined();
+    }
+    if (proxy->object.isUndefined()) {
+        proxy->object = proxy->buffer;
+    }
+    return proxy->object;
+}
+
+LuaTypedBufferToLua::Proxy *LuaTypedBufferToLua::checkProxy(lua_State *L, int idx)
+{
+    return (Proxy *) luaL_checkudata(L, idx, TYPED_BUFFER_META);
+}
+
+LuaTypedBuffer::Type LuaTypedBufferToLua::checkType(lua_State *L, int idx, LuaTypedBuffer::Type def)
+{
+    const char *name = luaL_optstring(L, idx, nullptr);
+    if (!name) {
+        return def;
+    }
+    LuaTypedBuffer::Type type;
+    if (!LuaTypedBuffer::parseType(name, type)) {
+        luaL_error(L, "LuaTypedBuffer error: unknown type \"%s\", requires f32, f64, i32 or i64", name);
+    }
+    return type;
+}
+
+int LuaTypedBufferToLua::regGC(lua_State *L)
+{
+    checkProxy(L, 1)->~Proxy();
+    return 0;
+}
+
+int LuaTypedBufferToLua::regIndex(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    if (lua_isinteger(L, 2)) {
+        lua_Integer i = lua_tointeger(L, 2);
+        // Looked up on every access, a wrapped GByteArray may have been resized
+        if (i < 0 || (size_t) i >= proxy->buffer.length()) {
+            lua_pushnil(L);
+            return 1;
+        }
+        const void *data = proxy->buffer.data();
+        switch (proxy->type) {
+            case LuaTypedBuffer::Type::F32:
+                lua_pushnumber(L, static_cast<const float *>(data)[i]);
+                break;
+            case LuaTypedBuffer::Type::F64:
+                lua_pushnumber(L, static_cast<const double *>(data)[i]);
+                break;
+            case LuaTypedBuffer::Type::I32:
+                lua_pushinteger(L, static_cast<const int32_t *>(data)[i]);
+                break;
+            case LuaTypedBuffer::Type::I64:
+                lua_pushinteger(L, static_cast<const int64_t *>(data)[i]);
+                break;
+        }
+        return 1;
+    }
+    lua_pushvalue(L, 2);
+    lua_gettable(L, lua_upvalueindex(1));
+    return 1;
+}
+
+int LuaTypedBufferToLua::regNewIndex(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_Integer i = luaL_checkinteger(L, 2);
+    size_t length = proxy->buffer.length();
+    if (i < 0 || (size_t) i >= length) {
+        return luaL_error(L, "LuaTypedBuffer error: index %I out of range [0, %I)", i, (lua_Integer) length);
+    }
+    void *data = proxy->buffer.data();
+    switch (proxy->type) {
+        case LuaTypedBuffer::Type::F32:
+            static_cast<float *>(data)[i] = (float) luaL_checknumber(L, 3);
+            break;
+        case LuaTypedBuffer::Type::F64:
+            static_cast<double *>(data)[i] = luaL_checknumber(L, 3);
+            break;
+        case LuaTypedBuffer::Type::I32:
+            static_cast<int32_t *>(data)[i] = (int32_t) luaL_checkinteger(L, 3);
+            break;
+        case LuaTypedBuffer::Type::I64:
+            static_cast<int64_t *>(data)[i] = (int64_t) luaL_checkinteger(L, 3);
+            break;
+    }
+    return 0;
+}
+
+int LuaTypedBufferToLua::regLen(lua_State *L)
+{
+    lua_pushinteger(L, (lua_Integer) checkProxy(L, 1)->buffer.length());
+    return 1;
+}
+
+int LuaTypedBufferToLua::regToString(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_pushfstring(L, "LuaTypedBuffer<%s>(%I)", proxy->buffer.typeName().c_str(),
+                    (lua_Integer) proxy->buffer.length());
+    return 1;
+}
+
+int LuaTypedBufferToLua::regSum(lua_State *L)
+{
+    lua_pushnumber(L, checkProxy(L, 1)->buffer.sum());
+    return 1;
+}
+
+int LuaTypedBufferToLua::regDot(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    Proxy *other = checkProxy(L, 2);
+    lua_pushnumber(L, proxy->buffer.dot(other->buffer));
+    return 1;
+}
+
+int LuaTypedBufferToLua::regAxpy(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_Number a = luaL_checknumber(L, 2);
+    Proxy *x = checkProxy(L, 3);
+    if (!proxy->buffer.axpy(a, x->buffer)) {
+        return luaL_error(L, "LuaTypedBuffer.axpy error: the types of the buffers are different");
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+int LuaTypedBufferToLua::regScale(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    proxy->buffer.scale(luaL_checknumber(L, 2));
+    lua_settop(L, 1);
+    return 1;
+}
+
+int LuaTypedBufferToLua::regMin(lua_State *L)
+{
+    lua_pushnumber(L, checkProxy(L, 1)->buffer.min());
+    return 1;
+}
+
+int LuaTypedBufferToLua::regMax(lua_State *L)
+{
+    lua_pushnumber(L, checkProxy(L, 1)->buffer.max());
+    return 1;
+}
+
+int LuaTypedBufferToLua::regSelect(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    const char *opName = luaL_checkstring(L, 2);
+    lua_Number threshold = luaL_checknumber(L, 3);
+    lua_Number ifTrue = luaL_checknumber(L, 4);
+    lua_Number ifFalse = luaL_checknumber(L, 5);
+    LuaTypedBuffer::CompareOp op;
+    if (!LuaTypedBuffer::parseCompareOp(opName, op)) {
+        return luaL_error(L, "LuaTypedBuffer.select error: unknown comparison \"%s\"", opName);
+    }
+    pushBuffer(L, proxy->buffer.select(op, threshold, ifTrue, ifFalse));
+    return 1;
+}
+
+int LuaTypedBufferToLua::regFill(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    proxy->buffer.fill(luaL_checknumber(L, 2));
+    lua_settop(L, 1);
+    return 1;
+}
+
+int LuaTypedBufferToLua::regSlice(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    size_t size = proxy->buffer.length();
+    lua_Integer length = luaL_optinteger(L, 3, (lua_Integer) size - offset);
+    if (offset < 0 || length < 0 || (size_t) offset > size || (size_t) length > size - offset) {
+        return luaL_error(L, "LuaTypedBuffer.slice error: range out of bounds");
+    }
+    pushBuffer(L, proxy->buffer.slice((size_t) offset, (size_t) length));
+    return 1;
+}
+
+int LuaTypedBufferToLua::regCopy(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    LuaTypedBuffer::Type type = checkType(L, 2, proxy->type);
+    pushBuffer(L, proxy->buffer.copy(type));
+    return 1;
+}
+
+int LuaTypedBufferToLua::regType(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    lua_pushstring(L, proxy->buffer.typeName().c_str());
+    return 1;
+}
+
+int LuaTypedBufferToLua::regToTable(lua_State *L)
+{
+    Proxy *proxy = checkProxy(L, 1);
+    size_t length = proxy->buffer.length();
+    lua_createtable(L, (int) length, 0);
+    for (size_t i = 0; i < length; i++) {
+        if (proxy->type == LuaTypedBuffer::Type::I32 || proxy->type == LuaTypedBuffer::Type::I64) {
+            lua_pushinteger(L, proxy->buffer.getInt(i));
+        } else {
+            lua_pushnumber(L, proxy->buffer.get(i));
+        }
+        lua_rawseti(L, -2, (lua_Integer) i + 1);
+    }
+    return 1;
+}
+
+GX_NS_END
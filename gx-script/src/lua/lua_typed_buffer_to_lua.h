@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_TYPED_BUFFER_TO_LUA_H
+#define GX_SCRIPT_LUA_TYPED_BUFFER_TO_LUA_H
+
+#include "lua_typed_buffer.h"
+
+#include <lua.hpp>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class LuaTypedBufferToLua
+ * @brief Bind LuaTypedBuffer to Lua as a userdata. <br>
+ *        buf[i] reads and writes elements directly in the memory of the buffer (0-based, nil out of range),
+ *        #buf is the length, and the kernels are methods: sum, dot, axpy, scale, min, max, select, fill,
+ *        slice, copy, type and totable.
+ */
+class LuaTypedBufferToLua
+{
+public:
+    static void toLua(lua_State *L);
+
+    static void pushBuffer(lua_State *L, const LuaTypedBuffer &buffer);
+
+    static bool isProxy(lua_State *L, int idx);
+
+    /**
+     * @brief Convert a proxy to a GAny of LuaTypedBuffer
+     * @param L
+     * @param idx
+     * @return
+     */
+    static GAny toGAny(lua_State *L, int idx);
+
+private:
+    struct Proxy;
+
+    static Proxy *checkProxy(lua_State *L, int idx);
+
+    static LuaTypedBuffer::Type checkType(lua_State *L, int idx, LuaTypedBuffer::Type def);
+
+private:
+    static int regGC(lua_State *L);
+
+    static int regIndex(lua_State *L);
+
+    static int regNewIndex(lua_State *L);
+
+    static int regLen(lua_State *L);
+
+    static int regToString(lua_State *L);
+
+    static int regSum(lua_State *L);
+
+    static int regDot(lua_State *L);
+
+    static int regAxpy(lua_State *L);
+
+    static int regScale(lua_State *L);
+
+    static int regMin(lua_State *L);
+
+    static int regMax(lua_State *L);
+
+    static int regSelect(lua_State *L);
+
+    static int regFill(lua_State *L);
+
+    static int regSlice(lua_State *L);
+
+    static int regCopy(lua_State *L);
+
+    static int regType(lua_State *L);
+
+    static int regToTable(lua_State *L);
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_TYPED_BUFFER_TO_LUA_H
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2023 Gxin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef GX_SCRIPT_LUA_MPSC_QUEUE_H
+#define GX_SCRIPT_LUA_MPSC_QUEUE_H
+
+#include <gx/gobject.h>
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+
+GX_NS_BEGIN
+
+/**
+ * @class MpscQueue
+ * @brief Lock-free multi-producer single-consumer queue. <br>
+ *        Any thread may push, the consumer takes all pending items at once in push order.
+ * @tparam T
+ */
+template<typename T>
+class MpscQueue
+{
+    struct Node
+    {
+        T value;
+        Node *next;
+    };
+
+public:
+    MpscQueue() = default;
+
+    ~MpscQueue()
+    {
+        clear();
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(T value)
+    {
+        Node *node = new Node{std::move(value), mHead.load(std::memory_order_relaxed)};
+        while (!mHead.compare_exchange_weak(node->next, node,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    bool empty() const
+    {
+        return mHead.load(std::memory_order_acquire) == nullptr;
+    }
+
+    /**
+     * @brief Take all pending items and call func for each of them in push order, only called by the consumer
+     * @param func
+     * @return Number of items consumed
+     */
+    template<typename Func>
+    size_t drain(Func &&func)
+    {
+        Node *node = mHead.exchange(nullptr, std::memory_order_acquire);
+        if (!node) {
+            return 0;
+        }
+
+        // Pushed as a stack, reverse to restore order
+        Node *reversed = nullptr;
+        while (node) {
+            Node *next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+
+        size_t count = 0;
+        while (reversed) {
+            Node *next = reversed->next;
+            func(reversed->value);
+            delete reversed;
+            reversed = next;
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Discard all pending items
+     */
+    void clear()
+    {
+        drain([](T &) {});
+    }
+
+private:
+    std::atomic<Node *> mHead{nullptr};
+};
+
+GX_NS_END
+
+#endif //GX_SCRIPT_LUA_MPSC_QUEUE_H
@@ -29,10 +29,33 @@
 
 #include "lua/lua_table.h"
 #include "lua/gany_lua_vm.h"
+#include "lua/lua_chunk.h"
+#include "lua/lua_future.h"
+#include "lua/lua_atomic_counter.h"
+#include "lua/lua_byte_view.h"
+#include "lua/lua_channel.h"
+#include "lua/lua_concurrent_map.h"
+#include "lua/lua_executor.h"
+#include "lua/lua_msgpack.h"
+#include "lua/lua_reclaimer.h"
+#include "lua/lua_parallel.h"
+#include "lua/lua_record_batch.h"
+#include "lua/lua_shared_table.h"
+#include "lua/lua_typed_buffer.h"
 
 
 using namespace gx;
 
+static std::vector<LuaFuture> toFutureList(const GAny &futures)
+{
+    std::vector<LuaFuture> list;
+    for (size_t i = 0; i < futures.size(); i++) {
+        const GAny item = futures[(int32_t) i];
+        list.push_back(item.is<LuaFuture>() ? item.as<LuaFuture>() : LuaFuture::resolved(item));
+    }
+    return list;
+}
+
 REGISTER_GANY_MODULE(GxScript)
 {
     Class<LuaTable>("L", "LuaTable", "lua table compatible types.")
@@ -46,6 +69,274 @@ REGISTER_GANY_MODULE(GxScript)
             .func(MetaFunction::ToObject, &LuaTable::toObject)
             .func("iterator", &LuaTable::iterator, "Get iterator.");
 
+    Class<LuaSharedTable>("L", "LuaSharedTable",
+                          "Immutable table shared by all lua vms without copying, "
+                          "new versions are published atomically.")
+            .construct<>()
+            .construct<const GAny &>("arg1: Data of the first version, GAnyObject, GAnyArray or LuaTable.")
+            .func(MetaFunction::ToString, &LuaSharedTable::toString)
+            .func(MetaFunction::Length, &LuaSharedTable::length)
+            .func(MetaFunction::GetItem, &LuaSharedTable::getItem)
+            .func(MetaFunction::ToObject, [](LuaSharedTable &self) {
+                return self.toObject();
+            })
+            .func("publish", &LuaSharedTable::publish,
+                  "Publish a new version, readers see it on their next access. \n"
+                  "arg1: Data, GAnyObject, GAnyArray or LuaTable.")
+            .func("version", &LuaSharedTable::version, "Number of the current version.");
+
+    Class<LuaTypedBuffer>("L", "LuaTypedBuffer",
+                          "Contiguous typed numeric array (f32, f64, i32, i64) with vectorized kernels, "
+                          "read and written by Lua in place.")
+            .staticFunc("create", [](const std::string &type, int64_t length) {
+                LuaTypedBuffer::Type t;
+                if (!LuaTypedBuffer::parseType(type, t) || length < 0) {
+                    return GAny::undefined();
+                }
+                return GAny(LuaTypedBuffer(t, (size_t) length));
+            }, "Create a zeroed buffer. \n"
+               "arg1: Element type: f32, f64, i32 or i64; \n"
+               "arg2: Number of elements; \n"
+               "return: LuaTypedBuffer, undefined if the type is unknown.")
+            .staticFunc("wrap", [](const std::string &type, const GAny &byteArray) {
+                LuaTypedBuffer::Type t;
+                if (!LuaTypedBuffer::parseType(type, t) || !byteArray.is<GByteArray>()) {
+                    return GAny::undefined();
+                }
+                return GAny(LuaTypedBuffer::wrap(t, byteArray));
+            }, "Wrap the memory of a GByteArray without copying, the array may be written or resized "
+               "while it is wrapped, the length follows its size. \n"
+               "arg1: Element type: f32, f64, i32 or i64; \n"
+               "arg2: GByteArray; \n"
+               "return: LuaTypedBuffer, undefined if the arguments are invalid.")
+            .func(MetaFunction::ToString, &LuaTypedBuffer::toString)
+            .func(MetaFunction::Length, &LuaTypedBuffer::length)
+            .func(MetaFunction::GetItem, [](LuaTypedBuffer &self, int64_t index) {
+                return self.get((size_t) index);
+            })
+            .func(MetaFunction::SetItem, [](LuaTypedBuffer &self, int64_t index, double value) {
+                self.set((size_t) index, value);
+            })
+            .func(MetaFunction::ToObject, [](LuaTypedBuffer &self) {
+                return self.toArray();
+            })
+            .func("type", &LuaTypedBuffer::typeName, "Element type: f32, f64, i32 or i64.")
+            .func("sum", &LuaTypedBuffer::sum, "Sum of the elements.")
+            .func("dot", &LuaTypedBuffer::dot, "Dot product. \n"
+                                               "arg1: LuaTypedBuffer; \n"
+                                               "return: Sum of the products over the shorter length.")
+            .func("axpy", &LuaTypedBuffer::axpy, "this = this + a * x. \n"
+                                                 "arg1: a; \n"
+                                                 "arg2: x, LuaTypedBuffer of the same type; \n"
+                                                 "return: false if the types are different.")
+            .func("scale", &LuaTypedBuffer::scale, "Multiply the elements. \n"
+                                                   "arg1: Factor.")
+            .func("min", &LuaTypedBuffer::min, "Minimum element, 0 if empty.")
+            .func("max", &LuaTypedBuffer::max, "Maximum element, 0 if empty.")
+            .func("select", [](LuaTypedBuffer &self, const std::string &op, double threshold,
+                               double ifTrue, double ifFalse) {
+                LuaTypedBuffer::CompareOp compareOp;
+                if (!LuaTypedBuffer::parseCompareOp(op, compareOp)) {
+                    return GAny::undefined();
+                }
+                return GAny(self.select(compareOp, threshold, ifTrue, ifFalse));
+            }, "Compare each element with a threshold and select one of two values. \n"
+               "arg1: Comparison: <, <=, >, >=, == or ~=; \n"
+               "arg2: Threshold; \n"
+               "arg3: Value if true; \n"
+               "arg4: Value if false; \n"
+               "return: New LuaTypedBuffer of the same type.")
+            .func("fill", &LuaTypedBuffer::fill, "Set all elements. \n"
+                                                 "arg1: Value.")
+            .func("slice", &LuaTypedBuffer::slice, "View of a range sharing the memory. \n"
+                                                   "arg1: Offset; \n"
+                                                   "arg2: Length; \n"
+                                                   "return: LuaTypedBuffer, empty if out of range.");
+
+    Class<LuaRecordBatch>("L", "LuaRecordBatch",
+                          "Columnar batch of records with typed columns, "
+                          "Lua iterates its rows with a cursor reading the fields in place.")
+            .staticFunc("create", [](int64_t rowCount) {
+                return LuaRecordBatch((size_t) std::max<int64_t>(rowCount, 0));
+            }, "Create a batch without columns. \n"
+               "arg1: Number of rows of every column; \n"
+               "return: LuaRecordBatch.")
+            .staticFunc("fromRecords", [](const GAny &records) {
+                return LuaRecordBatch::fromRecords(records.is<LuaTable>() ? records.toObject() : records);
+            }, "Build a batch from records, the fields become number, boolean or string columns. \n"
+               "arg1: GAnyArray or LuaTable of records; \n"
+               "return: LuaRecordBatch.")
+            .func(MetaFunction::ToString, &LuaRecordBatch::toString)
+            .func(MetaFunction::Length, &LuaRecordBatch::rowCount)
+            .func(MetaFunction::GetItem, [](LuaRecordBatch &self, int64_t row) {
+                return self.row((size_t) row);
+            })
+            .func(MetaFunction::ToObject, &LuaRecordBatch::toRecords)
+            .func("addColumn", [](LuaRecordBatch &self, const std::string &name, const LuaTypedBuffer &values) {
+                return self.addColumn(name, values);
+            }, "Add a number column referencing the buffer. \n"
+               "arg1: Column name; \n"
+               "arg2: LuaTypedBuffer with rowCount elements; \n"
+               "return: false if the name exists or the length is wrong.")
+            .func("addBooleanColumn", &LuaRecordBatch::addBooleanColumn,
+                  "Add a boolean column. \n"
+                  "arg1: Column name; \n"
+                  "arg2: i32 LuaTypedBuffer of 0 and 1 with rowCount elements; \n"
+                  "return: false if the name exists, the type or the length is wrong.")
+            .func("addStringColumn", [](LuaRecordBatch &self, const std::string &name, const GAny &values) {
+                GAny array = values.is<LuaTable>() ? values.toObject() : values;
+                std::vector<std::string> strings;
+                strings.reserve(array.size());
+                for (size_t i = 0; i < array.size(); i++) {
+                    strings.push_back(array[(int32_t) i].toString());
+                }
+                return self.addStringColumn(name, std::move(strings));
+            }, "Add a string column. \n"
+               "arg1: Column name; \n"
+               "arg2: GAnyArray or LuaTable with rowCount elements; \n"
+               "return: false if the name exists or the length is wrong.")
+            .func("rowCount", &LuaRecordBatch::rowCount, "Number of rows.")
+            .func("columnCount", &LuaRecordBatch::columnCount, "Number of columns.")
+            .func("columnIndex", &LuaRecordBatch::columnIndex, "Index of a column. \n"
+                                                               "arg1: Column name; \n"
+                                                               "return: -1 if not found.")
+            .func("columnNames", [](LuaRecordBatch &self) {
+                GAny names = GAny::array();
+                for (const auto &name: self.columnNames()) {
+                    names.pushBack(name);
+                }
+                return names;
+            }, "Names of the columns.")
+            .func("value", [](LuaRecordBatch &self, int64_t row, int64_t column) {
+                return self.value((size_t) row, (size_t) column);
+            }, "Value of a field. \n"
+               "arg1: Row; \n"
+               "arg2: Column index; \n"
+               "return: undefined if out of range.")
+            .func("toRecords", &LuaRecordBatch::toRecords, "Copy the rows to a GAnyArray of GAnyObject.");
+
+    Class<LuaByteView>("L", "LuaByteView",
+                       "View of bytes wrapping a GByteArray without copying, "
+                       "Lua reads and writes numbers of any endianness at byte offsets in place.")
+            .staticFunc("create", [](int64_t size) {
+                return LuaByteView((size_t) std::max<int64_t>(size, 0));
+            }, "Create a view owning zeroed memory. \n"
+               "arg1: Size in bytes; \n"
+               "return: LuaByteView.")
+            .staticFunc("wrap", [](const GAny &byteArray) {
+                if (!byteArray.is<GByteArray>()) {
+                    return GAny::undefined();
+                }
+                return GAny(LuaByteView::wrap(byteArray));
+            }, "Wrap the memory of a GByteArray without copying, the array may be written or resized "
+               "while it is wrapped, the size follows its size. \n"
+               "arg1: GByteArray; \n"
+               "return: LuaByteView, undefined if the argument is not a GByteArray.")
+            .func(MetaFunction::ToString, &LuaByteView::toString)
+            .func(MetaFunction::Length, &LuaByteView::size)
+            .func(MetaFunction::GetItem, [](LuaByteView &self, int64_t index) {
+                uint64_t value;
+                if (index < 0 || !self.readUInt((size_t) index, 1, false, value)) {
+                    return GAny::undefined();
+                }
+                return GAny((int32_t) value);
+            })
+            .func(MetaFunction::SetItem, [](LuaByteView &self, int64_t index, int32_t value) {
+                if (index >= 0) {
+                    self.writeUInt((size_t) index, 1, (uint64_t) value, false);
+                }
+            })
+            .func("size", &LuaByteView::size, "Size in bytes.")
+            .func("slice", &LuaByteView::slice, "View of a range sharing the memory. \n"
+                                                "arg1: Offset; \n"
+                                                "arg2: Size; \n"
+                                                "return: LuaByteView, empty if out of range.")
+            .func("toByteArray", &LuaByteView::toByteArray, "Copy the bytes to a new GByteArray.");
+
+    Class<LuaMsgPack>("L", "LuaMsgPack", "MessagePack codec, keeps integers and floating point numbers apart.")
+            .staticFunc("encode", [](const GAny &value) {
+                GByteArray out;
+                LuaMsgPack::encode(value, out);
+                return out;
+            }, "Encode a value, LuaTable and GAnyObject become maps (arrays for sequences), "
+               "GByteArray becomes bin. \n"
+               "arg1: Value; \n"
+               "return: GByteArray.")
+            .staticFunc("decode", [](const GAny &byteArray, int64_t offset) {
+                if (!byteArray.is<GByteArray>() || offset < 0) {
+                    return GAny::undefined();
+                }
+                const auto &ba = byteArray.as<GByteArray>();
+                auto pos = (size_t) offset;
+                GAny value;
+                if (!LuaMsgPack::decode(ba.data(), (size_t) ba.size(), pos, value)) {
+                    return GAny::undefined();
+                }
+                GAny result = GAny::object();
+                result["value"] = value;
+                result["offset"] = (int64_t) pos;
+                return result;
+            }, "Decode one message. \n"
+               "arg1: GByteArray; \n"
+               "arg2: Offset of the message; \n"
+               "return: {value, offset} with the offset after the message, undefined if malformed or incomplete.")
+            .staticFunc("decodeAll", [](const GAny &byteArray) {
+                GAny values = GAny::array();
+                if (!byteArray.is<GByteArray>()) {
+                    return values;
+                }
+                const auto &ba = byteArray.as<GByteArray>();
+                size_t pos = 0;
+                GAny value;
+                while (pos < (size_t) ba.size() && LuaMsgPack::decode(ba.data(), (size_t) ba.size(), pos, value)) {
+                    values.pushBack(value);
+                }
+                return values;
+            }, "Decode concatenated messages. \n"
+               "arg1: GByteArray; \n"
+               "return: GAnyArray of the values before the first malformed or incomplete message.");
+
+    Class<LuaReclaimer>("L", "LuaReclaimer", "Destruction of the GAny released by the Lua garbage collector.")
+            .staticFunc("setMode", [](const std::string &name) {
+                LuaReclaimer::Mode mode;
+                if (!LuaReclaimer::parseMode(name, mode)) {
+                    return false;
+                }
+                LuaReclaimer::setMode(mode);
+                return true;
+            }, "Set the default reclamation mode of the virtual machines that do not set their own. \n"
+               "arg1: \"immediate\" (deleted by the finalizers), \"deferred\" (deleted at the idle points "
+               "of their virtual machine) or \"background\" (deleted by a background thread); \n"
+               "return: false if the mode is unknown.")
+            .staticFunc("mode", []() {
+                return LuaReclaimer::modeName(LuaReclaimer::mode());
+            }, "Get the default reclamation mode. \n"
+               "return: Mode name.")
+            .staticFunc("setBatchSize", [](int64_t count) {
+                LuaReclaimer::setBatchSize(count > 0 ? (size_t) count : 1);
+            }, "Set the number of pending GAny that wakes up the background thread. \n"
+               "arg1: Count.")
+            .staticFunc("setInterval", [](int32_t ms) {
+                LuaReclaimer::setInterval(ms);
+            }, "Set the longest wait of the background thread between two batches. \n"
+               "arg1: Milliseconds.")
+            .staticFunc("reclaim", []() {
+                return (int64_t) LuaReclaimer::reclaim();
+            }, "Delete the GAny queued for the background thread now, "
+               "the deferred ones are deleted by GAnyLuaVM.reclaim. \n"
+               "return: Number of GAny deleted.")
+            .staticFunc("stats", []() {
+                LuaReclaimer::Stats stats = LuaReclaimer::stats();
+                GAny result = GAny::object();
+                result["pending"] = (int64_t) stats.pending;
+                result["maxPending"] = (int64_t) stats.maxPending;
+                result["retired"] = (int64_t) stats.retired;
+                result["reclaimed"] = (int64_t) stats.reclaimed;
+                result["batches"] = (int64_t) stats.batches;
+                return result;
+            }, "Get the queue statistics. \n"
+               "return: {pending, maxPending, retired, reclaimed, batches}.");
+
     // GAny LuaTable iterator, Special provision of reverse iteration function
     GAnyClass::Class < LuaTableIterator > ()
             ->setName("LuaTableIterator")
@@ -71,8 +362,297 @@ REGISTER_GANY_MODULE(GxScript)
                 return LuaTable::readFromByteArray(buf);
             });
 
+    Class<LuaChunk>("L", "LuaChunk", "Immutable precompiled Lua chunk, can be run by any virtual machine without copying its code.")
+            .func("chunkName", &LuaChunk::chunkName, "Get code source path of the chunk.")
+            .func("size", &LuaChunk::size, "Size of the shared bytecode.");
+
+    Class<LuaRequest>("L", "LuaRequest", "A request running in a pooled coroutine of a lua vm.")
+            .func("id", &LuaRequest::id, "Get request id.")
+            .func("isSuspended", &LuaRequest::isSuspended, "Determine whether the request is suspended (yielded).")
+            .func("isAwaiting", &LuaRequest::isAwaiting,
+                  "Determine whether the request is suspended by Async.await, it is continued by runPending of the vm.")
+            .func("isPreempted", &LuaRequest::isPreempted,
+                  "Determine whether the request used up its time slice and waits to be continued by the scheduler.")
+            .func("setPriority", &LuaRequest::setPriority,
+                  "Set the priority used by the priority scheduling policy, higher runs first. \n"
+                  "arg1: Priority.")
+            .func("priority", &LuaRequest::priority, "Get the priority of the request.")
+            .func("cpuTimeUs", &LuaRequest::cpuTimeUs,
+                  "CPU time spent running the request on the thread of the vm, in microseconds.")
+            .func("preemptions", &LuaRequest::preemptions, "Number of times the request was preempted.")
+            .func("isFinished", &LuaRequest::isFinished, "Determine whether the request has finished.")
+            .func("isFailed", &LuaRequest::isFailed, "Determine whether the request has failed.")
+            .func("isDone", &LuaRequest::isDone, "Determine whether the request has finished or failed.")
+            .func("result", &LuaRequest::result,
+                  "The return value of the finished request, or the value yielded by the suspended request.")
+            .func("error", &LuaRequest::error, "Error message of the failed request.");
+
+    Class<LuaFuture>("L", "LuaFuture",
+                     "The result of an asynchronous operation, completed once from any thread and awaited by Lua with Async.await.")
+            .construct<>()
+            .staticFunc("resolved", &LuaFuture::resolved, "Create a future that is already resolved. \n"
+                                                          "arg1: Value; \n"
+                                                          "return: LuaFuture.")
+            .staticFunc("rejected", &LuaFuture::rejected, "Create a future that is already rejected. \n"
+                                                          "arg1: Error message; \n"
+                                                          "return: LuaFuture.")
+            .staticFunc("all", [](const GAny &futures) {
+                return LuaFuture::all(toFutureList(futures));
+            }, "Create a future resolved with the array of values when all futures are resolved. \n"
+               "arg1: Array of futures (other values are treated as resolved futures); \n"
+               "return: LuaFuture.")
+            .staticFunc("race", [](const GAny &futures) {
+                return LuaFuture::race(toFutureList(futures));
+            }, "Create a future settled like the first of the futures to be settled. \n"
+               "arg1: Array of futures (other values are treated as resolved futures); \n"
+               "return: LuaFuture.")
+            .func("resolve", [](LuaFuture &self) {
+                return self.resolve();
+            }, "Complete the future without a value. \n"
+               "return: false if already completed.")
+            .func("resolve", [](LuaFuture &self, const GAny &value) {
+                return self.resolve(value);
+            }, "Complete the future with a value. \n"
+               "arg1: Value; \n"
+               "return: false if already completed.")
+            .func("reject", &LuaFuture::reject, "Complete the future with an error. \n"
+                                                "arg1: Error message; \n"
+                                                "return: false if already completed.")
+            .func("then", [](LuaFuture &self, const GAny &callback) {
+                self.then([callback](const LuaFuture &future) {
+                    callback(future);
+                });
+            }, "Add a callback called once on the thread that completes the future. \n"
+               "arg1: Callback function, the argument is the future.")
+            .func("isDone", &LuaFuture::isDone, "Determine whether the future is completed.")
+            .func("isResolved", &LuaFuture::isResolved, "Determine whether the future is resolved.")
+            .func("isRejected", &LuaFuture::isRejected, "Determine whether the future is rejected.")
+            .func("value", &LuaFuture::value, "Value of the resolved future.")
+            .func("error", &LuaFuture::error, "Error of the rejected future.")
+            .func("wait", [](LuaFuture &self) {
+                return self.wait();
+            }, "Block the calling thread until the future is completed.")
+            .func("wait", [](LuaFuture &self, int32_t timeoutMs) {
+                return self.wait(timeoutMs);
+            }, "Block the calling thread until the future is completed. \n"
+               "arg1: Maximum waiting time in milliseconds; \n"
+               "return: false if timed out.");
+
+    Class<LuaChannel>("L", "LuaChannel",
+                      "Bounded multi-producer multi-consumer channel passing messages between threads and lua vms, "
+                      "Lua receives with Async.recv.")
+            .construct<>()
+            .staticFunc("create", [](int32_t capacity) {
+                return LuaChannel((size_t) std::max(1, capacity));
+            }, "Create a channel. \n"
+               "arg1: Maximum number of buffered messages, rounded up to a power of two; \n"
+               "return: LuaChannel.")
+            .func("send", [](LuaChannel &self, const GAny &value) {
+                return self.send(value);
+            }, "Send a message, blocking while the channel is full. \n"
+               "arg1: Message; \n"
+               "return: false if the channel is closed.")
+            .func("send", [](LuaChannel &self, const GAny &value, int32_t timeoutMs) {
+                return self.send(value, timeoutMs);
+            }, "Send a message, blocking while the channel is full. \n"
+               "arg1: Message; \n"
+               "arg2: Maximum waiting time in milliseconds; \n"
+               "return: false if the channel is closed or timed out.")
+            .func("trySend", [](LuaChannel &self, const GAny &value) {
+                return self.trySend(value);
+            }, "Send a message without blocking. \n"
+               "arg1: Message; \n"
+               "return: false if the channel is full or closed.")
+            .func("recv", [](LuaChannel &self) {
+                GAny value;
+                self.recv(value);
+                return value;
+            }, "Receive a message, blocking the thread while the channel is empty. \n"
+               "return: The message, undefined if the channel is closed and empty.")
+            .func("recv", [](LuaChannel &self, int32_t timeoutMs) {
+                GAny value;
+                self.recv(value, timeoutMs);
+                return value;
+            }, "Receive a message, blocking the thread while the channel is empty. \n"
+               "arg1: Maximum waiting time in milliseconds; \n"
+               "return: The message, undefined if the channel is closed and empty or timed out.")
+            .func("tryRecv", [](LuaChannel &self) {
+                GAny value;
+                self.tryRecv(value);
+                return value;
+            }, "Receive a message without blocking. \n"
+               "return: The message, undefined if the channel is empty.")
+            .func("recvAsync", &LuaChannel::recvAsync,
+                  "Receive a message asynchronously. \n"
+                  "return: LuaFuture of the message, resolved with undefined if the channel is closed.")
+            .func("close", &LuaChannel::close,
+                  "Close the channel, the buffered messages can still be received.")
+            .func("isClosed", &LuaChannel::isClosed, "Determine whether the channel is closed.")
+            .func("size", &LuaChannel::size, "Number of buffered messages.")
+            .func("capacity", &LuaChannel::capacity, "Maximum number of buffered messages.");
+
+    Class<LuaAtomicCounter>("L", "LuaAtomicCounter", "Lock-free 64-bit counter shared between threads and lua vms.")
+            .construct<>()
+            .construct<int64_t>("arg1: Initial value.")
+            .func("get", &LuaAtomicCounter::get, "Get the value.")
+            .func("set", &LuaAtomicCounter::set, "Set the value. \n"
+                                                 "arg1: Value.")
+            .func("add", &LuaAtomicCounter::add, "Add to the counter. \n"
+                                                 "arg1: Delta; \n"
+                                                 "return: The new value.")
+            .func("increment", &LuaAtomicCounter::increment, "Add 1, return the new value.")
+            .func("decrement", &LuaAtomicCounter::decrement, "Subtract 1, return the new value.")
+            .func("exchange", &LuaAtomicCounter::exchange, "Replace the value. \n"
+                                                           "arg1: Value; \n"
+                                                           "return: The previous value.")
+            .func("compareAndSet", &LuaAtomicCounter::compareAndSet,
+                  "Replace the value only if it equals expected. \n"
+                  "arg1: Expected value; \n"
+                  "arg2: New value; \n"
+                  "return: false if the value was not expected.");
+
+    Class<LuaConcurrentMap>("L", "LuaConcurrentMap",
+                            "Sharded hash map shared between threads and lua vms, each operation on a key is atomic.")
+            .construct<>()
+            .staticFunc("create", [](int32_t shardCount) {
+                return LuaConcurrentMap((size_t) std::max(1, shardCount));
+            }, "Create a map. \n"
+               "arg1: Number of shards, rounded up to a power of two; \n"
+               "return: LuaConcurrentMap.")
+            .func("get", [](LuaConcurrentMap &self, const GAny &key) {
+                return self.get(key.toString());
+            }, "Get the value of a key. \n"
+               "arg1: Key; \n"
+               "return: Value, undefined if not found.")
+            .func("set", [](LuaConcurrentMap &self, const GAny &key, const GAny &value) {
+                self.set(key.toString(), value);
+            }, "Set the value of a key. \n"
+               "arg1: Key; \n"
+               "arg2: Value.")
+            .func("setIfAbsent", [](LuaConcurrentMap &self, const GAny &key, const GAny &value) {
+                return self.setIfAbsent(key.toString(), value);
+            }, "Set the value only if the key is not in the map. \n"
+               "arg1: Key; \n"
+               "arg2: Value; \n"
+               "return: false if the key already exists.")
+            .func("compareAndSet", [](LuaConcurrentMap &self, const GAny &key, const GAny &expected,
+                                      const GAny &desired) {
+                return self.compareAndSet(key.toString(), expected, desired);
+            }, "Replace the value only if the current value equals expected. \n"
+               "arg1: Key; \n"
+               "arg2: Expected value, undefined (nil) if the key should be absent; \n"
+               "arg3: New value, undefined (nil) to remove the key; \n"
+               "return: false if the current value was not expected.")
+            .func("add", [](LuaConcurrentMap &self, const GAny &key, const GAny &delta) {
+                return self.add(key.toString(), delta);
+            }, "Add to the number of a key, an absent key counts as 0. \n"
+               "arg1: Key; \n"
+               "arg2: Delta; \n"
+               "return: The new value, undefined if the value is not a number.")
+            .func("remove", [](LuaConcurrentMap &self, const GAny &key) {
+                return self.remove(key.toString());
+            }, "Remove a key. \n"
+               "arg1: Key; \n"
+               "return: false if not found.")
+            .func("contains", [](LuaConcurrentMap &self, const GAny &key) {
+                return self.contains(key.toString());
+            }, "Determine whether the key is in the map. \n"
+               "arg1: Key.")
+            .func("size", &LuaConcurrentMap::size, "Number of keys.")
+            .func("clear", &LuaConcurrentMap::clear, "Remove all keys.")
+            .func("snapshot", &LuaConcurrentMap::snapshot, "Copy the content to GAnyObject.")
+            .func("forEach", [](LuaConcurrentMap &self, const GAny &func) {
+                self.forEach([&func](const std::string &key, const GAny &value) {
+                    func(key, value);
+                });
+            }, "Call a function for each item of a snapshot. \n"
+               "arg1: func(key, value).");
+
+    Class<LuaExecutor>("L", "LuaExecutor",
+                       "Run Lua tasks on a set of worker threads with work stealing, each worker owns a lua vm.")
+            .staticFunc("create", []() {
+                return LuaExecutor::create();
+            }, "Create an executor with a worker per hardware thread. \n"
+               "return: LuaExecutor.")
+            .staticFunc("create", [](int32_t workerCount) {
+                return LuaExecutor::create(std::max(0, workerCount));
+            }, "Create an executor. \n"
+               "arg1: Number of workers, 0 for the number of hardware threads; \n"
+               "return: LuaExecutor.")
+            .func("submit", [](LuaExecutor &self, const GAny &func) {
+                return self.submit(func);
+            }, "Call a function on a worker. \n"
+               "arg1: Function; \n"
+               "return: LuaFuture of the return value.")
+            .func("submit", [](LuaExecutor &self, const GAny &func, const std::vector<GAny> &args) {
+                return self.submit(func, args);
+            }, "Call a function on a worker. \n"
+               "arg1: Function; \n"
+               "arg2: Arguments; \n"
+               "return: LuaFuture of the return value.")
+            .func("submitChunk", [](LuaExecutor &self, const std::shared_ptr<LuaChunk> &chunk,
+                                    const std::vector<GAny> &args) {
+                return self.submitChunk(chunk, args);
+            }, "Call the function returned by a chunk on a worker, the chunk is run once per worker. \n"
+               "arg1: LuaChunk; \n"
+               "arg2: Arguments; \n"
+               "return: LuaFuture of the return value.")
+            .func("submitModule", [](LuaExecutor &self, const std::string &module, const std::string &entry,
+                                     const std::vector<GAny> &args) {
+                return self.submitModule(module, entry, args);
+            }, "Call an entry point of a module on a worker, the module is loaded once per worker by requireLs. \n"
+               "arg1: Module name; \n"
+               "arg2: Name of the function in the module; \n"
+               "arg3: Arguments; \n"
+               "return: LuaFuture of the return value.")
+            .func("workerCount", &LuaExecutor::workerCount, "Number of workers.")
+            .func("pendingCount", &LuaExecutor::pendingCount, "Number of tasks submitted and not yet started.")
+            .func("stolenCount", &LuaExecutor::stolenCount, "Number of tasks taken from the deque of another worker.")
+            .func("shutdown", &LuaExecutor::shutdown,
+                  "Stop the workers after their running tasks, the pending tasks are rejected.");
+
+    Class<LuaParallel>("L", "LuaParallel", "Data parallel map and reduce over GAny arrays.")
+            .staticFunc("map", [](const GAny &array, const GAny &func) {
+                return LuaParallel::map(array, {func, nullptr});
+            }, "Call a function for each element in parallel. \n"
+               "arg1: GAnyArray; \n"
+               "arg2: func(value) -> mapped value; \n"
+               "return: GAnyArray of the results.")
+            .staticFunc("map", [](const GAny &array, const GAny &func, int32_t grain) {
+                return LuaParallel::map(array, {func, nullptr}, std::max(0, grain));
+            }, "Call a function for each element in parallel. \n"
+               "arg1: GAnyArray; \n"
+               "arg2: func(value) -> mapped value; \n"
+               "arg3: Number of elements per partition, 0 for automatic; \n"
+               "return: GAnyArray of the results.")
+            .staticFunc("reduce", [](const GAny &array, const GAny &func, const GAny &combine) {
+                return LuaParallel::reduce(array, {func, nullptr}, {combine, nullptr});
+            }, "Fold the elements in parallel. \n"
+               "arg1: GAnyArray; \n"
+               "arg2: func(accumulator, value) -> accumulator; \n"
+               "arg3: combine(accumulator, accumulator) -> accumulator; \n"
+               "return: Result, undefined if the array is empty.")
+            .staticFunc("reduce", [](const GAny &array, const GAny &func, const GAny &combine, int32_t grain) {
+                return LuaParallel::reduce(array, {func, nullptr}, {combine, nullptr}, std::max(0, grain));
+            }, "Fold the elements in parallel. \n"
+               "arg1: GAnyArray; \n"
+               "arg2: func(accumulator, value) -> accumulator; \n"
+               "arg3: combine(accumulator, accumulator) -> accumulator; \n"
+               "arg4: Number of elements per partition, 0 for automatic; \n"
+               "return: Result, undefined if the array is empty.")
+            .staticFunc("setExecutor", [](const GAny &executor) {
+                LuaParallel::setExecutor(executor.is<LuaExecutor>()
+                                         ? executor.as<std::shared_ptr<LuaExecutor>>()
+                                         : nullptr);
+            }, "Set the executor used by map and reduce. \n"
+               "arg1: LuaExecutor, null to release it and restore the default.");
+
     Class<GAnyLuaVM>("L", "GAnyLuaVM", "GAny lua vm.")
             .staticFunc("threadLocal", &GAnyLuaVM::threadLocal)
+            .staticFunc("create", &GAnyLuaVM::create,
+                        "Create an independent virtual machine owned by the current thread, "
+                        "any number of virtual machines can share a thread.")
+            .func("id", &GAnyLuaVM::id, "Unique id of the virtual machine.")
             .func("shutdown", &GAnyLuaVM::shutdown,
                   "Actively shut down the virtual machine. \n"
                   "After shutting down, the current virtual machine will become completely outdated. \n"
@@ -126,15 +706,129 @@ REGISTER_GANY_MODULE(GxScript)
                      "arg2: Code source path (file path or URI); \n"
                      "arg3: The environment variable (data) passed to Lua program must be a GAnyObject; \n"
                      "return: Returns the return value of the script.")
+            .func("loadRequestHandler", [](GAnyLuaVM &self, const std::string &script) {
+                return self.loadRequestHandler(script);
+            }, "Load a request handler: a Lua script that returns the function handling each request. \n"
+               "arg1: Lua script text; \n"
+               "return: Handler id, 0 if failed.")
+            .func("loadRequestHandler",
+                  [](GAnyLuaVM &self, const std::string &script, const std::string &sourcePath, const GAny &env) {
+                      return self.loadRequestHandler(script, sourcePath, env);
+                  }, "Load a request handler: a Lua script that returns the function handling each request. \n"
+                     "arg1: Lua script text; \n"
+                     "arg2: Code source path (file path or URI); \n"
+                     "arg3: The environment variable (data) passed to the script must be a GAnyObject; \n"
+                     "return: Handler id, 0 if failed.")
+            .func("unloadRequestHandler", &GAnyLuaVM::unloadRequestHandler,
+                  "Release a request handler, requests in flight are not affected.")
+            .func("request", [](GAnyLuaVM &self, int32_t handler, const GAny &env) {
+                return self.request(handler, env);
+            }, "Run a request in a pooled coroutine, it runs until it returns or yields. \n"
+               "arg1: Handler id; \n"
+               "arg2: The environment variable (data) of this request must be a GAnyObject; \n"
+               "return: LuaRequest.")
+            .func("request", [](GAnyLuaVM &self, int32_t handler, const GAny &env, const std::vector<GAny> &args) {
+                return self.request(handler, env, args);
+            }, "Run a request in a pooled coroutine, it runs until it returns or yields. \n"
+               "arg1: Handler id; \n"
+               "arg2: The environment variable (data) of this request must be a GAnyObject; \n"
+               "arg3: Arguments array passed to the handler; \n"
+               "return: LuaRequest.")
+            .func("resumeRequest", [](GAnyLuaVM &self, const std::shared_ptr<LuaRequest> &request) {
+                return self.resumeRequest(request);
+            }, "Continue a suspended request. \n"
+               "arg1: LuaRequest; \n"
+               "return: false if the request is not suspended.")
+            .func("resumeRequest",
+                  [](GAnyLuaVM &self, const std::shared_ptr<LuaRequest> &request, const GAny &value) {
+                      return self.resumeRequest(request, value);
+                  }, "Continue a suspended request. \n"
+                     "arg1: LuaRequest; \n"
+                     "arg2: Value returned by the yield of the request; \n"
+                     "return: false if the request is not suspended.")
+            .func("post", [](GAnyLuaVM &self, const GAny &task) {
+                self.post([task]() {
+                    task();
+                });
+            }, "Post a task to be run on the thread of the lua vm, may be called from any thread. \n"
+               "arg1: Task function.")
+            .func("runPending", [](GAnyLuaVM &self) {
+                return self.runPending();
+            }, "Run the posted tasks, including the continuation of requests whose awaited future is completed. \n"
+               "return: Number of tasks run.")
+            .func("runPending", [](GAnyLuaVM &self, int32_t timeoutMs) {
+                return self.runPending(timeoutMs);
+            }, "Run the posted tasks, including the continuation of requests whose awaited future is completed. \n"
+               "arg1: Time to wait for a task when there is none, negative numbers wait forever; \n"
+               "return: Number of tasks run.")
+            .func("hasPending", &GAnyLuaVM::hasPending, "Determine whether there are posted tasks not yet run.")
+            .func("runOnce", [](GAnyLuaVM &self) {
+                return self.runOnce();
+            }, "Run the ready tasks, timers and descriptor callbacks of the event loop once without waiting. \n"
+               "return: Number of callbacks run.")
+            .func("runOnce", [](GAnyLuaVM &self, int32_t timeoutMs) {
+                return self.runOnce(timeoutMs);
+            }, "Wait for events and run the ready tasks, timers and descriptor callbacks of the event loop once. \n"
+               "arg1: Maximum waiting time in milliseconds, negative numbers wait until an event happens; \n"
+               "return: Number of callbacks run.")
+            .func("runLoop", &GAnyLuaVM::runLoop,
+                  "Run the event loop until stopLoop is called, for a dedicated thread that owns the lua vm.")
+            .func("stopLoop", &GAnyLuaVM::stopLoop, "Make runLoop return, may be called from any thread.")
+            .func("loopStats", &GAnyLuaVM::loopStats,
+                  "Statistics of the event loop. \n"
+                  "return: object of iterations, tasksRun, timersFired, fdEvents, queueDepth, timerCount, fdCount, "
+                  "lastLagUs and maxLagUs.")
+            .func("setTimeSlice", [](GAnyLuaVM &self, int64_t sliceUs) {
+                self.setTimeSlice(sliceUs);
+            }, "Enable time slicing of requests, a request that used up its slice yields and continues later "
+               "from the event loop. \n"
+               "arg1: Time slice in microseconds, 0 to disable.")
+            .func("setTimeSlice", [](GAnyLuaVM &self, int64_t sliceUs, int32_t checkInstructions) {
+                self.setTimeSlice(sliceUs, checkInstructions);
+            }, "Enable time slicing of requests, a request that used up its slice yields and continues later "
+               "from the event loop. \n"
+               "arg1: Time slice in microseconds, 0 to disable; \n"
+               "arg2: Number of instructions between two checks of the slice.")
+            .func("setSchedulePolicy", [](GAnyLuaVM &self, int32_t policy) {
+                self.setSchedulePolicy(static_cast<GAnyLuaVM::SchedulePolicy>(policy));
+            }, "Set the order in which preempted requests continue. \n"
+               "arg1: 0: round robin, 1: priority.")
+            .func("readyRequestCount", &GAnyLuaVM::readyRequestCount, "Number of preempted requests waiting to continue.")
+            .func("activeRequestCount", &GAnyLuaVM::activeRequestCount, "Number of requests started and not yet done.")
+            .func("setRequestPoolSize", &GAnyLuaVM::setRequestPoolSize,
+                  "Set the maximum number of idle coroutines kept for reuse by requests.")
             .func("gc", &GAnyLuaVM::gc, "Trigger garbage collection for Lua virtual machine.")
             .func("gcStep", &GAnyLuaVM::gcStep, "GC step, Only incremental mode is valid.")
+            .func("setReclaimMode", [](GAnyLuaVM &self, const std::string &name) {
+                LuaReclaimer::Mode mode;
+                if (!LuaReclaimer::parseMode(name, mode)) {
+                    return false;
+                }
+                self.setReclaimMode(mode);
+                return true;
+            }, "Set how the GAny released by the garbage collector of this virtual machine are deleted, "
+               "instead of the default mode of LuaReclaimer. \n"
+               "arg1: \"immediate\", \"deferred\" or \"background\"; \n"
+               "return: false if the mode is unknown.")
+            .func("reclaimMode", [](GAnyLuaVM &self) {
+                return LuaReclaimer::modeName(self.reclaimMode());
+            }, "Get the reclamation mode of this virtual machine. \n"
+               "return: Mode name.")
+            .func("reclaim", [](GAnyLuaVM &self) {
+                return (int64_t) self.reclaim();
+            }, "Delete the GAny deferred by the garbage collector of this virtual machine now. \n"
+               "return: Number of GAny deleted.")
             .func("gcSetStepMul", &GAnyLuaVM::gcSetStepMul, "Set GC step rate, Only incremental mode is valid.")
             .func("gcSetPause", &GAnyLuaVM::gcSetPause, "Set GC step interval rate, Only incremental mode is valid.")
             .func("gcStop", &GAnyLuaVM::gcStop, "Stop garbage collector.")
             .func("gcRestart", &GAnyLuaVM::gcRestart, "Restart the garbage collector.")
             .func("gcIsRunning", &GAnyLuaVM::gcIsRunning, "Returns whether the garbage collector is running.")
             .func("gcGetCount", &GAnyLuaVM::gcGetCount,
-                  "Returns the amount of memory used by the current Lua virtual machine (in kb).")
+                  "Returns the amount of memory used by the current Lua virtual machine (in kb), "
+                  "without the external memory of the GAny userdata.")
+            .func("gcGetExternalCount", &GAnyLuaVM::gcGetExternalCount,
+                  "Returns the approximate amount of C++ memory held by the live GAny userdata (in kb), "
+                  "it paces the garbage collector like Lua memory.")
             .func("gcModeGen", &GAnyLuaVM::gcModeGen, "Switch garbage collector to generational mode.")
             .func("gcModeInc", &GAnyLuaVM::gcModeInc, "Switch the garbage collector to incremental mode.")
             .staticFunc("setExceptionHandler",
@@ -168,6 +862,59 @@ REGISTER_GANY_MODULE(GxScript)
                         },
                         "Set up a script reader. If a custom script reader is set up, "
                         "the custom reader will be called when using \"scriptFile\" and \"requireLs\" to read the script file.")
+            .staticFunc("setCodeCacheDir", &GAnyLuaVM::setCodeCacheDir,
+                        "Enable the on-disk bytecode cache, Lua source files loaded by \"scriptFile\" and \"requireLs\" "
+                        "are compiled once and loaded from the cache directory afterwards. \n"
+                        "arg1: Cache directory, empty to disable the cache.")
+            .func("scriptPreload", [](GAnyLuaVM &self, const std::string &name) {
+                return self.scriptPreload(name);
+            }, "Loading and Running a precompiled script embedded in the binary (see gx_script_embed). \n"
+               "arg1: Script name; \n"
+               "return: Returns the return value of the script.")
+            .func("scriptPreload", [](GAnyLuaVM &self, const std::string &name, const GAny &env) {
+                return self.scriptPreload(name, env);
+            }, "Loading and Running a precompiled script embedded in the binary (see gx_script_embed). \n"
+               "arg1: Script name; \n"
+               "arg2: The environment variable (data) passed to Lua program must be a GAnyObject; \n"
+               "return: Returns the return value of the script.")
+            .staticFunc("hasPreload", &GAnyLuaVM::hasPreload,
+                        "Determine whether a precompiled script with the specified name is embedded.")
+            .staticFunc("createChunk", [](const GByteArray &buffer) {
+                return GAnyLuaVM::createChunk(buffer);
+            }, "Create a shared chunk from Lua source code or bytecode, which can be run by any virtual machine. \n"
+               "arg1: Lua script or bytecode data stream Bytes Arrays; \n"
+               "return: LuaChunk.")
+            .staticFunc("createChunk", [](const GByteArray &buffer, const std::string &sourcePath) {
+                return GAnyLuaVM::createChunk(buffer, sourcePath);
+            }, "Create a shared chunk from Lua source code or bytecode, which can be run by any virtual machine. \n"
+               "arg1: Lua script or bytecode data stream Bytes Arrays; \n"
+               "arg2: Code source path (file path or URI); \n"
+               "return: LuaChunk.")
+            .func("scriptChunk", [](GAnyLuaVM &self, const std::shared_ptr<LuaChunk> &chunk) {
+                return self.scriptChunk(chunk);
+            }, "Loading and Running a shared chunk, the code of the chunk is referenced in place. \n"
+               "arg1: LuaChunk; \n"
+               "return: Returns the return value of the script.")
+            .func("scriptChunk",
+                  [](GAnyLuaVM &self, const std::shared_ptr<LuaChunk> &chunk, const GAny &env) {
+                      return self.scriptChunk(chunk, env);
+                  }, "Loading and Running a shared chunk, the code of the chunk is referenced in place. \n"
+                     "arg1: LuaChunk; \n"
+                     "arg2: The environment variable (data) passed to Lua program must be a GAnyObject; \n"
+                     "return: Returns the return value of the script.")
+            .staticFunc("callBatch", [](const GAny &func, const std::vector<std::vector<GAny>> &argsList) {
+                std::vector<GAny> results;
+                std::vector<std::string> errors;
+                size_t failed = GAnyLuaVM::callBatch(func, argsList, results, &errors);
+                GAny ret = GAny::object();
+                ret["results"] = results;
+                ret["errors"] = errors;
+                ret["failed"] = (int64_t) failed;
+                return ret;
+            }, "Call a function once for each argument list, a Lua function is prepared only once for the batch. \n"
+               "arg1: Function; \n"
+               "arg2: Array of argument lists; \n"
+               "return: {results: return values, errors: error messages (empty if succeeded), failed: number of failures}.")
             .func("compileCode", &GAnyLuaVM::compileCode,
                   "Compile from code to generate bytecode.\n"
                   "arg1: Lua source code;\n"
@@ -185,6 +932,18 @@ REGISTER_GANY_MODULE(GxScript)
 
     // Set Lua plugin loader
     GAny::Import("setPluginLoaders")("Ls", [](const std::string &searchPath, const std::string &pluginName) {
+        // Scripts embedded in the binary are resolved without touching the file system
+        if (GAnyLuaVM::hasPreload(pluginName)) {
+            GAnyLuaVM *lua = GAnyLuaVM::current();
+            try {
+                lua->scriptPreload(pluginName, GAny::object());
+                return true;
+            } catch (std::exception &e) {
+                LogE("Load lua plugin error: %s", e.what());
+            }
+            return false;
+        }
+
         GFile dir(searchPath);
 
         GFile scriptFile;
@@ -199,7 +958,7 @@ REGISTER_GANY_MODULE(GxScript)
             return false;
         }
 
-        auto lua = GAnyLuaVM::threadLocal();
+        GAnyLuaVM *lua = GAnyLuaVM::current();
 
         GAny env = GAny::object();
         try {
@@ -0,0 +1,92 @@
+# Runs the batch mode of luac on a temporary tree (ctest -R LuacBatch)
+#   cmake -DLUAC=<luac> -DWORK_DIR=<dir> -P LuacBatchTest.cmake
+
+if (NOT LUAC OR NOT WORK_DIR)
+    message(FATAL_ERROR "LUAC and WORK_DIR are required")
+endif ()
+
+set(SRC ${WORK_DIR}/src)
+set(OUT ${WORK_DIR}/out)
+set(MANIFEST ${OUT}/.luac-manifest)
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(WRITE ${SRC}/a.lua "return 'a'\n")
+file(WRITE ${SRC}/sub/b.lua "return 'b'\n")
+
+function(run_luac EXPECT_OK)
+    execute_process(COMMAND ${LUAC} ${ARGN} RESULT_VARIABLE ret ERROR_VARIABLE err)
+    if (EXPECT_OK AND NOT ret EQUAL 0)
+        message(FATAL_ERROR "luac ${ARGN} failed: ${err}")
+    elseif (NOT EXPECT_OK AND ret EQUAL 0)
+        message(FATAL_ERROR "luac ${ARGN} should have failed")
+    endif ()
+endfunction()
+
+# Replaces an output by a marker, a skipped source keeps it and a compiled one overwrites it
+function(mark_output NAME)
+    file(WRITE ${OUT}/${NAME} "stale")
+endfunction()
+
+function(expect_marked NAME MARKED)
+    file(READ ${OUT}/${NAME} content)
+    if (MARKED AND NOT content STREQUAL "stale")
+        message(FATAL_ERROR "${NAME} was compiled again")
+    elseif (NOT MARKED AND content STREQUAL "stale")
+        message(FATAL_ERROR "${NAME} was not compiled")
+    endif ()
+endfunction()
+
+# First run compiles everything
+run_luac(TRUE -b ${OUT} ${SRC})
+foreach (output a.lsc sub/b.lsc)
+    if (NOT EXISTS ${OUT}/${output})
+        message(FATAL_ERROR "${output} is missing")
+    endif ()
+endforeach ()
+file(STRINGS ${MANIFEST} entries)
+list(LENGTH entries count)
+if (NOT count EQUAL 2)
+    message(FATAL_ERROR "the manifest should list 2 sources: ${entries}")
+endif ()
+
+# Unchanged sources are skipped
+mark_output(a.lsc)
+run_luac(TRUE -b ${OUT} ${SRC})
+expect_marked(a.lsc TRUE)
+
+# A changed source is compiled again
+file(WRITE ${SRC}/a.lua "return 'a2'\n")
+run_luac(TRUE -b ${OUT} ${SRC})
+expect_marked(a.lsc FALSE)
+
+# -f ignores the manifest
+mark_output(a.lsc)
+run_luac(TRUE -f -b ${OUT} ${SRC})
+expect_marked(a.lsc FALSE)
+
+# The strip flag is part of the hash, stripped outputs are not reused for a debug build and back
+mark_output(a.lsc)
+run_luac(TRUE -s -b ${OUT} ${SRC})
+expect_marked(a.lsc FALSE)
+mark_output(a.lsc)
+run_luac(TRUE -s -b ${OUT} ${SRC})
+expect_marked(a.lsc TRUE)
+run_luac(TRUE -b ${OUT} ${SRC})
+expect_marked(a.lsc FALSE)
+
+# Outputs and manifest entries of deleted sources are removed
+file(REMOVE ${SRC}/sub/b.lua)
+run_luac(TRUE -b ${OUT} ${SRC})
+if (EXISTS ${OUT}/sub/b.lsc)
+    message(FATAL_ERROR "the output of a deleted source is left")
+endif ()
+file(STRINGS ${MANIFEST} entries)
+if (entries MATCHES "sub/b.lua")
+    message(FATAL_ERROR "the manifest still lists a deleted source: ${entries}")
+endif ()
+
+# Two inputs giving the same relative name are rejected
+file(WRITE ${WORK_DIR}/other/a.lua "return 'other'\n")
+run_luac(FALSE -b ${OUT} ${SRC} ${WORK_DIR}/other)
+
+file(REMOVE_RECURSE ${WORK_DIR})
@@ -0,0 +1 @@
+return "hello from embedded/greeting"
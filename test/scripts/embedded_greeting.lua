@@ -0,0 +1,2 @@
+-- Same C identifier as embedded/greeting before the names were hashed
+return "hello from embedded_greeting"
@@ -23,6 +23,43 @@
 #include <gtest/gtest.h>
 
 #include <gx/gany.h>
+#include <gx/gbytearray.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(GX_SCRIPT_TEST_INTERNAL)
+
+#include "gany_lua_vm.h"
+#include "lua_function.h"
+#include "lua_shared_table.h"
+#include "mpsc_queue.h"
+
+#ifndef LUA_BUILD_AS_CPP
+extern "C" {
+#endif
+
+#include "lobject.h"
+#include "lstate.h"
+
+#ifndef LUA_BUILD_AS_CPP
+}
+#endif
+
+#endif
+
+#if defined(__linux__)
+
+#include <unistd.h>
+
+#endif
 
 
 using namespace gx;
@@ -65,3 +102,1227 @@ end
     GAny ret = retFunc(1, 10);
     EXPECT_EQ(ret.toJsonString(), "[2,4,6,8,10,12,14,16,18,20]");
 }
+
+TEST(GxScriptTest, MultipleVMsPerThread)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+
+    auto vmA = tGAnyLuaVM.call("create");
+    auto vmB = tGAnyLuaVM.call("create");
+    EXPECT_NE(vmA.call("id"), vmB.call("id"));
+
+    auto counter = vmA.call("script", std::string(R"(
+local n = 0
+return function()
+    n = n + 1
+    return n
+end
+)"));
+    EXPECT_TRUE(counter.isFunction());
+    EXPECT_EQ(counter(), 1);
+    EXPECT_EQ(counter(), 2);
+
+    // Called from a script of another VM on the same thread, the closure still runs in its own VM
+    GAny env = GAny::object();
+    env["counter"] = counter;
+    auto ret = vmB.call("script", std::string("return LEnv.counter()"), env);
+    EXPECT_EQ(ret, 3);
+}
+
+TEST(GxScriptTest, FunctionAcrossThreads)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+
+    GAny add1, add2, scale;
+    {
+        auto lua = tGAnyLuaVM.call("create");
+        auto funcs = lua.call("script", std::string(R"(
+local function adder(n)
+    return function(x)
+        return x + n
+    end
+end
+local function scaler(n)
+    return function(x)
+        return x * n
+    end
+end
+return { adder(1), adder(2), scaler(3) }
+)")).toObject();
+        add1 = funcs[0];
+        add2 = funcs[1];
+        scale = funcs[2];
+
+        // Dumped on the first call from another thread, closures of one prototype share the code, not the upvalues
+        std::thread([&]() {
+            EXPECT_EQ(add1(10), 11);
+            EXPECT_EQ(add2(10), 12);
+        }).join();
+        EXPECT_EQ(add1(10), 11);
+    }
+
+    // The VM is gone: the prototype never called from another thread was dumped when it shut down
+    EXPECT_EQ(scale(5), 15);
+    EXPECT_EQ(add2(1), 3);
+}
+
+TEST(GxScriptTest, PooledRequests)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    auto handler = lua.call("loadRequestHandler", std::string(R"(
+local served = 0
+return function(name)
+    served = served + 1
+    local greeting = coroutine.yield(served)
+    return greeting .. ", " .. name .. " from " .. LEnv.region
+end
+)"));
+    EXPECT_GT(handler.toInt32(), 0);
+
+    GAny envA = GAny::object();
+    envA["region"] = "A";
+    GAny envB = GAny::object();
+    envB["region"] = "B";
+
+    auto reqA = lua.call("request", handler, envA, std::vector<GAny>{"Tom"});
+    auto reqB = lua.call("request", handler, envB, std::vector<GAny>{"Ann"});
+    EXPECT_TRUE(reqA.call("isSuspended").toBool());
+    EXPECT_TRUE(reqB.call("isSuspended").toBool());
+    EXPECT_EQ(reqB.call("result"), 2);
+    EXPECT_EQ(lua.call("activeRequestCount"), 2);
+
+    lua.call("resumeRequest", reqB, "Hi");
+    lua.call("resumeRequest", reqA, "Hello");
+    EXPECT_TRUE(reqA.call("isFinished").toBool());
+    EXPECT_EQ(reqA.call("result").toString(), "Hello, Tom from A");
+    EXPECT_EQ(reqB.call("result").toString(), "Hi, Ann from B");
+    EXPECT_EQ(lua.call("activeRequestCount"), 0);
+}
+
+TEST(GxScriptTest, AsyncAwait)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaFuture = GAny::Import("L.LuaFuture");
+    auto lua = tGAnyLuaVM.call("create");
+
+    std::vector<std::thread> workers;
+    GAny env = GAny::object();
+    env["fetch"] = [&workers, tLuaFuture](int32_t v) {
+        GAny future = tLuaFuture();
+        workers.emplace_back([future, v]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            future.call("resolve", v * 10);
+        });
+        return future;
+    };
+
+    auto handler = lua.call("loadRequestHandler", std::string(R"(
+return function()
+    local a = Async.await(LEnv.fetch(1))
+    local r = Async.all({ LEnv.fetch(2), LEnv.fetch(3), 4 })
+    return a + r[1] + r[2] + r[3]
+end
+)"));
+    auto req = lua.call("request", handler, env);
+    EXPECT_TRUE(req.call("isAwaiting").toBool());
+    EXPECT_FALSE(lua.call("resumeRequest", req).toBool());
+
+    while (!req.call("isDone").toBool()) {
+        lua.call("runPending", 100);
+    }
+    EXPECT_TRUE(req.call("isFinished").toBool());
+    EXPECT_EQ(req.call("result"), 64);
+
+    // Outside a request the await runs the pending tasks in place
+    auto ret = lua.call("script", std::string("return Async.await(LEnv.fetch(5))"), std::string(""), env);
+    EXPECT_EQ(ret, 50);
+
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+TEST(GxScriptTest, EventLoop)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    auto handler = lua.call("loadRequestHandler", std::string(R"(
+return function(fd)
+    local ticks = 0
+    local id
+    id = Async.setInterval(function()
+        ticks = ticks + 1
+        if ticks == 3 then
+            Async.clearTimer(id)
+        end
+    end, 5)
+    Async.sleep(100)
+    local ready = "-"
+    if fd >= 0 then
+        ready = Async.waitFd(fd, "r")
+    end
+    return ticks .. ":" .. ready
+end
+)"));
+
+    int fds[2] = {-1, -1};
+    std::thread writer;
+#if defined(__linux__)
+    ASSERT_EQ(pipe(fds), 0);
+    writer = std::thread([fds]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        ssize_t ret = write(fds[1], "x", 1);
+        (void) ret;
+    });
+#endif
+
+    auto req = lua.call("request", handler, GAny::object(), std::vector<GAny>{fds[0]});
+    EXPECT_TRUE(req.call("isAwaiting").toBool());
+    while (!req.call("isDone").toBool()) {
+        lua.call("runOnce", 100);
+    }
+    EXPECT_TRUE(req.call("isFinished").toBool());
+    EXPECT_EQ(req.call("result").toString(), fds[0] >= 0 ? "3:r" : "3:-");
+
+    auto stats = lua.call("loopStats");
+    EXPECT_GE(stats["timersFired"].toInt64(), 4);
+    EXPECT_EQ(stats["timerCount"].toInt64(), 0);
+    EXPECT_EQ(stats["fdCount"].toInt64(), 0);
+
+    if (writer.joinable()) {
+        writer.join();
+    }
+#if defined(__linux__)
+    close(fds[0]);
+    close(fds[1]);
+#endif
+}
+
+TEST(GxScriptTest, TimerCancelledByEarlierTimer)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    // Both are due in the same iteration, the first one cancels the second before it runs
+    auto log = lua.call("script", std::string(R"(
+local log = {}
+local second
+Async.setTimeout(function()
+    log[#log + 1] = "first:" .. tostring(Async.clearTimer(second))
+end, 0)
+second = Async.setTimeout(function()
+    log[#log + 1] = "second"
+end, 0)
+return function()
+    return table.concat(log, ",")
+end
+)"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    lua.call("runOnce", 0);
+    EXPECT_EQ(log().toString(), "first:true");
+    EXPECT_EQ(lua.call("loopStats")["timerCount"].toInt64(), 0);
+}
+
+TEST(GxScriptTest, TimeSlicing)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+    lua.call("setTimeSlice", 200, 100);
+
+    auto handler = lua.call("loadRequestHandler", std::string(R"(
+return function(n)
+    local sum = 0
+    for i = 1, n do
+        sum = sum + i % 7
+    end
+    return sum
+end
+)"));
+
+    auto heavy = lua.call("request", handler, GAny::object(), std::vector<GAny>{5000000});
+    auto light = lua.call("request", handler, GAny::object(), std::vector<GAny>{10});
+    EXPECT_TRUE(heavy.call("isPreempted").toBool());
+    EXPECT_TRUE(light.call("isFinished").toBool());
+    EXPECT_EQ(lua.call("readyRequestCount"), 1);
+
+    while (!heavy.call("isDone").toBool()) {
+        lua.call("runOnce", 10);
+    }
+    EXPECT_TRUE(heavy.call("isFinished").toBool());
+    EXPECT_GT(heavy.call("preemptions").toInt64(), 0);
+    EXPECT_GT(heavy.call("cpuTimeUs").toInt64(), light.call("cpuTimeUs").toInt64());
+    EXPECT_EQ(lua.call("activeRequestCount"), 0);
+}
+
+TEST(GxScriptTest, Executor)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaExecutor = GAny::Import("L.LuaExecutor");
+    auto executor = tLuaExecutor.call("create", 4);
+    EXPECT_EQ(executor.call("workerCount"), 4);
+
+    const std::string script = R"(
+return function(x)
+    return x * x
+end
+)";
+    GByteArray buffer;
+    buffer.write(script.data(), script.size());
+    auto chunk = tGAnyLuaVM.call("createChunk", buffer, std::string("square.lua"));
+
+    std::vector<GAny> futures;
+    for (int32_t i = 1; i <= 100; i++) {
+        futures.push_back(executor.call("submitChunk", chunk, std::vector<GAny>{i}));
+    }
+    int64_t sum = 0;
+    for (auto &future: futures) {
+        future.call("wait");
+        EXPECT_TRUE(future.call("isResolved").toBool());
+        sum += future.call("value").toInt64();
+    }
+    EXPECT_EQ(sum, 338350);
+
+    GAny add = [](int32_t a, int32_t b) {
+        return a + b;
+    };
+    auto future = executor.call("submit", add, std::vector<GAny>{1, 2});
+    future.call("wait");
+    EXPECT_EQ(future.call("value"), 3);
+
+    executor.call("shutdown");
+    future = executor.call("submit", add, std::vector<GAny>{1, 2});
+    EXPECT_TRUE(future.call("isRejected").toBool());
+}
+
+TEST(GxScriptTest, ParallelMapReduce)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaExecutor = GAny::Import("L.LuaExecutor");
+    auto tLuaParallel = GAny::Import("L.LuaParallel");
+    tLuaParallel.call("setExecutor", tLuaExecutor.call("create", 4));
+
+    auto lua = tGAnyLuaVM.call("create");
+    auto ret = lua.call("script", std::string(R"(
+local scale = 3
+local values = {}
+for i = 1, 1000 do
+    values[i] = i
+end
+local mapped = GAny._parallelMap(values, function(v)
+    return v * scale
+end, 100)
+local sum = GAny._parallelReduce(mapped, function(a, b)
+    return a + b
+end, nil, 100)
+return { mapped:size(), mapped[0], mapped[999], sum }
+)")).toObject();
+    EXPECT_EQ(ret[0], 1000);
+    EXPECT_EQ(ret[1], 3);
+    EXPECT_EQ(ret[2], 3000);
+    EXPECT_EQ(ret[3], 1501500);
+
+    GAny array = GAny::array();
+    for (int32_t i = 1; i <= 1000; i++) {
+        array.pushBack(i);
+    }
+    GAny add = [](int64_t a, int64_t b) {
+        return a + b;
+    };
+    EXPECT_EQ(tLuaParallel.call("reduce", array, add, add, 64), 500500);
+    EXPECT_TRUE(tLuaParallel.call("reduce", GAny::array(), add, add).isUndefined());
+
+    // Release the executor so later tests get the default one
+    tLuaParallel.call("setExecutor", GAny::null());
+}
+
+TEST(GxScriptTest, Channel)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaChannel = GAny::Import("L.LuaChannel");
+    auto tLuaTable = GAny::Import("L.LuaTable");
+    auto lua = tGAnyLuaVM.call("create");
+
+    auto input = tLuaChannel.call("create", 8);
+    auto output = tLuaChannel.call("create", 128);
+    EXPECT_EQ(input.call("capacity"), 8);
+
+    GAny env = GAny::object();
+    env["input"] = input;
+    env["output"] = output;
+    auto handler = lua.call("loadRequestHandler", std::string(R"(
+return function()
+    local sum = 0
+    while true do
+        local msg = Async.recv(LEnv.input)
+        if msg == nil then
+            break
+        end
+        sum = sum + msg.n
+        LEnv.output:send(msg.n * 2)
+    end
+    LEnv.output:close()
+    return sum
+end
+)"));
+    auto req = lua.call("request", handler, env);
+    EXPECT_TRUE(req.call("isAwaiting").toBool());
+
+    std::thread producer([input, tLuaTable]() {
+        for (int32_t i = 1; i <= 100; i++) {
+            GAny msg = tLuaTable();
+            msg.setItem("n", i);
+            input.call("send", msg);
+        }
+        input.call("close");
+    });
+
+    while (!req.call("isDone").toBool()) {
+        lua.call("runOnce", 100);
+    }
+    producer.join();
+    EXPECT_TRUE(req.call("isFinished").toBool());
+    EXPECT_EQ(req.call("result"), 5050);
+
+    int64_t sum = 0;
+    int32_t count = 0;
+    for (auto value = output.call("tryRecv"); !value.isUndefined(); value = output.call("tryRecv")) {
+        sum += value.toInt64();
+        count++;
+    }
+    EXPECT_EQ(count, 100);
+    EXPECT_EQ(sum, 10100);
+    EXPECT_TRUE(output.call("isClosed").toBool());
+    EXPECT_FALSE(output.call("send", 1).toBool());
+}
+
+TEST(GxScriptTest, SharedTable)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaSharedTable = GAny::Import("L.LuaSharedTable");
+
+    GAny routes = GAny::object();
+    routes["home"] = "/index";
+    routes["ports"] = GAny::array({80, 443});
+    auto shared = tLuaSharedTable(routes);
+    EXPECT_EQ(shared.call("version"), 1);
+
+    GAny env = GAny::object();
+    env["routes"] = shared;
+    const std::string script = R"(
+local ports = routes.ports
+local keys = 0
+for _ in pairs(routes) do
+    keys = keys + 1
+end
+local ok = pcall(function() routes.home = "x" end)
+return { routes.home, #ports, ports[2], keys, ok }
+)";
+
+    auto vmA = tGAnyLuaVM.call("create");
+    auto vmB = tGAnyLuaVM.call("create");
+    auto retA = vmA.call("script", script, env).toObject();
+    auto retB = vmB.call("script", script, env).toObject();
+    for (auto &ret: {retA, retB}) {
+        EXPECT_EQ(ret[0].toString(), "/index");
+        EXPECT_EQ(ret[1], 2);
+        EXPECT_EQ(ret[2], 443);
+        EXPECT_EQ(ret[3], 2);
+        EXPECT_FALSE(ret[4].toBool());
+    }
+
+    // A proxy follows the new version, a nested table keeps the version it was read from
+    auto reader = vmA.call("script", std::string(R"(
+local ports = routes.ports
+return function()
+    return routes.home .. ":" .. ports[1]
+end
+)"), env);
+    EXPECT_EQ(reader().toString(), "/index:80");
+
+    GAny next = GAny::object();
+    next["home"] = "/main";
+    next["ports"] = GAny::array({8080});
+    shared.call("publish", next);
+    EXPECT_EQ(shared.call("version"), 2);
+    EXPECT_EQ(reader().toString(), "/main:80");
+    EXPECT_EQ(shared["home"].toString(), "/main");
+}
+
+TEST(GxScriptTest, ConcurrentAggregation)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaAtomicCounter = GAny::Import("L.LuaAtomicCounter");
+    auto tLuaConcurrentMap = GAny::Import("L.LuaConcurrentMap");
+
+    GAny env = GAny::object();
+    env["counter"] = tLuaAtomicCounter();
+    env["hits"] = tLuaConcurrentMap();
+    env["seen"] = tLuaConcurrentMap();
+    const std::string script = R"(
+local firsts = 0
+for i = 1, 1000 do
+    counter:increment()
+    hits:add("k" .. (i % 10), 1)
+    if seen:setIfAbsent(i, true) then
+        firsts = firsts + 1
+    end
+end
+return firsts
+)";
+
+    std::vector<std::thread> workers;
+    std::atomic<int64_t> firsts{0};
+    for (int32_t i = 0; i < 4; i++) {
+        workers.emplace_back([&]() {
+            auto lua = tGAnyLuaVM.call("create");
+            firsts += lua.call("script", script, env).toInt64();
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+
+    EXPECT_EQ(env["counter"].call("get"), 4000);
+    EXPECT_EQ(firsts.load(), 1000);
+    EXPECT_EQ(env["seen"].call("size"), 1000);
+    auto hits = env["hits"].call("snapshot");
+    EXPECT_EQ(hits.size(), 10);
+    EXPECT_EQ(hits["k3"], 400);
+
+    auto counter = env["counter"];
+    EXPECT_FALSE(counter.call("compareAndSet", 1, 2).toBool());
+    EXPECT_TRUE(counter.call("compareAndSet", 4000, 0).toBool());
+    EXPECT_EQ(counter.call("get"), 0);
+}
+
+TEST(GxScriptTest, CallBatch)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    auto score = lua.call("script", std::string(R"(
+return function(a, b)
+    if b == 0 then
+        error("division by zero")
+    end
+    return a / b
+end
+)"));
+
+    std::vector<std::vector<GAny>> argsList;
+    for (int32_t i = 0; i < 100; i++) {
+        argsList.push_back({i * 10, i % 10});
+    }
+    auto ret = tGAnyLuaVM.call("callBatch", score, argsList);
+    EXPECT_EQ(ret["failed"], 10);
+    EXPECT_EQ(ret["results"].size(), 100);
+    EXPECT_EQ(ret["results"][11].toInt32(), 110);
+    EXPECT_TRUE(ret["results"][10].isUndefined());
+    EXPECT_NE(ret["errors"][10].toString().find("division by zero"), std::string::npos);
+    EXPECT_TRUE(ret["errors"][11].toString().empty());
+
+    GAny add = [](int32_t a, int32_t b) {
+        return a + b;
+    };
+    ret = tGAnyLuaVM.call("callBatch", add, std::vector<std::vector<GAny>>{{1, 2}, {3, 4}});
+    EXPECT_EQ(ret["failed"], 0);
+    EXPECT_EQ(ret["results"][1], 7);
+}
+
+TEST(GxScriptTest, TypedBuffer)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaTypedBuffer = GAny::Import("L.LuaTypedBuffer");
+    auto lua = tGAnyLuaVM.call("create");
+
+    GAny env = GAny::object();
+    env["x"] = tLuaTypedBuffer.call("create", std::string("f64"), 1000);
+    env["y"] = tLuaTypedBuffer.call("create", std::string("f64"), 1000);
+    auto ret = lua.call("script", std::string(R"(
+for i = 0, #x - 1 do
+    x[i] = i
+end
+y:fill(1)
+y:axpy(2, x)
+local mask = x:select(">=", 500, 1, 0)
+return { #x, x:sum(), x:dot(y), y:max(), mask:sum(), x[1000] == nil, y:slice(10, 5)[0] }
+)"), env).toObject();
+
+    EXPECT_EQ(ret[0], 1000);
+    EXPECT_DOUBLE_EQ(ret[1].toDouble(), 499500.0);
+    // sum(i * (1 + 2i)) for i < 1000
+    EXPECT_DOUBLE_EQ(ret[2].toDouble(), 499500.0 + 2 * 332833500.0);
+    EXPECT_DOUBLE_EQ(ret[3].toDouble(), 1999.0);
+    EXPECT_DOUBLE_EQ(ret[4].toDouble(), 500.0);
+    EXPECT_TRUE(ret[5].toBool());
+    EXPECT_DOUBLE_EQ(ret[6].toDouble(), 21.0);
+
+    // The writes of Lua are visible from C++
+    EXPECT_DOUBLE_EQ(env["y"][999].toDouble(), 1999.0);
+
+    // Integer buffers compare with the threshold unrounded
+    GAny ints = GAny::object();
+    ints["v"] = tLuaTypedBuffer.call("create", std::string("i32"), 10);
+    ret = lua.call("script", std::string(R"(
+for i = 0, #v - 1 do
+    v[i] = i
+end
+local above = v:select(">", 4.5, 1, 0)
+local below = v:select("<", 2.5, 1, 0)
+return { above:sum(), below:sum(), v:select("==", 4.5, 1, 0):sum(), above:type() }
+)"), ints).toObject();
+
+    EXPECT_DOUBLE_EQ(ret[0].toDouble(), 5.0);
+    EXPECT_DOUBLE_EQ(ret[1].toDouble(), 3.0);
+    EXPECT_DOUBLE_EQ(ret[2].toDouble(), 0.0);
+    EXPECT_EQ(ret[3], "i32");
+
+    // A wrapped GByteArray is looked up on every access and may grow while it is wrapped
+    GAny byteArray = GByteArray();
+    GAny wrapped = GAny::object();
+    wrapped["w"] = tLuaTypedBuffer.call("wrap", std::string("i32"), byteArray);
+    EXPECT_EQ(lua.call("script", std::string("return #w"), wrapped), 0);
+
+    const int32_t values[] = {7, 8, 9};
+    for (int i = 0; i < 64; i++) {
+        byteArray.as<GByteArray>().write(values, sizeof(values));
+    }
+    ret = lua.call("script", std::string(R"(
+w[191] = 42
+return { #w, w[0], w[190], w[191], w[192] == nil }
+)"), wrapped).toObject();
+
+    EXPECT_EQ(ret[0], 192);
+    EXPECT_EQ(ret[1], 7);
+    EXPECT_EQ(ret[2], 8);
+    EXPECT_EQ(ret[3], 42);
+    EXPECT_TRUE(ret[4].toBool());
+}
+
+TEST(GxScriptTest, RecordBatch)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaRecordBatch = GAny::Import("L.LuaRecordBatch");
+    auto lua = tGAnyLuaVM.call("create");
+
+    GAny records = GAny::array();
+    for (int32_t i = 0; i < 100; i++) {
+        GAny record = GAny::object();
+        record["id"] = i;
+        record["price"] = i * 0.5;
+        record["active"] = i % 2 == 0;
+        record["name"] = "item" + std::to_string(i);
+        records.pushBack(record);
+    }
+
+    GAny env = GAny::object();
+    env["batch"] = tLuaRecordBatch.call("fromRecords", records);
+    auto ret = lua.call("script", std::string(R"(
+local sum, active, ids = 0, 0, 0
+for row in batch:rows() do
+    if row.active then
+        active = active + 1
+    end
+    sum = sum + row.price
+    ids = ids + row[batch:columnIndex("id")]
+end
+local cur = batch:cursor()
+cur:seek(42)
+return { #batch, sum, active, ids, cur.name, math.type(cur.id), cur.missing == nil, batch:column("price"):sum() }
+)"), env).toObject();
+
+    EXPECT_EQ(ret[0], 100);
+    EXPECT_DOUBLE_EQ(ret[1].toDouble(), 2475.0);
+    EXPECT_EQ(ret[2], 50);
+    EXPECT_EQ(ret[3], 4950);
+    EXPECT_EQ(ret[4], "item42");
+    EXPECT_EQ(ret[5], "integer");
+    EXPECT_TRUE(ret[6].toBool());
+    EXPECT_DOUBLE_EQ(ret[7].toDouble(), 2475.0);
+
+    EXPECT_EQ(env["batch"].call("value", 7, env["batch"].call("columnIndex", "name")), "item7");
+}
+
+TEST(GxScriptTest, ByteView)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaByteView = GAny::Import("L.LuaByteView");
+    auto lua = tGAnyLuaVM.call("create");
+
+    // Header: u16 big-endian type, i32 little-endian value, length-prefixed name
+    const uint8_t packet[] = {0x01, 0x02, 0xfe, 0xff, 0xff, 0xff, 0x03, 'a', 'b', 'c', 0, 0, 0, 0};
+    GByteArray bytes;
+    bytes.write(packet, sizeof(packet));
+    GAny byteArray = bytes;
+
+    GAny env = GAny::object();
+    env["view"] = tLuaByteView.call("wrap", byteArray);
+    auto ret = lua.call("script", std::string(R"(
+local kind = view:u16(0, true)
+local value = view:i32(2)
+local name, next = view:unpack("s1", 6)
+local body = view:slice(next)
+body:setU32(0, 0xdeadbeef, true)
+return { kind, value, name, next, #body, view[10], view[13] }
+)"), env).toObject();
+
+    EXPECT_EQ(ret[0], 0x0102);
+    EXPECT_EQ(ret[1], -2);
+    EXPECT_EQ(ret[2], "abc");
+    EXPECT_EQ(ret[3], 10);
+    EXPECT_EQ(ret[4], 4);
+    EXPECT_EQ(ret[5], 0xde);
+    EXPECT_EQ(ret[6], 0xef);
+
+    // Written in place in the GByteArray
+    EXPECT_EQ(byteArray.as<GByteArray>().data()[11], 0xad);
+
+    // The view and its slices follow the GByteArray when it grows and moves its memory
+    std::vector<uint8_t> tail(4096, 0x5a);
+    byteArray.as<GByteArray>().write(tail.data(), tail.size());
+    ret = lua.call("script", std::string(R"(
+view:setU8(4000, 0x11)
+return { #view, view[11], view:u8(4000), #view:slice(10) }
+)"), env).toObject();
+
+    EXPECT_EQ(ret[0], (int64_t) sizeof(packet) + 4096);
+    EXPECT_EQ(ret[1], 0xad);
+    EXPECT_EQ(ret[2], 0x11);
+    EXPECT_EQ(ret[3], (int64_t) sizeof(packet) + 4096 - 10);
+}
+
+TEST(GxScriptTest, JsonCodec)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    auto ret = lua.call("script", std::string(R"(
+local records = {}
+for i = 1, 2000 do
+    records[i] = { id = i, name = "item\t" .. i, price = i * 0.25, tags = { "a", "b" }, empty = Json.array() }
+end
+local json = Json.encode(records)
+
+local decoded = Json.decode(json)
+local encoded = Json.encode(decoded)
+local viaGAny = GAny._parseJson(json):_toTable()
+
+local count = 0
+Json.sax(json, { startObject = function() count = count + 1 end })
+
+return { #decoded, decoded[2000].name, decoded[2000].price, viaGAny[2000].name, #encoded == #json, count,
+         Json.encode(decoded[1].empty) }
+)")).toObject();
+
+    EXPECT_EQ(ret[0], 2000);
+    EXPECT_EQ(ret[1], "item\t2000");
+    EXPECT_DOUBLE_EQ(ret[2].toDouble(), 500.0);
+    EXPECT_EQ(ret[3], "item\t2000");
+    EXPECT_TRUE(ret[4].toBool());
+    EXPECT_EQ(ret[5], 2000);
+    EXPECT_EQ(ret[6], "[]");
+
+    // Json.null reaches C++ as null
+    ret = lua.call("script", std::string(R"(return Json.decode('{"a":null,"b":1}'))")).toObject();
+    EXPECT_TRUE(ret["a"].isNull());
+    EXPECT_EQ(ret["b"], 1);
+    EXPECT_TRUE(lua.call("script", std::string("return Json.null")).isNull());
+}
+
+// Timings of the direct codec and of the GAny tree in the test report,
+// opt-in with --gtest_also_run_disabled_tests
+TEST(GxScriptTest, DISABLED_JsonCodecBenchmark)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    auto ret = lua.call("script", std::string(R"(
+local records = {}
+for i = 1, 2000 do
+    records[i] = { id = i, name = "item\t" .. i, price = i * 0.25, tags = { "a", "b" }, empty = Json.array() }
+end
+local json = Json.encode(records)
+
+-- Direct codec
+local t0 = os.clock()
+local decoded = Json.decode(json)
+local t1 = os.clock()
+Json.encode(decoded)
+local t2 = os.clock()
+
+-- Through the GAny tree
+GAny._parseJson(json):_toTable()
+local t3 = os.clock()
+GAny._parseJson(json):_toJsonString()
+local t4 = os.clock()
+
+return { t1 - t0, t2 - t1, t3 - t2, t4 - t3 }
+)")).toObject();
+
+    RecordProperty("json_decode_direct_us", (int) (ret[0].toDouble() * 1e6));
+    RecordProperty("json_encode_direct_us", (int) (ret[1].toDouble() * 1e6));
+    RecordProperty("json_decode_gany_us", (int) (ret[2].toDouble() * 1e6));
+    RecordProperty("json_roundtrip_gany_us", (int) (ret[3].toDouble() * 1e6));
+}
+
+TEST(GxScriptTest, MsgPack)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaMsgPack = GAny::Import("L.LuaMsgPack");
+    auto lua = tGAnyLuaVM.call("create");
+
+    // Encoded by C++, decoded by Lua
+    GAny record = GAny::object();
+    record["id"] = (int64_t) 9007199254740993LL;
+    record["ratio"] = 0.5;
+    record["name"] = "gx";
+    GAny bytes = tLuaMsgPack.call("encode", record);
+
+    GAny env = GAny::object();
+    env["bytes"] = bytes;
+    auto ret = lua.call("script", std::string(R"(
+local record = MsgPack.decode(bytes)
+local stream = MsgPack.encode({ 1, 2.0, "three" }) .. MsgPack.encode({ n = MsgPack.null })
+local unpacker = MsgPack.unpacker()
+local messages = 0
+for i = 1, #stream, 3 do
+    unpacker:feed(stream:sub(i, i + 2))
+    while unpacker:next() do
+        messages = messages + 1
+    end
+end
+local list = MsgPack.decode(stream)
+return { record.id, math.type(record.id), record.ratio, record.name, messages,
+         math.type(list[1]), math.type(list[2]), MsgPack.encode({ answer = 42 }) }
+)"), env).toObject();
+
+    EXPECT_EQ(ret[0].toInt64(), 9007199254740993LL);
+    EXPECT_EQ(ret[1], "integer");
+    EXPECT_DOUBLE_EQ(ret[2].toDouble(), 0.5);
+    EXPECT_EQ(ret[3], "gx");
+    EXPECT_EQ(ret[4], 2);
+    EXPECT_EQ(ret[5], "integer");
+    EXPECT_EQ(ret[6], "float");
+
+    // 64-bit integers cross between C++ and Lua exactly
+    GAny big = GAny::object();
+    big["n"] = (int64_t) 9007199254740993LL;
+    auto exact = lua.call("script", std::string("return { n, math.type(n), n + 1, -n }"), big).toObject();
+    EXPECT_EQ(exact[0].toInt64(), 9007199254740993LL);
+    EXPECT_EQ(exact[1], "integer");
+    EXPECT_EQ(exact[2].toInt64(), 9007199254740994LL);
+    EXPECT_EQ(exact[3].toInt64(), -9007199254740993LL);
+
+    // Encoded by Lua, decoded by C++
+    std::string packed = ret[7].toString();
+    GByteArray fromLua;
+    fromLua.write(packed.data(), packed.size());
+    GAny decoded = tLuaMsgPack.call("decode", fromLua, 0);
+    EXPECT_EQ(decoded["value"]["answer"], 42);
+    EXPECT_EQ(decoded["offset"], (int64_t) packed.size());
+}
+
+TEST(GxScriptTest, Reclaimer)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto tLuaReclaimer = GAny::Import("L.LuaReclaimer");
+    auto lua = tGAnyLuaVM.call("create");
+    auto other = tGAnyLuaVM.call("create");
+
+    // The mode of one virtual machine leaves the default and the other virtual machines alone
+    EXPECT_FALSE(lua.call("setReclaimMode", "lazy").toBool());
+    ASSERT_TRUE(lua.call("setReclaimMode", "deferred").toBool());
+    EXPECT_EQ(lua.call("reclaimMode"), "deferred");
+    EXPECT_EQ(other.call("reclaimMode"), tLuaReclaimer.call("mode"));
+
+    GAny before = tLuaReclaimer.call("stats");
+    lua.call("script", std::string(R"(
+for i = 1, 1000 do
+    local array = GAny._array()
+    array:pushBack(i)
+end
+collectgarbage()
+)"));
+
+    // Finalizers only queued the GAny
+    GAny queued = tLuaReclaimer.call("stats");
+    EXPECT_GE(queued["retired"].toInt64() - before["retired"].toInt64(), 1000);
+    EXPECT_GE(queued["pending"].toInt64(), 1000);
+    EXPECT_GE(queued["maxPending"].toInt64(), queued["pending"].toInt64());
+
+    // Neither the idle point of another virtual machine nor the shared queue touch them
+    other.call("gc");
+    EXPECT_EQ(tLuaReclaimer.call("reclaim"), 0);
+    EXPECT_EQ(tLuaReclaimer.call("stats")["pending"], queued["pending"]);
+
+    EXPECT_EQ(lua.call("reclaim").toInt64(), queued["pending"].toInt64());
+    GAny reclaimed = tLuaReclaimer.call("stats");
+    EXPECT_EQ(reclaimed["pending"], 0);
+    EXPECT_EQ(reclaimed["reclaimed"].toInt64() - queued["reclaimed"].toInt64(), queued["pending"].toInt64());
+
+    // Idle point of the virtual machine
+    lua.call("script", std::string("for i = 1, 10 do GAny._array() end collectgarbage()"));
+    EXPECT_GE(tLuaReclaimer.call("stats")["pending"].toInt64(), 10);
+    lua.call("gc");
+    EXPECT_EQ(tLuaReclaimer.call("stats")["pending"], 0);
+
+    // Leaving the Deferred mode deletes what is left
+    lua.call("script", std::string("for i = 1, 10 do GAny._array() end collectgarbage()"));
+    lua.call("setReclaimMode", "immediate");
+    EXPECT_EQ(tLuaReclaimer.call("stats")["pending"], 0);
+}
+
+TEST(GxScriptTest, ExternalMemory)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    GByteArray bytes;
+    std::string block(1024 * 1024, 'x');
+    bytes.write(block.data(), block.size());
+
+    GAny env = GAny::object();
+    env["bytes"] = bytes;
+    lua.call("gc");
+    int32_t luaKb = lua.call("gcGetCount").toInt32();
+
+    // Held by Lua: counted as external memory, not as Lua memory
+    lua.call("script", std::string("package.loaded.held = LEnv.bytes"), env);
+    EXPECT_GE(lua.call("gcGetExternalCount").toInt32(), 1024);
+    // Another userdata of the same array shares its charge
+    lua.call("script", std::string("package.loaded.again = LEnv.bytes"), env);
+    EXPECT_LT(lua.call("gcGetExternalCount").toInt32(), 2 * 1024);
+    EXPECT_LT(lua.call("gcGetCount").toInt32() - luaKb, 512);
+
+    // Every call returns a distinct 1 MB array with its own charge
+    env["makeBlock"] = [block]() {
+        GByteArray fresh;
+        fresh.write(block.data(), block.size());
+        return fresh;
+    };
+    auto ret = lua.call("script", std::string(R"(
+package.loaded.held = nil
+package.loaded.again = nil
+collectgarbage()
+local base = collectgarbage("count")
+local peak = 0
+for i = 1, 64 do
+    local block = LEnv.makeBlock()
+    peak = math.max(peak, collectgarbage("count") - base)
+end
+return peak
+)"), env);
+    // Each array was counted, and the collector ran along the loop instead of keeping 64 MB alive
+    EXPECT_GE(ret.toDouble(), 1024.0);
+    EXPECT_LT(ret.toDouble(), 16.0 * 1024);
+
+    // At most the copy in the environment of the last script is left
+    lua.call("gc");
+    EXPECT_LT(lua.call("gcGetExternalCount").toInt32(), 2 * 1024);
+}
+
+TEST(GxScriptTest, CodeCache)
+{
+    namespace fs = std::filesystem;
+
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    const fs::path dir = fs::temp_directory_path()
+                         / ("gx_script_code_cache_" + std::to_string(
+            std::chrono::steady_clock::now().time_since_epoch().count()));
+    const fs::path cacheDir = dir / "cache";
+    const fs::path source = dir / "cached.lua";
+    fs::create_directories(dir);
+    auto writeSource = [&](const std::string &code) {
+        std::ofstream(source, std::ios::binary | std::ios::trunc) << code;
+    };
+    auto countEntries = [&]() {
+        size_t count = 0;
+        for (const auto &entry: fs::directory_iterator(cacheDir)) {
+            count += entry.path().extension() == ".lcc" ? 1 : 0;
+        }
+        return count;
+    };
+
+    tGAnyLuaVM.call("setCodeCacheDir", cacheDir.string());
+
+    // Miss: compiled and stored
+    writeSource("return 1");
+    EXPECT_EQ(lua.call("scriptFile", source.string()), 1);
+    EXPECT_EQ(countEntries(), 1);
+
+    // Hit: same size and modification time, the source is not read again
+    auto mtime = fs::last_write_time(source);
+    writeSource("return 2");
+    fs::last_write_time(source, mtime);
+    EXPECT_EQ(lua.call("scriptFile", source.string()), 1);
+
+    // Modification time changed
+    fs::last_write_time(source, mtime + std::chrono::seconds(2));
+    EXPECT_EQ(lua.call("scriptFile", source.string()), 2);
+
+    // Size changed
+    mtime = fs::last_write_time(source);
+    writeSource("return 30");
+    fs::last_write_time(source, mtime);
+    EXPECT_EQ(lua.call("scriptFile", source.string()), 30);
+    EXPECT_EQ(countEntries(), 1);
+
+    // Damaged entries with a matching stat are a miss, the source is compiled and stored again
+    fs::path entryPath;
+    for (const auto &entry: fs::directory_iterator(cacheDir)) {
+        if (entry.path().extension() == ".lcc") {
+            entryPath = entry.path();
+        }
+    }
+    auto entrySize = fs::file_size(entryPath);
+    fs::resize_file(entryPath, entrySize / 2);
+    EXPECT_EQ(lua.call("scriptFile", source.string()), 30);
+    EXPECT_EQ(fs::file_size(entryPath), entrySize);
+    {
+        std::fstream entry(entryPath, std::ios::binary | std::ios::in | std::ios::out);
+        entry.seekp(-1, std::ios::end);
+        entry.put('\x7f');
+    }
+    EXPECT_EQ(lua.call("scriptFile", source.string()), 30);
+    EXPECT_EQ(lua.call("scriptFile", source.string()), 30);
+
+    tGAnyLuaVM.call("setCodeCacheDir", std::string());
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+}
+
+#if defined(GX_SCRIPT_TEST_EMBED)
+
+TEST(GxScriptTest, EmbeddedScript)
+{
+    auto tGAnyLuaVM = GAny::Import("L.GAnyLuaVM");
+    auto lua = tGAnyLuaVM.call("create");
+
+    EXPECT_TRUE(tGAnyLuaVM.call("hasPreload", "embedded/greeting").toBool());
+    EXPECT_TRUE(tGAnyLuaVM.call("hasPreload", "embedded_greeting.lua").toBool());
+
+    auto ret = lua.call("script", std::string(R"(
+return { requireLs("embedded/greeting"), requireLs("embedded_greeting") }
+)")).toObject();
+    EXPECT_EQ(ret[0], "hello from embedded/greeting");
+    EXPECT_EQ(ret[1], "hello from embedded_greeting");
+}
+
+#endif
+
+#if defined(GX_SCRIPT_TEST_INTERNAL)
+
+TEST(GxScriptTest, MpscQueue)
+{
+    constexpr int kProducers = 4;
+    constexpr int kCount = 20000;
+
+    MpscQueue<int> queue;
+    std::atomic<int> running{kProducers};
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&, p]() {
+            for (int i = 0; i < kCount; i++) {
+                queue.push(p * kCount + i);
+            }
+            running--;
+        });
+    }
+
+    // Single consumer draining while producers push, each producer's items come out in push order
+    std::vector<int> last(kProducers, -1);
+    size_t consumed = 0;
+    bool ordered = true;
+    auto consume = [&](int &value) {
+        int p = value / kCount;
+        ordered = ordered && value % kCount == last[p] + 1;
+        last[p] = value % kCount;
+    };
+    while (running > 0) {
+        consumed += queue.drain(consume);
+    }
+    for (auto &t: producers) {
+        t.join();
+    }
+    consumed += queue.drain(consume);
+
+    EXPECT_EQ(consumed, (size_t) kProducers * kCount);
+    EXPECT_TRUE(ordered);
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(queue.drain(consume), 0);
+}
+
+static int appendWriter(lua_State *, const void *p, size_t size, void *ud)
+{
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p), size);
+    return 0;
+}
+
+static void countChunkRef(void *ud, int delta)
+{
+    *static_cast<int *>(ud) += delta;
+}
+
+static bool inImage(const void *p, const unsigned char *image, size_t size)
+{
+    auto *b = static_cast<const unsigned char *>(p);
+    return b >= image && b < image + size;
+}
+
+TEST(GxScriptTest, SharedChunk)
+{
+    std::string dump;
+    {
+        lua_State *L = luaL_newstate();
+        ASSERT_EQ(luaL_loadstring(L, "local function twice(x) return x * 2 end return twice(21)"), LUA_OK);
+        ASSERT_EQ(lua_dumpaligned(L, appendWriter, &dump, 0), 0);
+        lua_close(L);
+    }
+    alignas(16) static unsigned char image[4096];
+    ASSERT_LE(dump.size(), sizeof(image));
+    memcpy(image, dump.data(), dump.size());
+
+    // Loaded in place by two states: the code arrays point into the image, which is referenced until both close
+    int refs = 0;
+    lua_State *states[2] = {luaL_newstate(), luaL_newstate()};
+    for (lua_State *L: states) {
+        ASSERT_EQ(lua_loadshared(L, (const char *) image, dump.size(), "=shared", countChunkRef, &refs), LUA_OK);
+        const Proto *proto = getproto(s2v(L->top.p - 1));
+        EXPECT_TRUE(inImage(proto->code, image, dump.size()));
+        ASSERT_EQ(proto->sizep, 1);
+        EXPECT_TRUE(inImage(proto->p[0]->code, image, dump.size()));
+        EXPECT_GT(refs, 0);
+    }
+    for (lua_State *L: states) {
+        ASSERT_EQ(lua_pcall(L, 0, 1, 0), LUA_OK);
+        EXPECT_EQ(lua_tointeger(L, -1), 42);
+    }
+    lua_close(states[0]);
+    EXPECT_GT(refs, 0);
+    lua_close(states[1]);
+    EXPECT_EQ(refs, 0);
+
+    // The padding of an aligned dump is still valid for the stock loader, which copies the code
+    lua_State *L = luaL_newstate();
+    ASSERT_EQ(luaL_loadbufferx(L, dump.data(), dump.size(), "=copied", "b"), LUA_OK);
+    EXPECT_FALSE(inImage(getproto(s2v(L->top.p - 1))->code, (const unsigned char *) dump.data(), dump.size()));
+    ASSERT_EQ(lua_pcall(L, 0, 1, 0), LUA_OK);
+    EXPECT_EQ(lua_tointeger(L, -1), 42);
+    lua_close(L);
+}
+
+static int countRegistryFunctions(lua_State *L)
+{
+    int count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, LUA_REGISTRYINDEX) != 0) {
+        count += lua_isfunction(L, -1) ? 1 : 0;
+        lua_pop(L, 1);
+    }
+    return count;
+}
+
+TEST(GxScriptTest, LuaFunctionRegistry)
+{
+    auto vm = GAnyLuaVM::create();
+    lua_State *L = vm->getLuaState();
+
+    auto makeFunction = [&]() {
+        lua_getglobal(L, "tostring");
+        auto func = std::make_shared<LuaFunction>(L, lua_gettop(L));
+        lua_pop(L, 1);
+        return func;
+    };
+
+    // A stale handle is rejected after its slot is reused
+    LuaFunctionRegistry registry;
+    auto f1 = makeFunction();
+    auto h1 = registry.add(f1);
+    EXPECT_NE(h1, 0u);
+    EXPECT_EQ(registry.remove(h1), f1);
+    EXPECT_EQ(registry.remove(h1), nullptr);
+
+    auto f2 = makeFunction();
+    auto h2 = registry.add(f2);
+    EXPECT_EQ(h2 & 0xffffffff, h1 & 0xffffffff);
+    EXPECT_NE(h2, h1);
+    EXPECT_EQ(registry.remove(h1), nullptr);
+    EXPECT_EQ(registry.size(), 1u);
+    EXPECT_EQ(registry.remove(h2), f2);
+    EXPECT_EQ(registry.size(), 0u);
+    f1.reset();
+    f2.reset();
+    vm->gc();
+
+    // Released on another thread: the reference is only dropped when the owner thread drains it
+    int base = countRegistryFunctions(L);
+    auto f3 = makeFunction();
+    EXPECT_EQ(countRegistryFunctions(L), base + 1);
+    std::thread([f = std::move(f3)]() mutable {
+        f.reset();
+    }).join();
+    EXPECT_EQ(countRegistryFunctions(L), base + 1);
+    vm->gc();
+    EXPECT_EQ(countRegistryFunctions(L), base);
+}
+
+TEST(GxScriptTest, VMLookup)
+{
+    auto vm1 = GAnyLuaVM::create();
+    auto vm2 = GAnyLuaVM::create();
+    lua_State *L1 = vm1->getLuaState();
+    lua_State *L2 = vm2->getLuaState();
+
+    // The extra space of every state, including coroutines, points to its own VM
+    EXPECT_EQ(GAnyLuaVM::fromLuaState(L1), vm1.get());
+    EXPECT_EQ(GAnyLuaVM::fromLuaState(L2), vm2.get());
+    lua_State *co1 = lua_newthread(L1);
+    lua_State *co2 = lua_newthread(L2);
+    EXPECT_EQ(GAnyLuaVM::fromLuaState(co1), vm1.get());
+    EXPECT_EQ(GAnyLuaVM::fromLuaState(co2), vm2.get());
+    lua_pop(L1, 1);
+    lua_pop(L2, 1);
+
+    // Scopes nest, the innermost VM is the current one of the thread
+    GAnyLuaVM *threadVM = GAnyLuaVM::current();
+    {
+        GAnyLuaVM::ContextScope scope1(vm1.get());
+        EXPECT_EQ(GAnyLuaVM::current(), vm1.get());
+        {
+            GAnyLuaVM::ContextScope scope2(vm2.get());
+            EXPECT_EQ(GAnyLuaVM::current(), vm2.get());
+        }
+        EXPECT_EQ(GAnyLuaVM::current(), vm1.get());
+    }
+    EXPECT_EQ(GAnyLuaVM::current(), threadVM);
+}
+
+TEST(GxScriptTest, SharedTableCycle)
+{
+    auto vm = GAnyLuaVM::create();
+    auto tables = vm->script(std::string(R"(
+local cyclic = { name = "root" }
+cyclic.self = cyclic
+local deep = {}
+local node = deep
+for i = 1, 100 do
+    node.next = {}
+    node = node.next
+end
+return { cyclic, deep }
+)"));
+
+    // A table referencing itself is rejected instead of overflowing the stack
+    EXPECT_THROW(LuaSharedTable::build(tables[1]), GAnyException);
+
+    auto deep = LuaSharedTable::build(tables[2]);
+    ASSERT_TRUE(deep);
+    EXPECT_NE(deep->find("next"), nullptr);
+}
+
+#endif
@@ -37,9 +37,13 @@ static void PrintFunction(const Proto *f, int full);
 static int listing = 0;            /* list bytecodes? */
 static int dumping = 1;            /* dump bytecodes? */
 static int stripping = 0;            /* strip debug information? */
+static int aligning = 0;            /* align code arrays for lua_loadshared? */
 static char Output[] = {OUTPUT};    /* default output file name */
 static const char *output = Output;    /* actual output file name */
 static const char *progname = PROGNAME;    /* actual program name */
+static const char *batchdir = NULL;    /* batch output directory */
+static int jobs = 0;            /* batch worker threads (0 = auto) */
+static int forcing = 0;            /* ignore batch manifest? */
 static TString **tmname;
 
 static void fatal(const char *message)
@@ -63,14 +67,19 @@ static void usage(const char *message)
     }
     fprintf(stderr,
             "usage: %s [options] [filenames]\n"
+            "       %s -b dir [-j n] [-f] [-s] [-a] [dirs or filenames]\n"
             "Available options are:\n"
             "  -l       list (use -l -l for full listing)\n"
             "  -o name  output to file 'name' (default is \"%s\")\n"
             "  -p       parse only\n"
             "  -s       strip debug information\n"
+            "  -a       align code arrays, the chunk can then be shared in place (lua_loadshared)\n"
             "  -v       show version information\n"
+            "  -b dir   batch mode: compile every .lua under the inputs to 'dir' as .lsc files\n"
+            "  -j n     batch mode: use 'n' worker threads (default is the number of cores)\n"
+            "  -f       batch mode: ignore the manifest and recompile everything\n"
             "  --       stop handling options\n"
-            "  -        stop handling options and process stdin\n", progname, Output);
+            "  -        stop handling options and process stdin\n", progname, progname, Output);
     exit(EXIT_FAILURE);
 }
 
@@ -104,8 +113,24 @@ static int doargs(int argc, char *argv[])
             dumping = 0;
         } else if (IS("-s")) {            /* strip debug information */
             stripping = 1;
+        } else if (IS("-a")) {            /* align code arrays */
+            aligning = 1;
         } else if (IS("-v")) {            /* show version */
             ++version;
+        } else if (IS("-b"))            /* batch output directory */
+        {
+            batchdir = argv[++i];
+            if (batchdir == NULL || *batchdir == 0 || *batchdir == '-') {
+                usage("'-b' needs argument");
+            }
+        } else if (IS("-j"))            /* batch worker threads */
+        {
+            const char *n = argv[++i];
+            if (n == NULL || (jobs = atoi(n)) <= 0) {
+                usage("'-j' needs a positive number");
+            }
+        } else if (IS("-f")) {            /* ignore batch manifest */
+            forcing = 1;
         } else {                    /* unknown option */
             usage(argv[i]);
         }
@@ -178,7 +203,7 @@ static int pmain(lua_State *L)
         FILE * D = (output == NULL) ? stdout : fopen(output, "wb");
         if (D == NULL) { cannot("open"); }
         lua_lock(L);
-        luaU_dump(L, f, writer, D, stripping);
+        luaU_dumpx(L, f, writer, D, stripping, aligning);
         lua_unlock(L);
         if (ferror(D)) { cannot("write"); }
         if (fclose(D)) { cannot("close"); }
@@ -192,8 +217,297 @@ static int pmain(lua_State *L)
 #include <gx/gbytearray.h>
 #include <gx/gfile.h>
 
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 using namespace gx;
 
+namespace fs = std::filesystem;
+
+#define MANIFEST ".luac-manifest"
+
+/**
+ * @brief Wrap raw bytecode into the compressed ".lsc" container read by GAnyLuaVM
+ * @param rawData   Bytecode produced by lua_dump
+ * @return
+ */
+static GByteArray packLsc(const GByteArray &rawData)
+{
+    GByteArray tarData = GByteArray::compress(rawData);
+
+    GByteArray outData;
+
+    const char head[4] = {(char) 0xff, 'l', 's', (char) 0xee};
+    outData.write(head, 4);
+    outData << tarData;
+    return outData;
+}
+
+static int bufferWriter(lua_State *, const void *p, size_t sz, void *ud)
+{
+    GByteArray &buff = *reinterpret_cast<GByteArray *>(ud);
+    buff.write(p, (int32_t) sz);
+    return 0;
+}
+
+struct BatchItem
+{
+    fs::path input;
+    fs::path output;
+    std::string name;   // Path relative to its input root, used as the manifest key
+    std::string hash;   // Content hash of the current source, empty if compilation failed
+};
+
+static std::unordered_map<std::string, std::string> readManifest(const fs::path &path)
+{
+    std::unordered_map<std::string, std::string> manifest;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t sp = line.find(' ');
+        if (sp != std::string::npos) {
+            manifest[line.substr(sp + 1)] = line.substr(0, sp);
+        }
+    }
+    return manifest;
+}
+
+static bool writeManifest(const fs::path &path, const std::vector<BatchItem> &items)
+{
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        for (const auto &item: items) {
+            if (!item.hash.empty()) {
+                out << item.hash << ' ' << item.name << '\n';
+            }
+        }
+        if (!out) {
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    return !ec;
+}
+
+/**
+ * @brief Write a file atomically: written to a temporary file next to it, then renamed over it
+ * @param path
+ * @param data
+ * @return false if any step failed, the previous file is left untouched
+ */
+static bool writeOutput(const fs::path &path, const GByteArray &data)
+{
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write((const char *) data.data(), (std::streamsize) data.size());
+        out.close();
+        if (!out) {
+            std::error_code ec;
+            fs::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Remove the outputs of sources listed by the previous manifest that are no longer inputs
+ * @param outDir
+ * @param manifest  Manifest of the previous run
+ * @param names     Names of the current inputs
+ */
+static void pruneOutputs(const fs::path &outDir, const std::unordered_map<std::string, std::string> &manifest,
+                         const std::unordered_map<std::string, const BatchItem *> &names)
+{
+    for (const auto &entry: manifest) {
+        if (names.count(entry.first)) {
+            continue;
+        }
+        fs::path rel = fs::path(entry.first).lexically_normal();
+        // Only outputs written by a previous run, a damaged manifest must not reach outside the directory
+        if (rel.empty() || rel.is_absolute() || *rel.begin() == "..") {
+            continue;
+        }
+        std::error_code ec;
+        fs::remove((outDir / rel).replace_extension(".lsc"), ec);
+    }
+}
+
+/**
+ * @brief Collect the .lua files of the inputs
+ * @return false if an input does not exist
+ */
+static bool collectInputs(int argc, char *argv[], const fs::path &outDir, std::vector<BatchItem> &items)
+{
+    bool found = true;
+    for (int i = 0; i < argc; i++) {
+        fs::path root(argv[i]);
+        std::error_code ec;
+        if (fs::is_directory(root, ec)) {
+            for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+                if (!it->is_regular_file() || it->path().extension() != ".lua") {
+                    continue;
+                }
+                fs::path rel = it->path().lexically_relative(root);
+                items.push_back({it->path(), (outDir / rel).replace_extension(".lsc"), rel.generic_string(), ""});
+            }
+        } else if (fs::is_regular_file(root, ec)) {
+            fs::path rel = root.filename();
+            items.push_back({root, (outDir / rel).replace_extension(".lsc"), rel.generic_string(), ""});
+        } else {
+            fprintf(stderr, "%s: cannot find %s\n", progname, argv[i]);
+            found = false;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Batch mode, compile all inputs on a thread pool (one lua_State per worker)
+ *        and skip sources whose content hash matches the manifest of the previous run
+ */
+static int runBatch(int argc, char *argv[])
+{
+    fs::path outDir(batchdir);
+    std::error_code ec;
+    fs::create_directories(outDir, ec);
+
+    std::vector<BatchItem> items;
+    bool complete = collectInputs(argc, argv, outDir, items);
+
+    // The relative path is both the manifest key and the output path, two roots must not share one
+    std::unordered_map<std::string, const BatchItem *> names;
+    bool conflict = false;
+    for (const auto &item: items) {
+        auto ret = names.emplace(item.name, &item);
+        if (!ret.second) {
+            fprintf(stderr, "%s: %s: conflicts with %s (same output %s)\n", progname,
+                    item.input.string().c_str(), ret.first->second->input.string().c_str(),
+                    item.output.string().c_str());
+            conflict = true;
+        }
+    }
+    if (conflict) {
+        return EXIT_FAILURE;
+    }
+
+    const fs::path manifestPath = outDir / MANIFEST;
+    const auto previous = readManifest(manifestPath);
+    const auto manifest = forcing ? std::unordered_map<std::string, std::string>() : previous;
+    // Outputs of deleted sources must not stay deployable, kept when an input is missing to not wipe its outputs
+    if (complete) {
+        pruneOutputs(outDir, previous, names);
+    }
+    const std::string flags = std::string(stripping ? "s" : "d") + (aligning ? "a" : "");
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    std::mutex errLock;
+
+    auto report = [&](const BatchItem &item, const char *message) {
+        std::lock_guard<std::mutex> locker(errLock);
+        fprintf(stderr, "%s: %s: %s\n", progname, item.input.string().c_str(), message);
+        failed++;
+    };
+
+    auto worker = [&]() {
+        lua_State *L = nullptr;
+        for (size_t i = next++; i < items.size(); i = next++) {
+            BatchItem &item = items[i];
+
+            GFile srcFile(item.input.string());
+            if (!srcFile.open(GFile::ReadOnly | GFile::Binary)) {
+                report(item, "cannot open");
+                continue;
+            }
+            GByteArray source = srcFile.read();
+            srcFile.close();
+
+            std::string hash = GByteArray::md5Sum(source).toHexString() + flags;
+            auto mIt = manifest.find(item.name);
+            if (mIt != manifest.end() && mIt->second == hash && fs::exists(item.output)) {
+                item.hash = hash;
+                continue;
+            }
+
+            if (!L && !(L = luaL_newstate())) {
+                report(item, "cannot create state: not enough memory");
+                continue;
+            }
+
+            std::string chunkName = "@" + item.input.string();
+            if (luaL_loadbuffer(L, (const char *) source.data(), (size_t) source.size(), chunkName.c_str()) != LUA_OK) {
+                report(item, lua_tostring(L, -1));
+                lua_settop(L, 0);
+                continue;
+            }
+            GByteArray rawData;
+            int status = aligning ? lua_dumpaligned(L, bufferWriter, &rawData, stripping)
+                                  : lua_dump(L, bufferWriter, &rawData, stripping);
+            lua_settop(L, 0);
+            if (status != LUA_OK) {
+                report(item, "cannot dump");
+                continue;
+            }
+
+            std::error_code dirEc;
+            fs::create_directories(item.output.parent_path(), dirEc);
+            if (!writeOutput(item.output, packLsc(rawData))) {
+                report(item, "cannot write output");
+                continue;
+            }
+
+            // Recorded only once the output is complete, a failed write is rebuilt by the next run
+            item.hash = hash;
+        }
+        if (L) {
+            lua_close(L);
+        }
+    };
+
+    size_t threadCount = jobs > 0 ? (size_t) jobs : std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, std::max<size_t>(items.size(), 1));
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &t: threads) {
+        t.join();
+    }
+
+    if (!complete) {
+        // The entries of the missing input are kept, a later complete run prunes or reuses them
+        for (const auto &entry: previous) {
+            if (!names.count(entry.first)) {
+                items.push_back({{}, {}, entry.first, entry.second});
+            }
+        }
+        failed++;
+    }
+    if (!writeManifest(manifestPath, items)) {
+        fprintf(stderr, "%s: cannot write %s\n", progname, manifestPath.string().c_str());
+    }
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
     initGAnyCore();
@@ -203,6 +517,7 @@ int main(int argc, char *argv[])
     argc -= i;
     argv += i;
     if (argc <= 0) { usage("no input files given"); }
+    if (batchdir) { return runBatch(argc, argv); }
     L = luaL_newstate();
     if (L == NULL) { fatal("cannot create state: not enough memory"); }
     lua_pushcfunction(L, &pmain);
@@ -218,13 +533,7 @@ int main(int argc, char *argv[])
             GByteArray rawData = binFile.read();
             binFile.close();
 
-            GByteArray tarData = GByteArray::compress(rawData);
-
-            GByteArray outData;
-
-            const char head[4] = {(char) 0xff, 'l', 's', (char) 0xee};
-            outData.write(head, 4);
-            outData << tarData;
+            GByteArray outData = packLsc(rawData);
 
             GFile outFile(output);
             if (outFile.open(GFile::WriteOnly | GFile::Binary)) {